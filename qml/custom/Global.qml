@@ -142,6 +142,7 @@ Item {
 
     Tracker {
         id: tracker
+        simplificationTolerance: AppSettings.trackerSimplification
     }
 
     PositionSimulator {
@@ -0,0 +1,60 @@
+/*
+ OSM Scout for Sailfish OS
+ Copyright (C) 2026  Lukas Karas
+
+ This program is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+import QtQuick 2.0
+
+/**
+ * Display points of CollectionTrackModel on the map while the track is loading.
+ * Every loaded chunk gets its own overlay, chunk overlays are removed
+ * when loading is finished and segments are displayed by the page.
+ */
+Item {
+    id: preview
+
+    property var model
+    property var map
+    // overlay ids of chunks, ids below are used for segments
+    property int idBase: 100000
+    property int chunkCount: 0
+
+    function clearChunks() {
+        for (var chunk = 0; chunk < chunkCount; chunk++) {
+            map.removeOverlayObject(idBase + chunk);
+        }
+        chunkCount = 0;
+    }
+
+    Connections {
+        target: preview.model
+
+        onChunkLoaded: {
+            var obj = preview.model.createOverlayForChunk(chunk);
+            if (obj == null) {
+                return;
+            }
+            obj.type = "_track";
+            preview.map.addOverlayObject(preview.idBase + chunk, obj);
+            preview.chunkCount = Math.max(preview.chunkCount, chunk + 1);
+        }
+
+        onLoadingChanged: {
+            preview.clearChunks();
+        }
+    }
+}
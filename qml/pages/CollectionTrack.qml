@@ -66,6 +66,11 @@ Dialog{
         }
     }
 
+    TrackLoadingPreview {
+        model: trackModel
+        map: wayPreviewMap
+    }
+
     DialogHeader {
         id: trackDialogheader
         //title: trackModel.name
@@ -644,6 +644,7 @@ Page {
             CollectionMapBridge{
                 id: collectionMapBridge
                 map: map
+                tracker: Global.tracker
                 enabled: AppSettings.showCollections
             }
 
@@ -287,6 +287,77 @@ Page {
                 }
             }
 
+            SectionHeader{ text: qsTr("Tracker") }
+
+            ComboBox {
+                id: trackerSimplificationComboBox
+                width: parent.width
+                //: tracker setting, points closer than given distance to recorded line are not stored
+                label: qsTr("Track simplification")
+
+                property bool initialized: false
+                property var values: [0, 1, 2, 5, 10]
+
+                menu: ContextMenu {
+                    MenuItem { text: qsTr("Off") }
+                    MenuItem { text: qsTr("%1 m").arg(1) }
+                    MenuItem { text: qsTr("%1 m").arg(2) }
+                    MenuItem { text: qsTr("%1 m").arg(5) }
+                    MenuItem { text: qsTr("%1 m").arg(10) }
+                }
+                onCurrentItemChanged: {
+                    if (!initialized){
+                        return;
+                    }
+                    AppSettings.trackerSimplification = values[currentIndex];
+                }
+                Component.onCompleted: {
+                    currentIndex = 0;
+                    for (var i = 0; i < values.length; i++){
+                        if (values[i] <= AppSettings.trackerSimplification){
+                            currentIndex = i;
+                        }
+                    }
+                    initialized = true;
+                }
+                onPressAndHold: {
+                    // improve default ComboBox UX :-)
+                    clicked(mouse);
+                }
+            }
+
+            ComboBox {
+                id: storageDurabilityComboBox
+                width: parent.width
+                //: tracker setting, how often are recorded points synced to disk
+                label: qsTr("Track storage")
+
+                property bool initialized: false
+                // Storage::DurabilityProfile values
+                property var values: [0, 2]
+
+                menu: ContextMenu {
+                    //: storage durability, recent points may be lost on power failure
+                    MenuItem { text: qsTr("Fast") }
+                    //: storage durability, every stored batch of points is synced to disk
+                    MenuItem { text: qsTr("Safe") }
+                }
+                onCurrentItemChanged: {
+                    if (!initialized){
+                        return;
+                    }
+                    AppSettings.storageDurability = values[currentIndex];
+                }
+                Component.onCompleted: {
+                    currentIndex = Math.max(0, values.indexOf(AppSettings.storageDurability));
+                    initialized = true;
+                }
+                onPressAndHold: {
+                    // improve default ComboBox UX :-)
+                    clicked(mouse);
+                }
+            }
+
             //: setting section for information panel on main screen
             SectionHeader{ text: qsTr("Info panel") }
 
@@ -107,6 +107,11 @@ Dialog {
         }
     }
 
+    TrackLoadingPreview {
+        model: trackModel
+        map: wayPreviewMap
+    }
+
     DialogHeader {
         id: trackEditDialogheader
         title: trackModel.name
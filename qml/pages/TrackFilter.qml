@@ -79,6 +79,11 @@ Dialog {
         }
     }
 
+    TrackLoadingPreview {
+        model: trackModel
+        map: wayPreviewMap
+    }
+
     DialogHeader {
         id: trackEditDialogheader
         title: trackModel.name
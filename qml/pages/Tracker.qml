@@ -312,6 +312,16 @@ Page {
                 label: qsTr("Raw distance")
                 value: Global.tracker.rawDistance < 0 ? "?" :Utils.humanDistance(Global.tracker.rawDistance)
             }
+            DetailItem {
+                id: storedPoints
+                visible: Global.tracker.receivedPoints > 0
+                //: count of points stored / received during this recording, compression ratio in braces
+                label: qsTr("Stored points")
+                value: qsTr("%1 / %2 (%3×)")
+                            .arg(Global.tracker.storedPoints)
+                            .arg(Global.tracker.receivedPoints)
+                            .arg(content.round10(Global.tracker.compressionRatio))
+            }
             DetailItem {
                 id: fromTime
                 visible: Global.tracker.from.getTime() > 0
@@ -37,6 +37,7 @@ BuildRequires:  pkgconfig(Qt5Quick)
 BuildRequires:  pkgconfig(Qt5Sql)
 BuildRequires:  pkgconfig(Qt5Svg)
 BuildRequires:  pkgconfig(Qt5Xml)
+BuildRequires:  pkgconfig(sqlite3)
 BuildRequires:  pkgconfig(sailfishapp) >= 1.0.2
 BuildRequires:  cmake
 BuildRequires:  chrpath
@@ -18,6 +18,7 @@
 */
 
 #include "AppSettings.h"
+#include "Storage.h"
 
 #include <osmscoutclientqt/OSMScoutQt.h>
 
@@ -182,6 +183,37 @@ void AppSettings::SetExportAccuracy(int accuracyIndex)
   }
 }
 
+double AppSettings::GetTrackerSimplification() const
+{
+  return settings.value("trackerSimplification", 0.0).toDouble();
+}
+
+void AppSettings::SetTrackerSimplification(double d)
+{
+  if (d!=GetTrackerSimplification()) {
+    settings.setValue("trackerSimplification", d);
+    emit TrackerSimplificationChanged(d);
+  }
+}
+
+int AppSettings::GetStorageDurability() const
+{
+  int profile = settings.value("storageDurability", Storage::Recording).toInt();
+  return profile == Storage::Durable ? Storage::Durable : Storage::Recording;
+}
+
+void AppSettings::SetStorageDurability(int profile)
+{
+  if (profile != Storage::Recording && profile != Storage::Durable) {
+    qWarning() << "Unsupported storage durability" << profile;
+    return;
+  }
+  if (profile!=GetStorageDurability()) {
+    settings.setValue("storageDurability", profile);
+    emit StorageDurabilityChanged(profile);
+  }
+}
+
 bool AppSettings::GetShowTrackerDistance() const
 {
   return settings.value("showTrackerDistance", "true").toBool();
@@ -40,6 +40,10 @@ class AppSettings: public QObject {
   Q_PROPERTY(bool vehicleAutoRotateMap READ GetVehicleAutoRotateMap WRITE SetVehicleAutoRotateMap NOTIFY VehicleAutoRotateMapChanged)
   Q_PROPERTY(bool automaticNightMode   READ GetAutomaticNightMode   WRITE SetAutomaticNightMode   NOTIFY AutomaticNightModeChanged)
 
+  // tracker settings
+  Q_PROPERTY(double trackerSimplification READ GetTrackerSimplification WRITE SetTrackerSimplification NOTIFY TrackerSimplificationChanged)
+  Q_PROPERTY(int    storageDurability     READ GetStorageDurability     WRITE SetStorageDurability     NOTIFY StorageDurabilityChanged)
+
   // flags for visible information on main screen
   Q_PROPERTY(bool showTrackerDistance READ GetShowTrackerDistance WRITE SetShowTrackerDistance  NOTIFY ShowTrackerDistanceChanged)
   Q_PROPERTY(bool showElevation       READ GetShowElevation       WRITE SetShowElevation        NOTIFY ShowElevationChanged)
@@ -77,6 +81,8 @@ signals:
   void LastCollectionChanged(const QString collectionId);
   void LastMapDirectoryChanged(const QString directory);
   void ExportAccuracyChanged(int);
+  void TrackerSimplificationChanged(double);
+  void StorageDurabilityChanged(int);
   void ShowTrackerDistanceChanged(bool);
   void ShowElevationChanged(bool);
   void ShowAccuracyChanged(bool);
@@ -129,6 +135,15 @@ public:
   int GetExportAccuracy() const;
   void SetExportAccuracy(int accuracyIndex);
 
+  double GetTrackerSimplification() const;
+  void SetTrackerSimplification(double);
+
+  /**
+   * Storage::DurabilityProfile of storage database, Storage::Recording or Storage::Durable
+   */
+  int GetStorageDurability() const;
+  void SetStorageDurability(int);
+
   bool GetShowTrackerDistance() const;
   void SetShowTrackerDistance(bool);
 
@@ -19,6 +19,19 @@
 
 #include "CollectionMapBridge.h"
 #include "CollectionModel.h"
+#include "TrackLod.h"
+
+#include <cmath>
+
+namespace {
+  constexpr double ViewportMargin = 0.5; // tracks near the screen are loaded in advance
+  constexpr double MetersPerDegree = 111319.49; // on equator
+  // appended points are split to overlays of limited size, so every append is cheap
+  constexpr size_t TailOverlaySize = 500;
+  // approximate memory of overlay objects
+  constexpr size_t OverlayPointSize = sizeof(osmscout::Point) * 2; // in the bridge and in the map
+  constexpr size_t OverlayObjectSize = 512; // object with name and type, map internals
+}
 
 CollectionMapBridge::CollectionMapBridge(QObject *parent):
   QObject(parent)
@@ -54,6 +67,10 @@ CollectionMapBridge::CollectionMapBridge(QObject *parent):
           this, &CollectionMapBridge::onCollectionDetailsLoaded,
           Qt::QueuedConnection);
 
+  connect(this, &CollectionMapBridge::trackDataRequest,
+          storage, &Storage::registerTrackDataRequest,
+          Qt::DirectConnection);
+
   connect(this, &CollectionMapBridge::trackDataRequest,
           storage, &Storage::loadTrackData,
           Qt::QueuedConnection);
@@ -62,9 +79,44 @@ CollectionMapBridge::CollectionMapBridge(QObject *parent):
           this, &CollectionMapBridge::onTrackDataLoaded,
           Qt::QueuedConnection);
 
+  connect(storage, &Storage::trackDataChunkLoaded,
+          this, &CollectionMapBridge::onTrackDataChunkLoaded,
+          Qt::QueuedConnection);
+
+  connect(this, &CollectionMapBridge::trackLodRequest,
+          storage, &Storage::loadTrackLod,
+          Qt::QueuedConnection);
+
+  connect(storage, &Storage::trackLodLoaded,
+          this, &CollectionMapBridge::onTrackLodLoaded,
+          Qt::QueuedConnection);
+
+  connect(storage, &Storage::trackDataAppended,
+          this, &CollectionMapBridge::onTrackDataAppended,
+          Qt::QueuedConnection);
+
+  if (MemoryManager *memoryManager = MemoryManager::getInstance(); memoryManager != nullptr) {
+    memoryCacheId = memoryManager->registerCache("map overlays", CacheTier::Offscreen,
+                                                 [this]() { return overlaysFootprint(); },
+                                                 [this](size_t bytes) { return releaseOffscreenOverlays(bytes); });
+  }
+
+  // view is changing continuously during map movement
+  viewportTimer.setSingleShot(true);
+  viewportTimer.setInterval(200);
+  connect(&viewportTimer, &QTimer::timeout,
+          this, &CollectionMapBridge::updateViewport);
+
   init();
 }
 
+CollectionMapBridge::~CollectionMapBridge()
+{
+  if (MemoryManager *memoryManager = MemoryManager::getInstance(); memoryManager != nullptr && memoryCacheId >= 0) {
+    memoryManager->unregisterCache(memoryCacheId);
+  }
+}
+
 void CollectionMapBridge::init()
 {
   if (delegatedMap == nullptr){
@@ -81,7 +133,6 @@ void CollectionMapBridge::storageInitialisationError(QString e)
 
 void CollectionMapBridge::onCollectionDetailsLoaded(Collection collection, bool /*ok*/)
 {
-  using namespace std::string_literals;
   if (!collection.visible || delegatedMap == nullptr){
     return;
   }
@@ -90,116 +141,404 @@ void CollectionMapBridge::onCollectionDetailsLoaded(Collection collection, bool
 
   DisplayedCollection &dispColl = displayedCollection[collection.id];
 
-  QMap<qint64, DisplayedWaypoint> wptToHide = dispColl.waypoints;
-  QMap<qint64, DisplayedWaypoint> &wptVisible = dispColl.waypoints;
-
-  QMap<qint64, DisplayedTrack> trkToHide = dispColl.tracks;
-  QMap<qint64, DisplayedTrack> &trkVisible = dispColl.tracks;
-
+  dispColl.visibleTracks.clear();
   if (collection.tracks){
     for (const auto &trk: *(collection.tracks)){
       if (trk.visible) {
-        trkToHide.remove(trk.id);
-        if (!trkVisible.contains(trk.id) || trkVisible[trk.id].lastModification != trk.lastModification) {
-          qDebug() << "Request track data (" << trk.id << ")"
-                   << trkVisible[trk.id].lastModification << "/" << trk.lastModification;
-          emit trackDataRequest(trk, std::nullopt);
-        }
+        Track metadata = trk;
+        metadata.data.reset();
+        dispColl.visibleTracks[trk.id] = metadata;
       }
     }
   }
 
+  dispColl.visibleWaypoints.clear();
   if (collection.waypoints){
     for (const auto &wpt: *(collection.waypoints)){
       if (wpt.visible) {
-        wptToHide.remove(wpt.id);
-        if (!wptVisible.contains(wpt.id) || wptVisible[wpt.id].lastModification != wpt.lastModification) {
-          if (!wptVisible.contains(wpt.id)) {
-            wptVisible[wpt.id] = DisplayedWaypoint{wpt.lastModification, nextObjectId++};
-          } else {
-            wptVisible[wpt.id].lastModification = wpt.lastModification;
-          }
-          qDebug() << "Adding overlay waypoint"
-                   << QString::fromStdString(wpt.data.name.value_or("<empty>"s))
-                   << "(" << wpt.id << ")"
-                   << wpt.lastModification;
-
-          QString type = CollectionModel::waypointType(wpt.data.symbol, waypointTypeName);
-
-          osmscout::OverlayNode wptOverlay;
-          wptOverlay.setTypeName(type);
-          wptOverlay.addPoint(wpt.data.coord.GetLat(), wpt.data.coord.GetLon());
-          wptOverlay.setName(QString::fromStdString(wpt.data.name.value_or(""s)));
-          delegatedMap->addOverlayObject(wptVisible[wpt.id].id, &wptOverlay);
-        }
+        dispColl.visibleWaypoints[wpt.id] = wpt;
+      }
+    }
+  }
+
+  for (const auto &id :dispColl.waypoints.keys()){
+    if (!dispColl.visibleWaypoints.contains(id)) {
+      removeWaypointOverlay(dispColl, id);
+    }
+  }
+  for (const auto &id :dispColl.tracks.keys()){
+    if (!dispColl.visibleTracks.contains(id)) {
+      removeTrackOverlay(dispColl, id);
+    }
+  }
+
+  updateCollectionOverlays(dispColl);
+}
+
+bool CollectionMapBridge::isInViewport(const osmscout::GeoBox &box) const
+{
+  if (!viewport.IsValid()) {
+    return true; // map size is not known yet
+  }
+  return box.IsValid() && viewport.Intersects(box);
+}
+
+bool CollectionMapBridge::isInViewport(const osmscout::GeoCoord &coord) const
+{
+  return !viewport.IsValid() || viewport.Includes(coord, false);
+}
+
+void CollectionMapBridge::updateCollectionOverlays(DisplayedCollection &dispColl)
+{
+  using namespace std::string_literals;
+
+  for (const auto &trk: dispColl.visibleTracks){
+    bool displayed = dispColl.tracks.contains(trk.id);
+    bool upToDate = displayed &&
+                    dispColl.tracks[trk.id].lastModification == trk.lastModification &&
+                    dispColl.tracks[trk.id].level == lodLevel;
+    if (upToDate) {
+      continue;
+    }
+    // live track is requested even without points, they are displayed from tracker
+    if (isInViewport(trk.statistics.bbox) || isLiveTrack(trk.id)) {
+      if (dispColl.requestedTracks.value(trk.id) == TrackRequest{trk.lastModification, lodLevel}) {
+        continue; // requested already
+      }
+      qDebug() << "Request track data (" << trk.id << ")"
+               << (displayed ? dispColl.tracks[trk.id].lastModification : QDateTime()) << "/" << trk.lastModification
+               << "level" << lodLevel;
+      dispColl.requestedTracks[trk.id] = TrackRequest{trk.lastModification, lodLevel};
+      requestTrack(trk);
+    } else if (displayed && dispColl.tracks[trk.id].lastModification != trk.lastModification) {
+      // outdated overlay out of the screen, it will be loaded again when it will be visible
+      removeTrackOverlay(dispColl, trk.id);
+    }
+  }
+
+  for (const auto &wpt: dispColl.visibleWaypoints){
+    bool displayed = dispColl.waypoints.contains(wpt.id);
+    if (displayed && dispColl.waypoints[wpt.id].lastModification == wpt.lastModification) {
+      continue;
+    }
+    if (!isInViewport(wpt.data.coord)) {
+      if (displayed) {
+        removeWaypointOverlay(dispColl, wpt.id);
+      }
+      continue;
+    }
+    if (!displayed) {
+      dispColl.waypoints[wpt.id] = DisplayedWaypoint{wpt.lastModification, nextObjectId++};
+    } else {
+      dispColl.waypoints[wpt.id].lastModification = wpt.lastModification;
+    }
+    qDebug() << "Adding overlay waypoint"
+             << QString::fromStdString(wpt.data.name.value_or("<empty>"s))
+             << "(" << wpt.id << ")"
+             << wpt.lastModification;
+
+    QString type = CollectionModel::waypointType(wpt.data.symbol, waypointTypeName);
+
+    osmscout::OverlayNode wptOverlay;
+    wptOverlay.setTypeName(type);
+    wptOverlay.addPoint(wpt.data.coord.GetLat(), wpt.data.coord.GetLon());
+    wptOverlay.setName(QString::fromStdString(wpt.data.name.value_or(""s)));
+    delegatedMap->addOverlayObject(dispColl.waypoints[wpt.id].id, &wptOverlay);
+  }
+}
+
+void CollectionMapBridge::removeTrackOverlay(DisplayedCollection &dispColl, qint64 trackId)
+{
+  qDebug() << "Removing overlay track" << trackId << dispColl.tracks[trackId].lastModification;
+  removeOverlays(dispColl.tracks[trackId]);
+  dispColl.tracks.remove(trackId);
+  dispColl.requestedTracks.remove(trackId);
+  discardLoadingTrack(trackId);
+}
+
+void CollectionMapBridge::removeOverlays(const DisplayedTrack &dispTrack)
+{
+  for (const auto &did: dispTrack.ids) {
+    delegatedMap->removeOverlayObject(did);
+  }
+  for (const auto &did: dispTrack.tailIds) {
+    delegatedMap->removeOverlayObject(did);
+  }
+}
+
+void CollectionMapBridge::removeWaypointOverlay(DisplayedCollection &dispColl, qint64 waypointId)
+{
+  qDebug() << "Removing overlay waypoint" << waypointId << dispColl.waypoints[waypointId].lastModification;
+  delegatedMap->removeOverlayObject(dispColl.waypoints[waypointId].id);
+  dispColl.waypoints.remove(waypointId);
+}
+
+void CollectionMapBridge::updateViewport()
+{
+  if (delegatedMap == nullptr) {
+    return;
+  }
+
+  double pixelSize = delegatedMap->GetPixelSize();
+  double width = delegatedMap->width();
+  double height = delegatedMap->height();
+  if (pixelSize <= 0 || width <= 0 || height <= 0) {
+    viewport.Invalidate();
+  } else {
+    // diagonal covers rotated map as well
+    double radius = std::sqrt(width * width + height * height) / 2 * pixelSize * (1 + ViewportMargin);
+    double lat = delegatedMap->GetLat();
+    double lon = delegatedMap->GetLon();
+    double latDelta = radius / MetersPerDegree;
+    double lonDelta = radius / (MetersPerDegree * std::max(std::cos(lat * M_PI / 180.0), 0.01));
+    viewport = osmscout::GeoBox(osmscout::GeoCoord(std::max(lat - latDelta, -90.0), std::max(lon - lonDelta, -180.0)),
+                                osmscout::GeoCoord(std::min(lat + latDelta, 90.0), std::min(lon + lonDelta, 180.0)));
+  }
+
+  if (!enabled) {
+    return;
+  }
+  for (auto &col: displayedCollection) {
+    updateCollectionOverlays(col);
+  }
+}
+
+size_t CollectionMapBridge::overlaysFootprint() const
+{
+  size_t footprint = 0;
+  for (const auto &col: displayedCollection) {
+    for (const auto &dispTrack: col.tracks) {
+      footprint += dispTrack.pointCount * OverlayPointSize +
+                   (dispTrack.ids.size() + dispTrack.tailIds.size()) * OverlayObjectSize;
+    }
+    footprint += size_t(col.waypoints.size()) * OverlayObjectSize;
+  }
+  for (const auto &loading: loadingTracks) {
+    footprint += loading.pointCount * OverlayPointSize + loading.ids.size() * OverlayObjectSize;
+  }
+  return footprint;
+}
+
+size_t CollectionMapBridge::releaseOffscreenOverlays(size_t bytes)
+{
+  if (delegatedMap == nullptr || !viewport.IsValid()) {
+    return 0;
+  }
+
+  size_t evicted = 0;
+  size_t released = 0;
+  for (auto &col: displayedCollection) {
+    for (const auto &id: col.tracks.keys()) {
+      if (released >= bytes) {
+        break;
       }
+      auto it = col.visibleTracks.find(id);
+      if (it == col.visibleTracks.end() || !isInViewport(it->statistics.bbox)) {
+        const DisplayedTrack &dispTrack = col.tracks[id];
+        released += dispTrack.pointCount * OverlayPointSize +
+                    (dispTrack.ids.size() + dispTrack.tailIds.size()) * OverlayObjectSize;
+        removeTrackOverlay(col, id);
+        evicted++;
+      }
+    }
+    for (const auto &id: col.waypoints.keys()) {
+      if (released >= bytes) {
+        break;
+      }
+      auto it = col.visibleWaypoints.find(id);
+      if (it == col.visibleWaypoints.end() || !isInViewport(it->data.coord)) {
+        removeWaypointOverlay(col, id);
+        released += OverlayObjectSize;
+        evicted++;
+      }
+    }
+  }
+  if (evicted > 0) {
+    qDebug() << "Evicted" << evicted << "overlays out of the screen";
+  }
+  return released;
+}
+
+void CollectionMapBridge::onTrackDataChunkLoaded(Track track,
+                                                 std::optional<double> accuracyFilter,
+                                                 quint64 segmentIndex,
+                                                 std::shared_ptr<std::vector<osmscout::gpx::TrackPoint>> points,
+                                                 QObject *requester)
+{
+  if (requester != this ||
+      delegatedMap == nullptr ||
+      accuracyFilter != std::nullopt ||
+      !points ||
+      !loadingTracks.contains(track.id) ||
+      !isPendingRequest(track, 0)
+      ){
+    return;
+  }
+
+  LoadingTrack &loading = loadingTracks[track.id];
+  if (segmentIndex >= loading.segmentCount) {
+    loading.segmentCount = segmentIndex + 1;
+    loading.last.reset();
+  }
+  if (points->empty()) {
+    return;
+  }
+
+  // every chunk has its own overlay, connected to the previous chunk of the segment,
+  // so loaded points are never processed again
+  std::vector<osmscout::Point> chunkPoints;
+  chunkPoints.reserve(points->size() + 1);
+  if (loading.last) {
+    chunkPoints.push_back(*loading.last);
+  }
+  for (auto const &p:*points) {
+    chunkPoints.emplace_back(0, p.coord);
+  }
+  loading.last = chunkPoints.back();
+  loading.pointCount += points->size();
+
+  osmscout::OverlayWay trkOverlay(chunkPoints);
+  trkOverlay.setTypeName(trackTypeName);
+  trkOverlay.setName(track.name);
+  if (track.color.has_value()) {
+    trkOverlay.setColorValue(track.color.value());
+  }
+  loading.ids.push_back(nextObjectId++);
+  delegatedMap->addOverlayObject(loading.ids.back(), &trkOverlay);
+}
+
+void CollectionMapBridge::onTrackDataLoaded(Track track, std::optional<double> accuracyFilter, bool complete, bool ok,
+                                            QObject *requester)
+{
+  if (requester != this || accuracyFilter != std::nullopt || !isPendingRequest(track, 0)) {
+    return;
+  }
+
+  if (!complete) {
+    // start of loading, points are received by chunks
+    discardLoadingTrack(track.id);
+    if (ok && delegatedMap != nullptr) {
+      loadingTracks[track.id] = LoadingTrack{track.collectionId};
     }
+    return;
+  }
+
+  finishTrackRequest(track);
+  if (!loadingTracks.contains(track.id)) {
+    return;
+  }
+  if (delegatedMap == nullptr ||
+      !ok ||
+      !enabled ||
+      lodLevel != 0 ||
+      !displayedCollection.contains(track.collectionId) ||
+      !displayedCollection[track.collectionId].visibleTracks.contains(track.id) ||
+      !track.visible
+      ){
+    discardLoadingTrack(track.id);
+    return;
+  }
+  LoadingTrack loading = loadingTracks.take(track.id);
+
+  qDebug() << "Loaded overlay track"
+           << track.name
+           << "(" << track.id << ")"
+           << track.lastModification
+           << "to map" << delegatedMap;
+
+  DisplayedCollection &dispColl = displayedCollection[track.collectionId];
+  if (dispColl.tracks.contains(track.id)) {
+    // loaded overlays replace the previous ones
+    removeOverlays(dispColl.tracks[track.id]);
   }
+  updateDisplayedTrack(track, 0, std::move(loading.ids), loading.segmentCount, loading.pointCount, loading.last);
+}
 
-  for (const auto &id :wptToHide.keys()){
-    qDebug() << "Removing overlay waypoint" << id << wptToHide[id].lastModification;
-    delegatedMap->removeOverlayObject(wptToHide[id].id);
-    wptVisible.remove(id);
+void CollectionMapBridge::discardLoadingTrack(qint64 trackId)
+{
+  auto it = loadingTracks.find(trackId);
+  if (it == loadingTracks.end()) {
+    return;
   }
-  for (const auto &id :trkToHide.keys()){
-    qDebug() << "Removing overlay track" << id << trkToHide[id].lastModification;
-    for (const auto &did: trkToHide[id].ids) {
+  if (delegatedMap != nullptr) {
+    for (const auto &did: it->ids) {
       delegatedMap->removeOverlayObject(did);
     }
-    trkVisible.remove(id);
   }
+  loadingTracks.erase(it);
 }
 
-void CollectionMapBridge::onTrackDataLoaded(Track track, std::optional<double> accuracyFilter, bool complete, bool ok)
+void CollectionMapBridge::onTrackLodLoaded(Track track, int level,
+                                           std::shared_ptr<std::vector<std::vector<osmscout::GeoCoord>>> segments,
+                                           bool ok)
 {
+  if (!isPendingRequest(track, level)) {
+    return;
+  }
+  finishTrackRequest(track);
+
   if (delegatedMap == nullptr ||
-      accuracyFilter != std::nullopt ||
-      !complete ||
       !ok ||
+      !segments ||
       !enabled ||
+      level != lodLevel || // magnification was changed meanwhile
       !displayedCollection.contains(track.collectionId) ||
-      !track.visible ||
-      displayedCollection[track.collectionId].tracks[track.id].lastModification == track.lastModification
+      !displayedCollection[track.collectionId].visibleTracks.contains(track.id) ||
+      !track.visible
       ){
     return;
   }
 
+  std::vector<std::vector<osmscout::Point>> points;
+  points.reserve(segments->size());
+  for (const auto &seg: *segments) {
+    auto &segmentPoints = points.emplace_back();
+    segmentPoints.reserve(seg.size());
+    for (const auto &coord: seg) {
+      segmentPoints.emplace_back(0, coord);
+    }
+  }
+  displayTrack(track, level, points);
+}
+
+void CollectionMapBridge::displayTrack(const Track &track, int level, const std::vector<std::vector<osmscout::Point>> &segments)
+{
   qDebug() << "Adding overlay track"
            << track.name
            << "(" << track.id << ")"
            << displayedCollection[track.collectionId].tracks[track.id].lastModification << "/" << track.lastModification
+           << "level" << level
            << "to map" << delegatedMap;
 
   std::vector<qint64> ids;
   // if track is displayed already...
   if (displayedCollection.contains(track.collectionId) &&
       displayedCollection[track.collectionId].tracks.contains(track.id)){
-    ids = displayedCollection[track.collectionId].tracks[track.id].ids;
+    const DisplayedTrack &displayed = displayedCollection[track.collectionId].tracks[track.id];
+    ids = displayed.ids;
+    // appended points are contained in segments now
+    for (const auto &did: displayed.tailIds) {
+      delegatedMap->removeOverlayObject(did);
+    }
   }
-  if (ids.size() < track.data->segments.size()) {
+  if (ids.size() < segments.size()) {
     // generate ids for new segments
-    ids.reserve(track.data->segments.size());
-    while (ids.size() < track.data->segments.size()) {
+    ids.reserve(segments.size());
+    while (ids.size() < segments.size()) {
       ids.push_back(nextObjectId++);
     }
   }
-  if (ids.size() > track.data->segments.size()) {
+  if (ids.size() > segments.size()) {
     // hide segments from tail
-    for (size_t i=track.data->segments.size(); i < ids.size(); i++){
+    for (size_t i=segments.size(); i < ids.size(); i++){
       delegatedMap->removeOverlayObject(ids[i]);
     }
-    ids.resize(track.data->segments.size());
+    ids.resize(segments.size());
   }
 
-  assert(ids.size() == track.data->segments.size());
-  for (size_t i=0; i < track.data->segments.size(); i++) {
-    const osmscout::gpx::TrackSegment &seg = track.data->segments[i];
-    std::vector<osmscout::Point> points;
-    points.reserve(seg.points.size());
-    for (auto const &p:seg.points) {
-      points.emplace_back(0, p.coord);
-    }
-    osmscout::OverlayWay trkOverlay(points);
+  assert(ids.size() == segments.size());
+  for (size_t i=0; i < segments.size(); i++) {
+    osmscout::OverlayWay trkOverlay(segments[i]);
     trkOverlay.setTypeName(trackTypeName);
     trkOverlay.setName(track.name);
     if (track.color.has_value()) {
@@ -207,10 +546,254 @@ void CollectionMapBridge::onTrackDataLoaded(Track track, std::optional<double> a
     }
     delegatedMap->addOverlayObject(ids[i],&trkOverlay);
   }
-  displayedCollection[track.collectionId].tracks[track.id]=DisplayedTrack{
-    track.lastModification,
-    ids
+  size_t pointCount = 0;
+  for (const auto &segment: segments) {
+    pointCount += segment.size();
+  }
+  std::optional<osmscout::Point> tailStart;
+  if (!segments.empty() && !segments.back().empty()) {
+    tailStart = segments.back().back();
+  }
+  updateDisplayedTrack(track, level, std::move(ids), segments.size(), pointCount, tailStart);
+}
+
+void CollectionMapBridge::updateDisplayedTrack(const Track &track, int level, std::vector<qint64> &&ids,
+                                               quint64 segmentCount, size_t pointCount,
+                                               const std::optional<osmscout::Point> &tailStart)
+{
+  DisplayedCollection &dispColl = displayedCollection[track.collectionId];
+  DisplayedTrack &dispTrack = dispColl.tracks[track.id];
+  dispTrack = DisplayedTrack{};
+  dispTrack.lastModification = track.lastModification;
+  dispTrack.ids = std::move(ids);
+  dispTrack.level = level;
+  dispTrack.segmentCount = segmentCount;
+  dispTrack.pointCount = pointCount;
+  dispTrack.tailStart = tailStart;
+  if (isLiveTrack(track.id) && dispColl.visibleTracks.contains(track.id)) {
+    appendRecentPoints(dispTrack, dispColl.visibleTracks[track.id]);
+  }
+  dispColl.requestedTracks.remove(track.id);
+}
+
+void CollectionMapBridge::onTrackDataAppended(Track track, QDateTime previousModification, quint64 segmentIndex,
+                                              std::shared_ptr<std::vector<osmscout::gpx::TrackPoint>> points,
+                                              bool segmentCreated)
+{
+  if (delegatedMap == nullptr ||
+      !points ||
+      !enabled ||
+      !displayedCollection.contains(track.collectionId) ||
+      !displayedCollection[track.collectionId].tracks.contains(track.id)
+      ){
+    return;
+  }
+
+  DisplayedCollection &dispColl = displayedCollection[track.collectionId];
+  DisplayedTrack &dispTrack = dispColl.tracks[track.id];
+  if (dispTrack.lastModification != previousModification) {
+    // displayed track is outdated, it is reloaded when collection details arrive
+    return;
+  }
+
+  if (isLiveTrack(track.id)) {
+    // points are displayed from tracker already
+    dispTrack.lastModification = track.lastModification;
+    if (dispColl.visibleTracks.contains(track.id)) {
+      dispColl.visibleTracks[track.id] = track;
+    }
+    return;
+  }
+  if (dispTrack.live) {
+    // tail from tracker overlaps with persisted points, it cannot be continued
+    dispTrack.lastModification = QDateTime(); // reload it
+    return;
+  }
+
+  if (segmentIndex == dispTrack.segmentCount) {
+    // the first segment of the track was created
+    dispTrack.segmentCount++;
+    breakTail(dispTrack);
+  } else if (segmentIndex + 1 != dispTrack.segmentCount) {
+    qWarning() << "Points appended to segment" << segmentIndex << "of track" << track.id
+               << "with" << dispTrack.segmentCount << "displayed segments";
+    dispTrack.lastModification = QDateTime(); // reload it
+    return;
+  }
+
+  std::vector<osmscout::GeoCoord> coords;
+  coords.reserve(points->size());
+  for (const auto &p: *points) {
+    coords.push_back(p.coord);
+  }
+  appendToTail(dispTrack, track, coords);
+
+  if (segmentCreated) {
+    dispTrack.segmentCount++;
+    breakTail(dispTrack);
+  }
+
+  // overlay is up to date, collection details with the new modification time don't trigger reload
+  dispTrack.lastModification = track.lastModification;
+  if (dispColl.visibleTracks.contains(track.id)) {
+    dispColl.visibleTracks[track.id] = track;
+  }
+}
+
+void CollectionMapBridge::appendToTail(DisplayedTrack &dispTrack, const Track &track, const std::vector<osmscout::GeoCoord> &coords)
+{
+  // Points are displayed as they are, without simplification, even when coarser level
+  // of detail is displayed. Tail is replaced by simplified data on next track reload.
+  auto updateTailOverlay = [&]() {
+    if (dispTrack.tailPoints.size() < 2) {
+      return;
+    }
+    osmscout::OverlayWay trkOverlay(dispTrack.tailPoints);
+    trkOverlay.setTypeName(trackTypeName);
+    trkOverlay.setName(track.name);
+    if (track.color.has_value()) {
+      trkOverlay.setColorValue(track.color.value());
+    }
+    delegatedMap->addOverlayObject(dispTrack.tailIds.back(), &trkOverlay);
   };
+
+  bool modified = false;
+  for (const auto &coord: coords) {
+    if (dispTrack.tailPoints.empty() || dispTrack.tailPoints.size() >= TailOverlaySize) {
+      // start new tail part, connected to the previous one
+      std::optional<osmscout::Point> start = dispTrack.tailPoints.empty() ?
+                                             dispTrack.tailStart :
+                                             std::make_optional(dispTrack.tailPoints.back());
+      if (modified) {
+        updateTailOverlay();
+      }
+      dispTrack.tailIds.push_back(nextObjectId++);
+      dispTrack.tailPoints.clear();
+      if (start) {
+        dispTrack.tailPoints.push_back(*start);
+      }
+    }
+    dispTrack.tailPoints.emplace_back(0, coord);
+    dispTrack.pointCount++;
+    modified = true;
+  }
+  if (modified) {
+    updateTailOverlay();
+  }
+}
+
+void CollectionMapBridge::breakTail(DisplayedTrack &dispTrack)
+{
+  dispTrack.tailPoints.clear();
+  dispTrack.tailStart.reset();
+}
+
+bool CollectionMapBridge::isLiveTrack(qint64 trackId) const
+{
+  return tracker != nullptr && tracker->isTracking() && tracker->getTrackId() == trackId;
+}
+
+void CollectionMapBridge::onRecentPointsAppended()
+{
+  if (delegatedMap == nullptr || !enabled || tracker == nullptr || !tracker->isTracking()) {
+    return;
+  }
+  qint64 trackId = tracker->getTrackId();
+  for (auto &dispColl: displayedCollection) {
+    if (dispColl.tracks.contains(trackId) && dispColl.visibleTracks.contains(trackId)) {
+      appendRecentPoints(dispColl.tracks[trackId], dispColl.visibleTracks[trackId]);
+    }
+  }
+}
+
+void CollectionMapBridge::appendRecentPoints(DisplayedTrack &dispTrack, const Track &track)
+{
+  assert(tracker != nullptr);
+  if (!dispTrack.live || dispTrack.recentSequence < tracker->getRecentPointsBegin()) {
+    // Recent points overlap with points loaded from database, so the tail
+    // is not connected to the last loaded point. Overlapping part is not visible.
+    breakTail(dispTrack);
+    dispTrack.live = true;
+    dispTrack.recentSequence = tracker->getRecentPointsBegin();
+  }
+
+  std::vector<osmscout::GeoCoord> coords;
+  for (; dispTrack.recentSequence < tracker->getRecentPointsEnd(); dispTrack.recentSequence++) {
+    const Tracker::RecentPoint &point = tracker->getRecentPoint(dispTrack.recentSequence);
+    if (point.segmentStart) {
+      appendToTail(dispTrack, track, coords);
+      coords.clear();
+      breakTail(dispTrack);
+    }
+    coords.push_back(point.coord);
+  }
+  appendToTail(dispTrack, track, coords);
+}
+
+void CollectionMapBridge::onTrackingChanged()
+{
+  // recent points of resumed track are displayed when the first point is recorded
+  for (auto &dispColl: displayedCollection) {
+    for (auto &dispTrack: dispColl.tracks) {
+      dispTrack.recentSequence = 0;
+    }
+  }
+}
+
+void CollectionMapBridge::setTracker(QObject *o)
+{
+  if (tracker != nullptr) {
+    disconnect(tracker, nullptr, this, nullptr);
+  }
+  tracker = qobject_cast<Tracker*>(o);
+  if (tracker == nullptr) {
+    return;
+  }
+  connect(tracker, &Tracker::recentPointsAppended,
+          this, &CollectionMapBridge::onRecentPointsAppended);
+  connect(tracker, &Tracker::trackingChanged,
+          this, &CollectionMapBridge::onTrackingChanged);
+  onRecentPointsAppended();
+}
+
+void CollectionMapBridge::requestTrack(const Track &track)
+{
+  if (lodLevel == 0) {
+    // full data are streamed by chunks
+    emit trackDataRequest(track, std::nullopt, this);
+  } else {
+    emit trackLodRequest(track, lodLevel);
+  }
+}
+
+bool CollectionMapBridge::isPendingRequest(const Track &track, int level) const
+{
+  auto it = displayedCollection.find(track.collectionId);
+  return it != displayedCollection.end() &&
+         it->requestedTracks.value(track.id) == TrackRequest{track.lastModification, level};
+}
+
+void CollectionMapBridge::finishTrackRequest(const Track &track)
+{
+  auto it = displayedCollection.find(track.collectionId);
+  if (it == displayedCollection.end()) {
+    return;
+  }
+  // stale entry would block the same request when user returns to this level of detail
+  it->requestedTracks.remove(track.id);
+}
+
+void CollectionMapBridge::onViewChanged()
+{
+  if (delegatedMap == nullptr) {
+    return;
+  }
+  int level = TrackLod::levelForPixelSize(delegatedMap->GetPixelSize());
+  if (level != lodLevel) {
+    qDebug() << "Track level of detail changed" << lodLevel << "->" << level;
+    lodLevel = level;
+  }
+  viewportTimer.start();
 }
 
 void CollectionMapBridge::onCollectionsLoaded(std::vector<Collection> collections, bool /*ok*/)
@@ -236,8 +819,11 @@ void CollectionMapBridge::onCollectionsLoaded(std::vector<Collection> collection
         delegatedMap->removeOverlayObject(wpt.id);
       }
       for (const auto &trk:col.tracks){
-        for (const auto &id:trk.ids){
-          delegatedMap->removeOverlayObject(id);
+        removeOverlays(trk);
+      }
+      for (const auto &trackId: loadingTracks.keys()) {
+        if (loadingTracks[trackId].collectionId == colId) {
+          discardLoadingTrack(trackId);
         }
       }
     }
@@ -246,11 +832,22 @@ void CollectionMapBridge::onCollectionsLoaded(std::vector<Collection> collection
 
 void CollectionMapBridge::setMap(QObject *map)
 {
+  if (delegatedMap != nullptr) {
+    disconnect(delegatedMap, nullptr, this, nullptr);
+  }
   delegatedMap = qobject_cast<osmscout::MapWidget*>(map);
   if (delegatedMap == nullptr){
     return;
   }
   qDebug() << "CollectionMapBridge map:" << delegatedMap;
+  connect(delegatedMap, &osmscout::MapWidget::viewChanged,
+          this, &CollectionMapBridge::onViewChanged);
+  connect(delegatedMap, &QQuickItem::widthChanged,
+          this, &CollectionMapBridge::onViewChanged);
+  connect(delegatedMap, &QQuickItem::heightChanged,
+          this, &CollectionMapBridge::onViewChanged);
+  lodLevel = TrackLod::levelForPixelSize(delegatedMap->GetPixelSize());
+  updateViewport();
   init();
 }
 
@@ -263,6 +860,7 @@ void CollectionMapBridge::Invalidate()
     for (auto &trk : col.tracks){
       trk.lastModification = QDateTime();
     }
+    col.requestedTracks.clear();
   }
 }
 
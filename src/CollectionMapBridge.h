@@ -20,18 +20,23 @@
 #pragma once
 
 #include "Storage.h"
+#include "MemoryManager.h"
+#include "Tracker.h"
 
 #include <osmscoutclientqt/MapWidget.h>
 
 #include <QObject>
+#include <QTimer>
 #include <QtCore/QSet>
 
+#include <optional>
 #include <vector>
 
 class CollectionMapBridge : public QObject {
 
   Q_OBJECT
   Q_PROPERTY(QObject* map READ getMap WRITE setMap)
+  Q_PROPERTY(QObject* tracker READ getTracker WRITE setTracker)
   Q_PROPERTY(QString waypointType READ getWaypointType WRITE setWaypointType)
   Q_PROPERTY(QString trackType READ getTrackType WRITE setTrackType)
   Q_PROPERTY(bool enabled READ isEnabled WRITE setEnabled NOTIFY enabledChanged)
@@ -39,7 +44,8 @@ class CollectionMapBridge : public QObject {
 signals:
   void collectionLoadRequest();
   void collectionDetailRequest(Collection);
-  void trackDataRequest(Track track, std::optional<double> accuracyFilter);
+  void trackDataRequest(Track track, std::optional<double> accuracyFilter, QObject *requester);
+  void trackLodRequest(Track track, int level);
   void error(QString message);
   void enabledChanged(bool enabled);
 
@@ -48,12 +54,26 @@ public slots:
   void storageInitialisationError(QString);
   void onCollectionsLoaded(std::vector<Collection> collections, bool ok);
   void onCollectionDetailsLoaded(Collection collection, bool ok);
-  void onTrackDataLoaded(Track track, std::optional<double> accuracyFilter, bool complete, bool ok);
+  void onTrackDataLoaded(Track track, std::optional<double> accuracyFilter, bool complete, bool ok,
+                         QObject *requester);
+  void onTrackDataChunkLoaded(Track track, std::optional<double> accuracyFilter, quint64 segmentIndex,
+                              std::shared_ptr<std::vector<osmscout::gpx::TrackPoint>> points,
+                              QObject *requester);
+  void onTrackLodLoaded(Track track, int level,
+                        std::shared_ptr<std::vector<std::vector<osmscout::GeoCoord>>> segments,
+                        bool ok);
+  void onTrackDataAppended(Track track, QDateTime previousModification, quint64 segmentIndex,
+                           std::shared_ptr<std::vector<osmscout::gpx::TrackPoint>> points,
+                           bool segmentCreated);
+  void onRecentPointsAppended();
+  void onTrackingChanged();
+  void onViewChanged();
+  void updateViewport();
 
 public:
   CollectionMapBridge(QObject *parent = nullptr);
 
-  virtual ~CollectionMapBridge() = default;
+  virtual ~CollectionMapBridge();
 
   inline QObject *getMap() const
   {
@@ -62,6 +82,17 @@ public:
 
   void setMap(QObject *map);
 
+  inline QObject *getTracker() const
+  {
+    return tracker;
+  }
+
+  /**
+   * When tracker is set, points of the recorded track are displayed
+   * directly from its recent points, without waiting for database.
+   */
+  void setTracker(QObject *tracker);
+
   inline QString getWaypointType() const
   {
     return waypointTypeName;
@@ -86,28 +117,141 @@ public:
   Q_INVOKABLE QVariantList getWaypointIds(qint64 objectId) const;
 
 private:
+  struct DisplayedCollection;
+  struct DisplayedTrack;
+
   void Invalidate();
 
+  /**
+   * Request track points in current level of detail.
+   */
+  void requestTrack(const Track &track);
+
+  /**
+   * True when track data in given level were requested by this bridge and response is not received yet.
+   * Responses for other requests (other consumers, outdated track) are ignored.
+   */
+  bool isPendingRequest(const Track &track, int level) const;
+
+  /**
+   * Forget pending request when its response arrives, even when it is not displayed,
+   * so failed request may be repeated.
+   */
+  void finishTrackRequest(const Track &track);
+
+  /**
+   * Replace overlays of track segments.
+   */
+  void displayTrack(const Track &track, int level, const std::vector<std::vector<osmscout::Point>> &segments);
+
+  /**
+   * Setup displayed track with given overlays, they replace previous overlays of the track.
+   */
+  void updateDisplayedTrack(const Track &track, int level, std::vector<qint64> &&ids,
+                            quint64 segmentCount, size_t pointCount,
+                            const std::optional<osmscout::Point> &tailStart);
+
+  /**
+   * Remove overlays of partially loaded track.
+   */
+  void discardLoadingTrack(qint64 trackId);
+
+  bool isInViewport(const osmscout::GeoBox &box) const;
+  bool isInViewport(const osmscout::GeoCoord &coord) const;
+
+  /**
+   * Create or request overlays of visible collection entries in viewport.
+   */
+  void updateCollectionOverlays(DisplayedCollection &dispColl);
+  void removeTrackOverlay(DisplayedCollection &dispColl, qint64 trackId);
+  void removeWaypointOverlay(DisplayedCollection &dispColl, qint64 waypointId);
+  void removeOverlays(const DisplayedTrack &dispTrack);
+
+  /**
+   * Approximate memory used by overlay objects.
+   */
+  size_t overlaysFootprint() const;
+
+  /**
+   * Remove overlays out of the screen, until requested amount of bytes is released.
+   * @return released bytes
+   */
+  size_t releaseOffscreenOverlays(size_t bytes);
+
+  /**
+   * Append points to the track tail overlays, tail continues the last displayed point.
+   */
+  void appendToTail(DisplayedTrack &dispTrack, const Track &track, const std::vector<osmscout::GeoCoord> &coords);
+  void breakTail(DisplayedTrack &dispTrack);
+
+  bool isLiveTrack(qint64 trackId) const;
+  void appendRecentPoints(DisplayedTrack &dispTrack, const Track &track);
+
 private:
   osmscout::MapWidget *delegatedMap{nullptr};
+  Tracker *tracker{nullptr};
   QString waypointTypeName{"_waypoint"};
   QString trackTypeName{"_track"};
   bool enabled{true};
 
   qint64 nextObjectId{50000};
 
+  int memoryCacheId{-1}; // overlays registered in MemoryManager
+
+  // level of detail of tracks for current map magnification, see TrackLod
+  int lodLevel{0};
+
+  // visible map area with margin, invalid when map size is not known
+  osmscout::GeoBox viewport;
+  QTimer viewportTimer;
+
   struct DisplayedTrack {
     QDateTime lastModification;
-    std::vector<qint64> ids; // overlay object ids (object for every segment)
+    std::vector<qint64> ids; // overlay object ids (object for every segment or loaded chunk)
+    int level{-1}; // level of detail of displayed overlays
+    quint64 segmentCount{0};
+    size_t pointCount{0}; // points of all overlays, for memory accounting
+
+    // points appended to the track after it was loaded (recording), see onTrackDataAppended
+    std::vector<qint64> tailIds; // overlay object ids of tail parts
+    std::vector<osmscout::Point> tailPoints; // points of the last tail part
+    std::optional<osmscout::Point> tailStart; // last point of the last segment, when tail is empty
+
+    bool live{false}; // tail contains recent points from tracker
+    quint64 recentSequence{0}; // the next recent point of tracker to display
+  };
+  struct TrackRequest {
+    QDateTime lastModification;
+    int level{-1};
+
+    bool operator==(const TrackRequest &o) const
+    {
+      return lastModification == o.lastModification && level == o.level;
+    }
   };
   struct DisplayedWaypoint {
     QDateTime lastModification;
     qint64 id; // overlay object id
   };
   struct DisplayedCollection {
+    // visible entries of collection, overlays are created just for these in viewport
+    QMap<qint64, Track> visibleTracks; // without data
+    QMap<qint64, Waypoint> visibleWaypoints;
+
     QMap<qint64, DisplayedTrack> tracks;
     QMap<qint64, DisplayedWaypoint> waypoints;
+    QMap<qint64, TrackRequest> requestedTracks; // pending data requests
   };
 
   QMap<qint64, DisplayedCollection> displayedCollection;
+
+  // track being loaded, overlay is added for every received chunk
+  struct LoadingTrack {
+    qint64 collectionId{-1};
+    std::vector<qint64> ids; // overlay object ids (object for every chunk)
+    quint64 segmentCount{0};
+    size_t pointCount{0};
+    std::optional<osmscout::Point> last; // last point of the last segment
+  };
+  QMap<qint64, LoadingTrack> loadingTracks; // by track id
 };
@@ -39,6 +39,10 @@ CollectionTrackModel::CollectionTrackModel()
           this, &CollectionTrackModel::storageInitialisationError,
           Qt::QueuedConnection);
 
+  connect(this, &CollectionTrackModel::trackDataRequest,
+          storage, &Storage::registerTrackDataRequest,
+          Qt::DirectConnection);
+
   connect(this, &CollectionTrackModel::trackDataRequest,
           storage, &Storage::loadTrackData,
           Qt::QueuedConnection);
@@ -63,6 +67,10 @@ CollectionTrackModel::CollectionTrackModel()
           this, &CollectionTrackModel::onTrackDataLoaded,
           Qt::QueuedConnection);
 
+  connect(storage, &Storage::trackDataChunkLoaded,
+          this, &CollectionTrackModel::onTrackDataChunkLoaded,
+          Qt::QueuedConnection);
+
   connect(this, &CollectionTrackModel::setColorRequest,
           storage, &Storage::setTrackColor,
           Qt::QueuedConnection);
@@ -72,7 +80,7 @@ void CollectionTrackModel::storageInitialised()
 {
   if (track.id > 0) {
     loading = true;
-    emit trackDataRequest(track, accuracyFilter);
+    emit trackDataRequest(track, accuracyFilter, this);
     emit loadingChanged();
   }
 }
@@ -228,25 +236,59 @@ QObject *CollectionTrackModel::getBBox() const
                            track.statistics.bbox);
 }
 
-void CollectionTrackModel::onTrackDataLoaded(Track track, std::optional<double> accuracyFilter, bool complete, bool /*ok*/)
+void CollectionTrackModel::onTrackDataLoaded(Track track, std::optional<double> accuracyFilter, bool complete, bool /*ok*/,
+                                             QObject *requester)
 {
-  if (track.id != this->track.id || accuracyFilter != this->accuracyFilter){
+  // track may be loaded by modification (without requester) or by our request
+  if (track.id != this->track.id || accuracyFilter != this->accuracyFilter ||
+      (requester != nullptr && requester != this)){
     return;
   }
   // TODO: error handling when !ok
   loading = !complete;
-  if (complete) {
-    GeoBox originalBox = this->track.statistics.bbox;
-    this->track = track;
-    if (originalBox.IsValid() != track.statistics.bbox.IsValid() ||
-        originalBox.GetMinCoord() != track.statistics.bbox.GetMinCoord() ||
-        originalBox.GetMaxCoord() != track.statistics.bbox.GetMaxCoord()) {
-      emit bboxChanged();
-    }
+  GeoBox originalBox = this->track.statistics.bbox;
+  std::shared_ptr<gpx::Track> data = this->track.data;
+  this->track = track;
+  chunks.clear();
+  if (!complete) {
+    // track metadata, points will be appended by chunks
+    this->track.data = std::make_shared<gpx::Track>();
+  } else if (!track.data) {
+    // points were received by chunks
+    this->track.data = data;
+  }
+  if (originalBox.IsValid() != track.statistics.bbox.IsValid() ||
+      originalBox.GetMinCoord() != track.statistics.bbox.GetMinCoord() ||
+      originalBox.GetMaxCoord() != track.statistics.bbox.GetMaxCoord()) {
+    emit bboxChanged();
   }
   emit loadingChanged();
 }
 
+void CollectionTrackModel::onTrackDataChunkLoaded(Track track,
+                                                  std::optional<double> accuracyFilter,
+                                                  quint64 segmentIndex,
+                                                  std::shared_ptr<std::vector<osmscout::gpx::TrackPoint>> points,
+                                                  QObject *requester)
+{
+  if (requester != this || track.id != this->track.id || accuracyFilter != this->accuracyFilter ||
+      !loading || !this->track.data || !points){
+    return;
+  }
+  auto &segments = this->track.data->segments;
+  if (segments.size() <= segmentIndex) {
+    segments.resize(segmentIndex + 1);
+  }
+  auto &segmentPoints = segments[segmentIndex].points;
+  size_t from = segmentPoints.size();
+  segmentPoints.insert(segmentPoints.end(), points->begin(), points->end());
+  if (points->empty()) {
+    return;
+  }
+  chunks.push_back(Chunk{segmentIndex, from, segmentPoints.size()});
+  emit chunkLoaded(int(chunks.size() - 1));
+}
+
 int CollectionTrackModel::getSegmentCount() const
 {
   return track.data ? track.data->segments.size() : 0;
@@ -281,6 +323,25 @@ QObject* CollectionTrackModel::createOverlayForSegment(int segment)
   return trkOverlay;
 }
 
+QObject* CollectionTrackModel::createOverlayForChunk(int chunk)
+{
+  if (!track.data || chunk < 0 || size_t(chunk) >= chunks.size())
+    return nullptr;
+
+  const Chunk &ch = chunks[chunk];
+  const gpx::TrackSegment &seg = track.data->segments[ch.segment];
+  std::vector<osmscout::Point> points;
+  points.reserve(ch.to - ch.from + 1);
+  for (size_t i = ch.from > 0 ? ch.from - 1 : 0; i < ch.to; i++){
+    points.emplace_back(0, seg.points[i].coord);
+  }
+  auto trkOverlay = new OverlayWay(points);
+  if (track.color.has_value()) {
+    trkOverlay->setColorValue(track.color.value());
+  }
+  return trkOverlay;
+}
+
 QPointF CollectionTrackModel::getPoint(quint64 index) const
 {
   if (!track.data)
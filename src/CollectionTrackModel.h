@@ -59,7 +59,8 @@ class CollectionTrackModel : public QObject {
 signals:
   void loadingChanged();
   void bboxChanged();
-  void trackDataRequest(Track track, std::optional<double>);
+  void chunkLoaded(int chunk);
+  void trackDataRequest(Track track, std::optional<double>, QObject *requester);
 
   // track edits
   void cropStartRequest(Track track, quint64 position);
@@ -71,7 +72,10 @@ signals:
 public slots:
   void storageInitialised();
   void storageInitialisationError(QString);
-  void onTrackDataLoaded(Track track, std::optional<double>, bool complete, bool ok);
+  void onTrackDataLoaded(Track track, std::optional<double>, bool complete, bool ok, QObject *requester);
+  void onTrackDataChunkLoaded(Track track, std::optional<double> accuracyFilter, quint64 segmentIndex,
+                              std::shared_ptr<std::vector<osmscout::gpx::TrackPoint>> points,
+                              QObject *requester);
 
 public:
   CollectionTrackModel();
@@ -107,6 +111,12 @@ public:
   int getSegmentCount() const;
   quint64 getPointCount() const;
   Q_INVOKABLE QObject* createOverlayForSegment(int segment);
+
+  /**
+   * Overlay of points received by the chunk while the track is loading,
+   * it is connected to the previous chunk of the same segment.
+   */
+  Q_INVOKABLE QObject* createOverlayForChunk(int chunk);
   Q_INVOKABLE QPointF getPoint(quint64 index) const;
 
   Q_INVOKABLE void cropStart(quint64 position);
@@ -116,7 +126,14 @@ public:
   Q_INVOKABLE void setupColor(const QString &color);
 
 private:
+  struct Chunk {
+    size_t segment;
+    size_t from; // index of the first chunk point in the segment
+    size_t to;
+  };
+
   bool loading{false};
   std::optional<double> accuracyFilter{std::nullopt};
   Track track;
+  std::vector<Chunk> chunks; // chunks of the track being loaded
 };
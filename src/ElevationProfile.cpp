@@ -0,0 +1,164 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2026 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "ElevationProfile.h"
+#include "Storage.h"
+
+#include <QDataStream>
+
+#include <algorithm>
+
+using namespace osmscout;
+
+namespace {
+constexpr quint32 EncodingVersion = 1;
+}
+
+bool ElevationProfile::append(std::vector<ElevationProfilePoint> &profile,
+                              const std::vector<gpx::TrackSegment> &segments,
+                              QByteArray &state)
+{
+  TrackStatisticsAccumulator trackStat;
+  ElevationFilter elevationFilter;
+  if (!state.isEmpty()) {
+    QDataStream in(state);
+    in.setVersion(QDataStream::Qt_5_6);
+    quint32 version = 0;
+    QByteArray trackStatState;
+    in >> version >> trackStatState;
+    if (in.status() != QDataStream::Ok || version != EncodingVersion) {
+      return false;
+    }
+    auto restored = TrackStatisticsAccumulator::deserialize(trackStatState);
+    if (!restored) {
+      return false;
+    }
+    trackStat = std::move(*restored);
+    elevationFilter.deserializeState(in);
+    if (in.status() != QDataStream::Ok) {
+      return false;
+    }
+  }
+
+  size_t pointCount = 0;
+  for (const auto &segment: segments) {
+    pointCount += segment.points.size();
+  }
+  profile.reserve(profile.size() + pointCount);
+
+  for (size_t i = 0; i < segments.size(); i++) {
+    if (i > 0) {
+      trackStat.segmentEnd();
+      elevationFilter.flush();
+    }
+    for (const auto &point: segments[i].points) {
+      trackStat.update(point);
+      std::optional<Distance> elevation = elevationFilter.update(point);
+      if (elevation.has_value()) {
+        profile.push_back(ElevationProfilePoint{trackStat.getLength(), *elevation, point.coord});
+      }
+    }
+  }
+
+  // the last segment is not finished, following points may continue it
+  state.clear();
+  QDataStream out(&state, QIODevice::WriteOnly);
+  out.setVersion(QDataStream::Qt_5_6);
+  out << EncodingVersion << trackStat.serialize();
+  elevationFilter.serializeState(out);
+  return true;
+}
+
+std::vector<ElevationProfilePoint> ElevationProfile::decimate(const std::vector<ElevationProfilePoint> &points, size_t buckets)
+{
+  if (buckets == 0 || points.size() <= 2 * buckets) {
+    return points;
+  }
+
+  std::vector<ElevationProfilePoint> result;
+  result.reserve(2 * buckets + 2);
+  result.push_back(points.front());
+
+  const double from = points.front().distance.AsMeter();
+  const double length = points.back().distance.AsMeter() - from;
+  size_t i = 1;
+  const size_t last = points.size() - 1;
+  for (size_t bucket = 1; bucket <= buckets && i < last; bucket++) {
+    const double bucketEnd = from + length * double(bucket) / double(buckets);
+    size_t lowest = i;
+    size_t highest = i;
+    size_t count = 0;
+    for (; i < last && (points[i].distance.AsMeter() <= bucketEnd || bucket == buckets); i++, count++) {
+      if (points[i].elevation < points[lowest].elevation) {
+        lowest = i;
+      }
+      if (points[i].elevation > points[highest].elevation) {
+        highest = i;
+      }
+    }
+    if (count == 0) {
+      continue;
+    }
+    result.push_back(points[std::min(lowest, highest)]);
+    if (lowest != highest) {
+      result.push_back(points[std::max(lowest, highest)]);
+    }
+  }
+
+  result.push_back(points.back());
+  return result;
+}
+
+QByteArray ElevationProfile::encode(const std::vector<ElevationProfilePoint> &points)
+{
+  QByteArray data;
+  QDataStream stream(&data, QIODevice::WriteOnly);
+  stream << EncodingVersion << quint32(points.size());
+  for (const auto &p: points) {
+    stream << p.distance.AsMeter() << p.elevation.AsMeter() << p.coord.GetLat() << p.coord.GetLon();
+  }
+  return data;
+}
+
+bool ElevationProfile::decode(const QByteArray &data, std::vector<ElevationProfilePoint> &points)
+{
+  QDataStream stream(data);
+  quint32 version;
+  quint32 count;
+  stream >> version >> count;
+  if (stream.status() != QDataStream::Ok || version != EncodingVersion) {
+    return false;
+  }
+  // count is not trusted, corrupted blob should not cause huge allocation
+  constexpr size_t HeaderSize = 2 * sizeof(quint32);
+  constexpr size_t PointSize = 4 * sizeof(double);
+  if (size_t(count) > (size_t(data.size()) - HeaderSize) / PointSize) {
+    return false;
+  }
+  points.reserve(points.size() + count);
+  for (quint32 i = 0; i < count; i++) {
+    double distance, elevation, lat, lon;
+    stream >> distance >> elevation >> lat >> lon;
+    if (stream.status() != QDataStream::Ok) {
+      return false;
+    }
+    points.push_back(ElevationProfilePoint{Meters(distance), Meters(elevation), GeoCoord(lat, lon)});
+  }
+  return true;
+}
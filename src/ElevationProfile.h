@@ -0,0 +1,76 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2026 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+
+#include <osmscoutgpx/Track.h>
+#include <osmscout/util/Distance.h>
+#include <osmscout/GeoCoord.h>
+
+#include <QByteArray>
+
+#include <vector>
+
+struct ElevationProfilePoint
+{
+  osmscout::Distance distance; // from track start
+  osmscout::Distance elevation;
+  osmscout::GeoCoord coord;
+};
+
+/**
+ * Elevation profile of the track, as displayed by TrackElevationChartWidget.
+ *
+ * Computing the profile requires pass over all track points, so it is done
+ * in Storage thread. Profile decimated to CacheResolution buckets is stored
+ * in `track_elevation_profile` table together with computation state,
+ * so the profile of recorded track is extended just by appended points,
+ * see Storage::loadElevationProfile.
+ */
+class ElevationProfile
+{
+public:
+  static constexpr size_t CacheResolution = 2048;
+
+  ElevationProfile() = delete;
+
+  /**
+   * Append distance and filtered elevation of track points to the profile, computed
+   * with the same TrackStatisticsAccumulator and ElevationFilter as track statistics.
+   *
+   * Computation continues from the state of previous call, empty state starts new profile.
+   * The first segment continues the last segment of the previous call.
+   *
+   * @return false when the state is corrupted or from incompatible version
+   */
+  static bool append(std::vector<ElevationProfilePoint> &profile,
+                     const std::vector<osmscout::gpx::TrackSegment> &segments,
+                     QByteArray &state);
+
+  /**
+   * Split profile to buckets with the same distance range and keep just
+   * the lowest and the highest point of every bucket (in distance order),
+   * so peaks are preserved. The first and the last point are kept always.
+   * Result contains 2 * buckets + 2 points at most.
+   */
+  static std::vector<ElevationProfilePoint> decimate(const std::vector<ElevationProfilePoint> &points, size_t buckets);
+
+  static QByteArray encode(const std::vector<ElevationProfilePoint> &points);
+
+  static bool decode(const QByteArray &data, std::vector<ElevationProfilePoint> &points);
+};
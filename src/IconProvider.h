@@ -18,23 +18,109 @@
 
 #pragma once
 
+#include "MemoryAccounting.h"
+#include "MemoryManager.h"
+
 #include <sailfishapp/sailfishapp.h>
 
 #include <QQuickImageProvider>
 #include <QPainter>
 #include <QColor>
+#include <QCache>
+#include <QMutex>
 
+#include <algorithm>
 #include <cassert>
+#include <memory>
 #include <QtSvg/QSvgRenderer>
 
+/**
+ * Rendered icons are cached, svg rendering is expensive. Memory held by the cache
+ * is accounted in MemoryAccounting::Counter::IconPixmaps and the cache is released
+ * by MemoryManager under memory pressure.
+ */
 class IconProvider : public QQuickImageProvider
 {
+private:
+  static constexpr int CacheSize = 4 * 1024 * 1024; // bytes
+
+  struct CachedIcon
+  {
+    QPixmap pixmap;
+    QSize sourceSize;
+    int64_t bytes;
+
+    CachedIcon(const QPixmap &pixmap, const QSize &sourceSize):
+      pixmap(pixmap),
+      sourceSize(sourceSize),
+      bytes(int64_t(pixmap.width()) * pixmap.height() * pixmap.depth() / 8)
+    {
+      MemoryAccounting::add(MemoryAccounting::Counter::IconPixmaps, bytes);
+    }
+
+    ~CachedIcon()
+    {
+      MemoryAccounting::add(MemoryAccounting::Counter::IconPixmaps, -bytes);
+    }
+  };
+
 public:
   IconProvider() : QQuickImageProvider(QQuickImageProvider::Pixmap)
   {
+    cache.setMaxCost(CacheSize);
+    if (MemoryManager *memoryManager = MemoryManager::getInstance(); memoryManager != nullptr) {
+      memoryCacheId = memoryManager->registerCache("icons", CacheTier::Database,
+                                                   [this]() { return footprint(); },
+                                                   [this](size_t) { return release(); });
+    }
+  }
+
+  ~IconProvider() override
+  {
+    if (MemoryManager *memoryManager = MemoryManager::getInstance(); memoryManager != nullptr && memoryCacheId >= 0) {
+      memoryManager->unregisterCache(memoryCacheId);
+    }
+  }
+
+  QPixmap requestPixmap(const QString &id, QSize *size, const QSize &requestedSize) override
+  {
+    QString key = QString("%1@%2x%3").arg(id).arg(requestedSize.width()).arg(requestedSize.height());
+    QMutexLocker locker(&mutex); // provider may be called from loader threads
+    if (const CachedIcon *icon = cache.object(key); icon != nullptr) {
+      if (size) {
+        *size = icon->sourceSize;
+      }
+      return icon->pixmap;
+    }
+
+    QSize sourceSize;
+    QPixmap pixmap = renderPixmap(id, &sourceSize, requestedSize);
+    if (size) {
+      *size = sourceSize;
+    }
+    auto icon = std::make_unique<CachedIcon>(pixmap, sourceSize);
+    int cost = int(std::min(icon->bytes, int64_t(CacheSize)));
+    cache.insert(key, icon.release(), cost);
+    return pixmap;
   }
 
-  QPixmap requestPixmap(const QString &id, QSize *size, const QSize &requestedSize)
+private:
+  size_t footprint()
+  {
+    QMutexLocker locker(&mutex);
+    return size_t(cache.totalCost());
+  }
+
+  size_t release()
+  {
+    // pixmaps used by QML items are shared, they are released when items are destroyed
+    QMutexLocker locker(&mutex);
+    size_t released = size_t(cache.totalCost());
+    cache.clear();
+    return released;
+  }
+
+  QPixmap renderPixmap(const QString &id, QSize *size, const QSize &requestedSize)
   {
     QStringList parts = id.split('?');
     assert(!parts.isEmpty());
@@ -76,4 +162,9 @@ public:
       return sourcePixmap;
     }
   }
+
+private:
+  QMutex mutex;
+  QCache<QString, CachedIcon> cache;
+  int memoryCacheId{-1};
 };
@@ -0,0 +1,71 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2026 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+/**
+ * Process wide counters of memory held by subsystems that don't live in UI thread,
+ * so they cannot register footprint callback in MemoryManager. Thread safe.
+ */
+class MemoryAccounting
+{
+public:
+  enum class Counter
+  {
+    StorageResults = 0, // data emitted by Storage, while some receiver holds them
+    IconPixmaps, // pixmaps held by IconProvider cache
+    CounterCount
+  };
+
+  MemoryAccounting() = delete;
+
+  static void add(Counter counter, int64_t bytes)
+  {
+    counters[size_t(counter)].fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  static int64_t get(Counter counter)
+  {
+    return counters[size_t(counter)].load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Account bytes to the counter until the last copy of returned pointer is released.
+   */
+  template<typename T>
+  static std::shared_ptr<T> account(Counter counter, std::shared_ptr<T> ptr, size_t bytes)
+  {
+    if (!ptr) {
+      return ptr;
+    }
+    add(counter, int64_t(bytes));
+    T *raw = ptr.get();
+    return std::shared_ptr<T>(raw, [counter, bytes, ptr = std::move(ptr)](T*) mutable {
+      add(counter, -int64_t(bytes));
+      ptr.reset();
+    });
+  }
+
+private:
+  static inline std::array<std::atomic<int64_t>, size_t(Counter::CounterCount)> counters{};
+};
@@ -19,16 +19,27 @@
 
 #include "MemoryManager.h"
 #include "AppSettings.h"
+#include "MemoryAccounting.h"
 
 #include <osmscoutclientqt/OSMScoutQt.h>
 
 #include <QDebug>
+#include <QDir>
+#include <QFile>
 #include <QtDBus/QtDBus>
 
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#include <fcntl.h>
 #include <malloc.h>
+#include <unistd.h>
 
 using namespace osmscout;
 
+static MemoryManager* memoryManagerInstance = nullptr;
+
 MCIMemoryWatcher::MCIMemoryWatcher()
 {
   QDBusConnection systemBus = QDBusConnection::systemBus();
@@ -75,81 +86,186 @@ void MCIMemoryWatcher::mciMemoryLevelChanged(const QString &level)
 namespace {
   constexpr uint64_t PageSize = 4096;
   constexpr uint64_t MiB = 1024*1024;
+  constexpr size_t ProcBufferSize = 4096; // /proc/meminfo has about 1.5 KiB
 
-#if QT_VERSION < QT_VERSION_CHECK(5, 15, 0)
-  constexpr QString::SplitBehavior SkipEmptyParts = QString::SplitBehavior::SkipEmptyParts;
-#else
-  constexpr Qt::SplitBehaviorFlags SkipEmptyParts = Qt::SkipEmptyParts;
-#endif
+  constexpr int ProcWatcherInterval = 2000; // ms
+  constexpr int ProcWatcherPressureInterval = 1000; // ms, when memory level is not normal
+  constexpr int PressureRecoveryInterval = 2000; // ms, it is PSI trigger window as well
+  constexpr int DefaultSnapshotInterval = 600; // s
 
-  size_t parseLine(const QString &line) {
-    QStringList arr = line.split(" ", SkipEmptyParts);
-    if (arr.size() != 3) {
-      qWarning() << "Can't parse memory line" << line;
-      return 0;
+  int openFile(const char *path, int flags = O_RDONLY)
+  {
+    int fd = ::open(path, flags | O_CLOEXEC);
+    if (fd < 0) {
+      qWarning() << "Can't open" << path << ":" << strerror(errno);
     }
-    if (arr[2] != "kB") {
-      qWarning() << "Can't parse memory line" << line;
-      return 0;
+    return fd;
+  }
+
+  void closeFile(int &fd)
+  {
+    if (fd >= 0) {
+      ::close(fd);
+      fd = -1;
     }
-    bool ok = true;
-    size_t val = arr[1].toULongLong(&ok);
-    if (!ok) {
-      qWarning() << "Can't parse memory line" << line;
-      return 0;
+  }
+
+  /**
+   * Read (proc) file content from its beginning to zero terminated buffer.
+   * Proc files generate content on every read, so file may be kept open.
+   *
+   * @return length of content, -1 on error
+   */
+  ssize_t readFile(int fd, char *buffer, size_t size)
+  {
+    if (fd < 0) {
+      return -1;
     }
-    return val * 1024;
+    size_t length = 0;
+    while (length + 1 < size) {
+      ssize_t result = ::pread(fd, buffer + length, size - 1 - length, off_t(length));
+      if (result < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return -1;
+      }
+      if (result == 0) {
+        break;
+      }
+      length += size_t(result);
+    }
+    buffer[length] = '\0';
+    return ssize_t(length);
   }
 
-  uint64_t availableMemory()
+  const char* skipSpaces(const char *p)
   {
-    uint64_t available = 0;
+    while (*p == ' ' || *p == '\t') {
+      p++;
+    }
+    return p;
+  }
 
-    QFile inputFile("/proc/meminfo");
-    if (!inputFile.open(QIODevice::ReadOnly)) {
-      qWarning() << "Can't open /proc/meminfo";
-      return 0;
+  bool isDigit(char c)
+  {
+    return c >= '0' && c <= '9';
+  }
+
+  /**
+   * Parse decimal number, leading spaces are skipped.
+   * On success, p points behind the number.
+   */
+  bool parseNumber(const char *&p, uint64_t &value)
+  {
+    p = skipSpaces(p);
+    if (!isDigit(*p)) {
+      return false;
+    }
+    value = 0;
+    for (; isDigit(*p); p++) {
+      value = value * 10 + uint64_t(*p - '0');
     }
+    return true;
+  }
 
-    QTextStream in(&inputFile);
+  bool parseNumber(const char *&p, int64_t &value)
+  {
+    p = skipSpaces(p);
+    bool negative = *p == '-';
+    if (negative) {
+      p++;
+    }
+    uint64_t absolute = 0;
+    if (!parseNumber(p, absolute)) {
+      return false;
+    }
+    value = negative ? -int64_t(absolute) : int64_t(absolute);
+    return true;
+  }
 
-    for (QString line = in.readLine(); !line.isEmpty(); line = in.readLine()) {
-      if (line.startsWith("MemFree:") || line.startsWith("Cached:")) {
-        available += parseLine(line);
+  /**
+   * Parse number with optional fraction part, like "12.34".
+   */
+  bool parseDecimal(const char *&p, double &value)
+  {
+    uint64_t integer = 0;
+    if (!parseNumber(p, integer)) {
+      return false;
+    }
+    value = double(integer);
+    if (*p == '.') {
+      p++;
+      for (double scale = 0.1; isDigit(*p); p++, scale /= 10) {
+        value += double(*p - '0') * scale;
       }
     }
+    return true;
+  }
 
-    return available;
+  /**
+   * Find line starting with the key.
+   * @return pointer behind the key, nullptr when there is no such line
+   */
+  const char* findKey(const char *buffer, const char *key)
+  {
+    size_t keyLength = strlen(key);
+    for (const char *line = buffer; line != nullptr && *line != '\0';) {
+      if (strncmp(line, key, keyLength) == 0) {
+        return line + keyLength;
+      }
+      line = strchr(line, '\n');
+      if (line != nullptr) {
+        line++;
+      }
+    }
+    return nullptr;
   }
 
-  uint64_t totalMemory()
+  /**
+   * Value of /proc/meminfo field in bytes, zero on error.
+   */
+  uint64_t memInfoValue(const char *buffer, const char *key)
   {
-    QFile inputFile("/proc/meminfo");
-    if (!inputFile.open(QIODevice::ReadOnly)) {
-      qWarning() << "Can't open /proc/meminfo";
+    const char *p = findKey(buffer, key);
+    uint64_t value = 0;
+    if (p == nullptr || !parseNumber(p, value) || strncmp(skipSpaces(p), "kB", 2) != 0) {
+      qWarning() << "Can't parse meminfo field" << key;
       return 0;
     }
+    return value * 1024;
+  }
 
-    QTextStream in(&inputFile);
-
-    for (QString line = in.readLine(); !line.isEmpty(); line = in.readLine()) {
-      if (line.startsWith("MemTotal:")) {
-        return parseLine(line);
-      }
+  uint64_t availableMemory(int meminfoFd)
+  {
+    char buffer[ProcBufferSize];
+    if (readFile(meminfoFd, buffer, sizeof(buffer)) <= 0) {
+      qWarning() << "Can't read /proc/meminfo";
+      return 0;
     }
-
-    return 0;
+    return memInfoValue(buffer, "MemFree:") + memInfoValue(buffer, "Cached:");
   }
 
-  QString readLine(const QString &file)
+  uint64_t totalMemory(int meminfoFd)
   {
-    QFile inputFile(file);
-    if (!inputFile.open(QIODevice::ReadOnly)) {
-      qWarning() << "Can't open file" << file;
-      return "";
+    char buffer[ProcBufferSize];
+    if (readFile(meminfoFd, buffer, sizeof(buffer)) <= 0) {
+      qWarning() << "Can't read /proc/meminfo";
+      return 0;
     }
+    return memInfoValue(buffer, "MemTotal:");
+  }
 
-    return inputFile.readLine();
+  bool readOomScoreAdj(int fd, int &adj)
+  {
+    char buffer[32];
+    int64_t value = 0;
+    const char *p = buffer;
+    if (readFile(fd, buffer, sizeof(buffer)) <= 0 || !parseNumber(p, value)) {
+      return false;
+    }
+    adj = int(value);
+    return true;
   }
 
   /**
@@ -168,93 +284,122 @@ namespace {
     uint64_t dt{0};        //!< dirty pages (unused since Linux 2.6; always 0)
   };
 
-
-  bool readStatM(StatM &statm) {
-    QFile inputFile("/proc/self/statm");
-    if (!inputFile.open(QIODevice::ReadOnly)) {
-      qWarning() << "Can't open sattm file";
+  bool readStatM(int fd, StatM &statm) {
+    char buffer[256];
+    if (readFile(fd, buffer, sizeof(buffer)) <= 0) {
+      qWarning() << "Can't read statm";
       return false;
     }
-    QTextStream in(&inputFile);
 
-    QString line = in.readLine();
-    if (line.isEmpty()){
-      qWarning() << "Can't parse statm";
-      return false;
+    const char *p = buffer;
+    for (uint64_t *field: {&statm.size, &statm.resident, &statm.shared, &statm.text, &statm.lib, &statm.data, &statm.dt}) {
+      if (!parseNumber(p, *field)) {
+        qWarning() << "Can't parse statm";
+        return false;
+      }
+      *field *= PageSize;
     }
+    return true;
+  }
 
-    QStringList arr = line.split(" ", SkipEmptyParts);
-    if (arr.size() < 7){
-      qWarning() << "Can't parse statm";
+  /**
+   * avg10 value of given line ("some" or "full") from /proc/pressure/memory, in percent.
+   */
+  bool pressureAvg10(const char *buffer, const char *line, double &value)
+  {
+    const char *p = findKey(buffer, line);
+    if (p == nullptr || strncmp(p, " avg10=", 7) != 0) {
       return false;
     }
-    QVector<uint64_t> arri;
-    arri.reserve(arr.size());
-    for (const auto &numStr:arr){
-      bool ok;
-      arri.push_back(numStr.toULongLong(&ok) * 4096);
-      if (!ok){
-        qWarning() << "Can't parse statm";
-        return false;
+    p += 7;
+    return parseDecimal(p, value);
+  }
+
+  /**
+   * Map of process oom score adjustment to free space levels.
+   */
+  std::map<int, FreeSpaceLevel> loadFreeSpaceLevels(const QSettings &setting, int meminfoFd)
+  {
+    std::map<int, FreeSpaceLevel> levelMap;
+    QVariant adjConf = setting.value("MemoryManager/adj");
+    QVariant warningLevelsConf = setting.value("MemoryManager/warning");
+    QVariant criticalLevelsConf = setting.value("MemoryManager/critical");
+    if (adjConf.isNull() || warningLevelsConf.isNull() || criticalLevelsConf.isNull()) {
+      // default values for critical are 110% of low-memory-killer's minfree from Xperia 10.II
+      // and 120% for warning level (in MiB).
+      // We have to use percentage values, so we take 10.II as reference and adjust it by total memory.
+      double total = totalMemory(meminfoFd);
+      if (total==0) {
+        qWarning() << "Failed to get total amount of memory";
+        return levelMap;
+      }
+      auto AddLevel = [&levelMap, &total](int adj, double referenceWarningLevel, double referenceCriticalLevel) {
+        double referenceTotal = 3558.0; // total memory on Xperia 10.II
+        levelMap[adj] = FreeSpaceLevel{total * (referenceWarningLevel / referenceTotal), total * (referenceCriticalLevel / referenceTotal)};
+      };
+      AddLevel(0,     549,  503);
+      AddLevel(58,    657,  602);
+      AddLevel(147,   765,  701);
+      AddLevel(529,   873,  800);
+      AddLevel(1000, 1202, 1102);
+    } else {
+
+      QStringList adj = adjConf.toString().split(',');
+      QStringList warningLevels = warningLevelsConf.toString().split(',');
+      QStringList criticalLevels = criticalLevelsConf.toString().split(',');
+
+      if (adj.size() != warningLevels.size() || adj.size() != criticalLevels.size() || adj.empty() ||
+          warningLevels.empty()) {
+        qWarning() << "memory watcher configuration is weird:" << adj << warningLevels;
+      }
+      for (int i = 0; i < std::min(std::min(adj.size(), warningLevels.size()), criticalLevels.size()); ++i) {
+        int adjVal = adj[i].toInt();
+        FreeSpaceLevel levels{
+          double(warningLevels[i].toLongLong() * MiB),
+          double(criticalLevels[i].toLongLong() * MiB)
+        };
+
+        levelMap[adjVal] = levels;
       }
     }
+    return levelMap;
+  }
 
-    statm.size = arri[0];
-    statm.resident = arri[1];
-    statm.shared = arri[2];
-    statm.text = arri[3];
-    statm.lib = arri[4];
-    statm.data = arri[5];
-    statm.dt = arri[6];
+  uint64_t heapAllocated()
+  {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    // fields of legacy mallinfo are int, they overflow with heap bigger than 2 GiB
+    struct mallinfo info = mallinfo();
+    return uint64_t(unsigned(info.uordblks)) + uint64_t(unsigned(info.hblkhd));
+#endif
+  }
 
-    return true;
+  const char* tierName(CacheTier tier)
+  {
+    switch (tier) {
+      case CacheTier::Offscreen: return "offscreen";
+      case CacheTier::Database: return "database";
+      case CacheTier::Heap: return "heap";
+    }
+    return "unknown";
   }
 
+  QString byteSize(qint64 bytes)
+  {
+    return QString::fromStdString(ByteSizeToString(double(bytes)));
+  }
 }
 
 ProcMemoryWatcher::ProcMemoryWatcher(const QSettings &setting)
 {
-  QVariant adjConf = setting.value("MemoryManager/adj");
-  QVariant warningLevelsConf = setting.value("MemoryManager/warning");
-  QVariant criticalLevelsConf = setting.value("MemoryManager/critical");
-  if (adjConf.isNull() || warningLevelsConf.isNull() || criticalLevelsConf.isNull()) {
-    // default values for critical are 110% of low-memory-killer's minfree from Xperia 10.II
-    // and 120% for warning level (in MiB).
-    // We have to use percentage values, so we take 10.II as reference and adjust it by total memory.
-    double total = totalMemory();
-    if (total==0) {
-      qWarning() << "Failed to get total amount of memory";
-      return;
-    }
-    auto AddLevel = [this, &total](int adj, double referenceWarningLevel, double referenceCriticalLevel) {
-      double referenceTotal = 3558.0; // total memory on Xperia 10.II
-      levelMap[adj] = FreeSpaceLevel{total * (referenceWarningLevel / referenceTotal), total * (referenceCriticalLevel / referenceTotal)};
-    };
-    AddLevel(0,     549,  503);
-    AddLevel(58,    657,  602);
-    AddLevel(147,   765,  701);
-    AddLevel(529,   873,  800);
-    AddLevel(1000, 1202, 1102);
-  } else {
-
-    QStringList adj = adjConf.toString().split(',');
-    QStringList warningLevels = warningLevelsConf.toString().split(',');
-    QStringList criticalLevels = criticalLevelsConf.toString().split(',');
+  meminfoFd = openFile("/proc/meminfo");
+  statmFd = openFile("/proc/self/statm");
+  oomScoreAdjFd = openFile("/proc/self/oom_score_adj");
 
-    if (adj.size() != warningLevels.size() || adj.size() != criticalLevels.size() || adj.empty() ||
-        warningLevels.empty()) {
-      qWarning() << "memory watcher configuration is weird:" << adj << warningLevels;
-    }
-    for (int i = 0; i < std::min(std::min(adj.size(), warningLevels.size()), criticalLevels.size()); ++i) {
-      int adjVal = adj[i].toInt();
-      FreeSpaceLevel levels{
-        double(warningLevels[i].toLongLong() * MiB),
-        double(criticalLevels[i].toLongLong() * MiB)
-      };
-
-      levelMap[adjVal] = levels;
-    }
-  }
+  levelMap = loadFreeSpaceLevels(setting, meminfoFd);
 
   for (auto const &pair: levelMap) {
     qDebug() << "ProcMemoryWatcher configuration" << pair.first
@@ -265,56 +410,264 @@ ProcMemoryWatcher::ProcMemoryWatcher(const QSettings &setting)
   if (!levelMap.empty()) {
     timer.setSingleShot(false);
     connect(&timer, &QTimer::timeout, this, &ProcMemoryWatcher::onTimeout);
-    timer.start(2000);
+    timer.start(ProcWatcherInterval);
   }
 }
 
+ProcMemoryWatcher::~ProcMemoryWatcher()
+{
+  closeFile(meminfoFd);
+  closeFile(statmFd);
+  closeFile(oomScoreAdjFd);
+}
+
 void ProcMemoryWatcher::onTimeout()
 {
-  int adj = readLine("/proc/self/oom_score_adj").toInt();
-  StatM statm;
-  if (!readStatM(statm)) {
-    qWarning() << "Failed to parse statm";
+  // it is invoked every few seconds for the whole application life,
+  // avoid heap allocations and logging when nothing is changed
+  int adj = 0;
+  if (!readOomScoreAdj(oomScoreAdjFd, adj)) {
+    qWarning() << "Failed to read oom_score_adj";
   }
-  qDebug() << "Self oom_score_adj:" << adj
-           << "Rss:" << QString::fromStdString(ByteSizeToString(statm.resident))
-           << "Anon:" << QString::fromStdString(ByteSizeToString(statm.resident - statm.shared));
 
   auto it = levelMap.upper_bound(adj);
   MemoryLevel currentLevel = MemoryLevel::Normal;
   assert(!levelMap.empty());
+  double available = 0;
   if (it != levelMap.begin()) {
     FreeSpaceLevel &levels = (--it)->second;
-    auto available = double(availableMemory());
-    qDebug() << "warning level:" << QString::fromStdString(ByteSizeToString(levels.warning))
-             << "critical level:" << QString::fromStdString(ByteSizeToString(levels.critical))
-             << "available:" << QString::fromStdString(ByteSizeToString(available));
+    available = double(availableMemory(meminfoFd));
     if (available < levels.critical) {
-      qDebug() << "Memory level: critical";
       currentLevel = MemoryLevel::Critical;
     } else if (available < levels.warning) {
-      qDebug() << "Memory level: warning";
       currentLevel = MemoryLevel::Warning;
     }
   }
   if (currentLevel != level) {
     level = currentLevel;
-    if (level==MemoryLevel::Normal) {
-      timer.setInterval(2000);
-    } else if (level==MemoryLevel::Warning) {
-      timer.setInterval(1000);
-    } else {
-      assert(level==MemoryLevel::Critical);
-      timer.setInterval(1000);
+    StatM statm;
+    if (!readStatM(statmFd, statm)) {
+      qWarning() << "Failed to parse statm";
     }
+    qDebug() << "Memory level:" << int(level)
+             << "Self oom_score_adj:" << adj
+             << "available:" << QString::fromStdString(ByteSizeToString(available))
+             << "Rss:" << QString::fromStdString(ByteSizeToString(statm.resident))
+             << "Anon:" << QString::fromStdString(ByteSizeToString(statm.resident - statm.shared));
+    timer.setInterval(level == MemoryLevel::Normal ? ProcWatcherInterval : ProcWatcherPressureInterval);
     emit memoryLevelChanged(level);
   }
 }
 
+PressureMemoryWatcher::PressureMemoryWatcher(const QSettings &setting)
+{
+  someStallThreshold = setting.value("MemoryManager/someStall", someStallThreshold).toDouble();
+  fullStallThreshold = setting.value("MemoryManager/fullStall", fullStallThreshold).toDouble();
+
+  if (!setupPressureTriggers() && !setupCgroupEvents()) {
+    return;
+  }
+
+  timer.setSingleShot(false);
+  timer.setInterval(PressureRecoveryInterval);
+  connect(&timer, &QTimer::timeout, this, &PressureMemoryWatcher::onTimeout);
+}
+
+PressureMemoryWatcher::~PressureMemoryWatcher()
+{
+  // notifiers have to be destroyed before file descriptors are closed
+  warningNotifier.reset();
+  criticalNotifier.reset();
+  eventsNotifier.reset();
+  closeFile(warningFd);
+  closeFile(criticalFd);
+  closeFile(eventsFd);
+}
+
+bool PressureMemoryWatcher::isValid() const
+{
+  return warningNotifier || eventsNotifier;
+}
+
+bool PressureMemoryWatcher::setupPressureTriggers()
+{
+  // trigger format: <some|full> <stall amount us> <time window us>,
+  // unprivileged process may use just windows that are multiple of 2 s
+  using namespace std::chrono;
+  const int64_t window = duration_cast<microseconds>(milliseconds(PressureRecoveryInterval)).count();
+  auto setupTrigger = [window](const char *type, double threshold) -> int {
+    int fd = ::open("/proc/pressure/memory", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+      qDebug() << "PSI is not available:" << strerror(errno);
+      return -1;
+    }
+    char trigger[64];
+    int length = snprintf(trigger, sizeof(trigger), "%s %lld %lld",
+                          type, (long long)(window * threshold / 100.0), (long long)window);
+    if (::write(fd, trigger, size_t(length) + 1) < 0) {
+      qDebug() << "Can't setup PSI trigger" << trigger << ":" << strerror(errno);
+      ::close(fd);
+      return -1;
+    }
+    return fd;
+  };
+
+  warningFd = setupTrigger("some", someStallThreshold);
+  if (warningFd < 0) {
+    return false;
+  }
+  criticalFd = setupTrigger("full", fullStallThreshold);
+  if (criticalFd < 0) {
+    closeFile(warningFd);
+    return false;
+  }
+
+  // triggers are signaled by POLLPRI
+  warningNotifier = std::make_unique<QSocketNotifier>(warningFd, QSocketNotifier::Exception);
+  connect(warningNotifier.get(), &QSocketNotifier::activated, this, &PressureMemoryWatcher::onWarningTrigger);
+  criticalNotifier = std::make_unique<QSocketNotifier>(criticalFd, QSocketNotifier::Exception);
+  connect(criticalNotifier.get(), &QSocketNotifier::activated, this, &PressureMemoryWatcher::onCriticalTrigger);
+
+  qDebug() << "Using PSI memory triggers, some:" << someStallThreshold << "% full:" << fullStallThreshold << "%";
+  return true;
+}
+
+bool PressureMemoryWatcher::setupCgroupEvents()
+{
+  // cgroup v2 entry has format "0::<path>"
+  QFile cgroupFile("/proc/self/cgroup");
+  if (!cgroupFile.open(QIODevice::ReadOnly)) {
+    return false;
+  }
+  QString cgroupPath;
+  for (QByteArray line = cgroupFile.readLine(); !line.isEmpty(); line = cgroupFile.readLine()) {
+    if (line.startsWith("0::")) {
+      cgroupPath = QString::fromUtf8(line.mid(3).trimmed());
+    }
+  }
+  if (cgroupPath.isEmpty()) {
+    qDebug() << "cgroup v2 is not available";
+    return false;
+  }
+
+  // events are generated just when some memory limit is configured
+  QDir cgroupDir("/sys/fs/cgroup" + cgroupPath);
+  bool limited = false;
+  for (const char *limitFile: {"memory.high", "memory.max"}) {
+    QFile limit(cgroupDir.filePath(limitFile));
+    if (limit.open(QIODevice::ReadOnly) && limit.readLine().trimmed() != "max") {
+      limited = true;
+    }
+  }
+  if (!limited) {
+    qDebug() << "cgroup" << cgroupPath << "don't have memory limit";
+    return false;
+  }
+
+  QByteArray eventsPath = cgroupDir.filePath("memory.events").toLocal8Bit();
+  eventsFd = openFile(eventsPath.constData());
+  if (eventsFd < 0 || !readMemoryEvents(lastEvents)) {
+    closeFile(eventsFd);
+    return false;
+  }
+
+  // kernfs signals file modification by POLLPRI
+  eventsNotifier = std::make_unique<QSocketNotifier>(eventsFd, QSocketNotifier::Exception);
+  connect(eventsNotifier.get(), &QSocketNotifier::activated, this, &PressureMemoryWatcher::onMemoryEvents);
+
+  qDebug() << "Using cgroup memory events" << eventsPath;
+  return true;
+}
+
+bool PressureMemoryWatcher::readMemoryEvents(MemoryEvents &events) const
+{
+  char buffer[256];
+  if (readFile(eventsFd, buffer, sizeof(buffer)) <= 0) {
+    return false;
+  }
+  const char *high = findKey(buffer, "high ");
+  const char *max = findKey(buffer, "max ");
+  const char *oom = findKey(buffer, "oom ");
+  return high != nullptr && parseNumber(high, events.high) &&
+         max != nullptr && parseNumber(max, events.max) &&
+         (oom == nullptr || parseNumber(oom, events.oom));
+}
+
+void PressureMemoryWatcher::raiseLevel(MemoryLevel newLevel)
+{
+  triggered = true;
+  if (int(newLevel) <= int(level)) {
+    return;
+  }
+  level = newLevel;
+  qDebug() << "Memory pressure, level:" << int(level);
+  timer.start();
+  emit memoryLevelChanged(level);
+}
+
+void PressureMemoryWatcher::onWarningTrigger()
+{
+  raiseLevel(MemoryLevel::Warning);
+}
+
+void PressureMemoryWatcher::onCriticalTrigger()
+{
+  raiseLevel(MemoryLevel::Critical);
+}
+
+void PressureMemoryWatcher::onMemoryEvents()
+{
+  MemoryEvents events;
+  if (!readMemoryEvents(events)) {
+    qWarning() << "Can't read memory events";
+    return;
+  }
+  if (events.max > lastEvents.max || events.oom > lastEvents.oom) {
+    raiseLevel(MemoryLevel::Critical);
+  } else if (events.high > lastEvents.high) {
+    raiseLevel(MemoryLevel::Warning);
+  }
+  lastEvents = events;
+}
+
+void PressureMemoryWatcher::onTimeout()
+{
+  // triggers fire at most once per window, level is decreased when there was
+  // no trigger during the last interval and averages are under the thresholds
+  MemoryLevel currentLevel = MemoryLevel::Normal;
+  if (warningFd >= 0) {
+    char buffer[256];
+    double some = 0;
+    double full = 0;
+    if (readFile(warningFd, buffer, sizeof(buffer)) > 0 &&
+        pressureAvg10(buffer, "some", some) &&
+        pressureAvg10(buffer, "full", full)) {
+      if (full >= fullStallThreshold) {
+        currentLevel = MemoryLevel::Critical;
+      } else if (some >= someStallThreshold) {
+        currentLevel = MemoryLevel::Warning;
+      }
+    }
+  }
+  if (triggered || int(currentLevel) >= int(level)) {
+    triggered = false;
+    return;
+  }
+
+  level = MemoryLevel(int(level) - 1);
+  qDebug() << "Memory pressure decreased, level:" << int(level);
+  if (level == MemoryLevel::Normal) {
+    timer.stop();
+  }
+  emit memoryLevelChanged(level);
+}
+
 MemoryManager::MemoryManager(QQmlEngine* engine)
   : qmlEngine(engine)
 {
   assert(qmlEngine!=nullptr);
+  assert(memoryManagerInstance==nullptr);
+  memoryManagerInstance = this;
   memoryLevelChanged(MemoryLevel::Normal);
 
   // MCE is using CGroup API for memory notifications when memnotify is not available
@@ -328,12 +681,30 @@ MemoryManager::MemoryManager(QQmlEngine* engine)
   // So we need to rely on configuration with some feasible defaults
   QSettings setting(AppSettings::settingFile(), QSettings::NativeFormat, this);
 
-  if (setting.value("MemoryManager/type", "proc").toString() == "proc") {
-    qDebug() << "Using Proc memory watcher";
-    watcher = std::make_unique<ProcMemoryWatcher>(setting);
-  } else {
-    qDebug() << "Using MCI memory watcher";
-    watcher = std::make_unique<MCIMemoryWatcher>();
+  meminfoFd = openFile("/proc/meminfo");
+  statmFd = openFile("/proc/self/statm");
+  oomScoreAdjFd = openFile("/proc/self/oom_score_adj");
+  levelMap = loadFreeSpaceLevels(setting, meminfoFd);
+
+  QString type = setting.value("MemoryManager/type", "proc").toString();
+  if (type == "pressure") {
+    // PSI is opt-in, it is event driven, but it is not available on all kernels
+    auto pressureWatcher = std::make_unique<PressureMemoryWatcher>(setting);
+    if (pressureWatcher->isValid()) {
+      qDebug() << "Using pressure memory watcher";
+      watcher = std::move(pressureWatcher);
+    } else {
+      qDebug() << "Memory pressure events are not available";
+    }
+  }
+  if (!watcher) {
+    if (type == "pressure" || type == "proc") {
+      qDebug() << "Using Proc memory watcher";
+      watcher = std::make_unique<ProcMemoryWatcher>(setting);
+    } else {
+      qDebug() << "Using MCI memory watcher";
+      watcher = std::make_unique<MCIMemoryWatcher>();
+    }
   }
 
   connect(watcher.get(), &MemoryWatcher::memoryLevelChanged, this, &MemoryManager::memoryLevelChanged);
@@ -341,49 +712,214 @@ MemoryManager::MemoryManager(QQmlEngine* engine)
   connect(&timer, &QTimer::timeout, this, &MemoryManager::onTimeout);
   timer.setSingleShot(false);
 
+  // statistics are logged periodically, it helps to find out what was consuming memory
+  // when the process was killed by low-memory-killer
+  int snapshotInterval = setting.value("MemoryManager/snapshotInterval", DefaultSnapshotInterval).toInt();
+  if (snapshotInterval > 0) {
+    connect(&snapshotTimer, &QTimer::timeout, this, &MemoryManager::onSnapshotTimeout);
+    snapshotTimer.setSingleShot(false);
+    snapshotTimer.start(snapshotInterval * 1000);
+  }
+
   auto dbThread=OSMScoutQt::GetInstance().GetDBThread();
   assert(dbThread);
   flushCachesRequest.Connect(dbThread->flushCaches);
+
+  registerCache("QML engine", CacheTier::Heap,
+                []() { return 0; },
+                [this](size_t) {
+                  qmlEngine->trimComponentCache();
+                  qmlEngine->collectGarbage();
+                  return 0;
+                });
+
+  registerCache("malloc", CacheTier::Heap,
+                []() { return 0; },
+                [this](size_t) -> size_t {
+                  StatM before;
+                  readStatM(statmFd, before);
+                  malloc_stats();
+                  if (malloc_trim(0) == 0){
+                    // The malloc_trim() function returns 1 if memory was actually released
+                    // back to the system, or 0 if it was not possible to release any
+                    // memory.
+                    qWarning() << "No memory can be returned";
+                    return 0;
+                  }
+                  StatM after;
+                  readStatM(statmFd, after);
+                  return before.resident > after.resident ? before.resident - after.resident : 0;
+                });
+}
+
+MemoryManager::~MemoryManager()
+{
+  memoryManagerInstance = nullptr;
+  closeFile(meminfoFd);
+  closeFile(statmFd);
+  closeFile(oomScoreAdjFd);
+}
+
+MemoryManager* MemoryManager::getInstance()
+{
+  return memoryManagerInstance;
+}
+
+int MemoryManager::registerCache(const QString &name, CacheTier tier, const CacheFootprint &footprint, const CacheEviction &evict)
+{
+  int id = nextCacheId++;
+  caches.push_back(Cache{id, name, tier, footprint, evict});
+  return id;
+}
+
+void MemoryManager::unregisterCache(int id)
+{
+  caches.erase(std::remove_if(caches.begin(), caches.end(), [id](const Cache &cache) { return cache.id == id; }),
+               caches.end());
+}
+
+void MemoryManager::refreshStatistics()
+{
+  StatM statm;
+  readStatM(statmFd, statm);
+  statistics.resident = qint64(statm.resident);
+  statistics.anonymous = qint64(statm.resident > statm.shared ? statm.resident - statm.shared : 0);
+  statistics.heap = qint64(heapAllocated());
+  statistics.storageResults = MemoryAccounting::get(MemoryAccounting::Counter::StorageResults);
+  statistics.iconPixmaps = MemoryAccounting::get(MemoryAccounting::Counter::IconPixmaps);
+
+  statistics.subsystems.clear();
+  statistics.subsystems.reserve(caches.size());
+  for (const auto &cache: caches) {
+    statistics.subsystems.push_back(Subsystem{cache.name, cache.tier, cache.footprint()});
+  }
+  emit statisticsChanged();
+}
+
+QVariantList MemoryManager::getSubsystems() const
+{
+  QVariantList result;
+  for (const auto &subsystem: statistics.subsystems) {
+    QVariantMap map;
+    map["name"] = subsystem.name;
+    map["tier"] = tierName(subsystem.tier);
+    map["bytes"] = qint64(subsystem.bytes);
+    result << map;
+  }
+  return result;
+}
+
+qint64 MemoryManager::getUnaccounted() const
+{
+  // Storage results are held by subsystems (overlays, charts...) partially,
+  // so this value is rather under-estimated. Icon pixmaps are held by registered icon cache.
+  qint64 accounted = statistics.storageResults;
+  for (const auto &subsystem: statistics.subsystems) {
+    accounted += qint64(subsystem.bytes);
+  }
+  return std::max(qint64(0), statistics.anonymous - accounted);
+}
+
+QString MemoryManager::statisticsSnapshot() const
+{
+  QString result = QString("level: %1, rss: %2, anonymous: %3, heap: %4, storage results: %5, icon pixmaps: %6")
+    .arg(int(level))
+    .arg(byteSize(statistics.resident))
+    .arg(byteSize(statistics.anonymous))
+    .arg(byteSize(statistics.heap))
+    .arg(byteSize(statistics.storageResults))
+    .arg(byteSize(statistics.iconPixmaps));
+  for (const auto &subsystem: statistics.subsystems) {
+    if (subsystem.bytes > 0) {
+      result += QString(", %1: %2").arg(subsystem.name).arg(byteSize(qint64(subsystem.bytes)));
+    }
+  }
+  result += QString(", unaccounted: %1").arg(byteSize(getUnaccounted()));
+  return result;
+}
+
+void MemoryManager::onSnapshotTimeout()
+{
+  refreshStatistics();
+  qDebug().noquote() << "Memory statistics:" << statisticsSnapshot();
+}
+
+size_t MemoryManager::reclaimTarget() const
+{
+  if (levelMap.empty()) {
+    return 0;
+  }
+  int adj = 0;
+  auto it = readOomScoreAdj(oomScoreAdjFd, adj) ? levelMap.upper_bound(adj) : levelMap.begin();
+  const FreeSpaceLevel &levels = it != levelMap.begin() ? std::prev(it)->second : it->second;
+  auto available = double(availableMemory(meminfoFd));
+  if (available > 0 && available < levels.warning) {
+    return size_t(levels.warning - available);
+  }
+  // watcher reports memory pressure (PSI or MCE), but free memory thresholds are not reached,
+  // release the margin between warning and critical threshold
+  return size_t(std::max(levels.warning - levels.critical, 0.0));
 }
 
 void MemoryManager::onTimeout()
 {
-  using namespace std::chrono;
-  malloc_stats();
-  flushCachesRequest.Emit(duration_cast<milliseconds>(cacheValidity));
-  if (callGc) {
-    qmlEngine->collectGarbage();
+  StatM statm;
+  readStatM(statmFd, statm);
+  const size_t target = reclaimTarget();
+
+  // libosmscout caches are flushed by age in DBThread, their size is not known here
+  flushCachesRequest.Emit(cacheValidity);
+
+  const CacheTier maxTier = level == MemoryLevel::Critical ? CacheTier::Heap : CacheTier::Database;
+
+  // the least valuable bytes first: lower tier first, the biggest cache first within the tier
+  std::vector<std::pair<size_t, Cache>> order;
+  order.reserve(caches.size());
+  for (const auto &cache: caches) {
+    if (cache.tier <= maxTier) {
+      order.emplace_back(cache.footprint(), cache);
+    }
   }
-  if (trimAlloc){
-    if (malloc_trim(0) == 0){
-      // The malloc_trim() function returns 1 if memory was actually released
-      // back to the system, or 0 if it was not possible to release any
-      // memory.
-      qWarning() << "No memory can be returned";
+  std::sort(order.begin(), order.end(), [](const auto &a, const auto &b) {
+    return a.second.tier != b.second.tier ? a.second.tier < b.second.tier : a.first > b.first;
+  });
+
+  size_t released = 0;
+  for (const auto &[footprint, cache]: order) {
+    if (released >= target) {
+      break;
     }
+    size_t cacheReleased = cache.evict(target - released);
+    released += cacheReleased;
+    qDebug() << "Cache" << cache.name << "footprint:" << QString::fromStdString(ByteSizeToString(double(footprint)))
+             << "released:" << QString::fromStdString(ByteSizeToString(double(cacheReleased)));
   }
+
+  qDebug() << "Memory level:" << int(level)
+           << "Rss:" << QString::fromStdString(ByteSizeToString(double(statm.resident)))
+           << "target Rss:" << QString::fromStdString(ByteSizeToString(double(statm.resident > target ? statm.resident - target : 0)))
+           << "released:" << QString::fromStdString(ByteSizeToString(double(released)));
 }
 
 void MemoryManager::memoryLevelChanged(const MemoryLevel &level)
 {
   using namespace std::chrono;
 
+  if (this->level != level) {
+    this->level = level;
+    // snapshot before caches are released
+    onSnapshotTimeout();
+  }
   // https://sailfishos.org/wiki/Mce
   if (level == MemoryLevel::Critical) {
     cacheValidity=seconds(1);
-    callGc=true;
-    trimAlloc=true;
     timer.start(duration_cast<milliseconds>(cacheValidity).count());
     onTimeout();
   } else if (level == MemoryLevel::Warning) {
     cacheValidity=seconds(10);
-    callGc=false;
-    trimAlloc=false;
     timer.start(duration_cast<milliseconds>(cacheValidity).count());
     onTimeout();
   } else if (level == MemoryLevel::Normal) {
-    callGc=false;
-    trimAlloc=false;
     timer.stop();
   } else {
     qWarning() << "Unsupported Memory level:" << int(level);
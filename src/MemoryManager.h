@@ -22,8 +22,12 @@
 #include <osmscoutclientqt/OSMScoutQt.h>
 
 #include <QQmlEngine>
+#include <QSocketNotifier>
+#include <QVariantList>
 
+#include <functional>
 #include <memory>
+#include <vector>
 
 enum class MemoryLevel
 {
@@ -55,12 +59,27 @@ public:
   ~MCIMemoryWatcher() override = default;
 };
 
+/**
+ * Caches of lower tier are released first.
+ */
+enum class CacheTier
+{
+  Offscreen = 0, // data that are not displayed now, cheap to load again (map overlays, chart profiles)
+  Database = 1, // rendered or decoded data, expensive to load again (icon pixmaps)
+  Heap = 2 // QML garbage collection, returning of free heap to the system, it blocks UI
+};
+
 struct FreeSpaceLevel
 {
   double warning{0};
   double critical{0};
 };
 
+/**
+ * Watcher polling free memory from /proc/meminfo and comparing it with low-memory-killer
+ * thresholds for current process oom_score_adj. Proc files are kept open and parsed
+ * without heap allocations.
+ */
 class ProcMemoryWatcher: public MemoryWatcher {
   Q_OBJECT
 
@@ -69,13 +88,75 @@ public slots:
 
 public:
   explicit ProcMemoryWatcher(const QSettings &setting);
-  ~ProcMemoryWatcher() override = default;
+  ~ProcMemoryWatcher() override;
 
 private:
   // map of process oom score adjustment to free space levels
   std::map<int, FreeSpaceLevel> levelMap;
   QTimer timer;
   MemoryLevel level{MemoryLevel::Normal};
+  int meminfoFd{-1};
+  int statmFd{-1};
+  int oomScoreAdjFd{-1};
+};
+
+/**
+ * Event driven watcher. It uses Linux pressure stall information triggers
+ * (/proc/pressure/memory, https://docs.kernel.org/accounting/psi.html)
+ * or cgroup v2 memory.events notifications when PSI is not available.
+ * It doesn't wake up while memory level is normal, when the level is
+ * elevated, it is decreased step by step when pressure disappears.
+ * It is opt-in by `MemoryManager/type=pressure` setting, ProcMemoryWatcher
+ * is used when pressure events are not available.
+ */
+class PressureMemoryWatcher: public MemoryWatcher {
+  Q_OBJECT
+
+public slots:
+  void onWarningTrigger();
+  void onCriticalTrigger();
+  void onMemoryEvents();
+  void onTimeout();
+
+public:
+  explicit PressureMemoryWatcher(const QSettings &setting);
+  ~PressureMemoryWatcher() override;
+
+  /**
+   * False when neither PSI triggers nor cgroup events are usable
+   * (old kernel, or restricted by sandbox).
+   */
+  bool isValid() const;
+
+private:
+  bool setupPressureTriggers();
+  bool setupCgroupEvents();
+  void raiseLevel(MemoryLevel newLevel);
+
+  struct MemoryEvents
+  {
+    uint64_t high{0};
+    uint64_t max{0};
+    uint64_t oom{0};
+  };
+  bool readMemoryEvents(MemoryEvents &events) const;
+
+private:
+  // stall time in percent of the trigger window
+  double someStallThreshold{10};
+  double fullStallThreshold{5};
+
+  int warningFd{-1}; // "some" trigger, used for reading averages as well
+  int criticalFd{-1}; // "full" trigger
+  int eventsFd{-1}; // cgroup memory.events
+  std::unique_ptr<QSocketNotifier> warningNotifier;
+  std::unique_ptr<QSocketNotifier> criticalNotifier;
+  std::unique_ptr<QSocketNotifier> eventsNotifier;
+  MemoryEvents lastEvents;
+
+  QTimer timer;
+  bool triggered{false}; // since last timeout
+  MemoryLevel level{MemoryLevel::Normal};
 };
 
 
@@ -83,24 +164,164 @@ private:
  * This class listen for events about memory state pressure
  * and tries to release some cache when system memory level
  * is "warning" or "critical" (third state is "normal").
+ *
+ * Subsystems register their caches with current footprint and eviction callback.
+ * While memory level is not normal, manager periodically computes how much memory
+ * should be released to get over the warning level of free memory (see ProcMemoryWatcher
+ * thresholds) and releases the least valuable bytes first - caches of lower tier first,
+ * the biggest cache first within the tier. Heap tier is used on critical level only.
+ *
+ * Memory statistics (process memory, footprints of registered caches and MemoryAccounting
+ * counters) are exposed as properties for debug page, they are updated by refreshStatistics.
+ * Snapshot of statistics is logged periodically and when memory level is changed.
  */
 class MemoryManager: public QObject {
   Q_OBJECT
+  Q_PROPERTY(int level READ getLevel NOTIFY statisticsChanged)
+  Q_PROPERTY(qint64 residentMemory READ getResidentMemory NOTIFY statisticsChanged)
+  Q_PROPERTY(qint64 anonymousMemory READ getAnonymousMemory NOTIFY statisticsChanged)
+  Q_PROPERTY(qint64 heapAllocated READ getHeapAllocated NOTIFY statisticsChanged)
+  Q_PROPERTY(qint64 storageResults READ getStorageResults NOTIFY statisticsChanged)
+  Q_PROPERTY(qint64 iconPixmaps READ getIconPixmaps NOTIFY statisticsChanged)
+  Q_PROPERTY(QVariantList subsystems READ getSubsystems NOTIFY statisticsChanged)
+  Q_PROPERTY(qint64 unaccounted READ getUnaccounted NOTIFY statisticsChanged)
+
+signals:
+  void statisticsChanged();
 
 public slots:
   void memoryLevelChanged(const MemoryLevel &level);
   void onTimeout();
+  void onSnapshotTimeout();
+
+public:
+  /**
+   * @return approximate size of cached data in bytes, zero when unknown
+   */
+  using CacheFootprint = std::function<size_t()>;
+
+  /**
+   * Release approximately requested amount of bytes.
+   * @return released bytes (estimate), zero when unknown
+   */
+  using CacheEviction = std::function<size_t(size_t bytes)>;
 
 public:
   explicit MemoryManager(QQmlEngine* engine);
-  ~MemoryManager() override = default;
+  ~MemoryManager() override;
+
+  /**
+   * Instance living in UI thread, it may be null (desktop mode).
+   */
+  static MemoryManager* getInstance();
+
+  /**
+   * Register cache, callbacks are invoked from UI thread.
+   * Cache have to be unregistered before callbacks become invalid.
+   * @return cache id
+   */
+  int registerCache(const QString &name, CacheTier tier, const CacheFootprint &footprint, const CacheEviction &evict);
+  void unregisterCache(int id);
+
+  /**
+   * Read current process memory and cache footprints, emits statisticsChanged.
+   */
+  Q_INVOKABLE void refreshStatistics();
+
+  /**
+   * One line summary of the statistics, as it is logged.
+   */
+  Q_INVOKABLE QString statisticsSnapshot() const;
+
+  int getLevel() const
+  {
+    return int(level);
+  }
+
+  qint64 getResidentMemory() const
+  {
+    return statistics.resident;
+  }
+
+  qint64 getAnonymousMemory() const
+  {
+    return statistics.anonymous;
+  }
+
+  qint64 getHeapAllocated() const
+  {
+    return statistics.heap;
+  }
+
+  qint64 getStorageResults() const
+  {
+    return statistics.storageResults;
+  }
+
+  qint64 getIconPixmaps() const
+  {
+    return statistics.iconPixmaps;
+  }
+
+  /**
+   * List of maps with name, tier and bytes keys, one entry per registered cache.
+   */
+  QVariantList getSubsystems() const;
+
+  /**
+   * Anonymous memory that is not accounted by any registered cache or counter.
+   * libosmscout caches cannot report their size, so they are part of this value.
+   */
+  qint64 getUnaccounted() const;
+
+private:
+  struct Cache
+  {
+    int id;
+    QString name;
+    CacheTier tier;
+    CacheFootprint footprint;
+    CacheEviction evict;
+  };
+
+  struct Subsystem
+  {
+    QString name;
+    CacheTier tier;
+    size_t bytes;
+  };
+
+  struct Statistics
+  {
+    qint64 resident{0};
+    qint64 anonymous{0}; // resident memory that is not backed by file
+    qint64 heap{0}; // allocated by malloc
+    qint64 storageResults{0};
+    qint64 iconPixmaps{0};
+    std::vector<Subsystem> subsystems;
+  };
+
+  /**
+   * Bytes that should be released by caches.
+   */
+  size_t reclaimTarget() const;
 
 private:
   std::unique_ptr<MemoryWatcher> watcher;
   QQmlEngine* qmlEngine;
   QTimer timer;
+  QTimer snapshotTimer;
+  MemoryLevel level{MemoryLevel::Normal};
+  Statistics statistics;
   std::chrono::milliseconds cacheValidity=std::chrono::minutes(10);
-  bool trimAlloc{false};
-  bool callGc{false};
   osmscout::Signal<std::chrono::milliseconds> flushCachesRequest;
+
+  std::vector<Cache> caches;
+  int nextCacheId{0};
+
+  // free memory thresholds, the same as ProcMemoryWatcher is using
+  std::map<int, FreeSpaceLevel> levelMap;
+  int meminfoFd{-1};
+  int statmFd{-1};
+  int oomScoreAdjFd{-1};
 };
@@ -80,7 +80,17 @@ static QObject *appSettingsSingletontypeProvider(QQmlEngine *engine, QJSEngine *
 {
   Q_UNUSED(engine)
   Q_UNUSED(scriptEngine)
-  return new AppSettings();
+  AppSettings *settings = new AppSettings();
+  // storage durability setting is applied on storage thread
+  Storage *storage = Storage::getInstance();
+  if (storage != nullptr) {
+    QObject::connect(settings, &AppSettings::StorageDurabilityChanged,
+                     storage, [storage](int profile) {
+                       storage->setDurabilityProfile(Storage::DurabilityProfile(profile));
+                     },
+                     Qt::QueuedConnection);
+  }
+  return settings;
 }
 
 std::string osPrettyName(){
@@ -169,12 +179,18 @@ Q_DECL_EXPORT int main(int argc, char* argv[])
   qRegisterMetaType<std::vector<Collection>>("std::vector<Collection>");
   qRegisterMetaType<std::vector<SearchItem>>("std::vector<SearchItem>");
   qRegisterMetaType<std::shared_ptr<std::vector<osmscout::gpx::TrackPoint>>>("std::shared_ptr<std::vector<osmscout::gpx::TrackPoint> >");
+  qRegisterMetaType<std::shared_ptr<TrackPointQueue>>("std::shared_ptr<TrackPointQueue>");
+  qRegisterMetaType<std::shared_ptr<std::vector<std::vector<osmscout::GeoCoord>>>>("std::shared_ptr<std::vector<std::vector<osmscout::GeoCoord> > >");
+  qRegisterMetaType<std::shared_ptr<std::vector<ElevationProfilePoint>>>("std::shared_ptr<std::vector<ElevationProfilePoint> >");
   qRegisterMetaType<std::optional<double>>("std::optional<double>");
   qRegisterMetaType<TrackStatistics>("TrackStatistics");
   qRegisterMetaType<Collection>("Collection");
   qRegisterMetaType<Track>("Track");
   qRegisterMetaType<Waypoint>("Waypoint");
   qRegisterMetaType<std::vector<Storage::WaypointNearby>>("std::vector<Storage::WaypointNearby>");
+  qRegisterMetaType<std::vector<Track>>("std::vector<Track>");
+  qRegisterMetaType<osmscout::GeoBox>("osmscout::GeoBox");
+  qRegisterMetaType<Qt::ApplicationState>("Qt::ApplicationState");
   qRegisterMetaType<std::optional<osmscout::Color>>("std::optional<osmscout::Color>");
 
   qmlRegisterType<CollectionListModel>("harbour.osmscout.map", 1, 0, "CollectionListModel");
@@ -274,7 +290,10 @@ Q_DECL_EXPORT int main(int argc, char* argv[])
     return 1;
   }
 
-  Storage::initInstance(dataDir);
+  Storage::initInstance(dataDir, Storage::DurabilityProfile(AppSettings().GetStorageDurability()));
+  QObject::connect(app, &QGuiApplication::applicationStateChanged,
+                   Storage::getInstance(), &Storage::applicationStateChanged,
+                   Qt::QueuedConnection);
 
   int result;
   if (!args.desktop) {
@@ -282,10 +301,13 @@ Q_DECL_EXPORT int main(int argc, char* argv[])
     view->rootContext()->setContextProperty("OSMScoutVersionString", OSMSCOUT_SAILFISH_VERSION_STRING);
     view->rootContext()->setContextProperty("PositionSimulationTrack", args.positionSimulatorFile);
     MemoryManager memoryManager(view->engine()); // lives in UI thread
+    view->rootContext()->setContextProperty("MemoryManager", &memoryManager);
     view->engine()->addImageProvider(QLatin1String("harbour-osmscout"), new IconProvider());
     view->setSource(SailfishApp::pathTo("qml/main.qml"));
     view->showFullScreen();
     result=app->exec();
+    // memory manager is destroyed before the view
+    view->rootContext()->setContextProperty("MemoryManager", nullptr);
   } else {
     QQmlApplicationEngine window(SailfishApp::pathTo("qml/desktop.qml"));
     result=app->exec();
@@ -17,12 +17,21 @@
   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include <fstream>
 #include <iostream>
 #include <iomanip>
 #include <limits>
+#include <map>
 #include <tuple>
+#include <vector>
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 
 #include "config.h"
+#include "TileAllocator.h"
 #define HAVE_LIB_OSMSCOUTMAPQT
 //#define HAVE_LIB_OSMSCOUTMAPCAIRO
 
@@ -101,6 +110,11 @@ struct Arguments {
   size_t loadRepeat{1};
   bool flushCache{false};
   bool flushDiskCache{false};
+  std::string allocator{"system"};
+  std::string output{"text"};
+  std::string outputFile{"-"};
+  std::string baseline;
+  double baselineThreshold{10}; // %
 
 #if defined(HAVE_LIB_GPERFTOOLS)
   bool heapProfile{false};
@@ -138,6 +152,36 @@ struct Arguments {
   }
 };
 
+struct TileStats
+{
+  uint32_t x;
+  uint32_t y;
+
+  double dbMinTime{std::numeric_limits<double>::max()};
+  double dbMaxTime{0.0};
+  double dbTotalTime{0.0};
+
+  double drawMinTime{std::numeric_limits<double>::max()};
+  double drawMaxTime{0.0};
+  double drawTotalTime{0.0};
+
+  double allocMax{0.0};
+
+  uint64_t allocationCount{0};
+  uint64_t allocatedBytes{0};
+
+  size_t nodeCount{0};
+  size_t wayCount{0};
+  size_t areaCount{0};
+  size_t routeCount{0};
+
+  TileStats(uint32_t x, uint32_t y)
+    : x(x), y(y)
+  {
+    // no code
+  }
+};
+
 struct LevelStats
 {
   size_t level;
@@ -153,6 +197,12 @@ struct LevelStats
   double allocMax{0.0};
   double allocSum{0.0};
 
+  // operator new calls during tile load and draw, see TileAllocator
+  uint64_t allocationCount{0};
+  uint64_t allocatedBytes{0};
+  uint64_t arenaChunks{0};
+  uint64_t retainedChunks{0}; // after the last tile of the level
+
   size_t nodeCount{0};
   size_t wayCount{0};
   size_t areaCount{0};
@@ -160,6 +210,8 @@ struct LevelStats
 
   size_t tileCount{0};
 
+  std::vector<TileStats> tiles;
+
   explicit LevelStats(size_t level)
     : level(level)
   {
@@ -183,6 +235,207 @@ std::string formatAlloc(double size)
   return buff.str();
 }
 
+double minTime(double min)
+{
+  // no samples
+  return min == std::numeric_limits<double>::max() ? 0.0 : min;
+}
+
+QJsonObject TimeJson(double min, double max, double total, size_t count)
+{
+  QJsonObject result;
+  result["min"] = minTime(min);
+  result["avg"] = count > 0 ? total / double(count) : 0.0;
+  result["max"] = max;
+  result["total"] = total;
+  return result;
+}
+
+QJsonObject DataJson(size_t nodes, size_t ways, size_t areas, size_t routes)
+{
+  QJsonObject result;
+  result["nodes"] = double(nodes);
+  result["ways"] = double(ways);
+  result["areas"] = double(areas);
+  result["routes"] = double(routes);
+  return result;
+}
+
+QJsonObject TileJson(const TileStats &tile, const Arguments &args)
+{
+  QJsonObject result;
+  result["x"] = double(tile.x);
+  result["y"] = double(tile.y);
+  result["db"] = TimeJson(tile.dbMinTime, tile.dbMaxTime, tile.dbTotalTime, args.loadRepeat);
+  result["draw"] = TimeJson(tile.drawMinTime, tile.drawMaxTime, tile.drawTotalTime, args.drawRepeat);
+#if defined(HAVE_MALLINFO) || defined(HAVE_MALLINFO2) || defined(HAVE_LIB_GPERFTOOLS)
+  result["memory"] = QJsonObject{{"max", tile.allocMax}};
+#endif
+  result["allocations"] = QJsonObject{{"avg", double(tile.allocationCount)},
+                                      {"avgBytes", double(tile.allocatedBytes)}};
+  result["data"] = DataJson(tile.nodeCount, tile.wayCount, tile.areaCount, tile.routeCount);
+  return result;
+}
+
+QJsonObject LevelJson(const LevelStats &stats, const Arguments &args)
+{
+  QJsonObject result;
+  result["level"] = double(stats.level);
+  result["tileCount"] = double(stats.tileCount);
+  result["db"] = TimeJson(stats.dbMinTime, stats.dbMaxTime, stats.dbTotalTime, stats.tileCount * args.loadRepeat);
+  result["draw"] = TimeJson(stats.drawMinTime, stats.drawMaxTime, stats.drawTotalTime, stats.tileCount * args.drawRepeat);
+#if defined(HAVE_MALLINFO) || defined(HAVE_MALLINFO2) || defined(HAVE_LIB_GPERFTOOLS)
+  size_t loads = stats.tileCount * args.loadRepeat;
+  result["memory"] = QJsonObject{{"max", stats.allocMax},
+                                 {"avg", loads > 0 ? stats.allocSum / double(loads) : 0.0}};
+#endif
+  double tiles = std::max(double(stats.tileCount), 1.0);
+  result["allocations"] = QJsonObject{{"avg", double(stats.allocationCount) / tiles},
+                                      {"avgBytes", double(stats.allocatedBytes) / tiles},
+                                      {"arenaChunks", double(stats.arenaChunks)},
+                                      {"retainedChunks", double(stats.retainedChunks)}};
+  result["data"] = DataJson(stats.nodeCount, stats.wayCount, stats.areaCount, stats.routeCount);
+
+  QJsonArray tileArray;
+  for (const auto &tile: stats.tiles) {
+    tileArray.append(TileJson(tile, args));
+  }
+  result["tiles"] = tileArray;
+  return result;
+}
+
+QJsonDocument ResultJson(const Arguments &args, const std::list<LevelStats> &statistics)
+{
+  QJsonObject result;
+  result["driver"] = QString::fromStdString(args.driver);
+  result["allocator"] = QString::fromStdString(args.allocator);
+  result["tileWidth"] = double(args.TileWidth());
+  result["tileHeight"] = double(args.TileHeight());
+  result["dpi"] = args.dpi;
+  result["loadRepeat"] = double(args.loadRepeat);
+  result["drawRepeat"] = double(args.drawRepeat);
+
+  QJsonArray levels;
+  for (const auto &stats: statistics) {
+    levels.append(LevelJson(stats, args));
+  }
+  result["levels"] = levels;
+  return QJsonDocument(result);
+}
+
+/**
+ * One row per level and per tile. Level rows contain total data counts
+ * and averages of allocations per tile, x and y columns are empty.
+ */
+void WriteCsv(std::ostream &out, const QJsonDocument &result)
+{
+  auto writeRow = [&out](const char *record, double level, const QJsonObject &obj) {
+    out << record << "," << level << ",";
+    if (obj.contains("x")) {
+      out << obj["x"].toDouble() << "," << obj["y"].toDouble() << ",1,";
+    } else {
+      out << ",," << obj["tileCount"].toDouble() << ",";
+    }
+    for (const char *key: {"db", "draw"}) {
+      const QJsonObject time = obj[key].toObject();
+      for (const char *field: {"min", "avg", "max", "total"}) {
+        out << time[field].toDouble() << ",";
+      }
+    }
+    if (obj.contains("memory")) {
+      out << obj["memory"].toObject().value("max").toDouble();
+    }
+    const QJsonObject allocations = obj["allocations"].toObject();
+    out << "," << allocations["avg"].toDouble() << "," << allocations["avgBytes"].toDouble();
+    const QJsonObject data = obj["data"].toObject();
+    for (const char *field: {"nodes", "ways", "areas", "routes"}) {
+      out << "," << data[field].toDouble();
+    }
+    out << std::endl;
+  };
+
+  out << std::setprecision(10);
+  out << "record,level,x,y,tiles,"
+      << "db_min,db_avg,db_max,db_total,"
+      << "draw_min,draw_avg,draw_max,draw_total,"
+      << "memory_max,allocations_avg,allocated_bytes_avg,"
+      << "nodes,ways,areas,routes" << std::endl;
+  for (const auto &levelValue: result.object().value("levels").toArray()) {
+    const QJsonObject level = levelValue.toObject();
+    double levelNumber = level["level"].toDouble();
+    writeRow("level", levelNumber, level);
+    for (const auto &tile: level["tiles"].toArray()) {
+      writeRow("tile", levelNumber, tile.toObject());
+    }
+  }
+}
+
+/**
+ * Compare per-level averages with baseline created by previous run with json output.
+ * @return 0 when there is no regression bigger than threshold (%), 2 on regression,
+ * 1 when baseline cannot be loaded
+ */
+int CompareWithBaseline(const QJsonDocument &result, const std::string &baselineFile, double threshold)
+{
+  QFile file(QString::fromStdString(baselineFile));
+  if (!file.open(QIODevice::ReadOnly)) {
+    std::cerr << "Cannot open baseline " << baselineFile << std::endl;
+    return 1;
+  }
+  QJsonParseError parseError;
+  QJsonDocument baseline = QJsonDocument::fromJson(file.readAll(), &parseError);
+  if (baseline.isNull()) {
+    std::cerr << "Cannot parse baseline " << baselineFile << ": " << parseError.errorString().toStdString() << std::endl;
+    return 1;
+  }
+
+  for (const char *key: {"driver", "allocator", "tileWidth", "tileHeight", "dpi"}) {
+    if (baseline.object().value(key) != result.object().value(key)) {
+      std::cout << "Warning: baseline " << key << " differs" << std::endl;
+    }
+  }
+
+  std::map<int, QJsonObject> baselineLevels;
+  for (const auto &level: baseline.object().value("levels").toArray()) {
+    baselineLevels[level.toObject().value("level").toInt()] = level.toObject();
+  }
+
+  std::cout << "==========" << std::endl;
+  std::cout << "Baseline " << baselineFile << ", threshold " << threshold << "%" << std::endl;
+
+  int regressions = 0;
+  for (const auto &levelValue: result.object().value("levels").toArray()) {
+    const QJsonObject level = levelValue.toObject();
+    auto it = baselineLevels.find(level["level"].toInt());
+    if (it == baselineLevels.end() || level["tileCount"].toDouble() == 0) {
+      continue;
+    }
+    for (const auto &[metric, field]: std::vector<std::pair<const char*, const char*>>{
+           {"db", "avg"}, {"draw", "avg"}, {"allocations", "avg"}}) {
+      double value = level[metric].toObject().value(field).toDouble();
+      double baselineValue = it->second.value(metric).toObject().value(field).toDouble();
+      if (baselineValue <= 0) {
+        continue;
+      }
+      double change = (value - baselineValue) / baselineValue * 100;
+      bool regression = change > threshold;
+      if (regression) {
+        regressions++;
+      }
+      std::cout << "Level " << level["level"].toInt() << " " << metric << " " << field << ": "
+                << value << " baseline: " << baselineValue << " ("
+                << std::showpos << std::setprecision(3) << change << std::noshowpos << std::setprecision(6) << "%)"
+                << (regression ? " REGRESSION" : "") << std::endl;
+    }
+  }
+
+  if (regressions > 0) {
+    std::cout << regressions << " regression(s) over threshold" << std::endl;
+    return 2;
+  }
+  return 0;
+}
+
 class PerformanceTestBackend {
 public:
   virtual ~PerformanceTestBackend() = default;
@@ -532,6 +785,39 @@ int main(int argc, char* argv[])
                       " (It work just on Linux with admin rights.)",
                       false);
 
+  argParser.AddOption(osmscout::CmdLineStringOption([&args](const std::string& value) {
+                        args.allocator = value;
+                      }),
+                      "allocator",
+                      "Allocator used for tile load and draw (arena|system|tcmalloc), default: " + args.allocator,
+                      false);
+
+  argParser.AddOption(osmscout::CmdLineStringOption([&args](const std::string& value) {
+                        args.output = value;
+                      }),
+                      "output",
+                      "Result format (text|json|csv), default: " + args.output,
+                      false);
+  argParser.AddOption(osmscout::CmdLineStringOption([&args](const std::string& value) {
+                        args.outputFile = value;
+                      }),
+                      "output-file",
+                      "File for json or csv result, human readable output goes to stderr when it is stdout, default: " +
+                      args.outputFile + " (stdout)",
+                      false);
+  argParser.AddOption(osmscout::CmdLineStringOption([&args](const std::string& value) {
+                        args.baseline = value;
+                      }),
+                      "baseline",
+                      "Json result of previous run, exit code is 2 when average time or allocations per level are worse",
+                      false);
+  argParser.AddOption(osmscout::CmdLineDoubleOption([&args](const double& value) {
+                        args.baselineThreshold = value;
+                      }),
+                      "baseline-threshold",
+                      "Regression threshold in percent, default: " + std::to_string(args.baselineThreshold),
+                      false);
+
   argParser.AddOption(osmscout::CmdLineUIntOption([&databaseParameter](const unsigned int& value) {
                         databaseParameter.SetNodeDataCacheSize(value);
                       }),
@@ -611,6 +897,37 @@ int main(int argc, char* argv[])
     return 0;
   }
 
+  TileAllocator::Type allocatorType;
+  if (!TileAllocator::parseType(args.allocator, allocatorType)) {
+    std::cerr << "Unsupported allocator '" << args.allocator << "'" << std::endl;
+    return 1;
+  }
+  if (!TileAllocator::isAvailable(allocatorType)) {
+    std::cerr << "Allocator '" << args.allocator << "' is not enabled" << std::endl;
+    return 1;
+  }
+
+  if (args.output != "text" && args.output != "json" && args.output != "csv") {
+    std::cerr << "Unsupported output '" << args.output << "'" << std::endl;
+    return 1;
+  }
+
+  // machine readable result should not be mixed with progress
+  std::streambuf *stdoutBuffer = std::cout.rdbuf();
+  std::ofstream outputFileStream;
+  if (args.output != "text") {
+    if (args.outputFile == "-") {
+      std::cout.rdbuf(std::cerr.rdbuf());
+    } else {
+      outputFileStream.open(args.outputFile);
+      if (!outputFileStream) {
+        std::cerr << "Cannot open output file " << args.outputFile << std::endl;
+        return 1;
+      }
+    }
+  }
+  std::ostream resultOutput(args.outputFile == "-" ? stdoutBuffer : outputFileStream.rdbuf());
+
   osmscout::log.Debug(args.debug);
 
   osmscout::DatabaseRef       database=std::make_shared<osmscout::Database>(databaseParameter);
@@ -633,6 +950,9 @@ int main(int argc, char* argv[])
     return 1;
   }
 
+  std::cout << "Using allocator '" << TileAllocator::typeName(allocatorType) << "'..." << std::endl;
+  TileAllocator::setType(allocatorType);
+
 #if defined(HAVE_LIB_GPERFTOOLS)
   if (args.heapProfile){
     HeapProfilerStart(args.heapProfilePrefix.c_str());
@@ -675,8 +995,14 @@ int main(int argc, char* argv[])
       delta=1;
     }
 
+    // tile records are appended inside the tile allocator scope, they must not allocate there
+    stats.tiles.reserve(tileCount);
+
     for (const auto& tile : tileArea) {
+      // load-and-draw cycle of one tile, data are released before the scope is closed
+      TileAllocatorScope      allocatorScope;
       osmscout::MapData       data;
+      TileStats               tileStats(tile.GetX(), tile.GetY());
       osmscout::OSMTileIdBox  tileBox(osmscout::OSMTileId(tile.GetX()-1,tile.GetY()-1),
                                       osmscout::OSMTileId(tile.GetX()+1,tile.GetY()+1));
       osmscout::GeoBox        boundingBox;
@@ -740,6 +1066,7 @@ int main(int argc, char* argv[])
 #if defined(HAVE_MALLINFO) || defined(HAVE_MALLINFO2) || defined(HAVE_LIB_GPERFTOOLS)
         std::cout << "memory usage: " << formatAlloc(alloc_info.uordblks) << std::endl;
         stats.allocMax = std::max(stats.allocMax, (double) alloc_info.uordblks);
+        tileStats.allocMax = std::max(tileStats.allocMax, (double) alloc_info.uordblks);
         stats.allocSum = stats.allocSum + (double) alloc_info.uordblks;
 #endif
 
@@ -753,6 +1080,10 @@ int main(int argc, char* argv[])
         stats.dbMaxTime = std::max(stats.dbMaxTime, dbTime);
         stats.dbTotalTime += dbTime;
 
+        tileStats.dbMinTime = std::min(tileStats.dbMinTime, dbTime);
+        tileStats.dbMaxTime = std::max(tileStats.dbMaxTime, dbTime);
+        tileStats.dbTotalTime += dbTime;
+
         if (args.flushCache) {
           tiles.clear(); // following flush method removes only tiles with use_count() == 1
           mapService->FlushTileCache();
@@ -786,6 +1117,11 @@ int main(int argc, char* argv[])
       stats.areaCount+=data.areas.size();
       stats.routeCount+=data.routes.size();
 
+      tileStats.nodeCount=data.nodes.size();
+      tileStats.wayCount=data.ways.size();
+      tileStats.areaCount=data.areas.size();
+      tileStats.routeCount=data.routes.size();
+
       stats.tileCount++;
       for (size_t i=0; i<args.drawRepeat; i++) {
         osmscout::StopClock drawTimer;
@@ -797,11 +1133,24 @@ int main(int argc, char* argv[])
         stats.drawMinTime = std::min(stats.drawMinTime, drawTime);
         stats.drawMaxTime = std::max(stats.drawMaxTime, drawTime);
         stats.drawTotalTime += drawTime;
+
+        tileStats.drawMinTime = std::min(tileStats.drawMinTime, drawTime);
+        tileStats.drawMaxTime = std::max(tileStats.drawMaxTime, drawTime);
+        tileStats.drawTotalTime += drawTime;
       }
 
+      TileAllocator::Statistics allocatorStats = TileAllocator::statistics();
+      stats.allocationCount += allocatorStats.allocations;
+      stats.allocatedBytes += allocatorStats.allocated;
+      stats.arenaChunks += allocatorStats.chunks;
+      tileStats.allocationCount = allocatorStats.allocations;
+      tileStats.allocatedBytes = allocatorStats.allocated;
+      stats.tiles.push_back(tileStats);
+
       current++;
     }
 
+    stats.retainedChunks = TileAllocator::statistics().retainedChunks;
     statistics.push_back(stats);
   }
 
@@ -823,6 +1172,17 @@ int main(int argc, char* argv[])
     std::cout << "avg: " << formatAlloc(stats.allocSum / (stats.tileCount * args.loadRepeat)) << std::endl;
 #endif
 
+    if (stats.tileCount > 0) {
+      std::cout << " Allocations: ";
+      std::cout << "avg: " << stats.allocationCount / stats.tileCount << " ";
+      std::cout << "avg size: " << formatAlloc(double(stats.allocatedBytes) / stats.tileCount);
+      if (allocatorType == TileAllocator::Type::Arena) {
+        std::cout << " arena chunks avg: " << double(stats.arenaChunks) / stats.tileCount << " ";
+        std::cout << "retained: " << stats.retainedChunks << " (" << formatAlloc(double(stats.retainedChunks * TileAllocator::ChunkSize)) << ")";
+      }
+      std::cout << std::endl;
+    }
+
     std::cout << " Tot. data  : ";
     std::cout << "nodes: " << stats.nodeCount << " ";
     std::cout << "way: " << stats.wayCount << " ";
@@ -856,7 +1216,19 @@ int main(int argc, char* argv[])
     }
   }
 
+  QJsonDocument result = ResultJson(args, statistics);
+  if (args.output == "json") {
+    resultOutput << result.toJson().toStdString();
+  } else if (args.output == "csv") {
+    WriteCsv(resultOutput, result);
+  }
+  resultOutput.flush();
+
   database->Close();
 
+  if (!args.baseline.empty()) {
+    return CompareWithBaseline(result, args.baseline, args.baselineThreshold);
+  }
+
   return 0;
 }
@@ -10,6 +10,9 @@
 /* Define to 1 if you have the `mallinfo2' function. */
 #cmakedefine HAVE_MALLINFO2 1
 
+/* Define to 1 if PerformanceTest is linked with gperftools tcmalloc. */
+#cmakedefine HAVE_LIB_GPERFTOOLS 1
+
 /* Define to 1 if you have the `mmap' function. */
 #cmakedefine HAVE_MMAP 1
 
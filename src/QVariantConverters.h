@@ -139,6 +139,20 @@ inline std::optional<osmscout::Timestamp> varLongToOptTimestamp(const QVariant &
   return std::nullopt;
 }
 
+inline std::optional<osmscout::Timestamp> varMillisToOptTimestamp(const QVariant &var)
+{
+  if (!var.isNull() &&
+      var.isValid() &&
+      var.canConvert(QMetaType::LongLong)) {
+
+    auto duration = std::chrono::milliseconds(varToLong(var));
+    static_assert(std::is_same<osmscout::Timestamp::clock, std::chrono::system_clock>::value, "Timestamp clock have use unix epoch");
+    return osmscout::Timestamp(duration);
+  }
+
+  return std::nullopt;
+}
+
 inline osmscout::Timestamp dateTimeToTimestamp(const QDateTime &datetime)
 {
   int64_t millis = datetime.toMSecsSinceEpoch();
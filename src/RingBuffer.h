@@ -0,0 +1,121 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2026 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Fixed capacity FIFO. Storage is allocated once, when buffer is full,
+ * push_back overrides the oldest element.
+ *
+ * It is not thread safe.
+ */
+template<typename T>
+class RingBuffer
+{
+public:
+  explicit RingBuffer(size_t capacity):
+    storage(capacity)
+  {
+    assert(capacity > 0);
+  }
+
+  size_t capacity() const
+  {
+    return storage.size();
+  }
+
+  size_t size() const
+  {
+    return count;
+  }
+
+  bool empty() const
+  {
+    return count == 0;
+  }
+
+  bool full() const
+  {
+    return count == storage.size();
+  }
+
+  void push_back(const T &value)
+  {
+    storage[slot(count)] = value;
+    if (full()) {
+      first = slot(1);
+    } else {
+      count++;
+    }
+  }
+
+  void pop_front()
+  {
+    assert(!empty());
+    first = slot(1);
+    count--;
+  }
+
+  void clear()
+  {
+    first = 0;
+    count = 0;
+  }
+
+  /**
+   * Element on position i, 0 is the oldest one.
+   */
+  const T& operator[](size_t i) const
+  {
+    assert(i < count);
+    return storage[slot(i)];
+  }
+
+  T& operator[](size_t i)
+  {
+    assert(i < count);
+    return storage[slot(i)];
+  }
+
+  const T& front() const
+  {
+    return (*this)[0];
+  }
+
+  const T& back() const
+  {
+    return (*this)[count - 1];
+  }
+
+private:
+  // index to storage, i <= capacity; it avoids division in the hot path
+  size_t slot(size_t i) const
+  {
+    size_t result = first + i;
+    return result >= storage.size() ? result - storage.size() : result;
+  }
+
+private:
+  std::vector<T> storage;
+  size_t first{0};
+  size_t count{0};
+};
@@ -0,0 +1,114 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2026 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Lock-free, bounded, single-producer / single-consumer queue.
+ *
+ * Slots are allocated in constructor, push and pop just copy the value.
+ * push may be called from one thread only (producer), pop from another
+ * one (consumer). Capacity is rounded up to power of two.
+ */
+template<typename T>
+class SpscQueue
+{
+public:
+  explicit SpscQueue(size_t requestedCapacity):
+    slots(roundUpToPowerOfTwo(requestedCapacity)),
+    mask(slots.size() - 1)
+  {
+  }
+
+  SpscQueue(const SpscQueue&) = delete;
+  SpscQueue& operator=(const SpscQueue&) = delete;
+
+  size_t capacity() const
+  {
+    return slots.size();
+  }
+
+  /**
+   * Producer side.
+   * @return false when queue is full, value is not inserted
+   */
+  bool push(const T &value)
+  {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t - cachedHead == slots.size()) {
+      cachedHead = head.load(std::memory_order_acquire);
+      if (t - cachedHead == slots.size()) {
+        return false;
+      }
+    }
+    slots[t & mask] = value;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Consumer side.
+   * @return false when queue is empty
+   */
+  bool pop(T &value)
+  {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h == cachedTail) {
+      cachedTail = tail.load(std::memory_order_acquire);
+      if (h == cachedTail) {
+        return false;
+      }
+    }
+    value = slots[h & mask];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Approximate count of queued values, it may be changed by other thread meanwhile.
+   */
+  size_t size() const
+  {
+    return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+  }
+
+private:
+  static size_t roundUpToPowerOfTwo(size_t n)
+  {
+    size_t result = 1;
+    while (result < n) {
+      result <<= 1;
+    }
+    return result;
+  }
+
+private:
+  std::vector<T> slots;
+  const size_t mask;
+
+  // indexes grow monotonically, slot is index & mask
+  alignas(64) std::atomic<size_t> head{0}; // written by consumer
+  size_t cachedTail{0}; // consumer's copy of tail
+  alignas(64) std::atomic<size_t> tail{0}; // written by producer
+  size_t cachedHead{0}; // producer's copy of head
+};
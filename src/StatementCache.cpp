@@ -0,0 +1,118 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2026 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "StatementCache.h"
+
+#include <QtSql/QSqlError>
+#include <QDebug>
+
+#include <algorithm>
+
+StatementCache::Statement::Statement(QSqlQuery *query, bool *inUse):
+  query(query), inUse(inUse)
+{
+  *inUse = true;
+}
+
+StatementCache::Statement::Statement(std::unique_ptr<QSqlQuery> query):
+  owned(std::move(query)), query(owned.get()), inUse(nullptr)
+{
+}
+
+StatementCache::Statement::~Statement()
+{
+  // release the result set, sqlite statement is reset, but keeps compiled program
+  query->finish();
+  if (inUse != nullptr) {
+    *inUse = false;
+  }
+}
+
+StatementCache::StatementCache(int capacity):
+  capacity(capacity)
+{
+}
+
+StatementCache::Statement StatementCache::prepare(const QSqlDatabase &db, const QString &sql)
+{
+  auto prepareUncached = [&]() {
+    uncached++;
+    auto query = std::make_unique<QSqlQuery>(db);
+    query->prepare(sql);
+    return query;
+  };
+
+  if (thread == nullptr) {
+    thread = QThread::currentThread();
+  } else if (thread != QThread::currentThread()) {
+    qWarning() << "Statement cache used from incorrect thread;" << thread << "!=" << QThread::currentThread();
+    return Statement(prepareUncached());
+  }
+
+  auto it = entries.find(sql);
+  if (it != entries.end()) {
+    std::shared_ptr<Entry> entry = it.value();
+    if (entry->inUse) {
+      return Statement(prepareUncached());
+    }
+    entry->reuseCount++;
+    return Statement(entry->query.get(), &entry->inUse);
+  }
+
+  if (entries.size() >= capacity) {
+    return Statement(prepareUncached());
+  }
+
+  auto query = std::make_unique<QSqlQuery>(db);
+  // client side result cache is not necessary, results are iterated once
+  query->setForwardOnly(true);
+  if (!query->prepare(sql)) {
+    // don't cache invalid statement, caller will see the error after exec
+    uncached++;
+    return Statement(std::move(query));
+  }
+  auto entry = std::make_shared<Entry>();
+  entry->query = std::move(query);
+  entries.insert(sql, entry);
+  return Statement(entry->query.get(), &entry->inUse);
+}
+
+void StatementCache::clear()
+{
+  for (const auto &entry: entries) {
+    if (entry->inUse) {
+      qWarning() << "Clearing statement that is in use:" << entry->query->lastQuery();
+    }
+  }
+  entries.clear();
+  thread = nullptr;
+}
+
+std::vector<StatementCache::Stats> StatementCache::stats() const
+{
+  std::vector<Stats> result;
+  result.reserve(entries.size());
+  for (auto it = entries.begin(); it != entries.end(); ++it) {
+    result.push_back(Stats{it.key(), it.value()->reuseCount});
+  }
+  std::sort(result.begin(), result.end(), [](const Stats &a, const Stats &b) {
+    return a.reuseCount > b.reuseCount;
+  });
+  return result;
+}
@@ -0,0 +1,123 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2026 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+#include <QString>
+#include <QHash>
+#include <QThread>
+
+#include <memory>
+#include <vector>
+
+/**
+ * Cache of prepared sql statements, keyed by sql text.
+ *
+ * Statement is prepared (parsed and planned by sqlite) on the first usage only,
+ * following usages just bind new values. Cache is not thread safe, it has to be used
+ * from the thread that owns the database connection. It must be cleared before
+ * the connection is closed.
+ */
+class StatementCache
+{
+public:
+  /**
+   * Prepared query borrowed from the cache. Query is finished when statement
+   * goes out of scope, so it don't hold read transaction and may be reused.
+   *
+   * When the same sql is requested while its cached query is still in use
+   * (recursive usage), or when cache is full, statement owns its own query
+   * that is prepared as usual.
+   */
+  class Statement
+  {
+  public:
+    Statement(QSqlQuery *query, bool *inUse);
+    explicit Statement(std::unique_ptr<QSqlQuery> query);
+    Statement(const Statement&) = delete;
+    Statement(Statement&&) = delete;
+    ~Statement();
+
+    Statement& operator=(const Statement&) = delete;
+    Statement& operator=(Statement&&) = delete;
+
+    QSqlQuery& operator*() const
+    {
+      return *query;
+    }
+
+    QSqlQuery* operator->() const
+    {
+      return query;
+    }
+
+  private:
+    std::unique_ptr<QSqlQuery> owned;
+    QSqlQuery *query;
+    bool *inUse;
+  };
+
+  struct Stats
+  {
+    QString sql;
+    quint64 reuseCount;
+  };
+
+public:
+  explicit StatementCache(int capacity = 64);
+  StatementCache(const StatementCache&) = delete;
+  StatementCache& operator=(const StatementCache&) = delete;
+
+  /**
+   * Prepared query for given sql. Caller binds values and executes it.
+   */
+  Statement prepare(const QSqlDatabase &db, const QString &sql);
+
+  /**
+   * Remove all cached statements. None of them may be in use.
+   */
+  void clear();
+
+  /**
+   * Reuse counts of cached statements, sorted from the most used.
+   */
+  std::vector<Stats> stats() const;
+
+  /**
+   * Count of statements that were not served from the cache.
+   */
+  quint64 uncachedCount() const
+  {
+    return uncached;
+  }
+
+private:
+  struct Entry
+  {
+    std::unique_ptr<QSqlQuery> query;
+    bool inUse{false};
+    quint64 reuseCount{0};
+  };
+
+  int capacity;
+  QThread *thread{nullptr};
+  QHash<QString, std::shared_ptr<Entry>> entries;
+  quint64 uncached{0};
+};
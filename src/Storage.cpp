@@ -19,6 +19,10 @@
 
 #include "Storage.h"
 #include "QVariantConverters.h"
+#include "TrackPointBlob.h"
+#include "TrackLod.h"
+#include "TrackJournal.h"
+#include "MemoryAccounting.h"
 
 #include <osmscoutclientqt/OSMScoutQt.h>
 #include <osmscoutgpx/GpxFile.h>
@@ -27,19 +31,54 @@
 
 #include <QDebug>
 #include <QThread>
+#include <QWaitCondition>
 #include <QtSql/QSqlQuery>
 #include <QtSql/QSqlRecord>
+#include <QtSql/QSqlDriver>
+
+#include <sqlite3.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <algorithm>
+#include <memory>
 
 namespace {
-  static constexpr int DbSchema = 3;
-  static constexpr int TrackPointBatchSize = 10000;
-  static constexpr int WayPointBatchSize = 100;
+  static constexpr int DbSchema = 9;
+  static constexpr size_t WaypointInsertRows = 64; // rows per multi-row insert, 10 parameters per row, sqlite limit is 999
+  static constexpr size_t TrackDataChunkSize = 10000; // points per stored blob chunk, track data are streamed by these chunks
+  static constexpr qint64 CheckpointInterval = 5 * 60 * 1000; // ms, minimal interval of wal checkpoints on going to background
 
   double durationSeconds(const osmscout::Timestamp::duration &d)
   {
     using namespace std::chrono;
     return duration_cast<duration<double,std::ratio<1,1>>>(d).count();
   }
+
+  // approximate memory held by emitted results, see MemoryAccounting
+  template<typename T>
+  size_t vectorBytes(const std::vector<T> &values)
+  {
+    return values.capacity() * sizeof(T);
+  }
+
+  template<typename T>
+  size_t vectorBytes(const std::vector<std::vector<T>> &values)
+  {
+    size_t bytes = values.capacity() * sizeof(std::vector<T>);
+    for (const auto &v: values) {
+      bytes += vectorBytes(v);
+    }
+    return bytes;
+  }
+
+  template<typename T>
+  std::shared_ptr<T> accountResult(std::shared_ptr<T> ptr, size_t bytes)
+  {
+    return MemoryAccounting::account(MemoryAccounting::Counter::StorageResults, std::move(ptr), bytes);
+  }
 }
 
 using namespace osmscout;
@@ -53,10 +92,141 @@ void ErrorCallback::Error(const std::string &err)
   emit error(QString::fromStdString(err));
 }
 
+namespace {
+/**
+ * Serialisation of accumulator state. State is stored just locally, with the open track segment,
+ * so it don't need to be portable between application versions - unknown version is ignored
+ * and accumulator is restored from track statistics then.
+ */
+static constexpr quint8 AccumulatorStateVersion = 2;
+
+void serializeValue(QDataStream &out, double value)
+{
+  out << value;
+}
+
+void serializeValue(QDataStream &out, const Distance &distance)
+{
+  out << distance.AsMeter();
+}
+
+void serializeValue(QDataStream &out, const Timestamp::duration &duration)
+{
+  out << qint64(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+}
+
+void serializeValue(QDataStream &out, const Timestamp &timestamp)
+{
+  serializeValue(out, timestamp.time_since_epoch());
+}
+
+void serializeValue(QDataStream &out, const GeoCoord &coord)
+{
+  out << coord.GetLat() << coord.GetLon();
+}
+
+void serializeValue(QDataStream &out, const gpx::TrackPoint &point);
+
+template<typename T>
+void serializeValue(QDataStream &out, const std::optional<T> &value)
+{
+  out << value.has_value();
+  if (value) {
+    serializeValue(out, *value);
+  }
+}
+
+void serializeValue(QDataStream &out, const gpx::TrackPoint &point)
+{
+  // just properties used by accumulator
+  serializeValue(out, point.coord);
+  serializeValue(out, point.timestamp);
+  serializeValue(out, point.elevation);
+  serializeValue(out, point.hdop);
+  serializeValue(out, point.vdop);
+  serializeValue(out, point.pdop);
+}
+
+void deserializeValue(QDataStream &in, double &value)
+{
+  in >> value;
+}
+
+void deserializeValue(QDataStream &in, Distance &distance)
+{
+  double meters = 0;
+  in >> meters;
+  distance = Meters(meters);
+}
+
+void deserializeValue(QDataStream &in, Timestamp::duration &duration)
+{
+  qint64 nanoseconds = 0;
+  in >> nanoseconds;
+  duration = std::chrono::duration_cast<Timestamp::duration>(std::chrono::nanoseconds(nanoseconds));
+}
+
+void deserializeValue(QDataStream &in, Timestamp &timestamp)
+{
+  Timestamp::duration sinceEpoch;
+  deserializeValue(in, sinceEpoch);
+  timestamp = Timestamp(sinceEpoch);
+}
+
+void deserializeValue(QDataStream &in, GeoCoord &coord)
+{
+  double lat = 0;
+  double lon = 0;
+  in >> lat >> lon;
+  coord.Set(lat, lon);
+}
+
+void deserializeValue(QDataStream &in, gpx::TrackPoint &point);
+
+template<typename T>
+void deserializeValue(QDataStream &in, std::optional<T> &value)
+{
+  bool hasValue = false;
+  in >> hasValue;
+  if (hasValue) {
+    T v{};
+    deserializeValue(in, v);
+    value = std::move(v);
+  } else {
+    value = std::nullopt;
+  }
+}
+
+// track point is not default constructible
+void deserializeValue(QDataStream &in, std::optional<gpx::TrackPoint> &value)
+{
+  bool hasValue = false;
+  in >> hasValue;
+  if (hasValue) {
+    gpx::TrackPoint point{GeoCoord()};
+    deserializeValue(in, point);
+    value = std::move(point);
+  } else {
+    value = std::nullopt;
+  }
+}
+
+void deserializeValue(QDataStream &in, gpx::TrackPoint &point)
+{
+  deserializeValue(in, point.coord);
+  deserializeValue(in, point.timestamp);
+  deserializeValue(in, point.elevation);
+  deserializeValue(in, point.hdop);
+  deserializeValue(in, point.vdop);
+  deserializeValue(in, point.pdop);
+}
+}
+
 void MaxSpeedBuffer::flush()
 {
-  lastPoint.reset();
-  bufferTime.zero();
+  lastCoord.reset();
+  fifo.clear();
+  bufferTime = Timestamp::duration::zero();
   bufferDistance = Distance::Of<Meter>(0);
 }
 
@@ -65,28 +235,34 @@ void MaxSpeedBuffer::insert(const gpx::TrackPoint &p)
   if (!p.timestamp){
     return;
   }
-  if (lastPoint){
-    Timestamp::duration timeDiff = *(p.timestamp) - *(lastPoint->timestamp);
+  if (lastCoord){
+    Timestamp::duration timeDiff = *(p.timestamp) - lastTimestamp;
     if (timeDiff.count() < 0){
       qWarning() << "Traveling in time is not supported";
       return;
     }
-    Distance distanceDiff = GetEllipsoidalDistance(lastPoint->coord, p.coord);
-    distanceFifo.push_back(distanceDiff);
-    timeFifo.push_back(timeDiff);
+    Distance distanceDiff = GetEllipsoidalDistance(*lastCoord, p.coord);
+    if (fifo.full()) {
+      // merge two oldest steps, buffer sums are not changed
+      Step oldest = fifo.front();
+      fifo.pop_front();
+      fifo[0].distance += oldest.distance;
+      fifo[0].time += oldest.time;
+    }
+    fifo.push_back(Step{distanceDiff, timeDiff});
     bufferDistance += distanceDiff;
     bufferTime += timeDiff;
 
-    while (bufferTime > std::chrono::seconds(5) && !distanceFifo.empty()){
+    while (bufferTime > std::chrono::seconds(5) && !fifo.empty()){
       double speed = bufferDistance.AsMeter() / durationSeconds(bufferTime);
       maxSpeed = std::max(maxSpeed, speed);
-      bufferDistance = bufferDistance - distanceFifo.front(); // it can be inaccurate!
-      bufferTime -= timeFifo.front();
-      distanceFifo.pop_front();
-      timeFifo.pop_front();
+      bufferDistance = bufferDistance - fifo.front().distance; // it can be inaccurate!
+      bufferTime -= fifo.front().time;
+      fifo.pop_front();
     }
   }
-  lastPoint=std::make_shared<osmscout::gpx::TrackPoint>(p);
+  lastCoord = p.coord;
+  lastTimestamp = *(p.timestamp);
 }
 
 double MaxSpeedBuffer::getMaxSpeed() const
@@ -99,6 +275,42 @@ void MaxSpeedBuffer::setMaxSpeed(double speed)
   maxSpeed=speed;
 }
 
+void MaxSpeedBuffer::serializeState(QDataStream &out) const
+{
+  out << quint32(fifo.size());
+  for (size_t i = 0; i < fifo.size(); i++) {
+    serializeValue(out, fifo[i].distance);
+    serializeValue(out, fifo[i].time);
+  }
+  serializeValue(out, bufferDistance);
+  serializeValue(out, bufferTime);
+  serializeValue(out, lastCoord);
+  serializeValue(out, lastTimestamp);
+  serializeValue(out, maxSpeed);
+}
+
+void MaxSpeedBuffer::deserializeState(QDataStream &in)
+{
+  quint32 size = 0;
+  in >> size;
+  fifo.clear();
+  if (size > fifo.capacity()) {
+    in.setStatus(QDataStream::ReadCorruptData);
+    return;
+  }
+  for (quint32 i = 0; i < size && in.status() == QDataStream::Ok; i++) {
+    Step step;
+    deserializeValue(in, step.distance);
+    deserializeValue(in, step.time);
+    fifo.push_back(step);
+  }
+  deserializeValue(in, bufferDistance);
+  deserializeValue(in, bufferTime);
+  deserializeValue(in, lastCoord);
+  deserializeValue(in, lastTimestamp);
+  deserializeValue(in, maxSpeed);
+}
+
 ElevationFilter::ElevationFilter(const std::optional<osmscout::Distance> &minElevation,
                                  const std::optional<osmscout::Distance> &maxElevation,
                                  const osmscout::Distance &ascent,
@@ -111,14 +323,67 @@ ElevationFilter::ElevationFilter(const std::optional<osmscout::Distance> &minEle
 
 void ElevationFilter::flush() {
   qDebug() << "flush buffer";
-  distanceFifo.clear();
-  elevationFifo.clear();
+  fifo.clear();
   bufferLength = Meters(0);
   bufferElevation = Meters(0);
   lastPoint = std::nullopt;
   lastEleStep = std::nullopt;
 }
 
+void ElevationFilter::merge(const ElevationFilter &following)
+{
+  if (following.minElevation) {
+    minElevation = minElevation ? std::min(*minElevation, *following.minElevation) : *following.minElevation;
+  }
+  if (following.maxElevation) {
+    maxElevation = maxElevation ? std::max(*maxElevation, *following.maxElevation) : *following.maxElevation;
+  }
+  ascent += following.ascent;
+  descent += following.descent;
+}
+
+void ElevationFilter::serializeState(QDataStream &out) const
+{
+  serializeValue(out, minElevation);
+  serializeValue(out, maxElevation);
+  serializeValue(out, ascent);
+  serializeValue(out, descent);
+  serializeValue(out, lastEleStep);
+  out << quint32(fifo.size());
+  for (size_t i = 0; i < fifo.size(); i++) {
+    serializeValue(out, fifo[i].distance);
+    serializeValue(out, fifo[i].elevation);
+  }
+  serializeValue(out, bufferLength);
+  serializeValue(out, bufferElevation);
+  serializeValue(out, lastPoint);
+}
+
+void ElevationFilter::deserializeState(QDataStream &in)
+{
+  deserializeValue(in, minElevation);
+  deserializeValue(in, maxElevation);
+  deserializeValue(in, ascent);
+  deserializeValue(in, descent);
+  deserializeValue(in, lastEleStep);
+  quint32 size = 0;
+  in >> size;
+  fifo.clear();
+  if (size > fifo.capacity()) {
+    in.setStatus(QDataStream::ReadCorruptData);
+    return;
+  }
+  for (quint32 i = 0; i < size && in.status() == QDataStream::Ok; i++) {
+    Sample sample;
+    deserializeValue(in, sample.distance);
+    deserializeValue(in, sample.elevation);
+    fifo.push_back(sample);
+  }
+  deserializeValue(in, bufferLength);
+  deserializeValue(in, bufferElevation);
+  deserializeValue(in, lastPoint);
+}
+
 std::optional<osmscout::Distance> ElevationFilter::update(const osmscout::gpx::TrackPoint &p) {
   using namespace std::chrono;
   if (!p.elevation || (p.vdop && *(p.vdop) >= 50.0) || (p.hdop && *(p.hdop) >= 30.0)) {
@@ -147,32 +412,29 @@ std::optional<osmscout::Distance> ElevationFilter::update(const osmscout::gpx::T
       flush();
     } else {
       // push buffer
-      distanceFifo.push_back(distanceDiff);
-      elevationFifo.push_back(currentEle);
+      fifo.push_back(Sample{distanceDiff, currentEle});
       bufferLength += distanceDiff;
       bufferElevation += currentEle;
     }
   }
-  if (distanceFifo.empty()) {
+  if (fifo.empty()) {
     // push initial point to buffer
-    distanceFifo.push_back(Meters(0));
-    elevationFifo.push_back(currentEle);
+    fifo.push_back(Sample{Meters(0), currentEle});
     bufferLength = Meters(0);
     bufferElevation = currentEle;
   }
 
   lastPoint = p;
 
-  if (!distanceFifo.empty() && (bufferLength > Meters(250) || distanceFifo.size() > 60)) {
+  if (!fifo.empty() && (bufferLength > Meters(250) || fifo.size() > WindowSize)) {
     // we have enough samples, or distance is significant
-    osmscout::Distance eleAvg = bufferElevation / distanceFifo.size();
+    osmscout::Distance eleAvg = bufferElevation / fifo.size();
     // qDebug() << "ele avg.:" << eleAvg.AsMeter() << "m";
 
     // pop buffer
-    bufferLength -= distanceFifo.front();
-    distanceFifo.pop_front();
-    bufferElevation -= elevationFifo.front();
-    elevationFifo.pop_front();
+    bufferLength -= fifo.front().distance;
+    bufferElevation -= fifo.front().elevation;
+    fifo.pop_front();
 
     // update statistics
     minElevation = minElevation ? std::min(eleAvg, *minElevation) : eleAvg;
@@ -248,6 +510,40 @@ QString sqlCreateTrack(){
   return sql;
 }
 
+/**
+ * Statistics of single segment, they may be merged to track statistics.
+ * Statistics are not computed when raw_distance is NULL,
+ * distance column contains filtered distance then.
+ */
+QString sqlTrackSegmentStatisticsColumns(){
+  QString sql;
+  sql.append(",").append( "`from_time` INTEGER NULL"); // milliseconds since epoch
+  sql.append(",").append( "`to_time` INTEGER NULL"); // milliseconds since epoch
+  sql.append(",").append( "`raw_distance` DOUBLE NULL");
+  sql.append(",").append( "`moving_duration` INTEGER NULL");
+  sql.append(",").append( "`max_speed` DOUBLE NULL");
+  sql.append(",").append( "`ascent` DOUBLE NULL");
+  sql.append(",").append( "`descent` DOUBLE NULL");
+  sql.append(",").append( "`min_elevation` DOUBLE NULL");
+  sql.append(",").append( "`max_elevation` DOUBLE NULL");
+  sql.append(",").append( "`bbox_min_lat` DOUBLE NULL");
+  sql.append(",").append( "`bbox_min_lon` DOUBLE NULL");
+  sql.append(",").append( "`bbox_max_lat` DOUBLE NULL");
+  sql.append(",").append( "`bbox_max_lon` DOUBLE NULL");
+  return sql;
+}
+
+QString sqlInsertTrackSegment(){
+  return QString("INSERT INTO `track_segment` (`track_id`, `open`, `creation_time`, `point_count`, `points`, ")
+    .append("`distance`, `from_time`, `to_time`, `raw_distance`, `moving_duration`, `max_speed`, ")
+    .append("`ascent`, `descent`, `min_elevation`, `max_elevation`, ")
+    .append("`bbox_min_lat`, `bbox_min_lon`, `bbox_max_lat`, `bbox_max_lon`) ")
+    .append("VALUES (:track_id, :open, :creation_time, :point_count, :points, ")
+    .append(":distance, :from_time, :to_time, :raw_distance, :moving_duration, :max_speed, ")
+    .append(":ascent, :descent, :min_elevation, :max_elevation, ")
+    .append(":bbox_min_lat, :bbox_min_lon, :bbox_max_lat, :bbox_max_lon)");
+}
+
 QString sqlCreateTrackSegment(){
   QString sql("CREATE TABLE `track_segment`");
   sql.append("(").append( "`id` INTEGER PRIMARY KEY");
@@ -255,10 +551,34 @@ QString sqlCreateTrackSegment(){
   sql.append(",").append( "`open` tinyint(1) NOT NULL");
   sql.append(",").append( "`creation_time` datetime NOT NULL");
   sql.append(",").append( "`distance` double NOT NULL");
+  sql.append(",").append( "`point_count` INTEGER NOT NULL DEFAULT 0");
+  sql.append(",").append( "`points` BLOB NULL"); // see TrackPointBlob
+  sql.append(sqlTrackSegmentStatisticsColumns());
+  sql.append(",").append( "`statistics_state` BLOB NULL"); // TrackStatisticsAccumulator state of open segment
+  sql.append(");");
+  return sql;
+}
+
+/**
+ * Points appended to the open segment during recording. Every batch is stored as new chunk,
+ * so appending don't rewrite the segment blob. Chunks are merged to the segment blob
+ * when the segment is closed, see Storage::compactSegmentChunks.
+ */
+QString sqlCreateTrackSegmentChunk(){
+  QString sql("CREATE TABLE `track_segment_chunk`");
+  sql.append("(").append( "`segment_id` INTEGER NOT NULL REFERENCES track_segment(id) ON DELETE CASCADE");
+  sql.append(",").append( "`chunk` INTEGER NOT NULL");
+  sql.append(",").append( "`point_count` INTEGER NOT NULL");
+  sql.append(",").append( "`points` BLOB NULL"); // see TrackPointBlob
+  sql.append(",").append( "PRIMARY KEY (`segment_id`, `chunk`)");
   sql.append(");");
   return sql;
 }
 
+/**
+ * Track points were stored in separate table till schema v3,
+ * it is used just for schema upgrade now.
+ */
 QString sqlCreateTrackPoint(){
   QString sql("CREATE TABLE `track_point`");
   sql.append("(").append( "`segment_id` INTEGER NOT NULL REFERENCES track_segment(id) ON DELETE CASCADE");
@@ -293,6 +613,62 @@ QString sqlCreateWaypoint(){
   return sql;
 }
 
+/**
+ * R*Tree index of waypoint coordinates, it is synchronized with waypoint table by triggers.
+ */
+QStringList sqlCreateWaypointRTree(){
+  QStringList sql;
+  sql << "CREATE VIRTUAL TABLE `waypoint_rtree` USING rtree(`id`, `min_lat`, `max_lat`, `min_lon`, `max_lon`);";
+  sql << "INSERT INTO `waypoint_rtree` SELECT `id`, `latitude`, `latitude`, `longitude`, `longitude` FROM `waypoint`;";
+  sql << QString("CREATE TRIGGER IF NOT EXISTS `waypoint_rtree_insert` AFTER INSERT ON `waypoint` BEGIN ")
+           .append("INSERT INTO `waypoint_rtree` VALUES (NEW.`id`, NEW.`latitude`, NEW.`latitude`, NEW.`longitude`, NEW.`longitude`); ")
+           .append("END;");
+  sql << QString("CREATE TRIGGER IF NOT EXISTS `waypoint_rtree_update` AFTER UPDATE OF `latitude`, `longitude` ON `waypoint` BEGIN ")
+           .append("UPDATE `waypoint_rtree` SET `min_lat` = NEW.`latitude`, `max_lat` = NEW.`latitude`, ")
+           .append("`min_lon` = NEW.`longitude`, `max_lon` = NEW.`longitude` WHERE `id` = NEW.`id`; ")
+           .append("END;");
+  sql << QString("CREATE TRIGGER IF NOT EXISTS `waypoint_rtree_delete` AFTER DELETE ON `waypoint` BEGIN ")
+           .append("DELETE FROM `waypoint_rtree` WHERE `id` = OLD.`id`; ")
+           .append("END;");
+  return sql;
+}
+
+/**
+ * Simplified track segment points, levels 1..TrackLod::LevelCount-1 of its level of detail pyramid.
+ * Missing levels are computed lazily, see Storage::loadTrackLod.
+ */
+QString sqlCreateTrackSegmentLod(){
+  QString sql("CREATE TABLE `track_segment_lod`");
+  sql.append("(").append( "`segment_id` INTEGER NOT NULL REFERENCES track_segment(id) ON DELETE CASCADE");
+  sql.append(",").append( "`level` INTEGER NOT NULL");
+  sql.append(",").append( "`point_count` INTEGER NOT NULL");
+  sql.append(",").append( "`points` BLOB NULL"); // see TrackLod::encode
+  sql.append(",").append( "PRIMARY KEY (`segment_id`, `level`)");
+  sql.append(");");
+  return sql;
+}
+
+/**
+ * Decimated elevation profile of the track, see Storage::loadElevationProfile.
+ * Accuracy filter -1 is used when points are not filtered.
+ * Profile is extended by points appended after the last processed point,
+ * it is deleted when track segments are modified.
+ */
+QString sqlCreateTrackElevationProfile(){
+  QString sql("CREATE TABLE `track_elevation_profile`");
+  sql.append("(").append( "`track_id` INTEGER NOT NULL REFERENCES track(id) ON DELETE CASCADE");
+  sql.append(",").append( "`accuracy_filter` REAL NOT NULL");
+  sql.append(",").append( "`modification_time` datetime NOT NULL"); // of the track when profile was computed
+  sql.append(",").append( "`segment_count` INTEGER NOT NULL"); // processed segments, the last one may be processed partially
+  sql.append(",").append( "`segment_points` INTEGER NOT NULL"); // processed points of the last processed segment
+  sql.append(",").append( "`state` BLOB NULL"); // see ElevationProfile::append
+  sql.append(",").append( "`point_count` INTEGER NOT NULL");
+  sql.append(",").append( "`points` BLOB NULL"); // see ElevationProfile::encode
+  sql.append(",").append( "PRIMARY KEY (`track_id`, `accuracy_filter`)");
+  sql.append(");");
+  return sql;
+}
+
 QString sqlCreateSearchHistory(){
   QString sql("CREATE TABLE `search_history` ");
   sql.append("(").append( "`pattern` varchar(255) NOT NULL PRIMARY KEY");
@@ -320,6 +696,7 @@ Storage::~Storage()
   }
 
   if (db.isValid()) {
+    statementCache.clear(); // cached queries must be released before connection is closed
     if (db.isOpen()) {
       db.close();
     }
@@ -393,6 +770,12 @@ bool Storage::updateSchema(){
   bool updateTrackPointTable = false;
   bool updateWaypointTable = false;
   bool updateTrackTable = false;
+  bool migrateTrackPoints = false;
+  bool addSegmentChunks = false;
+  bool addSegmentStatistics = false;
+  bool addStatisticsState = false;
+  bool addSegmentLod = false;
+  bool addElevationProfile = false;
   if (currentSchema < 2){
     // from schema v2 may be timestamps null
     updateTrackPointTable = true;
@@ -405,6 +788,36 @@ bool Storage::updateSchema(){
     updateWaypointTable = true;
   }
 
+  if (currentSchema < 4) {
+    // from schema v4 track points are stored as blob in track_segment table
+    migrateTrackPoints = true;
+  }
+
+  if (currentSchema < 5) {
+    // from schema v5 points appended to open segment are stored in track_segment_chunk table
+    addSegmentChunks = true;
+  }
+
+  if (currentSchema < 6) {
+    // from schema v6 track segments have its own statistics
+    addSegmentStatistics = true;
+  }
+
+  if (currentSchema < 7) {
+    // from schema v7 open segment holds state of statistics accumulator
+    addStatisticsState = true;
+  }
+
+  if (currentSchema < 8) {
+    // from schema v8 simplified segment points are cached in track_segment_lod table
+    addSegmentLod = true;
+  }
+
+  if (currentSchema < 9) {
+    // from schema v9 elevation profiles are cached in track_elevation_profile table
+    addElevationProfile = true;
+  }
+
   if (updateTrackPointTable) {
     // alter track_point
     updateQueries << "ALTER TABLE `track_point` RENAME TO `_track_point`";
@@ -419,7 +832,7 @@ bool Storage::updateSchema(){
     updateQueries << sqlCreateWaypoint();
 
     // in v3 we added one column (visible), so we need to explicitly name columns (from v2)
-    static_assert(DbSchema==3);
+    static_assert(DbSchema==9);
     updateQueries << (QString("INSERT INTO `waypoint` (")
       .append("`id`, `collection_id`, `modification_time`, `timestamp`, `latitude`,")
       .append("`longitude`, `elevation`, `name`, `description`,")
@@ -439,7 +852,7 @@ bool Storage::updateSchema(){
     updateQueries << sqlCreateTrack();
 
     // in v3 we added three columns, so we need to explicitly name columns (from v2)
-    static_assert(DbSchema==3);
+    static_assert(DbSchema==9);
     updateQueries << (QString("INSERT INTO `track` (")
       .append("`id`, `collection_id`, `name`, `description`, `open`, `creation_time`, ")
       .append("`modification_time`, `color`, `type`, `visible`, ")
@@ -459,6 +872,37 @@ bool Storage::updateSchema(){
     updateQueries << "DROP TABLE `_track`";
   }
 
+  if (migrateTrackPoints) {
+    // alter track_segment, points are converted by migrateTrackPointTable
+    updateQueries << "ALTER TABLE `track_segment` ADD COLUMN `point_count` INTEGER NOT NULL DEFAULT 0";
+    updateQueries << "ALTER TABLE `track_segment` ADD COLUMN `points` BLOB NULL";
+  }
+
+  if (addSegmentChunks) {
+    updateQueries << sqlCreateTrackSegmentChunk();
+  }
+
+  if (addSegmentStatistics) {
+    // statistics of existing segments are computed lazily, see updateTrackStatisticsFromSegments
+    for (const QString &column: sqlTrackSegmentStatisticsColumns().split(",", QString::SkipEmptyParts)) {
+      updateQueries << QString("ALTER TABLE `track_segment` ADD COLUMN %1").arg(column);
+    }
+  }
+
+  if (addStatisticsState) {
+    updateQueries << "ALTER TABLE `track_segment` ADD COLUMN `statistics_state` BLOB NULL";
+  }
+
+  if (addSegmentLod) {
+    updateQueries << sqlCreateTrackSegmentLod();
+  }
+
+  if (addElevationProfile) {
+    // it is just cache, it may be dropped safely
+    updateQueries << "DROP TABLE IF EXISTS `track_elevation_profile`";
+    updateQueries << sqlCreateTrackElevationProfile();
+  }
+
   if (currentSchema < DbSchema){
     updateQueries << QString("INSERT INTO `version` (`version`) VALUES (%1)").arg(DbSchema);
     currentSchema = DbSchema;
@@ -485,6 +929,12 @@ bool Storage::updateSchema(){
         return false;
       }
     }
+    if (migrateTrackPoints && !migrateTrackPointTable()) {
+      qWarning() << "Track points migration failed";
+      db.rollback();
+      db.close();
+      return false;
+    }
     if (!db.commit()) {
       qWarning() << "Commit database update failed";
       db.close();
@@ -530,12 +980,34 @@ bool Storage::updateSchema(){
     }
   }
 
-  if (!tables.contains("track_point")){
-    qDebug()<< "creating track_point table";
+  if (!tables.contains("track_segment_chunk")){
+    qDebug()<< "creating track_segment_chunk table";
 
-    QSqlQuery q = db.exec(sqlCreateTrackPoint());
+    QSqlQuery q = db.exec(sqlCreateTrackSegmentChunk());
     if (q.lastError().isValid()){
-      qWarning() << "Storage: creating track node table failed" << q.lastError();
+      qWarning() << "Storage: creating track segment chunk table failed" << q.lastError();
+      db.close();
+      return false;
+    }
+  }
+
+  if (!tables.contains("track_segment_lod")){
+    qDebug()<< "creating track_segment_lod table";
+
+    QSqlQuery q = db.exec(sqlCreateTrackSegmentLod());
+    if (q.lastError().isValid()){
+      qWarning() << "Storage: creating track segment lod table failed" << q.lastError();
+      db.close();
+      return false;
+    }
+  }
+
+  if (!tables.contains("track_elevation_profile")){
+    qDebug()<< "creating track_elevation_profile table";
+
+    QSqlQuery q = db.exec(sqlCreateTrackElevationProfile());
+    if (q.lastError().isValid()){
+      qWarning() << "Storage: creating track elevation profile table failed" << q.lastError();
       db.close();
       return false;
     }
@@ -592,28 +1064,113 @@ bool Storage::updateSchema(){
     }
   }
 
-  if (!indexes.contains("idx_track_point_segment_id")){
-    qDebug() << "creating idx_track_point_segment_id index";
+  if (!indexes.contains("idx_waypoint_collection_id")){
+    qDebug() << "creating idx_waypoint_collection_id index";
 
-    QSqlQuery q = db.exec("CREATE INDEX `idx_track_point_segment_id` ON `track_point` (`segment_id`)");
+    QSqlQuery q = db.exec("CREATE INDEX `idx_waypoint_collection_id` on `waypoint`(`collection_id`);");
     if (q.lastError().isValid()){
-      qWarning() << "Storage: creating idx_track_point_segment_id index failed" << q.lastError();
+      qWarning() << "Storage: creating idx_waypoint_collection_id index failed" << q.lastError();
       db.close();
       return false;
     }
   }
 
-  if (!indexes.contains("idx_waypoint_collection_id")){
-    qDebug() << "creating idx_waypoint_collection_id index";
+  // spatial indexes are optional, sqlite may be compiled without rtree module
+  spatialIndex = tables.contains("waypoint_rtree") || createSpatialIndex("waypoint_rtree", sqlCreateWaypointRTree());
+  if (!spatialIndex) {
+    qWarning() << "Storage: spatial index is not available, spatial queries will be slow";
+  }
 
-    QSqlQuery q = db.exec("CREATE INDEX `idx_waypoint_collection_id` on `waypoint`(`collection_id`);");
-    if (q.lastError().isValid()){
-      qWarning() << "Storage: creating idx_waypoint_collection_id index failed" << q.lastError();
-      db.close();
+  return true;
+}
+
+bool Storage::createSpatialIndex(const QString &name, const QStringList &queries)
+{
+  qDebug() << "creating" << name << "spatial index";
+  QElapsedTimer timer;
+  timer.start();
+
+  db.transaction();
+  for (const QString &query: queries) {
+    QSqlQuery q = db.exec(query);
+    if (q.lastError().isValid()) {
+      qWarning() << "Storage: creating" << name << "failed" << q.lastError();
+      db.rollback();
+      return false;
+    }
+  }
+  if (!db.commit()) {
+    qWarning() << "Storage: creating" << name << "failed" << db.lastError();
+    return false;
+  }
+  qDebug() << "created" << name << "in" << timer.elapsed() << "ms";
+  return true;
+}
+
+bool Storage::migrateTrackPointTable()
+{
+  QElapsedTimer timer;
+  timer.start();
+
+  std::vector<qint64> segmentIds;
+  QSqlQuery sqlSegments = db.exec("SELECT `id` FROM `track_segment`;");
+  if (sqlSegments.lastError().isValid()) {
+    qWarning() << "Loading segments failed" << sqlSegments.lastError();
+    return false;
+  }
+  while (sqlSegments.next()) {
+    segmentIds.push_back(varToLong(sqlSegments.value(0)));
+  }
+
+  // timestamp is stored as string with milliseconds, convert it to epoch millis
+  QSqlQuery sqlPoints(db);
+  sqlPoints.prepare(QString("SELECT CAST(ROUND((JULIANDAY(`timestamp`) - 2440587.5) * 86400000.0) AS INTEGER) AS `timestamp`, ")
+                      .append("`latitude`, `longitude`, `elevation`, `horiz_accuracy`, `vert_accuracy` ")
+                      .append("FROM `track_point` WHERE `segment_id` = :segmentId ORDER BY `rowid`;"));
+
+  QSqlQuery sqlUpdate(db);
+  sqlUpdate.prepare("UPDATE `track_segment` SET `point_count` = :point_count, `points` = :points WHERE `id` = :id;");
+
+  size_t pointCount = 0;
+  for (qint64 segmentId: segmentIds) {
+    sqlPoints.bindValue(":segmentId", segmentId);
+    sqlPoints.exec();
+    if (sqlPoints.lastError().isValid()) {
+      qWarning() << "Loading points of segment" << segmentId << "failed" << sqlPoints.lastError();
+      return false;
+    }
+
+    std::vector<gpx::TrackPoint> points;
+    while (sqlPoints.next()) {
+      gpx::TrackPoint &point = points.emplace_back(GeoCoord(
+        varToDouble(sqlPoints.value(1)),
+        varToDouble(sqlPoints.value(2))
+      ));
+      point.timestamp = varMillisToOptTimestamp(sqlPoints.value(0));
+      point.elevation = varToDoubleOpt(sqlPoints.value(3));
+      point.hdop = varToDoubleOpt(sqlPoints.value(4));
+      point.vdop = varToDoubleOpt(sqlPoints.value(5));
+    }
+    sqlPoints.finish();
+
+    sqlUpdate.bindValue(":point_count", qint64(points.size()));
+    sqlUpdate.bindValue(":points", points.empty() ? QVariant() : QVariant(TrackPointBlob::encode(points, TrackDataChunkSize)));
+    sqlUpdate.bindValue(":id", segmentId);
+    sqlUpdate.exec();
+    if (sqlUpdate.lastError().isValid()) {
+      qWarning() << "Storing points of segment" << segmentId << "failed" << sqlUpdate.lastError();
       return false;
     }
+    pointCount += points.size();
   }
 
+  QSqlQuery sqlDrop = db.exec("DROP TABLE `track_point`;");
+  if (sqlDrop.lastError().isValid()) {
+    qWarning() << "Dropping track_point table failed" << sqlDrop.lastError();
+    return false;
+  }
+
+  qDebug() << "Migrated" << pointCount << "points in" << segmentIds.size() << "segments in" << timer.elapsed() << "ms";
   return true;
 }
 
@@ -661,6 +1218,10 @@ void Storage::init()
     return;
   }
   qDebug() << "Storage database opened:" << path;
+  if (!setupConnection()){
+    emit initialisationError("setup connection");
+    return;
+  }
   if (!updateSchema()){
     emit initialisationError("update schema");
     return;
@@ -675,52 +1236,173 @@ void Storage::init()
   emit initialised();
 }
 
-bool Storage::checkAccess(QString slotName, bool requireOpen)
+bool Storage::setupConnection()
 {
-  if (thread != QThread::currentThread()){
-    qWarning() << this << "::" << slotName << "from non incorrect thread;" << thread << "!=" << QThread::currentThread();
+  // WAL journal don't require fsync on every commit and readers don't block writer
+  QSqlQuery journal = db.exec("PRAGMA journal_mode = WAL;");
+  if (journal.lastError().isValid() || !journal.next()) {
+    qWarning() << "Setting WAL journal mode fails:" << journal.lastError();
+  } else if (varToString(journal.value(0)).toLower() != "wal") {
+    qWarning() << "WAL journal mode is not supported, journal mode:" << varToString(journal.value(0));
+  }
+  journal.finish();
+
+  QStringList pragmas;
+  pragmas << "PRAGMA cache_size = -4096;"; // KiB
+  pragmas << "PRAGMA mmap_size = 33554432;"; // 32 MiB
+  pragmas << "PRAGMA temp_store = MEMORY;";
+  for (const QString &pragma: pragmas) {
+    QSqlQuery q = db.exec(pragma);
+    if (q.lastError().isValid()) {
+      // just performance tuning, don't fail
+      qWarning() << pragma << "fails:" << q.lastError();
+    }
+  }
+
+  rawSqlite = checkSqliteLibrary();
+
+  return applyDurabilityProfile(durabilityProfile);
+}
+
+bool Storage::checkSqliteLibrary()
+{
+  QSqlQuery q = db.exec("SELECT sqlite_version(), sqlite_source_id();");
+  if (q.lastError().isValid() || !q.next()) {
+    qWarning() << "Evaluating sqlite version fails:" << q.lastError();
     return false;
   }
-  if (requireOpen && !ok){
-    qWarning() << "Database is not open, " << this << "::" << slotName << "";
+  QString driverVersion = varToString(q.value(0));
+  QString driverSourceId = varToString(q.value(1));
+  if (driverVersion != QString::fromLatin1(sqlite3_libversion()) ||
+      driverSourceId != QString::fromLatin1(sqlite3_sourceid())) {
+    qWarning() << "QSQLITE driver uses sqlite" << driverVersion << driverSourceId
+               << "but" << sqlite3_libversion() << sqlite3_sourceid() << "is linked, raw sqlite access is disabled";
     return false;
   }
   return true;
 }
 
-void Storage::loadCollections()
+bool Storage::applyDurabilityProfile(DurabilityProfile profile)
+{
+  QString pragma;
+  switch (profile) {
+    case Recording:
+      pragma = "PRAGMA synchronous = NORMAL;";
+      break;
+    case BulkImport:
+      pragma = "PRAGMA synchronous = OFF;";
+      break;
+    case Durable:
+      pragma = "PRAGMA synchronous = FULL;";
+      break;
+  }
+  QSqlQuery q = db.exec(pragma);
+  if (q.lastError().isValid()) {
+    qWarning() << "Setting durability profile" << profile << "fails:" << q.lastError();
+    return false;
+  }
+  return true;
+}
+
+void Storage::setDurabilityProfile(Storage::DurabilityProfile profile)
 {
   if (!checkAccess(__FUNCTION__)){
-    emit collectionsLoaded(std::vector<Collection>(), false);
     return;
   }
+  if (applyDurabilityProfile(profile)) {
+    durabilityProfile = profile;
+  }
+}
 
-  auto sql = QString("SELECT `id`, `visible`, `name`, `description`, ")
-    .append("(SELECT COUNT(*) FROM `waypoint` AS `wpt` WHERE `wpt`.`collection_id` = `collection`.`id` AND NOT `wpt`.`visible`) AS `wpt_hidden`, ")
-    .append("(SELECT COUNT(*) FROM `track`    AS `trk` WHERE `trk`.`collection_id` = `collection`.`id` AND NOT `trk`.`visible`) AS `trk_hidden` ")
-    .append("FROM `collection`;");
-
-  QSqlQuery q = db.exec(sql);
-  if (q.lastError().isValid()) {
-    emit collectionsLoaded(std::vector<Collection>(), false);
+void Storage::checkpoint()
+{
+  if (!checkAccess(__FUNCTION__)){
+    return;
   }
-  std::vector<Collection> result;
-  while (q.next()) {
-    bool visibleAll = varToLong(q.value("wpt_hidden")) == 0 && varToLong(q.value("trk_hidden")) == 0;
-    result.emplace_back(
-      varToLong(q.value("id")),
-      varToBool(q.value("visible")),
-      visibleAll,
-      varToString(q.value("name")),
-      varToString(q.value("description"))
-    );
+  QElapsedTimer timer;
+  timer.start();
+  QSqlQuery q = db.exec("PRAGMA wal_checkpoint(PASSIVE);");
+  if (q.lastError().isValid()) {
+    qWarning() << "Database checkpoint fails:" << q.lastError();
+    return;
   }
-  emit collectionsLoaded(result, true);
+  lastCheckpoint.start();
+  qDebug() << "Database checkpoint took" << timer.elapsed() << "ms";
 }
 
-Track Storage::makeTrack(QSqlQuery &sqlTrack) const
+void Storage::applicationStateChanged(Qt::ApplicationState state)
 {
-  GeoBox bbox(GeoCoord(varToDouble(sqlTrack.value("bbox_min_lat")),
+  bool background = state != Qt::ApplicationActive;
+  if (background && !inBackground &&
+      (!lastCheckpoint.isValid() || lastCheckpoint.elapsed() >= CheckpointInterval)) {
+    checkpoint();
+  }
+  inBackground = background;
+}
+
+void Storage::logStatementCacheStats()
+{
+  if (!checkAccess(__FUNCTION__, false)){
+    return;
+  }
+  std::vector<StatementCache::Stats> stats = statementCache.stats();
+  qDebug() << "Statement cache:" << stats.size() << "statements," << statementCache.uncachedCount() << "uncached usages";
+  for (const auto &stat: stats) {
+    qDebug() << "  reused" << stat.reuseCount << "x:" << stat.sql;
+  }
+}
+
+StatementCache::Statement Storage::preparedQuery(const QString &sql)
+{
+  return statementCache.prepare(db, sql);
+}
+
+bool Storage::checkAccess(QString slotName, bool requireOpen)
+{
+  if (thread != QThread::currentThread()){
+    qWarning() << this << "::" << slotName << "from non incorrect thread;" << thread << "!=" << QThread::currentThread();
+    return false;
+  }
+  if (requireOpen && !ok){
+    qWarning() << "Database is not open, " << this << "::" << slotName << "";
+    return false;
+  }
+  return true;
+}
+
+void Storage::loadCollections()
+{
+  if (!checkAccess(__FUNCTION__)){
+    emit collectionsLoaded(std::vector<Collection>(), false);
+    return;
+  }
+
+  auto sql = QString("SELECT `id`, `visible`, `name`, `description`, ")
+    .append("(SELECT COUNT(*) FROM `waypoint` AS `wpt` WHERE `wpt`.`collection_id` = `collection`.`id` AND NOT `wpt`.`visible`) AS `wpt_hidden`, ")
+    .append("(SELECT COUNT(*) FROM `track`    AS `trk` WHERE `trk`.`collection_id` = `collection`.`id` AND NOT `trk`.`visible`) AS `trk_hidden` ")
+    .append("FROM `collection`;");
+
+  QSqlQuery q = db.exec(sql);
+  if (q.lastError().isValid()) {
+    emit collectionsLoaded(std::vector<Collection>(), false);
+  }
+  std::vector<Collection> result;
+  while (q.next()) {
+    bool visibleAll = varToLong(q.value("wpt_hidden")) == 0 && varToLong(q.value("trk_hidden")) == 0;
+    result.emplace_back(
+      varToLong(q.value("id")),
+      varToBool(q.value("visible")),
+      visibleAll,
+      varToString(q.value("name")),
+      varToString(q.value("description"))
+    );
+  }
+  emit collectionsLoaded(result, true);
+}
+
+Track Storage::makeTrack(QSqlQuery &sqlTrack) const
+{
+  GeoBox bbox(GeoCoord(varToDouble(sqlTrack.value("bbox_min_lat")),
                        varToDouble(sqlTrack.value("bbox_min_lon"))),
               GeoCoord(varToDouble(sqlTrack.value("bbox_max_lat")),
                        varToDouble(sqlTrack.value("bbox_max_lon"))));
@@ -759,20 +1441,19 @@ Track Storage::makeTrack(QSqlQuery &sqlTrack) const
 
 std::shared_ptr<std::vector<Track>> Storage::loadTracks(qint64 collectionId)
 {
-  QSqlQuery sqlTrack(db);
-  sqlTrack.prepare("SELECT * FROM `track` WHERE collection_id = :collectionId;");
-  sqlTrack.bindValue(":collectionId", collectionId);
-  sqlTrack.exec();
+  auto sqlTrack = preparedQuery("SELECT * FROM `track` WHERE collection_id = :collectionId;");
+  sqlTrack->bindValue(":collectionId", collectionId);
+  sqlTrack->exec();
 
-  if (sqlTrack.lastError().isValid()) {
+  if (sqlTrack->lastError().isValid()) {
     qWarning() << "Loading tracks for collection id" << collectionId << "fails";
     emit error(tr("Loading tracks for collection id %1 fails").arg(collectionId));
     return nullptr;
   }
 
   std::shared_ptr<std::vector<Track>> result = std::make_shared<std::vector<Track>>();
-  while (sqlTrack.next()) {
-    result->emplace_back(makeTrack(sqlTrack));
+  while (sqlTrack->next()) {
+    result->emplace_back(makeTrack(*sqlTrack));
   }
   return result;
 }
@@ -802,45 +1483,43 @@ Waypoint Storage::makeWaypoint(QSqlQuery &sql) const
 
 std::shared_ptr<std::vector<Waypoint>> Storage::loadWaypoints(qint64 collectionId)
 {
-  QSqlQuery sql(db);
-  sql.prepare("SELECT * FROM `waypoint` WHERE collection_id = :collectionId;");
-  sql.bindValue(":collectionId", collectionId);
-  sql.exec();
+  auto sql = preparedQuery("SELECT * FROM `waypoint` WHERE collection_id = :collectionId;");
+  sql->bindValue(":collectionId", collectionId);
+  sql->exec();
 
-  if (sql.lastError().isValid()) {
+  if (sql->lastError().isValid()) {
     qWarning() << "Loading waypoints for collection id" << collectionId << "fails";
     emit error(tr("Loading waypoints for collection id %1 fails").arg(collectionId));
     return nullptr;
   }
 
   std::shared_ptr<std::vector<Waypoint>> result = std::make_shared<std::vector<Waypoint>>();
-  while (sql.next()) {
-    result->emplace_back(makeWaypoint(sql));
+  while (sql->next()) {
+    result->emplace_back(makeWaypoint(*sql));
   }
   return result;
 }
 
 bool Storage::loadCollectionDetailsPrivate(Collection &collection)
 {
-  QSqlQuery sql(db);
-  sql.prepare("SELECT `name`, `description`, `visible` FROM `collection` WHERE id = :collectionId;");
-  sql.bindValue(":collectionId", collection.id);
-  sql.exec();
-  if (sql.lastError().isValid()) {
+  auto sql = preparedQuery("SELECT `name`, `description`, `visible` FROM `collection` WHERE id = :collectionId;");
+  sql->bindValue(":collectionId", collection.id);
+  sql->exec();
+  if (sql->lastError().isValid()) {
     qWarning() << "Loading collection id" << collection.id << "fails";
     emit error(tr("Loading collection id %1 fails").arg(collection.id));
     return false;
   }
   std::vector<Collection> result;
-  if (!sql.next()) {
+  if (!sql->next()) {
     qWarning() << "Collection id" << collection.id << "don't exists";
     emit error(tr("Collection id %1 don't exists").arg(collection.id));
     return false;
   }
 
-  collection.name = varToString(sql.value("name"));
-  collection.description = varToString(sql.value("description"));
-  collection.visible = varToBool(sql.value("visible"));
+  collection.name = varToString(sql->value("name"));
+  collection.description = varToString(sql->value("description"));
+  collection.visible = varToBool(sql->value("visible"));
 
   collection.tracks = loadTracks(collection.id);
   collection.waypoints = loadWaypoints(collection.id);
@@ -861,69 +1540,545 @@ void Storage::loadCollectionDetails(Collection collection)
   }
 }
 
-// QSqlQuery::size() is not supported with SQLite.
-// But you can get the number of rows with a workaround
-// https://stackoverflow.com/questions/26495049/qsqlquery-size-always-returns-1
-int Storage::querySize(QSqlQuery &query)
+bool Storage::loadTrackPoints(qint64 segmentId, gpx::TrackSegment &segment)
 {
-  int initialPos = query.at();
-  int size = 0;
-  if (query.last()) {
-    size = query.at() + 1;
-  } else {
-    size = 0;
+  auto sql = preparedQuery("SELECT `point_count`, `points` FROM `track_segment` WHERE `id` = :segmentId;");
+  sql->bindValue(":segmentId", segmentId);
+  sql->exec();
+  if (sql->lastError().isValid()) {
+    qWarning() << "Loading nodes for segment id" << segmentId << "failed";
+    emit error(tr("Loading nodes for segment id %1 failed: %2").arg(segmentId).arg(sql->lastError().text()));
+    return false;
+  }
+  if (!sql->next()) {
+    qWarning() << "Segment id" << segmentId << "don't exists";
+    emit error(tr("Segment id %1 don't exists").arg(segmentId));
+    return false;
+  }
+
+  segment.points.reserve(segment.points.size() + varToLong(sql->value(0), 0));
+  QByteArray blob = sql->value(1).toByteArray();
+  sql->finish();
+  if (!TrackPointBlob::decode(blob, segment.points)) {
+    qWarning() << "Decoding nodes for segment id" << segmentId << "failed";
+    emit error(tr("Decoding nodes for segment id %1 failed").arg(segmentId));
+    return false;
+  }
+
+  // points appended to open segment, see appendTrackPoints
+  auto sqlChunks = preparedQuery("SELECT `points` FROM `track_segment_chunk` WHERE `segment_id` = :segmentId ORDER BY `chunk`;");
+  sqlChunks->bindValue(":segmentId", segmentId);
+  sqlChunks->exec();
+  if (sqlChunks->lastError().isValid()) {
+    qWarning() << "Loading nodes for segment id" << segmentId << "failed";
+    emit error(tr("Loading nodes for segment id %1 failed: %2").arg(segmentId).arg(sqlChunks->lastError().text()));
+    return false;
+  }
+  while (sqlChunks->next()) {
+    if (!TrackPointBlob::decode(sqlChunks->value(0).toByteArray(), segment.points)) {
+      qWarning() << "Decoding nodes for segment id" << segmentId << "failed";
+      emit error(tr("Decoding nodes for segment id %1 failed").arg(segmentId));
+      return false;
+    }
   }
-  // Important to restore initial pos
-  query.seek(initialPos);
-  return size;
+  return true;
 }
 
-void Storage::loadTrackPoints(qint64 segmentId, gpx::TrackSegment &segment)
+sqlite3* Storage::sqliteHandle() const
 {
-  // QElapsedTimer timer;
-  // timer.start();
-  QSqlQuery sql(db);
-  sql.prepare("SELECT CAST(STRFTIME('%s',`timestamp`, 'UTC') AS INTEGER) AS `timestamp`, `latitude`, `longitude`, `elevation`, `horiz_accuracy`, `vert_accuracy` FROM `track_point` WHERE segment_id = :segmentId;");
-  sql.bindValue(":segmentId", segmentId);
-  sql.exec();
-  if (sql.lastError().isValid()) {
-    qWarning() << "Loading nodes for segment id" << segmentId << "failed";
-    emit error(tr("Loading nodes for segment id %1 failed: %2").arg(segmentId).arg(sql.lastError().text()));
-    return;
+  if (!rawSqlite) {
+    return nullptr;
+  }
+  // QSQLITE driver provides its sqlite3 handle wrapped in QVariant
+  QVariant handle = db.driver()->handle();
+  if (handle.isValid() && qstrcmp(handle.typeName(), "sqlite3*") == 0) {
+    return *static_cast<sqlite3* const*>(handle.constData());
   }
+  return nullptr;
+}
 
-  // qDebug() << "    segment" << segmentId << "sql:" << timer.elapsed() << "ms";
+bool Storage::streamTrackSegments(qint64 trackId, const TrackChunkCallback &chunkLoaded)
+{
+  size_t segmentIndex = 0;
+  qint64 segmentId = -1;
+  qint64 segmentPointCount = 0;
+  bool emptySegment = true;
+  auto decodeBlob = [&](const char *data, size_t size) -> bool {
+    if (data == nullptr || size == 0) {
+      return true;
+    }
+    bool aborted = false;
+    bool decoded = TrackPointBlob::decodeChunks(data, size, [&](std::vector<gpx::TrackPoint> &&points) {
+      emptySegment = false;
+      aborted = !chunkLoaded(segmentIndex, segmentPointCount, std::move(points));
+      return !aborted;
+    });
+    if (!decoded && !aborted) {
+      qWarning() << "Decoding nodes for segment id" << segmentId << "failed";
+      emit error(tr("Decoding nodes for segment id %1 failed").arg(segmentId));
+    }
+    return decoded;
+  };
+  // every segment is reported, even empty one
+  auto segmentDone = [&]() -> bool {
+    bool result = !emptySegment || chunkLoaded(segmentIndex, 0, std::vector<gpx::TrackPoint>());
+    segmentIndex++;
+    return result;
+  };
 
-  auto size = querySize(sql);
-  // qDebug() << "    segment" << segmentId << "size:" << timer.elapsed() << "ms";
-  assert(size>=0);
-  segment.points.reserve(size);
+  sqlite3 *handle = sqliteHandle();
+  if (handle == nullptr) {
+    // fallback to Qt api
+    QSqlQuery sql(db);
+    sql.prepare("SELECT `id`, `point_count`, `points` FROM `track_segment` WHERE `track_id` = :trackId ORDER BY `id`;");
+    sql.bindValue(":trackId", trackId);
+    sql.exec();
+    if (sql.lastError().isValid()) {
+      qWarning() << "Loading segments for track id" << trackId << "failed";
+      emit error(tr("Loading segments for track id %1 failed: %2").arg(trackId).arg(sql.lastError().text()));
+      return false;
+    }
+    while (sql.next()) {
+      segmentId = varToLong(sql.value(0));
+      segmentPointCount = varToLong(sql.value(1), 0);
+      emptySegment = true;
+      QByteArray blob = sql.value(2).toByteArray();
+      if (!decodeBlob(blob.constData(), size_t(blob.size()))) {
+        return false;
+      }
 
-  // qDebug() << "    segment" << segmentId << "alloc:" << timer.elapsed() << "ms";
+      // points appended to open segment, see appendTrackPoints
+      auto sqlChunks = preparedQuery("SELECT `points` FROM `track_segment_chunk` WHERE `segment_id` = :segmentId ORDER BY `chunk`;");
+      sqlChunks->bindValue(":segmentId", segmentId);
+      sqlChunks->exec();
+      if (sqlChunks->lastError().isValid()) {
+        qWarning() << "Loading nodes for segment id" << segmentId << "failed";
+        emit error(tr("Loading nodes for segment id %1 failed: %2").arg(segmentId).arg(sqlChunks->lastError().text()));
+        return false;
+      }
+      while (sqlChunks->next()) {
+        QByteArray chunk = sqlChunks->value(0).toByteArray();
+        if (!decodeBlob(chunk.constData(), size_t(chunk.size()))) {
+          return false;
+        }
+      }
+      if (!segmentDone()) {
+        return false;
+      }
+    }
+    return true;
+  }
 
-  QSqlRecord record = sql.record();
-  int iLatitude = record.indexOf("latitude");
-  int iLongitude = record.indexOf("longitude");
-  int iTimestamp = record.indexOf("timestamp");
-  int iElevation = record.indexOf("elevation");
-  int iHorizAcc = record.indexOf("horiz_accuracy");
-  int iVertAcc = record.indexOf("vert_accuracy");
+  // Read blobs directly from sqlite statement. It avoids QVariant boxing and copying
+  // of the blob, points are decoded from memory owned by sqlite.
+  sqlite3_stmt *rawStmt = nullptr;
+  int result = sqlite3_prepare_v2(handle,
+                                  "SELECT `id`, `point_count`, `points` FROM `track_segment` WHERE `track_id` = ? ORDER BY `id`;",
+                                  -1, &rawStmt, nullptr);
+  std::unique_ptr<sqlite3_stmt, decltype(&sqlite3_finalize)> stmt(rawStmt, &sqlite3_finalize);
+  if (result != SQLITE_OK || sqlite3_bind_int64(stmt.get(), 1, trackId) != SQLITE_OK) {
+    qWarning() << "Loading segments for track id" << trackId << "failed:" << sqlite3_errmsg(handle);
+    emit error(tr("Loading segments for track id %1 failed: %2").arg(trackId).arg(sqlite3_errmsg(handle)));
+    return false;
+  }
 
-  while (sql.next()) {
-    segment.points.emplace_back(GeoCoord(
-      varToDouble(sql.value(iLatitude)),
-      varToDouble(sql.value(iLongitude))
-    ));
-    gpx::TrackPoint &point = segment.points.back();
+  // points appended to open segment, see appendTrackPoints
+  sqlite3_stmt *rawChunkStmt = nullptr;
+  result = sqlite3_prepare_v2(handle,
+                              "SELECT `points` FROM `track_segment_chunk` WHERE `segment_id` = ? ORDER BY `chunk`;",
+                              -1, &rawChunkStmt, nullptr);
+  std::unique_ptr<sqlite3_stmt, decltype(&sqlite3_finalize)> chunkStmt(rawChunkStmt, &sqlite3_finalize);
+  if (result != SQLITE_OK) {
+    qWarning() << "Loading segments for track id" << trackId << "failed:" << sqlite3_errmsg(handle);
+    emit error(tr("Loading segments for track id %1 failed: %2").arg(trackId).arg(sqlite3_errmsg(handle)));
+    return false;
+  }
+
+  while ((result = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+    segmentId = sqlite3_column_int64(stmt.get(), 0);
+    segmentPointCount = sqlite3_column_int64(stmt.get(), 1);
+    emptySegment = true;
+    if (segmentPointCount > 0) {
+      // pointer must be obtained before size, see sqlite3_column_blob documentation
+      const char *blob = static_cast<const char*>(sqlite3_column_blob(stmt.get(), 2));
+      if (!decodeBlob(blob, size_t(sqlite3_column_bytes(stmt.get(), 2)))) {
+        return false;
+      }
+
+      sqlite3_reset(chunkStmt.get());
+      if (sqlite3_bind_int64(chunkStmt.get(), 1, segmentId) != SQLITE_OK) {
+        qWarning() << "Loading nodes for segment id" << segmentId << "failed:" << sqlite3_errmsg(handle);
+        emit error(tr("Loading nodes for segment id %1 failed: %2").arg(segmentId).arg(sqlite3_errmsg(handle)));
+        return false;
+      }
+      int chunkResult;
+      while ((chunkResult = sqlite3_step(chunkStmt.get())) == SQLITE_ROW) {
+        const char *chunk = static_cast<const char*>(sqlite3_column_blob(chunkStmt.get(), 0));
+        if (!decodeBlob(chunk, size_t(sqlite3_column_bytes(chunkStmt.get(), 0)))) {
+          return false;
+        }
+      }
+      if (chunkResult != SQLITE_DONE) {
+        qWarning() << "Loading nodes for segment id" << segmentId << "failed:" << sqlite3_errmsg(handle);
+        emit error(tr("Loading nodes for segment id %1 failed: %2").arg(segmentId).arg(sqlite3_errmsg(handle)));
+        return false;
+      }
+    }
+    if (!segmentDone()) {
+      return false;
+    }
+  }
+  if (result != SQLITE_DONE) {
+    qWarning() << "Loading segments for track id" << trackId << "failed:" << sqlite3_errmsg(handle);
+    emit error(tr("Loading segments for track id %1 failed: %2").arg(trackId).arg(sqlite3_errmsg(handle)));
+    return false;
+  }
+  return true;
+}
+
+bool Storage::loadTrackSegments(qint64 trackId, std::vector<gpx::TrackSegment> &segments)
+{
+  size_t offset = segments.size();
+  return streamTrackSegments(trackId, [&](size_t segmentIndex, qint64 pointCount, std::vector<gpx::TrackPoint> &&points) {
+    if (segments.size() <= offset + segmentIndex) {
+      segments.resize(offset + segmentIndex + 1);
+    }
+    std::vector<gpx::TrackPoint> &segmentPoints = segments[offset + segmentIndex].points;
+    if (segmentPoints.empty()) {
+      segmentPoints = std::move(points);
+      segmentPoints.reserve(std::max(size_t(pointCount), segmentPoints.size()));
+    } else {
+      segmentPoints.insert(segmentPoints.end(), points.begin(), points.end());
+    }
+    return true;
+  });
+}
+
+bool Storage::storeTrackPoints(qint64 segmentId, const std::vector<gpx::TrackPoint> &points)
+{
+  auto sql = preparedQuery(QString("UPDATE `track_segment` SET `point_count` = :point_count, `points` = :points, ")
+                             .append("`distance` = :distance, `from_time` = :from_time, `to_time` = :to_time, ")
+                             .append("`raw_distance` = :raw_distance, `moving_duration` = :moving_duration, `max_speed` = :max_speed, ")
+                             .append("`ascent` = :ascent, `descent` = :descent, `min_elevation` = :min_elevation, `max_elevation` = :max_elevation, ")
+                             .append("`bbox_min_lat` = :bbox_min_lat, `bbox_min_lon` = :bbox_min_lon, `bbox_max_lat` = :bbox_max_lat, `bbox_max_lon` = :bbox_max_lon ")
+                             .append("WHERE `id` = :id;"));
+  sql->bindValue(":point_count", qint64(points.size()));
+  sql->bindValue(":points", points.empty() ? QVariant() : QVariant(TrackPointBlob::encode(points, TrackDataChunkSize)));
+  bindSegmentStatistics(*sql, computeSegmentStatistics(points));
+  sql->bindValue(":id", segmentId);
+  sql->exec();
+  if (sql->lastError().isValid()) {
+    qWarning() << "Storing nodes of segment" << segmentId << "failed" << sql->lastError();
+    emit error(tr("Storing nodes of segment %1 failed: %2").arg(segmentId).arg(sql->lastError().text()));
+    return false;
+  }
+
+  // appended chunks are part of the stored points now
+  auto sqlChunks = preparedQuery("DELETE FROM `track_segment_chunk` WHERE `segment_id` = :id;");
+  sqlChunks->bindValue(":id", segmentId);
+  sqlChunks->exec();
+  if (sqlChunks->lastError().isValid()) {
+    qWarning() << "Deleting chunks of segment" << segmentId << "failed" << sqlChunks->lastError();
+    emit error(tr("Storing nodes of segment %1 failed: %2").arg(segmentId).arg(sqlChunks->lastError().text()));
+    return false;
+  }
+  return deleteSegmentLod(segmentId);
+}
+
+bool Storage::storeSegmentLod(qint64 segmentId, const std::vector<std::vector<GeoCoord>> &levels)
+{
+  auto sql = preparedQuery("INSERT OR REPLACE INTO `track_segment_lod` (`segment_id`, `level`, `point_count`, `points`) VALUES (:segment_id, :level, :point_count, :points);");
+  for (size_t i = 0; i < levels.size(); i++) {
+    sql->bindValue(":segment_id", segmentId);
+    sql->bindValue(":level", int(i + 1));
+    sql->bindValue(":point_count", qint64(levels[i].size()));
+    sql->bindValue(":points", levels[i].empty() ? QVariant() : QVariant(TrackLod::encode(levels[i])));
+    sql->exec();
+    if (sql->lastError().isValid()) {
+      qWarning() << "Storing lod of segment" << segmentId << "failed" << sql->lastError();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Storage::loadCachedElevationProfile(qint64 trackId,
+                                         std::optional<double> accuracyFilter,
+                                         CachedElevationProfile &profile)
+{
+  auto sql = preparedQuery(QString("SELECT `modification_time`, `segment_count`, `segment_points`, `state`, `points` ")
+                             .append("FROM `track_elevation_profile` WHERE `track_id` = :track_id AND `accuracy_filter` = :accuracy_filter;"));
+  sql->bindValue(":track_id", trackId);
+  sql->bindValue(":accuracy_filter", accuracyFilter.value_or(-1));
+  sql->exec();
+  if (sql->lastError().isValid()) {
+    qWarning() << "Loading elevation profile of track" << trackId << "failed" << sql->lastError();
+    return false;
+  }
+  if (!sql->next()) {
+    return false;
+  }
+  profile.modification = varToDateTime(sql->value(0));
+  profile.segmentCount = quint64(varToLong(sql->value(1)));
+  profile.segmentPoints = quint64(varToLong(sql->value(2)));
+  profile.state = sql->value(3).toByteArray();
+  QByteArray blob = sql->value(4).toByteArray();
+  sql->finish();
+  if (!blob.isEmpty() && !ElevationProfile::decode(blob, profile.points)) {
+    qWarning() << "Decoding elevation profile of track" << trackId << "failed";
+    profile = CachedElevationProfile{};
+    return false;
+  }
+  return true;
+}
+
+bool Storage::storeElevationProfile(qint64 trackId,
+                                    std::optional<double> accuracyFilter,
+                                    const CachedElevationProfile &profile)
+{
+  auto sql = preparedQuery(QString("INSERT OR REPLACE INTO `track_elevation_profile` (`track_id`, `accuracy_filter`, `modification_time`, ")
+                             .append("`segment_count`, `segment_points`, `state`, `point_count`, `points`) ")
+                             .append("VALUES (:track_id, :accuracy_filter, :modification_time, ")
+                             .append(":segment_count, :segment_points, :state, :point_count, :points);"));
+  sql->bindValue(":track_id", trackId);
+  sql->bindValue(":accuracy_filter", accuracyFilter.value_or(-1));
+  sql->bindValue(":modification_time", dateTimeToSQL(profile.modification));
+  sql->bindValue(":segment_count", qint64(profile.segmentCount));
+  sql->bindValue(":segment_points", qint64(profile.segmentPoints));
+  sql->bindValue(":state", profile.state.isEmpty() ? QVariant() : QVariant(profile.state));
+  sql->bindValue(":point_count", qint64(profile.points.size()));
+  sql->bindValue(":points", profile.points.empty() ? QVariant() : QVariant(ElevationProfile::encode(profile.points)));
+  sql->exec();
+  if (sql->lastError().isValid()) {
+    qWarning() << "Storing elevation profile of track" << trackId << "failed" << sql->lastError();
+    return false;
+  }
+  return true;
+}
+
+bool Storage::deleteElevationProfile(qint64 trackId)
+{
+  auto sql = preparedQuery("DELETE FROM `track_elevation_profile` WHERE `track_id` = :track_id;");
+  sql->bindValue(":track_id", trackId);
+  sql->exec();
+  if (sql->lastError().isValid()) {
+    qWarning() << "Deleting elevation profile of track" << trackId << "failed" << sql->lastError();
+    return false;
+  }
+  return true;
+}
+
+bool Storage::extendElevationProfile(qint64 trackId,
+                                     std::optional<double> accuracyFilter,
+                                     CachedElevationProfile &profile)
+{
+  std::vector<std::pair<qint64, qint64>> sizes; // segment id, point count
+  if (!loadSegmentSizes(trackId, sizes)) {
+    return false;
+  }
+  if (sizes.size() < profile.segmentCount ||
+      (profile.segmentCount > 0 && quint64(sizes[profile.segmentCount - 1].second) < profile.segmentPoints)) {
+    qWarning() << "Cached elevation profile of track" << trackId << "don't match its segments";
+    return false;
+  }
+
+  // the first segment continues the last processed one, its processed points are skipped
+  std::vector<gpx::TrackSegment> segments;
+  size_t first = profile.segmentCount > 0 ? profile.segmentCount - 1 : 0;
+  for (size_t i = first; i < sizes.size(); i++) {
+    auto &segment = segments.emplace_back();
+    bool continued = i == first && profile.segmentCount > 0;
+    if (continued && quint64(sizes[i].second) == profile.segmentPoints) {
+      continue; // no new points
+    }
+    if (!loadTrackPoints(sizes[i].first, segment)) {
+      return false;
+    }
+    if (continued) {
+      segment.points.erase(segment.points.begin(), segment.points.begin() + profile.segmentPoints);
+    }
+    if (accuracyFilter) {
+      gpx::FilterInaccuratePoints(segment.points, *accuracyFilter);
+    }
+  }
+
+  if (!ElevationProfile::append(profile.points, segments, profile.state)) {
+    qWarning() << "Cached elevation profile state of track" << trackId << "is not valid";
+    return false;
+  }
+  profile.points = ElevationProfile::decimate(profile.points, ElevationProfile::CacheResolution);
+  profile.segmentCount = sizes.size();
+  profile.segmentPoints = sizes.empty() ? 0 : quint64(sizes.back().second);
+  return true;
+}
+
+bool Storage::deleteSegmentLod(qint64 segmentId)
+{
+  auto sql = preparedQuery("DELETE FROM `track_segment_lod` WHERE `segment_id` = :id;");
+  sql->bindValue(":id", segmentId);
+  sql->exec();
+  if (sql->lastError().isValid()) {
+    qWarning() << "Deleting lod of segment" << segmentId << "failed" << sql->lastError();
+    emit error(tr("Deleting simplified nodes of segment %1 failed: %2").arg(segmentId).arg(sql->lastError().text()));
+    return false;
+  }
+  return true;
+}
+
+bool Storage::insertSegment(qint64 trackId, const std::vector<gpx::TrackPoint> &points, qint64 &segmentId)
+{
+  auto sql = preparedQuery(sqlInsertTrackSegment());
+  sql->bindValue(":track_id", trackId);
+  sql->bindValue(":open", false);
+  sql->bindValue(":creation_time", dateTimeToSQL(QDateTime::currentDateTime()));
+  sql->bindValue(":point_count", qint64(points.size()));
+  sql->bindValue(":points", points.empty() ? QVariant() : QVariant(TrackPointBlob::encode(points, TrackDataChunkSize)));
+  bindSegmentStatistics(*sql, computeSegmentStatistics(points));
+  sql->exec();
+  if (sql->lastError().isValid()) {
+    qWarning() << "Segment creation failed" << sql->lastError();
+    emit error(tr("Segment creation failed: %1").arg(sql->lastError().text()));
+    return false;
+  }
+  segmentId = varToLong(sql->lastInsertId());
+  return true;
+}
+
+bool Storage::storeSegmentStatistics(qint64 segmentId, const TrackStatistics &statistics)
+{
+  auto sql = preparedQuery(QString("UPDATE `track_segment` SET ")
+                             .append("`distance` = :distance, `from_time` = :from_time, `to_time` = :to_time, ")
+                             .append("`raw_distance` = :raw_distance, `moving_duration` = :moving_duration, `max_speed` = :max_speed, ")
+                             .append("`ascent` = :ascent, `descent` = :descent, `min_elevation` = :min_elevation, `max_elevation` = :max_elevation, ")
+                             .append("`bbox_min_lat` = :bbox_min_lat, `bbox_min_lon` = :bbox_min_lon, `bbox_max_lat` = :bbox_max_lat, `bbox_max_lon` = :bbox_max_lon ")
+                             .append("WHERE `id` = :id;"));
+  bindSegmentStatistics(*sql, statistics);
+  sql->bindValue(":id", segmentId);
+  sql->exec();
+  if (sql->lastError().isValid()) {
+    qWarning() << "Storing statistics of segment" << segmentId << "failed" << sql->lastError();
+    emit error(tr("Storing statistics of segment %1 failed: %2").arg(segmentId).arg(sql->lastError().text()));
+    return false;
+  }
+  return true;
+}
+
+TrackStatistics Storage::computeSegmentStatistics(const std::vector<gpx::TrackPoint> &points) const
+{
+  TrackStatisticsAccumulator acc;
+  for (const auto &point: points) {
+    acc.update(point);
+  }
+  acc.segmentEnd();
+  return acc.accumulate();
+}
+
+void Storage::bindSegmentStatistics(QSqlQuery &sql, const TrackStatistics &statistics) const
+{
+  sql.bindValue(":distance", statistics.distance.AsMeter());
+  sql.bindValue(":from_time", statistics.from.isValid() ? QVariant(statistics.from.toMSecsSinceEpoch()) : QVariant());
+  sql.bindValue(":to_time", statistics.to.isValid() ? QVariant(statistics.to.toMSecsSinceEpoch()) : QVariant());
+  sql.bindValue(":raw_distance", statistics.rawDistance.AsMeter());
+  sql.bindValue(":moving_duration", statistics.movingDurationMillis());
+  sql.bindValue(":max_speed", statistics.maxSpeed);
+  sql.bindValue(":ascent", statistics.ascent.AsMeter());
+  sql.bindValue(":descent", statistics.descent.AsMeter());
+  sql.bindValue(":min_elevation", statistics.minElevation.has_value() ? QVariant::fromValue(statistics.minElevation->AsMeter()) : QVariant());
+  sql.bindValue(":max_elevation", statistics.maxElevation.has_value() ? QVariant::fromValue(statistics.maxElevation->AsMeter()) : QVariant());
+
+  sql.bindValue(":bbox_min_lat", statistics.bbox.IsValid() ? statistics.bbox.GetMinLat() : -1000);
+  sql.bindValue(":bbox_min_lon", statistics.bbox.IsValid() ? statistics.bbox.GetMinLon() : -1000);
+  sql.bindValue(":bbox_max_lat", statistics.bbox.IsValid() ? statistics.bbox.GetMaxLat() : -1000);
+  sql.bindValue(":bbox_max_lon", statistics.bbox.IsValid() ? statistics.bbox.GetMaxLon() : -1000);
+}
+
+TrackStatistics Storage::makeSegmentStatistics(QSqlQuery &sql) const
+{
+  GeoBox bbox(GeoCoord(varToDouble(sql.value("bbox_min_lat")),
+                       varToDouble(sql.value("bbox_min_lon"))),
+              GeoCoord(varToDouble(sql.value("bbox_max_lat")),
+                       varToDouble(sql.value("bbox_max_lon"))));
+
+  if (bbox.GetMinCoord().GetLat() < -90 || bbox.GetMinCoord().GetLon() < -180){
+    bbox.Invalidate();
+  }
+
+  QVariant fromVar = sql.value("from_time");
+  QVariant toVar = sql.value("to_time");
+  QDateTime from = fromVar.isNull() ? QDateTime() : QDateTime::fromMSecsSinceEpoch(varToLong(fromVar));
+  QDateTime to = toVar.isNull() ? QDateTime() : QDateTime::fromMSecsSinceEpoch(varToLong(toVar));
+
+  // duration and speeds are computed after merge
+  return TrackStatistics(from,
+                         to,
+                         Distance::Of<Meter>(varToDouble(sql.value("distance"))),
+                         Distance::Of<Meter>(varToDouble(sql.value("raw_distance"))),
+                         Timestamp::duration::zero(),
+                         std::chrono::milliseconds(varToLong(sql.value("moving_duration"))),
+                         varToDouble(sql.value("max_speed")),
+                         -1,
+                         -1,
+                         Distance::Of<Meter>(varToDouble(sql.value("ascent"))),
+                         Distance::Of<Meter>(varToDouble(sql.value("descent"))),
+                         varToDistanceOpt(sql.value("min_elevation")),
+                         varToDistanceOpt(sql.value("max_elevation")),
+                         bbox);
+}
+
+bool Storage::updateTrackStatisticsFromSegments(qint64 trackId, TrackStatistics &statistics)
+{
+  QElapsedTimer timer;
+  timer.start();
+
+  // track segments were modified, accumulator state and cached elevation profile don't match them anymore
+  if (!clearStatisticsState(trackId) || !deleteElevationProfile(trackId)) {
+    return false;
+  }
 
-    point.timestamp = varLongToOptTimestamp(sql.value(iTimestamp));
-    point.elevation = varToDoubleOpt(sql.value(iElevation));
+  std::vector<std::pair<qint64, std::optional<TrackStatistics>>> segments;
+  {
+    auto sql = preparedQuery(QString("SELECT `id`, `distance`, `from_time`, `to_time`, `raw_distance`, `moving_duration`, `max_speed`, ")
+                               .append("`ascent`, `descent`, `min_elevation`, `max_elevation`, ")
+                               .append("`bbox_min_lat`, `bbox_min_lon`, `bbox_max_lat`, `bbox_max_lon` ")
+                               .append("FROM `track_segment` WHERE `track_id` = :trackId ORDER BY `id`;"));
+    sql->bindValue(":trackId", trackId);
+    sql->exec();
+    if (sql->lastError().isValid()) {
+      qWarning() << "Loading segment statistics of track" << trackId << "failed" << sql->lastError();
+      emit error(tr("Loading segments for track id %1 failed: %2").arg(trackId).arg(sql->lastError().text()));
+      return false;
+    }
+    while (sql->next()) {
+      if (sql->value("raw_distance").isNull()) {
+        segments.emplace_back(varToLong(sql->value("id")), std::nullopt);
+      } else {
+        segments.emplace_back(varToLong(sql->value("id")), makeSegmentStatistics(*sql));
+      }
+    }
+  }
 
-    // see TrackPoint notes
-    point.hdop = varToDoubleOpt(sql.value(iHorizAcc));
-    point.vdop = varToDoubleOpt(sql.value(iVertAcc));
+  TrackStatisticsAccumulator acc;
+  size_t computed = 0;
+  for (auto &[segmentId, segmentStatistics]: segments) {
+    if (!segmentStatistics) {
+      // statistics of segment are not computed yet
+      gpx::TrackSegment segment;
+      if (!loadTrackPoints(segmentId, segment)) {
+        return false;
+      }
+      segmentStatistics = computeSegmentStatistics(segment.points);
+      if (!storeSegmentStatistics(segmentId, *segmentStatistics)) {
+        return false;
+      }
+      computed++;
+    }
+    acc.merge(TrackStatisticsAccumulator(*segmentStatistics));
   }
-  // qDebug() << "    segment" << segmentId << "loading:" << timer.elapsed() << "ms";
+  statistics = acc.accumulate();
+  qDebug() << "Statistics of track" << trackId << "merged from" << segments.size() << "segments"
+           << "(" << computed << "computed) in" << timer.elapsed() << "ms";
+
+  return updateTrackStatistics(trackId, statistics);
 }
 
 bool Storage::loadTrackDataPrivate(Track &track, std::optional<double> accuracyFilter)
@@ -932,26 +2087,26 @@ bool Storage::loadTrackDataPrivate(Track &track, std::optional<double> accuracyF
   QElapsedTimer timer;
   timer.start();
 
-  QSqlQuery sqlTrack(db);
-  sqlTrack.prepare("SELECT * FROM `track` WHERE id = :trackId;");
-  sqlTrack.bindValue(":trackId", track.id);
-  sqlTrack.exec();
+  auto sqlTrack = preparedQuery("SELECT * FROM `track` WHERE id = :trackId;");
+  sqlTrack->bindValue(":trackId", track.id);
+  sqlTrack->exec();
 
   // qDebug() << "  track sql" << track.id << ":" << timer.elapsed() << "ms";
 
-  if (sqlTrack.lastError().isValid()) {
-    qWarning() << "Loading track id" << track.id << "fails: " << sqlTrack.lastError();
+  if (sqlTrack->lastError().isValid()) {
+    qWarning() << "Loading track id" << track.id << "fails: " << sqlTrack->lastError();
     emit error(tr("Loading track id %1 fails").arg(track.id));
     return false;
   }
 
-  if (!sqlTrack.next()) {
+  if (!sqlTrack->next()) {
     qWarning() << "Track id" << track.id << "don't exists";
     emit error(tr("Track id %1 don't exists").arg(track.id));
     return false;
   }
 
-  track = makeTrack(sqlTrack);
+  track = makeTrack(*sqlTrack);
+  sqlTrack->finish();
   // qDebug() << "  make track" << track.id << ":" << timer.elapsed() << "ms";
 
   emit trackDataLoaded(track, accuracyFilter, false, true);
@@ -968,24 +2123,10 @@ bool Storage::loadTrackDataPrivate(Track &track, std::optional<double> accuracyF
   }
   track.data->displayColor = track.color;
 
-  QSqlQuery sql(db);
-  sql.prepare("SELECT `id` FROM `track_segment` WHERE track_id = :trackId;");
-  sql.bindValue(":trackId", track.id);
-  sql.exec();
-
-  // qDebug() << "  track_segment sql" << track.id << ":" << timer.elapsed() << "ms";
-  if (sql.lastError().isValid()) {
-    qWarning() << "Loading segments for track id" << track.id << "failed";
-    emit error(tr("Loading segments for track id %1 failed: %2").arg(track.id).arg(sql.lastError().text()));
-  }else{
-    while (sql.next()) {
-      track.data->segments.emplace_back();
-      long segmentId = varToLong(sql.value("id"));
-      // qDebug() << "  track_segment " << segmentId << "before:" << timer.elapsed() << "ms";
-      loadTrackPoints(segmentId, track.data->segments.back());
-      // qDebug() << "  track_segment " << segmentId << "after:" << timer.elapsed() << "ms";
-    }
+  if (!loadTrackSegments(track.id, track.data->segments)) {
+    return false;
   }
+  // qDebug() << "  track_segment" << track.id << ":" << timer.elapsed() << "ms";
 
   if (accuracyFilter){
     track.data->FilterPoints([accuracyFilter](std::vector<osmscout::gpx::TrackPoint> &points){
@@ -998,20 +2139,251 @@ bool Storage::loadTrackDataPrivate(Track &track, std::optional<double> accuracyF
   return true;
 }
 
-void Storage::loadTrackData(Track track, std::optional<double> accuracyFilter)
+void Storage::registerTrackDataRequest(Track track, std::optional<double> accuracyFilter, QObject *requester)
+{
+  QMutexLocker locker(&trackRequestMutex);
+  pendingTrackRequests[TrackRequestKey(requester, track.id, accuracyFilter)]++;
+}
+
+bool Storage::takeTrackDataRequest(const TrackRequestKey &key)
+{
+  QMutexLocker locker(&trackRequestMutex);
+  auto it = pendingTrackRequests.find(key);
+  if (it == pendingTrackRequests.end()) {
+    return true; // request was not registered
+  }
+  if (--(it->second) == 0) {
+    pendingTrackRequests.erase(it);
+    return true;
+  }
+  return false;
+}
+
+bool Storage::hasNewerTrackDataRequest(const TrackRequestKey &key)
+{
+  QMutexLocker locker(&trackRequestMutex);
+  return pendingTrackRequests.find(key) != pendingTrackRequests.end();
+}
+
+void Storage::loadTrackData(Track track, std::optional<double> accuracyFilter, QObject *requester)
 {
+  TrackRequestKey requestKey(requester, track.id, accuracyFilter);
+  if (!takeTrackDataRequest(requestKey)) {
+    qDebug() << "Skip loading of track" << track.id << ", there is newer request";
+    return;
+  }
+
   if (!checkAccess(__FUNCTION__)){
-    emit trackDataLoaded(track, accuracyFilter, true, false);
+    emit trackDataLoaded(track, accuracyFilter, true, false, requester);
     return;
   }
 
-  if (loadTrackDataPrivate(track, accuracyFilter)) {
-    emit trackDataLoaded(track, accuracyFilter, true, true);
-  }else{
-    emit trackDataLoaded(track, accuracyFilter, true, false);
+  qDebug() << "Loading track data" << track.id;
+  QElapsedTimer timer;
+  timer.start();
+
+  if (!trackHeader(track.id, track)) {
+    emit error(tr("Loading track id %1 fails").arg(track.id));
+    emit trackDataLoaded(track, accuracyFilter, true, false, requester);
+    return;
+  }
+  emit trackDataLoaded(track, accuracyFilter, false, true, requester);
+
+  // Points are emitted in chunks as they are decoded from database, so neither storage
+  // nor requester holds the track twice. Statistics of filtered track are accumulated on the way.
+  bool cancelled = false;
+  TrackStatisticsAccumulator acc;
+  std::optional<size_t> currentSegment;
+  size_t pointCount = 0;
+  auto chunkLoaded = [&](size_t segmentIndex, qint64, std::vector<gpx::TrackPoint> &&points) -> bool {
+    if (hasNewerTrackDataRequest(requestKey)) {
+      qDebug() << "Loading of track" << track.id << "cancelled, there is newer request";
+      cancelled = true;
+      return false;
+    }
+    if (accuracyFilter) {
+      gpx::FilterInaccuratePoints(points, *accuracyFilter);
+      if (currentSegment && *currentSegment != segmentIndex) {
+        acc.segmentEnd();
+      }
+      for (const auto &point: points) {
+        acc.update(point);
+      }
+    }
+    currentSegment = segmentIndex;
+    pointCount += points.size();
+    auto chunk = std::make_shared<std::vector<gpx::TrackPoint>>(std::move(points));
+    emit trackDataChunkLoaded(track, accuracyFilter, segmentIndex, accountResult(chunk, vectorBytes(*chunk)), requester);
+    return true;
+  };
+
+  if (streamTrackSegments(track.id, chunkLoaded)) {
+    if (accuracyFilter) {
+      if (currentSegment) {
+        acc.segmentEnd();
+      }
+      track.statistics = acc.accumulate();
+    }
+    qDebug() << "  track" << track.id << "data loading:" << timer.elapsed() << "ms," << pointCount << "points";
+    emit trackDataLoaded(track, accuracyFilter, true, true, requester);
+  } else if (!cancelled) {
+    emit trackDataLoaded(track, accuracyFilter, true, false, requester);
   }
 }
 
+void Storage::loadTrackLod(Track track, int level)
+{
+  auto segments = std::make_shared<std::vector<std::vector<GeoCoord>>>();
+  if (!checkAccess(__FUNCTION__)){
+    emit trackLodLoaded(track, level, segments, false);
+    return;
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+
+  level = std::clamp(level, 0, TrackLod::LevelCount - 1);
+  if (level == 0) {
+    std::vector<gpx::TrackSegment> data;
+    if (!loadTrackSegments(track.id, data)) {
+      emit trackLodLoaded(track, level, segments, false);
+      return;
+    }
+    segments->reserve(data.size());
+    for (const auto &segment: data) {
+      auto &coords = segments->emplace_back();
+      coords.reserve(segment.points.size());
+      for (const auto &p: segment.points) {
+        coords.push_back(p.coord);
+      }
+    }
+    emit trackLodLoaded(track, level, accountResult(segments, vectorBytes(*segments)), true);
+    return;
+  }
+
+  struct MissingLod {
+    size_t index;
+    qint64 segmentId;
+    bool growing; // points are still appended to the segment, its lod is not stored
+  };
+  std::vector<MissingLod> missing;
+  {
+    // segment with appended chunks or the last segment of open track is growing during recording,
+    // its lod would be outdated with the next appended batch
+    auto sql = preparedQuery(QString("SELECT `s`.`id`, `l`.`points`, `l`.`segment_id` IS NULL AS `missing`, ")
+                               .append("EXISTS (SELECT 1 FROM `track_segment_chunk` AS `c` WHERE `c`.`segment_id` = `s`.`id`) OR ")
+                               .append("(`t`.`open` = 1 AND `s`.`id` = (SELECT MAX(`id`) FROM `track_segment` WHERE `track_id` = :lastTrackId)) AS `growing` ")
+                               .append("FROM `track_segment` AS `s` JOIN `track` AS `t` ON `t`.`id` = `s`.`track_id` ")
+                               .append("LEFT JOIN `track_segment_lod` AS `l` ")
+                               .append("ON `l`.`segment_id` = `s`.`id` AND `l`.`level` = :level ")
+                               .append("WHERE `s`.`track_id` = :trackId ORDER BY `s`.`id`;"));
+    sql->bindValue(":lastTrackId", track.id);
+    sql->bindValue(":level", level);
+    sql->bindValue(":trackId", track.id);
+    sql->exec();
+    if (sql->lastError().isValid()) {
+      qWarning() << "Loading lod of track" << track.id << "failed" << sql->lastError();
+      emit error(tr("Loading segments for track id %1 failed: %2").arg(track.id).arg(sql->lastError().text()));
+      emit trackLodLoaded(track, level, segments, false);
+      return;
+    }
+    while (sql->next()) {
+      qint64 segmentId = varToLong(sql->value(0));
+      bool growing = sql->value(3).toBool();
+      auto &coords = segments->emplace_back();
+      if (sql->value(2).toBool() || growing) {
+        missing.push_back(MissingLod{segments->size() - 1, segmentId, growing});
+        continue;
+      }
+      QByteArray blob = sql->value(1).toByteArray();
+      if (!TrackLod::decode(blob.constData(), size_t(blob.size()), coords)) {
+        qWarning() << "Decoding lod of segment" << segmentId << "failed";
+        coords.clear();
+        missing.push_back(MissingLod{segments->size() - 1, segmentId, false});
+      }
+    }
+  }
+
+  if (!missing.empty()) {
+    // pyramid is not computed yet (track recorded or edited), compute all levels of segment
+    db.transaction();
+    bool stored = true;
+    for (const auto &[index, segmentId, growing]: missing) {
+      gpx::TrackSegment segment;
+      if (!loadTrackPoints(segmentId, segment)) {
+        db.rollback();
+        emit trackLodLoaded(track, level, segments, false);
+        return;
+      }
+      if (growing) {
+        // just the requested level is needed, it is simplified from all points directly
+        std::vector<GeoCoord> coords;
+        coords.reserve(segment.points.size());
+        for (const auto &p: segment.points) {
+          coords.push_back(p.coord);
+        }
+        (*segments)[index] = TrackLod::simplify(coords, TrackLod::levelTolerance(level));
+        continue;
+      }
+      auto levels = TrackLod::pyramid(segment.points);
+      stored = stored && storeSegmentLod(segmentId, levels);
+      (*segments)[index] = std::move(levels[level - 1]);
+    }
+    if (!stored || !db.commit()) {
+      // it is just cache, it will be computed next time again
+      qWarning() << "Storing lod of track" << track.id << "failed";
+      db.rollback();
+    }
+  }
+
+  qDebug() << "Track" << track.id << "lod" << level << "loaded in" << timer.elapsed() << "ms,"
+           << missing.size() << "of" << segments->size() << "segments computed";
+  emit trackLodLoaded(track, level, accountResult(segments, vectorBytes(*segments)), true);
+}
+
+void Storage::loadElevationProfile(Track track, std::optional<double> accuracyFilter, int buckets)
+{
+  auto points = std::make_shared<std::vector<ElevationProfilePoint>>();
+  if (!checkAccess(__FUNCTION__)){
+    emit elevationProfileLoaded(track, accuracyFilter, points, false);
+    return;
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+
+  // requester may hold outdated metadata, cache is validated by current modification time
+  if (!trackHeader(track.id, track)) {
+    emit elevationProfileLoaded(track, accuracyFilter, points, false);
+    return;
+  }
+
+  CachedElevationProfile profile;
+  bool cached = loadCachedElevationProfile(track.id, accuracyFilter, profile) &&
+                profile.modification == track.lastModification;
+  if (!cached) {
+    // profile of recorded track is extended by appended points,
+    // it is computed from the beginning when there is no usable cached profile
+    if (!extendElevationProfile(track.id, accuracyFilter, profile)) {
+      profile = CachedElevationProfile{};
+      if (!extendElevationProfile(track.id, accuracyFilter, profile)) {
+        emit elevationProfileLoaded(track, accuracyFilter, points, false);
+        return;
+      }
+    }
+    profile.modification = track.lastModification;
+    if (!storeElevationProfile(track.id, accuracyFilter, profile)) {
+      // it is just cache, it will be computed next time again
+      qWarning() << "Storing elevation profile of track" << track.id << "failed";
+    }
+  }
+
+  *points = ElevationProfile::decimate(profile.points, size_t(std::max(buckets, 1)));
+  qDebug() << "Elevation profile of track" << track.id << (cached ? "loaded" : "updated") << "in" << timer.elapsed() << "ms,"
+           << points->size() << "points";
+  emit elevationProfileLoaded(track, accuracyFilter, accountResult(points, vectorBytes(*points)), true);
+}
+
 void Storage::updateOrCreateCollection(Collection collection)
 {
   if (!checkAccess(__FUNCTION__)){
@@ -1172,54 +2544,64 @@ bool Storage::importWaypoints(const gpx::GpxFile &gpxFile, qint64 collectionId)
 {
   using namespace std::string_literals;
 
+  auto insertSql = [](size_t rows) {
+    QString sql("INSERT INTO `waypoint` (`collection_id`, `timestamp`, `modification_time`, `latitude`, `longitude`, `elevation`, `name`, `description`, `symbol`, `visible`) VALUES ");
+    for (size_t row = 0; row < rows; row++) {
+      sql.append(row == 0 ? "" : ", ").append("(?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+    }
+    return sql;
+  };
+
+  const QString modificationTime = dateTimeToSQL(QDateTime::currentDateTime());
+  const auto &waypoints = gpxFile.waypoints;
   int wptNum = 0;
-  db.transaction();
-  QSqlQuery sqlWpt(db);
-  sqlWpt.prepare(
-    "INSERT INTO `waypoint` (`collection_id`, `timestamp`, `modification_time`, `latitude`, `longitude`, `elevation`, `name`, `description`, `symbol`, `visible`) "
-    "VALUES                 (:collection_id,  :timestamp,  :modification_time,  :latitude,  :longitude,  :elevation,  :name,  :description,  :symbol, :visible)");
-  for (const auto &wpt: gpxFile.waypoints) {
-    wptNum++;
-
-    QString wptName = QString::fromStdString(wpt.name.value_or(""s));
-    if (wptName.isEmpty())
-      wptName = tr("waypoint %1").arg(wptNum);
-
-    sqlWpt.bindValue(":collection_id", collectionId);
-    sqlWpt.bindValue(":timestamp", dateTimeToSQL(timestampToDateTime(wpt.timestamp)));
-    sqlWpt.bindValue(":modification_time", dateTimeToSQL(QDateTime::currentDateTime()));
-    sqlWpt.bindValue(":latitude", wpt.coord.GetLat());
-    sqlWpt.bindValue(":longitude", wpt.coord.GetLon());
-    sqlWpt.bindValue(":elevation", (wpt.elevation ? *wpt.elevation : QVariant()));
-    sqlWpt.bindValue(":name", wptName);
-    sqlWpt.bindValue(":description",
-                     (wpt.description ? QString::fromStdString(*wpt.description) : QVariant()));
-    sqlWpt.bindValue(":symbol", (wpt.symbol ? QString::fromStdString(*wpt.symbol) : QVariant()));
-    sqlWpt.bindValue(":visible", true);
+
+  auto insertRows = [&](QSqlQuery &sqlWpt, size_t begin, size_t rows) -> bool {
+    int pos = 0;
+    for (size_t i = begin; i < begin + rows; i++) {
+      const auto &wpt = waypoints[i];
+      wptNum++;
+
+      QString wptName = QString::fromStdString(wpt.name.value_or(""s));
+      if (wptName.isEmpty())
+        wptName = tr("waypoint %1").arg(wptNum);
+
+      sqlWpt.bindValue(pos++, collectionId);
+      sqlWpt.bindValue(pos++, dateTimeToSQL(timestampToDateTime(wpt.timestamp)));
+      sqlWpt.bindValue(pos++, modificationTime);
+      sqlWpt.bindValue(pos++, wpt.coord.GetLat());
+      sqlWpt.bindValue(pos++, wpt.coord.GetLon());
+      sqlWpt.bindValue(pos++, (wpt.elevation ? *wpt.elevation : QVariant()));
+      sqlWpt.bindValue(pos++, wptName);
+      sqlWpt.bindValue(pos++, (wpt.description ? QString::fromStdString(*wpt.description) : QVariant()));
+      sqlWpt.bindValue(pos++, (wpt.symbol ? QString::fromStdString(*wpt.symbol) : QVariant()));
+      sqlWpt.bindValue(pos++, true);
+    }
 
     sqlWpt.exec();
     if (sqlWpt.lastError().isValid()) {
       qWarning() << "Import of waypoints failed" << sqlWpt.lastError();
       emit error(tr("Import of waypoints failed: %1").arg(sqlWpt.lastError().text()));
-      if (!db.rollback()) {
-        qWarning() << "Transaction rollback failed" << db.lastError();
-      }
       return false;
     }
-    // commit batch WayPointBatchSize queries
-    if (wptNum % WayPointBatchSize == 0) {
-      if (!db.commit()) {
-        emit error(tr("Transaction commit failed: %1").arg(db.lastError().text()));
-        qWarning() << "Transaction commit failed" << db.lastError();
-        return false;
-      }
-      db.transaction();
+    return true;
+  };
+
+  // full batches share one cached statement
+  const QString batchSql = insertSql(WaypointInsertRows);
+  size_t begin = 0;
+  for (; begin + WaypointInsertRows <= waypoints.size(); begin += WaypointInsertRows) {
+    auto sqlWpt = preparedQuery(batchSql);
+    if (!insertRows(*sqlWpt, begin, WaypointInsertRows)) {
+      return false;
     }
   }
-  if (!db.commit()) {
-    emit error(tr("Transaction commit failed: %1").arg(db.lastError().text()));
-    qWarning() << "Transaction commit failed" << db.lastError();
-    return false;
+  if (begin < waypoints.size()) {
+    QSqlQuery sqlWpt(db);
+    sqlWpt.prepare(insertSql(waypoints.size() - begin));
+    if (!insertRows(sqlWpt, begin, waypoints.size() - begin)) {
+      return false;
+    }
   }
   return true;
 }
@@ -1325,6 +2707,119 @@ void TrackStatisticsAccumulator::segmentEnd()
   elevationFilter.flush();
 }
 
+void TrackStatisticsAccumulator::merge(const TrackStatisticsAccumulator &following)
+{
+  segmentEnd();
+
+  // filter
+  rawCount += following.rawCount;
+  filteredCnt += following.filteredCnt;
+
+  // duration accumulator
+  if (!from.has_value()) {
+    from = following.from;
+  }
+  if (following.to.has_value()) {
+    to = following.to;
+  }
+
+  // bbox
+  if (following.bbox.IsValid()) {
+    bbox.Include(following.bbox);
+  }
+
+  // distance
+  length += following.length;
+  rawLength += following.rawLength;
+
+  // max speed, moving duration
+  maxSpeedBuf.setMaxSpeed(std::max(maxSpeedBuf.getMaxSpeed(), following.maxSpeedBuf.getMaxSpeed()));
+  movingDuration += following.movingDuration;
+
+  // elevation
+  elevationFilter.merge(following.elevationFilter);
+}
+
+QByteArray TrackStatisticsAccumulator::serialize() const
+{
+  QByteArray state;
+  QDataStream out(&state, QIODevice::WriteOnly);
+  out.setVersion(QDataStream::Qt_5_6);
+  out << AccumulatorStateVersion;
+
+  out << quint64(rawCount) << quint64(filteredCnt);
+  serializeValue(out, maxDilution);
+  serializeValue(out, filterLastPoint);
+  serializeValue(out, minDistance);
+  serializeValue(out, from);
+  serializeValue(out, to);
+  out << bbox.IsValid();
+  if (bbox.IsValid()) {
+    serializeValue(out, bbox.GetMinCoord());
+    serializeValue(out, bbox.GetMaxCoord());
+  }
+  serializeValue(out, filterLastCoord);
+  serializeValue(out, length);
+  serializeValue(out, lastCoord);
+  serializeValue(out, rawLength);
+  maxSpeedBuf.serializeState(out);
+  serializeValue(out, previousTime);
+  serializeValue(out, movingDuration);
+  elevationFilter.serializeState(out);
+
+  return state;
+}
+
+std::optional<TrackStatisticsAccumulator> TrackStatisticsAccumulator::deserialize(const QByteArray &state)
+{
+  if (state.isEmpty()) {
+    return std::nullopt;
+  }
+  QDataStream in(state);
+  in.setVersion(QDataStream::Qt_5_6);
+  quint8 version = 0;
+  in >> version;
+  if (version != AccumulatorStateVersion) {
+    qWarning() << "Unsupported accumulator state version" << version;
+    return std::nullopt;
+  }
+
+  TrackStatisticsAccumulator acc;
+  quint64 rawCount = 0;
+  quint64 filteredCnt = 0;
+  in >> rawCount >> filteredCnt;
+  acc.rawCount = rawCount;
+  acc.filteredCnt = filteredCnt;
+  deserializeValue(in, acc.maxDilution);
+  deserializeValue(in, acc.filterLastPoint);
+  deserializeValue(in, acc.minDistance);
+  deserializeValue(in, acc.from);
+  deserializeValue(in, acc.to);
+  bool bboxValid = false;
+  in >> bboxValid;
+  if (bboxValid) {
+    GeoCoord minCoord;
+    GeoCoord maxCoord;
+    deserializeValue(in, minCoord);
+    deserializeValue(in, maxCoord);
+    acc.bbox = GeoBox(minCoord, maxCoord);
+  }
+  deserializeValue(in, acc.filterLastCoord);
+  deserializeValue(in, acc.length);
+  deserializeValue(in, acc.lastCoord);
+  deserializeValue(in, acc.rawLength);
+  acc.maxSpeedBuf.deserializeState(in);
+  deserializeValue(in, acc.previousTime);
+  deserializeValue(in, acc.movingDuration);
+  acc.elevationFilter.deserializeState(in);
+
+  if (in.status() != QDataStream::Ok || !in.atEnd()) {
+    qWarning() << "Accumulator state is corrupted";
+    return std::nullopt;
+  }
+  return std::make_optional(std::move(acc));
+}
+
 TrackStatistics TrackStatisticsAccumulator::accumulate() const
 {
   osmscout::Timestamp::duration duration{0};
@@ -1465,20 +2960,70 @@ bool Storage::importTracks(const gpx::GpxFile &gpxFile, qint64 collectionId)
 {
   using namespace std::string_literals;
 
-  int trkNum = 0;
-  QSqlQuery sqlTrk=trackInsertSql();
+  // CPU heavy part of the import (statistics, segment encoding) is computed in parallel,
+  // results are written to database by the Storage thread in track order
+  struct EncodedTrack {
+    TrackStatistics statistics;
+    std::vector<TrackStatistics> segmentStatistics;
+    std::vector<QByteArray> segmentPoints;
+    std::vector<std::vector<std::vector<GeoCoord>>> segmentLod;
+  };
 
-  QSqlQuery sqlSeg(db);
-  sqlSeg.prepare("INSERT INTO `track_segment` (`track_id`, `open`, `creation_time`, `distance`) VALUES (:track_id, :open, :creation_time, :distance)");
+  const auto &tracks = gpxFile.tracks;
+  std::vector<EncodedTrack> encoded(tracks.size());
+  std::unique_ptr<std::atomic_bool[]> ready(new std::atomic_bool[tracks.size()]);
+  for (size_t i = 0; i < tracks.size(); i++) {
+    ready[i] = false;
+  }
+  std::atomic_size_t nextToEncode{0};
+  std::atomic_bool aborted{false};
+  // writer waits for encoded tracks when there is nothing to encode
+  QMutex readyMutex;
+  QWaitCondition readyCondition;
+
+  auto encodeNext = [&]() -> bool {
+    size_t i = nextToEncode++;
+    if (i >= tracks.size()) {
+      return false;
+    }
+    const gpx::Track &trk = tracks[i];
+    EncodedTrack &result = encoded[i];
+    // track statistics are merged from segment statistics
+    TrackStatisticsAccumulator trackAcc;
+    result.segmentStatistics.reserve(trk.segments.size());
+    result.segmentPoints.reserve(trk.segments.size());
+    result.segmentLod.reserve(trk.segments.size());
+    for (auto const &seg: trk.segments){
+      TrackStatisticsAccumulator segmentAcc;
+      for (const auto &point: seg.points) {
+        segmentAcc.update(point);
+      }
+      segmentAcc.segmentEnd();
+      result.segmentStatistics.push_back(segmentAcc.accumulate());
+      trackAcc.merge(segmentAcc);
+      result.segmentPoints.push_back(TrackPointBlob::encode(seg.points, TrackDataChunkSize));
+      result.segmentLod.push_back(TrackLod::pyramid(seg.points));
+    }
+    result.statistics = trackAcc.accumulate();
+    {
+      QMutexLocker locker(&readyMutex);
+      ready[i].store(true, std::memory_order_release);
+    }
+    readyCondition.wakeAll();
+    return true;
+  };
+
+  QSqlQuery sqlTrk=trackInsertSql();
+  const QString creationTime = dateTimeToSQL(QDateTime::currentDateTime());
 
-  for (const auto &trk: gpxFile.tracks){
-    trkNum++;
+  auto writeTrack = [&](size_t i) -> bool {
+    const gpx::Track &trk = tracks[i];
+    EncodedTrack &enc = encoded[i];
 
     QString trackName = QString::fromStdString(trk.name.value_or(""s));
     if (trackName.isEmpty())
-      trackName = tr("track %1").arg(trkNum);
+      trackName = tr("track %1").arg(i + 1);
 
-    TrackStatistics stat = computeTrackStatistics(trk);
     QStringOpt desc = trk.desc ?
                       QStringOpt(QString::fromStdString(*trk.desc)) :
                       std::nullopt;
@@ -1487,7 +3032,7 @@ bool Storage::importTracks(const gpx::GpxFile &gpxFile, qint64 collectionId)
     QString type = trk.type.has_value() ? QString::fromStdString(*trk.type) : QString();
     prepareTrackInsert(sqlTrk, collectionId, trackName, desc,
                        trk.displayColor, type, true,
-                       stat, false);
+                       enc.statistics, false);
 
     sqlTrk.exec();
     if (sqlTrk.lastError().isValid()) {
@@ -1498,81 +3043,129 @@ bool Storage::importTracks(const gpx::GpxFile &gpxFile, qint64 collectionId)
 
     qint64 trackId = varToLong(sqlTrk.lastInsertId());
 
-    for (auto const &seg: trk.segments){
-      sqlSeg.bindValue(":track_id", trackId);
-      sqlSeg.bindValue(":open", false);
-
-      // TODO: do we need segment statics?
-      sqlSeg.bindValue(":creation_time", dateTimeToSQL(QDateTime::currentDateTime()));
-      sqlSeg.bindValue(":distance", seg.GetLength().AsMeter());
-      sqlSeg.exec();
-      if (sqlSeg.lastError().isValid()) {
-        qWarning() << "Import of segments failed" << sqlSeg.lastError();
-        emit error(tr("Import of segments failed: %1").arg(sqlSeg.lastError().text()));
+    for (size_t segIndex = 0; segIndex < trk.segments.size(); segIndex++){
+      auto sqlSeg = preparedQuery(sqlInsertTrackSegment());
+      sqlSeg->bindValue(":track_id", trackId);
+      sqlSeg->bindValue(":open", false);
+      sqlSeg->bindValue(":creation_time", creationTime);
+      sqlSeg->bindValue(":point_count", qint64(trk.segments[segIndex].points.size()));
+      sqlSeg->bindValue(":points", enc.segmentPoints[segIndex].isEmpty() ? QVariant() : QVariant(enc.segmentPoints[segIndex]));
+      bindSegmentStatistics(*sqlSeg, enc.segmentStatistics[segIndex]);
+      sqlSeg->exec();
+      if (sqlSeg->lastError().isValid()) {
+        qWarning() << "Import of segments failed" << sqlSeg->lastError();
+        emit error(tr("Import of segments failed: %1").arg(sqlSeg->lastError().text()));
         return false;
       }
-      qint64 segmentId = varToLong(sqlSeg.lastInsertId());
-
-      if (!importTrackPoints(seg.points, segmentId)){
-        qWarning() << "Import of track points failed" << sqlSeg.lastError();
-        emit error(tr("Import of track points failed: %1").arg(sqlSeg.lastError().text()));
+      qint64 segmentId = varToLong(sqlSeg->lastInsertId());
+      if (!storeSegmentLod(segmentId, enc.segmentLod[segIndex])) {
+        emit error(tr("Import of segments failed"));
         return false;
       }
-      qDebug() << "Imported" << seg.points.size() << "points to segment" << segmentId << "for track" << trackId;
     }
-    qDebug() << "Imported track " << trackId;
+    qDebug() << "Imported track" << trackId << "with" << trk.segments.size() << "segments";
+    enc = EncodedTrack(); // release encoded data
+    return true;
+  };
+
+  bool success = true;
+#pragma omp parallel
+  {
+#ifdef _OPENMP
+    bool writer = omp_get_thread_num() == 0; // master thread is the Storage thread, owner of db connection
+#else
+    bool writer = true;
+#endif
+    if (writer) {
+      for (size_t i = 0; i < tracks.size(); i++) {
+        // help to workers while waiting, it is necessary when there is just one thread
+        while (!ready[i].load(std::memory_order_acquire) && encodeNext()) {}
+        QMutexLocker locker(&readyMutex);
+        while (!ready[i].load(std::memory_order_acquire)) {
+          readyCondition.wait(&readyMutex);
+        }
+        locker.unlock();
+        if (!writeTrack(i)) {
+          success = false;
+          aborted = true;
+          break;
+        }
+      }
+    } else {
+      while (!aborted && encodeNext()) {}
+    }
   }
-  return true;
+  return success;
 }
 
-bool Storage::importTrackPoints(const std::vector<gpx::TrackPoint> &points, qint64 segmentId)
+bool Storage::appendTrackPoints(const std::vector<gpx::TrackPoint> &points, qint64 segmentId)
 {
   if (points.empty()){
     return true;
   }
 
-  size_t pointNum = 0;
-  db.transaction();
-  QSqlQuery sql(db);
-  sql.prepare(QString("INSERT INTO `track_point` ")
-               .append("(`segment_id`, `timestamp`, `latitude`, `longitude`, `elevation`, `horiz_accuracy`, `vert_accuracy`) ")
-               .append("VALUES ")
-               .append("(:segment_id, :timestamp, :latitude, :longitude, :elevation, :horiz_accuracy, :vert_accuracy)"));
-
-  for (const auto &point: points){
-    pointNum ++;
-
-    sql.bindValue(":segment_id", segmentId);
-    sql.bindValue(":timestamp", dateTimeToSQL(timestampToDateTime(point.timestamp)));
-    sql.bindValue(":latitude", point.coord.GetLat());
-    sql.bindValue(":longitude", point.coord.GetLon());
-    sql.bindValue(":elevation", point.elevation.has_value() ? *point.elevation : QVariant());
-    // read TrackPoint notes
-    sql.bindValue(":horiz_accuracy", point.hdop.has_value() ? *point.hdop : QVariant());
-    sql.bindValue(":vert_accuracy", point.vdop.has_value() ? *point.vdop : QVariant());
+  // points are stored as new chunk row, so appending is independent of the segment size,
+  // chunks are merged to the segment blob by compactSegmentChunks
+  auto sql = preparedQuery(QString("INSERT INTO `track_segment_chunk` (`segment_id`, `chunk`, `point_count`, `points`) ")
+                             .append("SELECT :segment_id, COALESCE(MAX(`chunk`), 0) + 1, :point_count, :points ")
+                             .append("FROM `track_segment_chunk` WHERE `segment_id` = :id;"));
+  sql->bindValue(":segment_id", segmentId);
+  sql->bindValue(":point_count", qint64(points.size()));
+  sql->bindValue(":points", TrackPointBlob::encode(points));
+  sql->bindValue(":id", segmentId);
+  sql->exec();
+  if (sql->lastError().isValid()) {
+    qWarning() << "Import of track points failed" << sql->lastError();
+    emit error(tr("Import of track points failed: %1").arg(sql->lastError().text()));
+    return false;
+  }
 
-    sql.exec();
-    if (sql.lastError().isValid()) {
-      qWarning() << "Import of track points failed" << sql.lastError();
-      emit error(tr("Import of track points failed: %1").arg(sql.lastError().text()));
-      if (!db.rollback()) {
-        qWarning() << "Transaction rollback failed" << db.lastError();
-      }
+  // segment statistics are invalidated, open segment statistics are tracked by Tracker
+  auto sqlUpdate = preparedQuery("UPDATE `track_segment` SET `point_count` = `point_count` + :count, `raw_distance` = NULL WHERE `id` = :id;");
+  sqlUpdate->bindValue(":count", qint64(points.size()));
+  sqlUpdate->bindValue(":id", segmentId);
+  sqlUpdate->exec();
+  if (sqlUpdate->lastError().isValid()) {
+    qWarning() << "Import of track points failed" << sqlUpdate->lastError();
+    emit error(tr("Import of track points failed: %1").arg(sqlUpdate->lastError().text()));
+    return false;
+  }
+  // lod of segment with appended chunks is not stored, see loadTrackLod
+  return true;
+}
+
+bool Storage::compactSegmentChunks(qint64 trackId)
+{
+  auto sql = preparedQuery(QString("SELECT DISTINCT `track_segment_chunk`.`segment_id` FROM `track_segment_chunk` ")
+                             .append("JOIN `track_segment` ON `track_segment`.`id` = `track_segment_chunk`.`segment_id` ")
+                             .append("WHERE `track_segment`.`track_id` = :trackId;"));
+  sql->bindValue(":trackId", trackId);
+  sql->exec();
+  if (sql->lastError().isValid()) {
+    qWarning() << "Loading chunks of track" << trackId << "failed" << sql->lastError();
+    return false;
+  }
+  std::vector<qint64> segmentIds;
+  while (sql->next()) {
+    segmentIds.push_back(varToLong(sql->value(0)));
+  }
+  sql->finish();
+  if (segmentIds.empty()) {
+    return true;
+  }
+
+  // merged blob is compressed much better than many small chunks
+  db.transaction();
+  for (qint64 segmentId: segmentIds) {
+    gpx::TrackSegment segment;
+    if (!loadTrackPoints(segmentId, segment) || !storeTrackPoints(segmentId, segment.points)) {
+      db.rollback();
       return false;
     }
-    // commit batch TrackPointBatchSize queries
-    if (pointNum % TrackPointBatchSize == 0) {
-      if (!db.commit()) {
-        emit error(tr("Transaction commit failed: %1").arg(db.lastError().text()));
-        qWarning() << "Transaction commit failed" << db.lastError();
-        return false;
-      }
-      db.transaction();
-    }
   }
   if (!db.commit()) {
-    emit error(tr("Transaction commit failed: %1").arg(db.lastError().text()));
     qWarning() << "Transaction commit failed" << db.lastError();
+    emit error(tr("Transaction commit failed: %1").arg(db.lastError().text()));
     return false;
   }
   return true;
@@ -1585,6 +3178,13 @@ void Storage::importCollection(QString filePath)
     return;
   }
 
+  applyDurabilityProfile(BulkImport);
+  importCollectionPrivate(filePath);
+  applyDurabilityProfile(durabilityProfile);
+}
+
+void Storage::importCollectionPrivate(const QString &filePath)
+{
   QElapsedTimer timer;
   timer.start();
   qDebug() << "Importing collection from" << filePath;
@@ -1602,35 +3202,59 @@ void Storage::importCollection(QString filePath)
     loadCollections();
     return;
   }
+  qint64 parseTime = timer.elapsed();
 
-  // import collection
-  QSqlQuery sql(db);
-  sql.prepare("INSERT INTO `collection` (`name`, `description`, `visible`) VALUES (:name, :description, 0);");
-  sql.bindValue(":name", gpxFile.name.has_value() ?
-                         QString::fromStdString(*gpxFile.name) : QFileInfo(filePath).baseName());
-  sql.bindValue(":description", gpxFile.desc.has_value() && !gpxFile.desc->empty() ?
-                                QString::fromStdString(*gpxFile.desc) :
-                                tr("Imported from %1").arg(filePath));
+  size_t pointCount = 0;
+  for (const auto &trk: gpxFile.tracks) {
+    for (const auto &seg: trk.segments) {
+      pointCount += seg.points.size();
+    }
+  }
 
-  sql.exec();
-  if (sql.lastError().isValid()){
-    qWarning() << "Creating collection failed" << sql.lastError();
-    emit error(tr("Creating collection failed: %1").arg(sql.lastError().text()));
+  // whole collection is imported in single transaction
+  if (!db.transaction()) {
+    qWarning() << "Transaction begin failed" << db.lastError();
+    emit error(tr("Creating collection failed: %1").arg(db.lastError().text()));
     loadCollections();
     return;
   }
-  qint64 collectionId = varToLong(sql.lastInsertId());
+  auto rollback = [&]() {
+    if (!db.rollback()) {
+      qWarning() << "Transaction rollback failed" << db.lastError();
+    }
+    loadCollections();
+  };
+
+  // import collection
+  qint64 collectionId;
+  {
+    auto sql = preparedQuery("INSERT INTO `collection` (`name`, `description`, `visible`) VALUES (:name, :description, 0);");
+    sql->bindValue(":name", gpxFile.name.has_value() ?
+                            QString::fromStdString(*gpxFile.name) : QFileInfo(filePath).baseName());
+    sql->bindValue(":description", gpxFile.desc.has_value() && !gpxFile.desc->empty() ?
+                                   QString::fromStdString(*gpxFile.desc) :
+                                   tr("Imported from %1").arg(filePath));
+
+    sql->exec();
+    if (sql->lastError().isValid()){
+      qWarning() << "Creating collection failed" << sql->lastError();
+      emit error(tr("Creating collection failed: %1").arg(sql->lastError().text()));
+      rollback();
+      return;
+    }
+    collectionId = varToLong(sql->lastInsertId());
+  }
   if (collectionId < 0){
     qWarning() << "Invalid collection id" << collectionId;
     emit error(tr("Invalid collection id: %1").arg(collectionId));
-    loadCollections();
+    rollback();
     return;
   }
 
   // import waypoints
   if (!gpxFile.waypoints.empty()) {
     if (!importWaypoints(gpxFile, collectionId)){
-      loadCollections();
+      rollback();
       return;
     }
   }
@@ -1639,12 +3263,26 @@ void Storage::importCollection(QString filePath)
   // import tracks
   if (!gpxFile.tracks.empty()) {
     if (!importTracks(gpxFile, collectionId)){
-      loadCollections();
+      rollback();
       return;
     }
   }
-  qDebug() << "Imported" << gpxFile.tracks.size() << "tracks to collection" << collectionId
-           << "from" << filePath << "in" << timer.elapsed() << "ms";
+
+  if (!db.commit()) {
+    emit error(tr("Transaction commit failed: %1").arg(db.lastError().text()));
+    qWarning() << "Transaction commit failed" << db.lastError();
+    rollback();
+    return;
+  }
+
+  qint64 elapsed = timer.elapsed();
+  qint64 storeTime = elapsed - parseTime;
+  qDebug() << "Imported" << gpxFile.tracks.size() << "tracks with" << pointCount << "points to collection" << collectionId
+           << "from" << filePath << "in" << elapsed << "ms (parsing" << parseTime << "ms, storing" << storeTime << "ms)";
+  if (elapsed > 0) {
+    qDebug() << "Import throughput:" << qint64(double(pointCount) * 1000 / elapsed) << "points/s,"
+             << "storing only:" << (storeTime > 0 ? qint64(double(pointCount) * 1000 / storeTime) : -1) << "points/s";
+  }
 
   loadCollections();
 }
@@ -1755,6 +3393,10 @@ void Storage::closeTrack(qint64 collectionId, qint64 trackId){
     return;
   }
 
+  // closed track cannot be resumed
+  clearStatisticsState(trackId);
+  compactSegmentChunks(trackId);
+
   loadCollectionDetails(Collection(collectionId));
 }
 
@@ -2032,8 +3674,7 @@ void Storage::moveTrack(qint64 trackId, qint64 collectionId)
 }
 
 bool Storage::updateTrackStatistics(qint64 trackId, const TrackStatistics &statistics){
-  QSqlQuery sql(db);
-  sql.prepare(QString("UPDATE `track` SET ")
+  static const QString updateSql = QString("UPDATE `track` SET ")
                 .append("`from_time` = :from_time, ")
                 .append("`to_time` = :to_time, ")
                 .append("`distance` = :distance, ")
@@ -2052,35 +3693,66 @@ bool Storage::updateTrackStatistics(qint64 trackId, const TrackStatistics &stati
                 .append("`bbox_max_lat` = :bbox_max_lat, ")
                 .append("`bbox_max_lon` = :bbox_max_lon, ")
                 .append("`modification_time` = :modification_time ")
-                .append("WHERE `id` = :id"));
-
-  sql.bindValue(":from_time", dateTimeToSQL(statistics.from));
-  sql.bindValue(":to_time", dateTimeToSQL(statistics.to));
-  sql.bindValue(":distance", statistics.distance.AsMeter());
-  sql.bindValue(":raw_distance", statistics.rawDistance.AsMeter());
-  sql.bindValue(":duration", statistics.durationMillis());
-  sql.bindValue(":moving_duration", statistics.movingDurationMillis());
-  sql.bindValue(":max_speed", statistics.maxSpeed);
-  sql.bindValue(":average_speed", statistics.averageSpeed);
-  sql.bindValue(":moving_average_speed", statistics.movingAverageSpeed);
-  sql.bindValue(":ascent", statistics.ascent.AsMeter());
-  sql.bindValue(":descent", statistics.descent.AsMeter());
-  sql.bindValue(":min_elevation", statistics.minElevation.has_value() ? QVariant::fromValue(statistics.minElevation->AsMeter()) : QVariant());
-  sql.bindValue(":max_elevation", statistics.maxElevation.has_value() ? QVariant::fromValue(statistics.maxElevation->AsMeter()) : QVariant());
-
-  sql.bindValue(":bbox_min_lat", statistics.bbox.IsValid() ? statistics.bbox.GetMinLat() : -1000);
-  sql.bindValue(":bbox_min_lon", statistics.bbox.IsValid() ? statistics.bbox.GetMinLon() : -1000);
-  sql.bindValue(":bbox_max_lat", statistics.bbox.IsValid() ? statistics.bbox.GetMaxLat() : -1000);
-  sql.bindValue(":bbox_max_lon", statistics.bbox.IsValid() ? statistics.bbox.GetMaxLon() : -1000);
+                .append("WHERE `id` = :id");
+  auto sql = preparedQuery(updateSql);
+
+  sql->bindValue(":from_time", dateTimeToSQL(statistics.from));
+  sql->bindValue(":to_time", dateTimeToSQL(statistics.to));
+  sql->bindValue(":distance", statistics.distance.AsMeter());
+  sql->bindValue(":raw_distance", statistics.rawDistance.AsMeter());
+  sql->bindValue(":duration", statistics.durationMillis());
+  sql->bindValue(":moving_duration", statistics.movingDurationMillis());
+  sql->bindValue(":max_speed", statistics.maxSpeed);
+  sql->bindValue(":average_speed", statistics.averageSpeed);
+  sql->bindValue(":moving_average_speed", statistics.movingAverageSpeed);
+  sql->bindValue(":ascent", statistics.ascent.AsMeter());
+  sql->bindValue(":descent", statistics.descent.AsMeter());
+  sql->bindValue(":min_elevation", statistics.minElevation.has_value() ? QVariant::fromValue(statistics.minElevation->AsMeter()) : QVariant());
+  sql->bindValue(":max_elevation", statistics.maxElevation.has_value() ? QVariant::fromValue(statistics.maxElevation->AsMeter()) : QVariant());
+
+  sql->bindValue(":bbox_min_lat", statistics.bbox.IsValid() ? statistics.bbox.GetMinLat() : -1000);
+  sql->bindValue(":bbox_min_lon", statistics.bbox.IsValid() ? statistics.bbox.GetMinLon() : -1000);
+  sql->bindValue(":bbox_max_lat", statistics.bbox.IsValid() ? statistics.bbox.GetMaxLat() : -1000);
+  sql->bindValue(":bbox_max_lon", statistics.bbox.IsValid() ? statistics.bbox.GetMaxLon() : -1000);
+
+  sql->bindValue(":modification_time", dateTimeToSQL(QDateTime::currentDateTime()));
+
+  sql->bindValue(":id", trackId);
+  sql->exec();
+
+  if (sql->lastError().isValid()) {
+    qWarning() << "Edit track failed" << sql->lastError();
+    emit error(tr("Edit track failed: %1").arg(sql->lastError().text()));
+    return false;
+  }
+  return true;
+}
 
-  sql.bindValue(":modification_time", dateTimeToSQL(QDateTime::currentDateTime()));
+bool Storage::loadSegmentSizes(qint64 trackId, std::vector<std::pair<qint64, qint64>> &segments)
+{
+  auto sql = preparedQuery("SELECT `id`, `point_count` FROM `track_segment` WHERE `track_id` = :id ORDER BY `id`;");
+  sql->bindValue(":id", trackId);
+  sql->exec();
 
-  sql.bindValue(":id", trackId);
-  sql.exec();
+  if (sql->lastError().isValid()) {
+    qWarning() << "Loading track id" << trackId << "fails";
+    emit error(tr("Loading track id %1 fails").arg(trackId));
+    return false;
+  }
+  while (sql->next()) {
+    segments.emplace_back(varToLong(sql->value("id")), varToLong(sql->value("point_count")));
+  }
+  return true;
+}
 
-  if (sql.lastError().isValid()) {
-    qWarning() << "Edit track failed" << sql.lastError();
-    emit error(tr("Edit track failed: %1").arg(sql.lastError().text()));
+bool Storage::deleteSegment(qint64 segmentId)
+{
+  auto sql = preparedQuery("DELETE FROM `track_segment` WHERE `id` = :id");
+  sql->bindValue(":id", segmentId);
+  sql->exec();
+  if (sql->lastError().isValid()) {
+    qWarning() << "Deleting segment" << segmentId << "failed: " << sql->lastError();
+    emit error(tr("Deleting segment %1 failed: %2").arg(segmentId).arg(sql->lastError().text()));
     return false;
   }
   return true;
@@ -2088,94 +3760,81 @@ bool Storage::updateTrackStatistics(qint64 trackId, const TrackStatistics &stati
 
 void Storage::cropTrackPrivate(qint64 trackId, quint64 position, bool cropStart)
 {
-  QSqlQuery sql(db);
-  sql.prepare(QString("SELECT `id`, `track_id`, (")
-                .append(" SELECT COUNT(*) FROM `track_point` WHERE `segment_id` = `track_segment`.`id`")
-                .append(") AS `point_cnt` ")
-                .append("FROM `track_segment` ")
-                .append("WHERE `track_id` = :id"));
-
-  sql.bindValue(":id", trackId);
-  sql.exec();
-
-  if (sql.lastError().isValid()) {
-    qWarning() << "Loading track id" << trackId << "fails";
-    emit error(tr("Loading track id %1 fails").arg(trackId));
+  std::vector<std::pair<qint64, qint64>> segments; // id, point count
+  if (!loadSegmentSizes(trackId, segments)) {
     return;
   }
 
-  auto deleteSegment = [this](qint64 segmentId){
-    QSqlQuery sql(db);
-    sql.prepare("DELETE FROM `track_segment` WHERE `id` = :id");
-    sql.bindValue(":id", segmentId);
-    sql.exec();
-    //qDebug() << sql.executedQuery() << " ... " << sql.boundValues();
-    if (sql.lastError().isValid()) {
-      qWarning() << "Deleting segment" << segmentId << "failed: " << sql.lastError();
-    }
-  };
-
   auto deleteSegmentPart = [this, &cropStart](qint64 segmentId, quint64 count){
-    QSqlQuery sql(db);
-    sql.prepare(QString("DELETE FROM `track_point` WHERE `segment_id` = :segmentId1 AND `rowid` IN (")
-                  .append("SELECT `rowid` FROM `track_point` WHERE `segment_id` = :segmentId2 ")
-                  .append("ORDER BY `rowid` ").append(cropStart ? "ASC " : "DESC ")
-                  .append("LIMIT :cnt")
-                  .append(")"));
-    sql.bindValue(":segmentId1", segmentId);
-    sql.bindValue(":segmentId2", segmentId);
-    sql.bindValue(":cnt", count);
-    sql.exec();
-    //qDebug() << sql.executedQuery() << " ... " << sql.boundValues();
-    if (sql.lastError().isValid()) {
-      qWarning() << "Deleting part of segment" << segmentId << "failed: " << sql.lastError();
+    gpx::TrackSegment segment;
+    if (!loadTrackPoints(segmentId, segment)) {
+      qWarning() << "Deleting part of segment" << segmentId << "failed";
+      return false;
     }
+    count = std::min(count, quint64(segment.points.size()));
+    if (cropStart) {
+      segment.points.erase(segment.points.begin(), segment.points.begin() + count);
+    } else {
+      segment.points.erase(segment.points.end() - count, segment.points.end());
+    }
+    // statistics of modified segment are recomputed, others are kept
+    if (!storeTrackPoints(segmentId, segment.points)) {
+      qWarning() << "Deleting part of segment" << segmentId << "failed";
+      return false;
+    }
+    return true;
   };
 
+  db.transaction();
+  bool success = true;
   if (cropStart) {
-    while (sql.next() && position > 0) {
-      qint64 segmentId = varToLong(sql.value("id"));
-      qint64 pointCnt = varToLong(sql.value("point_cnt"));
+    for (auto it = segments.begin(); success && it != segments.end() && position > 0; ++it) {
+      auto [segmentId, pointCnt] = *it;
       if ((qint64)position > pointCnt){
-        deleteSegment(segmentId);
+        success = deleteSegment(segmentId);
         position -= pointCnt;
       } else {
-        deleteSegmentPart(segmentId, position);
+        success = deleteSegmentPart(segmentId, position);
         position = 0;
       }
     }
   } else {
-    while (sql.next()){
-      qint64 segmentId = varToLong(sql.value("id"));
-      qint64 pointCnt = varToLong(sql.value("point_cnt"));
+    for (auto it = segments.begin(); success && it != segments.end(); ++it) {
+      auto [segmentId, pointCnt] = *it;
       if ((qint64)position < pointCnt){
-        deleteSegmentPart(segmentId, pointCnt - position);
+        success = deleteSegmentPart(segmentId, pointCnt - position);
         position = 0;
       } else if (position == 0){
-        deleteSegment(segmentId);
+        success = deleteSegment(segmentId);
       } else {
         position -= pointCnt;
       }
     }
   }
 
+  TrackStatistics statistics;
+  success = success && updateTrackStatisticsFromSegments(trackId, statistics);
+  if (success) {
+    if (!db.commit()) {
+      qWarning() << "Transaction commit failed" << db.lastError();
+      emit error(tr("Transaction commit failed: %1").arg(db.lastError().text()));
+      success = false;
+    }
+  } else if (!db.rollback()) {
+    qWarning() << "Transaction rollback failed" << db.lastError();
+  }
+
+  // statistics are updated already, just load data for the view
   Track track;
   track.id = trackId;
   if (!loadTrackDataPrivate(track, std::nullopt)){
-    loadCollectionDetails(Collection(track.collectionId));
-    emit trackDataLoaded(track, std::nullopt, true, true);
-    return;
-  }
-
-  track.statistics = computeTrackStatistics(*track.data);
-  if (!updateTrackStatistics(trackId, track.statistics)){
     loadCollectionDetails(Collection(track.collectionId));
     emit trackDataLoaded(track, std::nullopt, true, false);
     return;
   }
 
   loadCollectionDetails(Collection(track.collectionId));
-  emit trackDataLoaded(track, std::nullopt, true, true);
+  emit trackDataLoaded(track, std::nullopt, true, success);
 }
 
 void Storage::cropTrackStart(Track track, quint64 position)
@@ -2195,49 +3854,119 @@ void Storage::cropTrackEnd(Track track, quint64 position)
   cropTrackPrivate(track.id, position, false);
 }
 
+bool Storage::splitTrackPrivate(const Track &track, quint64 position)
+{
+  std::vector<std::pair<qint64, qint64>> segments; // id, point count
+  if (!loadSegmentSizes(track.id, segments)) {
+    return false;
+  }
+
+  // find the segment where the tail starts
+  quint64 skip = position;
+  auto splitSegment = segments.begin();
+  for (; splitSegment != segments.end(); ++splitSegment) {
+    if (skip == 0 || skip < quint64(splitSegment->second)) {
+      break;
+    }
+    skip -= splitSegment->second;
+  }
+
+  // create new track for the tail, its statistics are updated when segments are moved
+  QSqlQuery sqlTrk = trackInsertSql();
+  prepareTrackInsert(sqlTrk, track.collectionId,
+                     //: name for new track created by splitting
+                     Storage::tr("%1, part 2").arg(track.name),
+                     QStringOpt(track.description),
+                     track.color, track.type, true,
+                     TrackStatisticsAccumulator().accumulate(), false);
+  sqlTrk.exec();
+  if (sqlTrk.lastError().isValid()) {
+    qWarning() << "Creating track failed" << sqlTrk.lastError();
+    emit error(tr("Creating track failed: %1").arg(sqlTrk.lastError().text()));
+    return false;
+  }
+  qint64 tailTrackId = varToLong(sqlTrk.lastInsertId());
+
+  if (splitSegment != segments.end()) {
+    // Segments are ordered by id. Split segment row (with tail points) and following segments
+    // are moved to the new track, head of the split segment is inserted as new (last) segment
+    // of the original track.
+    qint64 splitSegmentId = splitSegment->first;
+    gpx::TrackSegment segment;
+    if (skip > 0 && !loadTrackPoints(splitSegmentId, segment)) {
+      return false;
+    }
+
+    auto sql = preparedQuery("UPDATE `track_segment` SET `track_id` = :tailTrackId WHERE `track_id` = :trackId AND `id` >= :segmentId;");
+    sql->bindValue(":tailTrackId", tailTrackId);
+    sql->bindValue(":trackId", track.id);
+    sql->bindValue(":segmentId", splitSegmentId);
+    sql->exec();
+    if (sql->lastError().isValid()) {
+      qWarning() << "Moving segments failed" << sql->lastError();
+      emit error(tr("Moving segments failed: %1").arg(sql->lastError().text()));
+      return false;
+    }
+
+    if (skip > 0) {
+      std::vector<gpx::TrackPoint> head(segment.points.begin(), segment.points.begin() + skip);
+      segment.points.erase(segment.points.begin(), segment.points.begin() + skip);
+      qint64 headSegmentId;
+      if (!storeTrackPoints(splitSegmentId, segment.points) ||
+          !insertSegment(track.id, head, headSegmentId)) {
+        return false;
+      }
+    }
+  }
+
+  TrackStatistics statistics;
+  return updateTrackStatisticsFromSegments(track.id, statistics) &&
+         updateTrackStatisticsFromSegments(tailTrackId, statistics);
+}
+
 void Storage::splitTrack(Track track, quint64 position)
 {
   if (!checkAccess(__FUNCTION__)){
     return;
   }
 
-  if (!loadTrackDataPrivate(track, std::nullopt)){
-    loadCollectionDetails(Collection(track.collectionId));
-    emit trackDataLoaded(track, std::nullopt, true, true);
-    return;
-  }
-
-  // copy tail to new track
-  gpx::Track trackTail;
-  //: name for new track created by splitting
-  trackTail.name = Storage::tr("%1, part 2").arg(track.name).toStdString();
-  trackTail.desc = track.description.toStdString();
-  trackTail.type = track.type.toStdString();
-  trackTail.displayColor = track.color;
-  quint64 skip=position;
-  for (const auto &seg: track.data->segments){
-    if (skip==0){
-      trackTail.segments.push_back(seg);
-    } else if (skip < seg.points.size()) {
-      auto &segTail=trackTail.segments.emplace_back();
-      segTail.points.insert(segTail.points.end(),
-                            seg.points.begin()+skip, seg.points.end());
-      skip = 0;
+  bool success;
+  {
+    auto sqlTrack = preparedQuery("SELECT * FROM `track` WHERE id = :trackId;");
+    sqlTrack->bindValue(":trackId", track.id);
+    sqlTrack->exec();
+    success = !sqlTrack->lastError().isValid() && sqlTrack->next();
+    if (success) {
+      track = makeTrack(*sqlTrack);
     } else {
-      skip -= seg.points.size();
+      qWarning() << "Loading track id" << track.id << "fails: " << sqlTrack->lastError();
+      emit error(tr("Loading track id %1 fails").arg(track.id));
     }
   }
 
-  // import tail as new track
-  gpx::GpxFile gpxFile;
-  gpxFile.tracks.push_back(trackTail);
-  if (!importTracks(gpxFile, track.collectionId)){
+  if (success) {
+    db.transaction();
+    success = splitTrackPrivate(track, position);
+    if (success) {
+      if (!db.commit()) {
+        qWarning() << "Transaction commit failed" << db.lastError();
+        emit error(tr("Transaction commit failed: %1").arg(db.lastError().text()));
+        success = false;
+      }
+    } else if (!db.rollback()) {
+      qWarning() << "Transaction rollback failed" << db.lastError();
+    }
+  }
+
+  // statistics are updated already, just load data for the view
+  if (!loadTrackDataPrivate(track, std::nullopt)){
     loadCollectionDetails(Collection(track.collectionId));
+    emit trackDataLoaded(track, std::nullopt, true, false);
     return;
   }
 
-  // crop end from original track
-  cropTrackPrivate(track.id, position, false);
+  loadCollectionDetails(Collection(track.collectionId));
+  emit trackDataLoaded(track, std::nullopt, true, success);
 }
 
 void Storage::filterTrackNodes(Track track, std::optional<double> accuracyFilter)
@@ -2250,40 +3979,60 @@ void Storage::filterTrackNodes(Track track, std::optional<double> accuracyFilter
     return;
   }
 
-  // drop inaccurate nodes by SQL query
-  QSqlQuery sql(db);
-  sql.prepare(QString("DELETE FROM `track_point` WHERE `horiz_accuracy` > :filter ")
-              .append("AND `segment_id` IN (")
-              .append("SELECT `id` FROM `track_segment` WHERE `track_id` = :trackId")
-              .append(");"));
-
-  sql.bindValue(":filter", *accuracyFilter);
-  sql.bindValue(":trackId", track.id);
-  sql.exec();
-  // qDebug() << sql.executedQuery() << " ... " << sql.boundValues();
-
-  if (sql.lastError().isValid()) {
+  // drop inaccurate nodes, points without accuracy are kept
+  std::vector<std::pair<qint64, qint64>> segments; // id, point count
+  if (!loadSegmentSizes(track.id, segments)) {
     loadCollectionDetails(Collection(track.collectionId));
     emit trackDataLoaded(track, std::nullopt, true, false);
-    qWarning() << "Filter nodes failed: " << sql.lastError();
     return;
   }
 
-  if (!loadTrackDataPrivate(track, std::nullopt)){
-    loadCollectionDetails(Collection(track.collectionId));
-    emit trackDataLoaded(track, std::nullopt, true, false);
-    return;
+  double filter = *accuracyFilter;
+  db.transaction();
+  bool success = true;
+  for (const auto &segmentEntry: segments) {
+    qint64 segmentId = segmentEntry.first;
+    gpx::TrackSegment segment;
+    if (!loadTrackPoints(segmentId, segment)) {
+      success = false;
+      break;
+    }
+    auto newEnd = std::remove_if(segment.points.begin(), segment.points.end(),
+                                 [filter](const gpx::TrackPoint &p) {
+                                   return p.hdop.has_value() && *p.hdop > filter;
+                                 });
+    if (newEnd == segment.points.end()) {
+      continue;
+    }
+    segment.points.erase(newEnd, segment.points.end());
+    // statistics of modified segment are recomputed, others are kept
+    if (!storeTrackPoints(segmentId, segment.points)) {
+      success = false;
+      break;
+    }
   }
 
-  track.statistics = computeTrackStatistics(*track.data);
-  if (!updateTrackStatistics(track.id, track.statistics)){
+  TrackStatistics statistics;
+  success = success && updateTrackStatisticsFromSegments(track.id, statistics);
+  if (success) {
+    if (!db.commit()) {
+      qWarning() << "Transaction commit failed" << db.lastError();
+      emit error(tr("Transaction commit failed: %1").arg(db.lastError().text()));
+      success = false;
+    }
+  } else if (!db.rollback()) {
+    qWarning() << "Transaction rollback failed" << db.lastError();
+  }
+
+  // statistics are updated already, just load data for the view
+  if (!loadTrackDataPrivate(track, std::nullopt)){
     loadCollectionDetails(Collection(track.collectionId));
     emit trackDataLoaded(track, std::nullopt, true, false);
     return;
   }
 
   loadCollectionDetails(Collection(track.collectionId));
-  emit trackDataLoaded(track, std::nullopt, true, true);
+  emit trackDataLoaded(track, std::nullopt, true, success);
 }
 
 void Storage::setTrackColor(Track track, std::optional<osmscout::Color> colorOpt){
@@ -2322,6 +4071,8 @@ void Storage::loadRecentOpenTrack(){
     return;
   }
 
+  replayTrackJournal();
+
   QSqlQuery sqlTrack(db);
   sqlTrack.prepare("SELECT * FROM `track` WHERE `open` ORDER BY `creation_time` DESC LIMIT 1;");
   sqlTrack.exec();
@@ -2329,67 +4080,220 @@ void Storage::loadRecentOpenTrack(){
   if (sqlTrack.lastError().isValid()) {
     qWarning() << "Loading last open track fails";
     emit error(tr("Loading last open track fails"));
-    emit openTrackLoaded(Track{}, false);
+    emit openTrackLoaded(Track{}, QByteArray(), false);
+    return;
   }
 
   if (sqlTrack.next()) {
-    openTrackLoaded(makeTrack(sqlTrack), true);
+    Track track = makeTrack(sqlTrack);
+    sqlTrack.finish();
+
+    QByteArray statisticsState;
+    auto sqlState = preparedQuery("SELECT `statistics_state` FROM `track_segment` WHERE `track_id` = :trackId ORDER BY `id` DESC LIMIT 1;");
+    sqlState->bindValue(":trackId", track.id);
+    sqlState->exec();
+    if (sqlState->lastError().isValid()) {
+      // not fatal, track may be resumed with accumulator restored from statistics
+      qWarning() << "Loading statistics state of track" << track.id << "fails" << sqlState->lastError();
+    } else if (sqlState->next()) {
+      statisticsState = sqlState->value(0).toByteArray();
+    }
+
+    emit openTrackLoaded(track, statisticsState, true);
   } else {
-    emit openTrackLoaded(Track{}, true);
+    emit openTrackLoaded(Track{}, QByteArray(), true);
+  }
+}
+
+QString Storage::trackJournalPath() const
+{
+  return directory.filePath("track.journal");
+}
+
+bool Storage::replayTrackJournal()
+{
+  QString path = trackJournalPath();
+  qint64 trackId;
+  std::vector<TrackJournal::Entry> entries;
+  if (!TrackJournal::read(path, trackId, entries) || entries.empty()) {
+    return true; // nothing to replay
+  }
+
+  Track track;
+  if (!trackHeader(trackId, track)) {
+    qWarning() << "Dropping" << entries.size() << "journal points of track" << trackId;
+    TrackJournal::remove(path);
+    return false;
+  }
+
+  auto sqlSegment = preparedQuery("SELECT `id`, `point_count` FROM `track_segment` WHERE `track_id` = :id ORDER BY `id` DESC LIMIT 1;");
+  sqlSegment->bindValue(":id", trackId);
+  sqlSegment->exec();
+  if (sqlSegment->lastError().isValid()) {
+    qWarning() << "Evaluating last segment failed" << sqlSegment->lastError();
+    return false;
+  }
+  qint64 segmentId = -1;
+  qint64 pointCount = 0;
+  if (sqlSegment->next()) {
+    segmentId = varToLong(sqlSegment->value(0));
+    pointCount = varToLong(sqlSegment->value(1));
+  }
+  sqlSegment->finish();
+
+  // batch may be persisted just before the application was killed, without commit in journal
+  std::optional<Timestamp> lastPersisted = dateTimeToTimestampOpt(track.statistics.to);
+
+  std::vector<gpx::TrackPoint> points;
+  auto appendPoints = [&]() {
+    if (points.empty()) {
+      return true;
+    }
+    if (segmentId < 0 && !createSegment(trackId, segmentId)) {
+      return false;
+    }
+    pointCount += points.size();
+    bool result = appendTrackPoints(points, segmentId);
+    points.clear();
+    return result;
+  };
+
+  db.transaction();
+  bool success = true;
+  size_t replayed = 0;
+  for (const auto &entry: entries) {
+    if (lastPersisted && entry.point.timestamp && *entry.point.timestamp <= *lastPersisted) {
+      continue;
+    }
+    // open segment created by the last persisted batch may be empty
+    if (entry.segmentStart && (pointCount > 0 || !points.empty())) {
+      success = success && appendPoints() && createSegment(trackId, segmentId);
+      pointCount = 0;
+    }
+    points.push_back(entry.point);
+    replayed++;
+  }
+  success = success && appendPoints();
+
+  // accumulator state of the open segment don't contain replayed points,
+  // it is cleared in the same transaction, so resumed tracking can't use the outdated state
+  TrackStatistics statistics;
+  success = success && replayed > 0 &&
+            clearStatisticsState(trackId) &&
+            updateTrackStatisticsFromSegments(trackId, statistics);
+  if (success) {
+    if (!db.commit()) {
+      qWarning() << "Transaction commit failed" << db.lastError();
+      emit error(tr("Transaction commit failed: %1").arg(db.lastError().text()));
+      success = false;
+    }
+  } else if (!db.rollback()) {
+    qWarning() << "Transaction rollback failed" << db.lastError();
+  }
+
+  if (success || replayed == 0) {
+    qDebug() << "Replayed" << replayed << "from" << entries.size() << "journal points to track" << trackId;
+    TrackJournal::remove(path);
+  }
+  return success;
+}
+
+bool Storage::storeStatisticsState(qint64 segmentId, const QByteArray &statisticsState)
+{
+  auto sql = preparedQuery("UPDATE `track_segment` SET `statistics_state` = :state WHERE `id` = :id;");
+  sql->bindValue(":state", statisticsState.isEmpty() ? QVariant() : QVariant(statisticsState));
+  sql->bindValue(":id", segmentId);
+  sql->exec();
+  if (sql->lastError().isValid()) {
+    qWarning() << "Storing statistics state of segment" << segmentId << "failed" << sql->lastError();
+    return false;
+  }
+  return true;
+}
+
+bool Storage::clearStatisticsState(qint64 trackId)
+{
+  auto sql = preparedQuery("UPDATE `track_segment` SET `statistics_state` = NULL WHERE `track_id` = :trackId AND `statistics_state` IS NOT NULL;");
+  sql->bindValue(":trackId", trackId);
+  sql->exec();
+  if (sql->lastError().isValid()) {
+    qWarning() << "Clearing statistics state of track" << trackId << "failed" << sql->lastError();
+    return false;
   }
+  return true;
 }
 
 bool Storage::createSegment(qint64 trackId, qint64 &segmentId)
 {
-  QSqlQuery sqlSeg(db);
-  sqlSeg.prepare("INSERT INTO `track_segment` (`track_id`, `open`, `creation_time`, `distance`) VALUES (:track_id, :open, :creation_time, :distance)");
+  auto sqlSeg = preparedQuery("INSERT INTO `track_segment` (`track_id`, `open`, `creation_time`, `distance`) VALUES (:track_id, :open, :creation_time, :distance)");
 
-  sqlSeg.bindValue(":track_id", trackId);
-  sqlSeg.bindValue(":open", true);
+  sqlSeg->bindValue(":track_id", trackId);
+  sqlSeg->bindValue(":open", true);
 
   // TODO: do we need segment statics?
-  sqlSeg.bindValue(":creation_time", dateTimeToSQL(QDateTime::currentDateTime()));
-  sqlSeg.bindValue(":distance", 0); // ignored right now
-  sqlSeg.exec();
-  if (sqlSeg.lastError().isValid()) {
-    qWarning() << "Segment creation failed" << sqlSeg.lastError();
-    emit error(tr("Segment creation failed: %1").arg(sqlSeg.lastError().text()));
+  sqlSeg->bindValue(":creation_time", dateTimeToSQL(QDateTime::currentDateTime()));
+  sqlSeg->bindValue(":distance", 0); // ignored right now
+  sqlSeg->exec();
+  if (sqlSeg->lastError().isValid()) {
+    qWarning() << "Segment creation failed" << sqlSeg->lastError();
+    emit error(tr("Segment creation failed: %1").arg(sqlSeg->lastError().text()));
     return false;
   }
-  segmentId = varToLong(sqlSeg.lastInsertId());
+  segmentId = varToLong(sqlSeg->lastInsertId());
   return true;
 }
 
 void Storage::appendNodes(qint64 trackId,
-                          std::shared_ptr<std::vector<osmscout::gpx::TrackPoint>> batch,
+                          std::shared_ptr<TrackPointQueue> queue,
+                          quint64 count,
                           TrackStatistics statistics,
-                          bool createNewSegment)
+                          QByteArray statisticsState,
+                          bool createNewSegment,
+                          quint64 journalSequence)
 {
-  if (!checkAccess(__FUNCTION__)){
-    return;
-  }
+  assert(queue);
+  bool ok = checkAccess(__FUNCTION__) &&
+            appendNodesPrivate(trackId, *queue, count, statistics, statisticsState, createNewSegment);
+  // tracker commits its journal up to the sequence of persisted batch
+  emit nodesAppended(trackId, journalSequence, ok);
+}
 
-  assert(batch);
+bool Storage::appendNodesPrivate(qint64 trackId,
+                                 TrackPointQueue &queue,
+                                 quint64 count,
+                                 const TrackStatistics &statistics,
+                                 const QByteArray &statisticsState,
+                                 bool createNewSegment)
+{
+  // batch is allocated on storage thread, producer just fills preallocated queue
+  auto batch = std::make_shared<std::vector<osmscout::gpx::TrackPoint>>(count);
+  for (quint64 i = 0; i < count; i++) {
+    if (!queue.pop((*batch)[i])) {
+      qWarning() << "Track point queue contains just" << i << "from" << count << "points";
+      batch->resize(i);
+      break;
+    }
+  }
 
-  QSqlQuery sqlSegment(db);
-  sqlSegment.prepare("SELECT MAX(`id`) AS `segment_id` FROM `track_segment` WHERE `track_id` = :id;");
-  sqlSegment.bindValue(":id", trackId);
-  sqlSegment.exec();
+  auto sqlSegment = preparedQuery("SELECT MAX(`id`) AS `segment_id` FROM `track_segment` WHERE `track_id` = :id;");
+  sqlSegment->bindValue(":id", trackId);
+  sqlSegment->exec();
 
-  if (sqlSegment.lastError().isValid()) {
-    qWarning() << "Evaluating last segment failed" << sqlSegment.lastError();
+  if (sqlSegment->lastError().isValid()) {
+    qWarning() << "Evaluating last segment failed" << sqlSegment->lastError();
     emit error(tr("Failed to append nodes to track"));
-    return;
+    return false;
   }
 
   qint64 segmentId;
-  if (sqlSegment.next()) {
-    QVariant segmentIdVar = sqlSegment.value("segment_id");
+  if (sqlSegment->next()) {
+    QVariant segmentIdVar = sqlSegment->value("segment_id");
+    sqlSegment->finish();
     if (segmentIdVar.isNull()){
       if (!createSegment(trackId, segmentId)){
         qWarning() << "Creating segment failed";
         emit error(tr("Failed to append nodes to track"));
-        return;
+        return false;
       }
     }else {
       segmentId = varToLong(segmentIdVar);
@@ -2397,59 +4301,91 @@ void Storage::appendNodes(qint64 trackId,
   } else {
     qWarning() << "Evaluating last segment failed, cannot retrieve row";
     emit error(tr("Failed to append nodes to track"));
-    return;
+    return false;
+  }
+
+  Track previous;
+  if (!trackHeader(trackId, previous)){
+    emit error(tr("Failed to append nodes to track"));
+    return false;
+  }
+
+  quint64 appendedSegmentIndex = 0;
+  if (!segmentIndex(trackId, segmentId, appendedSegmentIndex)){
+    emit error(tr("Failed to append nodes to track"));
+    return false;
   }
 
-  if (!importTrackPoints(*batch, segmentId)){
+  if (!appendTrackPoints(*batch, segmentId)){
     qWarning() << "Failed to append nodes to track";
     emit error(tr("Failed to append nodes to track"));
-    return;
+    return false;
   }
 
+  bool segmentCreated = false;
   if (createNewSegment){
+    // state is held by the open (last) segment only
+    clearStatisticsState(trackId);
+    compactSegmentChunks(trackId);
     if (!createSegment(trackId, segmentId)){
       qWarning() << "Creating segment failed";
+    } else {
+      segmentCreated = true;
     }
   }
 
-  qint64 collectionId;
-  if (!trackCollection(trackId, collectionId)){
-    return;
+  if (!updateTrackStatistics(trackId, statistics)) {
+    loadCollectionDetails(Collection(previous.collectionId));
+    return true; // points are persisted already
   }
 
-  if (!updateTrackStatistics(trackId, statistics)) {
-    loadCollectionDetails(Collection(collectionId));
-    return;
+  // state is stored after statistics, so it never describes more points than statistics
+  storeStatisticsState(segmentId, statisticsState);
+
+  Track track;
+  if (trackHeader(trackId, track)){
+    // receivers displaying the track may just append the batch, see CollectionMapBridge
+    emit trackDataAppended(track, previous.lastModification, appendedSegmentIndex,
+                           accountResult(batch, vectorBytes(*batch)), segmentCreated);
   }
 
-  loadCollectionDetails(Collection(collectionId));
+  loadCollectionDetails(Collection(previous.collectionId));
+  return true;
 }
 
-bool Storage::trackCollection(qint64 trackId, qint64 &collectionId)
+bool Storage::trackHeader(qint64 trackId, Track &track)
 {
-  QSqlQuery sqlSegment(db);
-  sqlSegment.prepare("SELECT `collection_id` FROM `track` WHERE `id` = :id;");
-  sqlSegment.bindValue(":id", trackId);
-  sqlSegment.exec();
+  auto sqlTrack = preparedQuery("SELECT * FROM `track` WHERE id = :trackId;");
+  sqlTrack->bindValue(":trackId", trackId);
+  sqlTrack->exec();
 
-  if (sqlSegment.lastError().isValid()) {
-    qWarning() << "Cannot obtain collection id" << sqlSegment.lastError();
+  if (sqlTrack->lastError().isValid()) {
+    qWarning() << "Loading track id" << trackId << "fails: " << sqlTrack->lastError();
     return false;
   }
 
-  if (sqlSegment.next()) {
-    QVariant segmentIdVar = sqlSegment.value("collection_id");
-    if (segmentIdVar.isNull()){
-      qWarning() << "Cannot obtain collection id, track don't exits";
-      return false;
-    }else {
-      collectionId = varToLong(segmentIdVar);
-    }
-  } else {
-    qWarning() << "Cannot obtain collection id, cannot retrieve row";
+  if (!sqlTrack->next()) {
+    qWarning() << "Track id" << trackId << "don't exists";
+    return false;
+  }
+
+  track = makeTrack(*sqlTrack);
+  return true;
+}
+
+bool Storage::segmentIndex(qint64 trackId, qint64 segmentId, quint64 &index)
+{
+  auto sql = preparedQuery("SELECT COUNT(*) FROM `track_segment` WHERE `track_id` = :trackId AND `id` < :segmentId;");
+  sql->bindValue(":trackId", trackId);
+  sql->bindValue(":segmentId", segmentId);
+  sql->exec();
+
+  if (sql->lastError().isValid() || !sql->next()) {
+    qWarning() << "Cannot evaluate index of segment" << segmentId << sql->lastError();
     return false;
   }
 
+  index = varToLong(sql->value(0));
   return true;
 }
 
@@ -2531,22 +4467,26 @@ void Storage::removeSearchPattern(QString pattern){
   loadSearchHistory();
 }
 
-void Storage::loadNearbyWaypoints(const osmscout::GeoCoord &center, const osmscout::Distance &distance)
+bool Storage::loadWaypointsInBox(const osmscout::GeoBox &bbox, std::vector<Waypoint> &waypoints)
 {
-  if (!checkAccess(__FUNCTION__)){
-    return;
-  }
-
-  osmscout::GeoBox bbox=osmscout::GeoBox::BoxByCenterAndRadius(center, distance);
-
-  std::vector<WaypointNearby> waypoints;
   QSqlQuery sql(db);
-  sql.prepare(QString("SELECT * FROM `waypoint` WHERE ")
-                      .append("`latitude` >= :minLat AND ")
-                      .append("`latitude` <= :maxLat AND ")
-                      .append("`longitude` >= :minLon AND ")
-                      .append("`longitude` <= :maxLon")
-                      .append(";"));
+  if (spatialIndex) {
+    // rtree stores 32 bit floats rounded outwards, so result is superset of waypoints in the box
+    sql.prepare(QString("SELECT `waypoint`.* FROM `waypoint_rtree` ")
+                        .append("JOIN `waypoint` ON `waypoint`.`id` = `waypoint_rtree`.`id` WHERE ")
+                        .append("`waypoint_rtree`.`max_lat` >= :minLat AND ")
+                        .append("`waypoint_rtree`.`min_lat` <= :maxLat AND ")
+                        .append("`waypoint_rtree`.`max_lon` >= :minLon AND ")
+                        .append("`waypoint_rtree`.`min_lon` <= :maxLon")
+                        .append(";"));
+  } else {
+    sql.prepare(QString("SELECT * FROM `waypoint` WHERE ")
+                        .append("`latitude` >= :minLat AND ")
+                        .append("`latitude` <= :maxLat AND ")
+                        .append("`longitude` >= :minLon AND ")
+                        .append("`longitude` <= :maxLon")
+                        .append(";"));
+  }
 
   sql.bindValue(":minLat", bbox.GetMinLat());
   sql.bindValue(":maxLat", bbox.GetMaxLat());
@@ -2555,22 +4495,41 @@ void Storage::loadNearbyWaypoints(const osmscout::GeoCoord &center, const osmsco
 
   sql.exec();
   if (sql.lastError().isValid()) {
-    qWarning() << "Cannot load nearby waypoints" << sql.lastError();
+    qWarning() << "Cannot load waypoints in box" << sql.lastError();
+    return false;
+  }
+
+  while (sql.next()) {
+    waypoints.push_back(makeWaypoint(sql));
+  }
+  return true;
+}
+
+void Storage::loadNearbyWaypoints(const osmscout::GeoCoord &center, const osmscout::Distance &distance)
+{
+  if (!checkAccess(__FUNCTION__)){
+    return;
+  }
+
+  osmscout::GeoBox bbox=osmscout::GeoBox::BoxByCenterAndRadius(center, distance);
+
+  std::vector<Waypoint> candidates;
+  if (!loadWaypointsInBox(bbox, candidates)) {
     emit error("Cannot load nearby waypoints");
     return;
   }
 
-  while (sql.next()) {
-    auto wpt = makeWaypoint(sql);
+  std::vector<WaypointNearby> waypoints;
+  for (auto &wpt: candidates) {
     auto wptDist = osmscout::GetSphericalDistance(center, wpt.data.coord);
     if (wptDist <= distance) {
       waypoints.push_back(std::make_tuple(
         wptDist,
-        wpt));
+        std::move(wpt)));
     }
   }
 
-  std::sort(waypoints.begin(), waypoints.end(), [&center](const WaypointNearby &a, const WaypointNearby &b){
+  std::sort(waypoints.begin(), waypoints.end(), [](const WaypointNearby &a, const WaypointNearby &b){
     return std::get<0>(a) < std::get<0>(b);
   });
 
@@ -2590,11 +4549,12 @@ Storage* Storage::getInstance()
   return storage;
 }
 
-void Storage::initInstance(const QDir &directory)
+void Storage::initInstance(const QDir &directory, DurabilityProfile durability)
 {
   if (storage == nullptr){
     QThread *thread = OSMScoutQt::GetInstance().makeThread("Storage");
     storage = new Storage(thread, directory);
+    storage->durabilityProfile = durability;
     storage->moveToThread(thread);
     connect(thread, &QThread::started,
             storage, &Storage::init);
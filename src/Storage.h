@@ -24,15 +24,33 @@
 #include <osmscoutgpx/GpxFile.h>
 #include <osmscout/util/GeoBox.h>
 
+#include "StatementCache.h"
+#include "SpscQueue.h"
+#include "RingBuffer.h"
+#include "ElevationProfile.h"
+
 #include <QObject>
+#include <QDataStream>
 
 #include <QtSql/QSqlDatabase>
 #include <QtSql/QSqlError>
 #include <QDir>
+#include <QMutex>
 #include <QtCore/QDateTime>
+#include <QtCore/QElapsedTimer>
 
 #include <atomic>
+#include <functional>
+#include <map>
 #include <optional>
+#include <tuple>
+
+struct sqlite3;
+
+/**
+ * Points recorded by Tracker (producer, UI thread), consumed by Storage thread.
+ */
+using TrackPointQueue = SpscQueue<osmscout::gpx::TrackPoint>;
 
 class ErrorCallback: public QObject, public osmscout::gpx::ProcessCallback
 {
@@ -155,12 +173,25 @@ public:
 
   void setMaxSpeed(double speed);
 
+  void serializeState(QDataStream &out) const;
+  void deserializeState(QDataStream &in);
+
 private:
-  QList<osmscout::Distance> distanceFifo;
-  QList<osmscout::Timestamp::duration> timeFifo;
+  // usually there are just few points in 5 seconds window,
+  // the oldest ones are merged when there are more
+  static constexpr size_t FifoCapacity = 128;
+
+  struct Step
+  {
+    osmscout::Distance distance;
+    osmscout::Timestamp::duration time{0};
+  };
+
+  RingBuffer<Step> fifo{FifoCapacity};
   osmscout::Distance bufferDistance;
   osmscout::Timestamp::duration bufferTime{0};
-  std::shared_ptr<osmscout::gpx::TrackPoint> lastPoint;
+  std::optional<osmscout::GeoCoord> lastCoord;
+  osmscout::Timestamp lastTimestamp;
   double maxSpeed{0}; // m / s
 };
 
@@ -182,6 +213,12 @@ public:
 
   void flush();
 
+  /**
+   * Merge results of filter that processed following segments.
+   * Both filters should be flushed.
+   */
+  void merge(const ElevationFilter &following);
+
   /**
    * Update internal filter state.
    *
@@ -210,6 +247,8 @@ public:
     return maxElevation;
   }
 
+  void serializeState(QDataStream &out) const;
+  void deserializeState(QDataStream &in);
 
 private:
   std::optional<osmscout::Distance> minElevation;
@@ -218,9 +257,16 @@ private:
   osmscout::Distance descent;
   std::optional<osmscout::Distance> lastEleStep; // last elevation used for ascent/descent computation
 
-  // buffer
-  QList<osmscout::Distance> distanceFifo; // distances from previous
-  QList<osmscout::Distance> elevationFifo; // point elevations
+  static constexpr size_t WindowSize = 60; // points
+
+  struct Sample
+  {
+    osmscout::Distance distance; // from previous
+    osmscout::Distance elevation;
+  };
+
+  // buffer, one sample over the window size is pushed before the oldest one is popped
+  RingBuffer<Sample> fifo{WindowSize + 1};
   osmscout::Distance bufferLength; // distance of segment in buffer
   osmscout::Distance bufferElevation; // summary of points elevations in buffer
   std::optional<osmscout::gpx::TrackPoint> lastPoint=std::nullopt;
@@ -243,6 +289,13 @@ public:
   void update(const osmscout::gpx::TrackPoint &point);
   void segmentEnd();
 
+  /**
+   * Merge accumulator of following track segments. Segment end is assumed
+   * between accumulated points and following ones, so the result is the same
+   * as if all the points were accumulated by this accumulator.
+   */
+  void merge(const TrackStatisticsAccumulator &following);
+
   TrackStatistics accumulate() const;
 
   std::optional<osmscout::Timestamp> getTo() const
@@ -255,6 +308,26 @@ public:
     return length;
   }
 
+  /**
+   * Last accumulated point of current segment.
+   */
+  std::optional<osmscout::GeoCoord> getLastCoord() const
+  {
+    return lastCoord;
+  }
+
+  /**
+   * Complete internal state of accumulator, including filter windows.
+   * Deserialized accumulator continues exactly as this one, without need
+   * to process track points again.
+   */
+  QByteArray serialize() const;
+
+  /**
+   * @return nullopt when state is empty, corrupted or from incompatible version
+   */
+  static std::optional<TrackStatisticsAccumulator> deserialize(const QByteArray &state);
+
 private:
   // filter
   size_t rawCount{0};
@@ -390,6 +463,16 @@ public:
   using QStringOpt = std::optional<QString>;
   using WaypointNearby = std::tuple<osmscout::Distance, Waypoint>;
 
+  /**
+   * Database is in WAL mode, durability profile controls how often are changes synced to disk.
+   */
+  enum DurabilityProfile {
+    Recording, // synchronous=NORMAL, commit may be lost on power failure (not on app crash), default
+    BulkImport, // synchronous=OFF, used for import of big files
+    Durable // synchronous=FULL, every commit is synced to disk
+  };
+  Q_ENUM(DurabilityProfile)
+
 private:
   bool updateSchema();
 
@@ -399,7 +482,53 @@ signals:
 
   void collectionsLoaded(std::vector<Collection> collections, bool ok);
   void collectionDetailsLoaded(Collection collection, bool ok);
-  void trackDataLoaded(Track track, std::optional<double>, bool complete, bool ok);
+  /**
+   * Requester is the object passed to loadTrackData, it is nullptr when track was loaded
+   * after modification. Track loaded by loadTrackData don't contain data,
+   * its points are delivered to the requester by trackDataChunkLoaded.
+   */
+  void trackDataLoaded(Track track, std::optional<double>, bool complete, bool ok, QObject *requester = nullptr);
+
+  /**
+   * Part of track data, emitted by loadTrackData between trackDataLoaded(complete=false)
+   * and trackDataLoaded(complete=true) signals. Points should be appended to segment
+   * with given index, segments are loaded in order and every segment is announced
+   * by one chunk at least. Track don't contain data.
+   */
+  void trackDataChunkLoaded(Track track, std::optional<double> accuracyFilter, quint64 segmentIndex,
+                            std::shared_ptr<std::vector<osmscout::gpx::TrackPoint>> points,
+                            QObject *requester);
+
+  /**
+   * Simplified track points, see TrackLod. Track don't contain data.
+   */
+  void trackLodLoaded(Track track, int level,
+                      std::shared_ptr<std::vector<std::vector<osmscout::GeoCoord>>> segments,
+                      bool ok);
+
+  /**
+   * Elevation profile of the track decimated to requested count of buckets,
+   * see ElevationProfile. Track don't contain data.
+   */
+  void elevationProfileLoaded(Track track, std::optional<double> accuracyFilter,
+                              std::shared_ptr<std::vector<ElevationProfilePoint>> points,
+                              bool ok);
+
+  /**
+   * Points appended to the track by appendNodes. Track don't contain data,
+   * its lastModification is already updated. Receiver that holds track data with
+   * previousModification may append points to the segment with given index instead
+   * of reloading whole track. When segmentCreated is true, following points
+   * will be appended to new segment.
+   */
+  void trackDataAppended(Track track, QDateTime previousModification, quint64 segmentIndex,
+                         std::shared_ptr<std::vector<osmscout::gpx::TrackPoint>> points,
+                         bool segmentCreated);
+
+  /**
+   * Result of appendNodes, it is emitted for every request, successful or not.
+   */
+  void nodesAppended(qint64 trackId, quint64 journalSequence, bool ok);
   void collectionExported(qint64 collectionId, QString file, bool success);
   void trackExported(qint64 trackId, QString file, bool success);
 
@@ -410,7 +539,7 @@ signals:
   void trackDeleted(qint64 collectionId, qint64 trackId);
   void waypointDeleted(qint64 collectionId, qint64 waypointId);
 
-  void openTrackLoaded(Track track, bool ok);
+  void openTrackLoaded(Track track, QByteArray statisticsState, bool ok);
 
   void searchHistory(std::vector<SearchItem> items);
 
@@ -421,6 +550,28 @@ signals:
 public slots:
   void init();
 
+  /**
+   * Change durability profile of database connection.
+   */
+  void setDurabilityProfile(Storage::DurabilityProfile profile);
+
+  /**
+   * Copy WAL content to database file, readers and writers are not blocked
+   * and WAL file is not truncated (PASSIVE mode).
+   */
+  void checkpoint();
+
+  /**
+   * Database is checkpointed when application goes to the background,
+   * at most once per five minutes.
+   */
+  void applicationStateChanged(Qt::ApplicationState state);
+
+  /**
+   * Print reuse counts of cached prepared statements to debug log.
+   */
+  void logStatementCacheStats();
+
   /**
    * load collection list
    * emits collectionsLoaded
@@ -435,9 +586,37 @@ public slots:
 
   /**
    * load track data
-   * emits trackDataLoaded
+   * emits trackDataLoaded (complete=false), trackDataChunkLoaded (repeatedly)
+   * and trackDataLoaded (complete=true), all of them with given requester.
+   * Requester is used just to identify the request, it is not dereferenced.
+   *
+   * When the same requester registered newer request for the same track (and accuracy filter)
+   * by registerTrackDataRequest, loading is cancelled and the final trackDataLoaded
+   * signal is not emitted.
    */
-  void loadTrackData(Track track, std::optional<double> accuracyFilter);
+  void loadTrackData(Track track, std::optional<double> accuracyFilter, QObject *requester);
+
+  /**
+   * Register track data request, it should be invoked via direct connection
+   * from requester thread, before loadTrackData request is queued.
+   * Thread safe.
+   */
+  void registerTrackDataRequest(Track track, std::optional<double> accuracyFilter, QObject *requester);
+
+  /**
+   * load coordinates of track segments simplified to given level of detail,
+   * missing levels of segments are computed and stored.
+   * emits trackLodLoaded
+   */
+  void loadTrackLod(Track track, int level);
+
+  /**
+   * load elevation profile of the track decimated to given count of buckets
+   * (usually chart width in pixels). Profile is cached in database
+   * until the track is modified.
+   * emits elevationProfileLoaded
+   */
+  void loadElevationProfile(Track track, std::optional<double> accuracyFilter, int buckets);
 
   /**
    * update collection or create it (if id < 0)
@@ -577,20 +756,31 @@ public slots:
 
   /**
    * emit openTrackLoaded()
+   *
+   * Points from track journal that was not persisted (application was killed
+   * during recording) are appended to their track first.
+   * Serialized TrackStatisticsAccumulator of the open segment is emitted with the track,
+   * when it is available.
    */
   void loadRecentOpenTrack();
 
   /**
-   * Append batch of nodes to last segment in track,
-   * update track statistics.
-   * Possibly create new segment when "createNewSegment" is true
+   * Append batch of nodes to last segment in track, batch are the first "count"
+   * points from the queue, update track statistics.
+   * Possibly create new segment when "createNewSegment" is true.
+   * Accumulator state (see TrackStatisticsAccumulator::serialize) is stored
+   * with the open segment, it should correspond to the track statistics.
+   * Journal sequence is just passed to nodesAppended signal, see TrackJournal.
    *
-   * emit collectionDetailsLoaded
+   * emit trackDataAppended, nodesAppended, collectionDetailsLoaded
    */
   void appendNodes(qint64 trackId,
-                   std::shared_ptr<std::vector<osmscout::gpx::TrackPoint>> batch,
+                   std::shared_ptr<TrackPointQueue> queue,
+                   quint64 count,
                    TrackStatistics statistics,
-                   bool createNewSegment);
+                   QByteArray statisticsState,
+                   bool createNewSegment,
+                   quint64 journalSequence);
 
   /**
    * emit searchHistory
@@ -628,10 +818,16 @@ public:
 
   operator bool() const;
 
-  static void initInstance(const QDir &directory);
+  static void initInstance(const QDir &directory, DurabilityProfile durability = Recording);
   static Storage* getInstance();
   static void clearInstance();
 
+  /**
+   * Journal of recorded points that are not persisted yet, see TrackJournal.
+   * It may be used from any thread.
+   */
+  QString trackJournalPath() const;
+
 private:
   QSqlQuery trackInsertSql();
 
@@ -649,15 +845,57 @@ private:
   Waypoint makeWaypoint(QSqlQuery &sql) const;
   std::shared_ptr<std::vector<Track>> loadTracks(qint64 collectionId);
   std::shared_ptr<std::vector<Waypoint>> loadWaypoints(qint64 collectionId);
-  void loadTrackPoints(qint64 segmentId, osmscout::gpx::TrackSegment &segment);
+  bool loadTrackPoints(qint64 segmentId, osmscout::gpx::TrackSegment &segment);
+  /**
+   * Callback with chunk of segment points (segment index, segment point count, points),
+   * loading is aborted when it returns false.
+   */
+  using TrackChunkCallback = std::function<bool(size_t, qint64, std::vector<osmscout::gpx::TrackPoint> &&)>;
+
+  /**
+   * Load points of all track segments chunk by chunk, as they are stored in database,
+   * without holding whole track in memory. Callback is called at least once for every segment.
+   */
+  bool streamTrackSegments(qint64 trackId, const TrackChunkCallback &chunkLoaded);
+
+  /**
+   * Load all segments of the track.
+   */
+  bool loadTrackSegments(qint64 trackId, std::vector<osmscout::gpx::TrackSegment> &segments);
+  /**
+   * Store segment points together with its statistics.
+   */
+  bool storeTrackPoints(qint64 segmentId, const std::vector<osmscout::gpx::TrackPoint> &points);
+  bool storeSegmentStatistics(qint64 segmentId, const TrackStatistics &statistics);
+  bool insertSegment(qint64 trackId, const std::vector<osmscout::gpx::TrackPoint> &points, qint64 &segmentId);
+  TrackStatistics computeSegmentStatistics(const std::vector<osmscout::gpx::TrackPoint> &points) const;
+  void bindSegmentStatistics(QSqlQuery &sql, const TrackStatistics &statistics) const;
+  TrackStatistics makeSegmentStatistics(QSqlQuery &sql) const;
+
+  /**
+   * Compute track statistics by merging statistics of its segments. Segments without
+   * computed statistics (legacy or open segments) are loaded and computed.
+   * Track statistics are stored to database.
+   */
+  bool updateTrackStatisticsFromSegments(qint64 trackId, TrackStatistics &statistics);
   bool checkAccess(QString slotName, bool requireOpen = true);
   bool importWaypoints(const osmscout::gpx::GpxFile &file, qint64 collectionId);
   bool importTracks(const osmscout::gpx::GpxFile &file, qint64 collectionId);
-  bool importTrackPoints(const std::vector<osmscout::gpx::TrackPoint> &points, qint64 segId);
+  bool appendTrackPoints(const std::vector<osmscout::gpx::TrackPoint> &points, qint64 segId);
+  /**
+   * Merge chunks appended to the track segments into segment blobs.
+   */
+  bool compactSegmentChunks(qint64 trackId);
   TrackStatistics computeTrackStatistics(const osmscout::gpx::Track &trk) const;
   bool loadCollectionDetailsPrivate(Collection &collection);
   bool loadTrackDataPrivate(Track &track, std::optional<double> accuracyFilter);
   bool createSegment(qint64 trackId, qint64 &segmentId);
+  bool appendNodesPrivate(qint64 trackId,
+                          TrackPointQueue &queue,
+                          quint64 count,
+                          const TrackStatistics &statistics,
+                          const QByteArray &statisticsState,
+                          bool createNewSegment);
   bool exportPrivate(qint64 collectionId,
                      const QString &file,
                      const std::optional<qint64> &trackId,
@@ -665,18 +903,97 @@ private:
                      std::optional<double> accuracyFilter);
 
   /**
-   * obtain collection id from trackId
+   * load track metadata (without data) by its id
    */
-  bool trackCollection(qint64 trackId, qint64 &collectionId);
+  bool trackHeader(qint64 trackId, Track &track);
+  bool segmentIndex(qint64 trackId, qint64 segmentId, quint64 &index);
+
+  /**
+   * Append points from the journal of recording that was not finished correctly.
+   */
+  bool replayTrackJournal();
   bool listIndexes(QStringList &indexes);
-  int querySize(QSqlQuery &query);
+  bool migrateTrackPointTable();
+  bool createSpatialIndex(const QString &name, const QStringList &queries);
+  bool setupConnection();
+  void importCollectionPrivate(const QString &filePath);
+  bool applyDurabilityProfile(DurabilityProfile profile);
+  bool loadWaypointsInBox(const osmscout::GeoBox &bbox, std::vector<Waypoint> &waypoints);
+
+  /**
+   * Raw sqlite handle of opened database, used for performance critical reading.
+   * It may be nullptr when QSQLITE driver don't provide it
+   * or when driver uses different sqlite library, see checkSqliteLibrary.
+   */
+  sqlite3* sqliteHandle() const;
+
+  /**
+   * Check that QSQLITE driver uses the same sqlite library as we are linked with.
+   * Qt may be built with bundled sqlite, its handle cannot be used with our library then.
+   */
+  bool checkSqliteLibrary();
+
+  /**
+   * Prepared query from the statement cache, it should be used for static sql
+   * that is executed repeatedly.
+   */
+  StatementCache::Statement preparedQuery(const QString &sql);
 
   void cropTrackPrivate(qint64 trackId, quint64 count, bool cropStart);
+  bool loadSegmentSizes(qint64 trackId, std::vector<std::pair<qint64, qint64>> &segments);
+  bool deleteSegment(qint64 segmentId);
+  bool storeSegmentLod(qint64 segmentId, const std::vector<std::vector<osmscout::GeoCoord>> &levels);
+  bool deleteSegmentLod(qint64 segmentId);
+
+  struct CachedElevationProfile {
+    QDateTime modification; // of the track when profile was computed
+    quint64 segmentCount{0}; // processed segments, the last one may be processed partially
+    quint64 segmentPoints{0}; // processed points of the last processed segment
+    QByteArray state; // see ElevationProfile::append
+    std::vector<ElevationProfilePoint> points; // decimated to ElevationProfile::CacheResolution
+  };
+  bool loadCachedElevationProfile(qint64 trackId,
+                                  std::optional<double> accuracyFilter,
+                                  CachedElevationProfile &profile);
+  bool storeElevationProfile(qint64 trackId,
+                             std::optional<double> accuracyFilter,
+                             const CachedElevationProfile &profile);
+  bool deleteElevationProfile(qint64 trackId);
+
+  /**
+   * Process track points after the last processed point of the profile.
+   * @return false on database error or when profile don't match track segments
+   */
+  bool extendElevationProfile(qint64 trackId,
+                              std::optional<double> accuracyFilter,
+                              CachedElevationProfile &profile);
+
+  bool storeStatisticsState(qint64 segmentId, const QByteArray &statisticsState);
+  bool clearStatisticsState(qint64 trackId);
+  bool splitTrackPrivate(const Track &track, quint64 position);
   bool updateTrackStatistics(qint64 trackId, const TrackStatistics &statistics);
 
+  using TrackRequestKey = std::tuple<QObject*, qint64, std::optional<double>>;
+
+  /**
+   * Mark request as processed.
+   * @return true when there is no newer request for the same track
+   */
+  bool takeTrackDataRequest(const TrackRequestKey &key);
+  bool hasNewerTrackDataRequest(const TrackRequestKey &key);
+
 private :
   QSqlDatabase db;
   QThread *thread;
   QDir directory;
   std::atomic_bool ok{false};
+  bool spatialIndex{false}; // rtree tables are available
+  bool rawSqlite{false}; // sqliteHandle may be used, see checkSqliteLibrary
+  DurabilityProfile durabilityProfile{Recording};
+  bool inBackground{false};
+  QElapsedTimer lastCheckpoint;
+  StatementCache statementCache;
+
+  QMutex trackRequestMutex;
+  std::map<TrackRequestKey, size_t> pendingTrackRequests; // guarded by trackRequestMutex
 };
@@ -0,0 +1,548 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2026 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "Storage.h"
+#include "QVariantConverters.h"
+
+#include <osmscoutgpx/Export.h>
+
+#include <osmscout/cli/CmdLineParsing.h>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QtSql/QSqlQuery>
+#include <QList>
+
+#include <cmath>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <memory>
+
+/*
+  Benchmark of track storage. It imports generated track to temporary database
+  and measures track data loading by Storage. For comparison, the same points
+  are loaded from row-per-point table (used till storage schema v3)
+  through QSqlQuery and QVariant conversions.
+
+  Generated waypoints are used for measuring spatial queries.
+
+  Per-point cost of MaxSpeedBuffer and ElevationFilter is compared with
+  their previous implementation, using QList FIFOs and heap allocated last point.
+
+  src/StoragePerfTest --points 100000 --waypoints 100000 --repeat 10
+*/
+
+using namespace osmscout;
+using namespace converters;
+
+struct Arguments {
+  bool help{false};
+  size_t points{100000};
+  size_t segments{1};
+  size_t waypoints{100000};
+  size_t repeat{10};
+};
+
+struct Stats {
+  double minTime{std::numeric_limits<double>::max()};
+  double maxTime{0.0};
+  double totalTime{0.0};
+  size_t count{0};
+
+  void add(double time)
+  {
+    minTime = std::min(minTime, time);
+    maxTime = std::max(maxTime, time);
+    totalTime += time;
+    count++;
+  }
+
+  double avgTime() const
+  {
+    return count == 0 ? 0 : totalTime / count;
+  }
+};
+
+gpx::GpxFile generateGpx(const Arguments &args)
+{
+  gpx::GpxFile gpxFile;
+  gpxFile.name = "StoragePerfTest";
+  gpx::Track &track = gpxFile.tracks.emplace_back();
+  track.name = "generated track";
+
+  Timestamp time = std::chrono::time_point_cast<Timestamp::duration>(std::chrono::system_clock::now());
+  double lat = 50.0;
+  double lon = 14.0;
+  double ele = 300;
+  size_t pointsPerSegment = std::max(size_t(1), args.points / std::max(size_t(1), args.segments));
+  for (size_t i = 0; i < args.points; ++i) {
+    if (i % pointsPerSegment == 0) {
+      track.segments.emplace_back();
+    }
+    // random walk, approximately 5 m per second
+    lat += double(std::rand() % 100) / 1e6 - 0.00003;
+    lon += double(std::rand() % 100) / 1e6 - 0.00003;
+    ele += double(std::rand() % 100) / 100 - 0.5;
+    time += std::chrono::seconds(1);
+
+    gpx::TrackPoint &point = track.segments.back().points.emplace_back(GeoCoord(lat, lon));
+    point.timestamp = time;
+    point.elevation = ele;
+    point.hdop = double(std::rand() % 200) / 10;
+    point.vdop = double(std::rand() % 200) / 10;
+  }
+
+  // waypoints randomly distributed in 1x1 degree box around the track start
+  gpxFile.waypoints.reserve(args.waypoints);
+  for (size_t i = 0; i < args.waypoints; ++i) {
+    gpx::Waypoint &wpt = gpxFile.waypoints.emplace_back(GeoCoord(49.5 + double(std::rand() % 1000000) / 1e6,
+                                                                 13.5 + double(std::rand() % 1000000) / 1e6));
+    wpt.name = "waypoint " + std::to_string(i);
+  }
+  return gpxFile;
+}
+
+bool createLegacyTable(QSqlDatabase &db, const gpx::GpxFile &gpxFile)
+{
+  QSqlQuery create = db.exec(QString("CREATE TABLE `track_point` (")
+                               .append("`segment_id` INTEGER NOT NULL, `timestamp` datetime NULL, ")
+                               .append("`latitude` double NOT NULL, `longitude` double NOT NULL, ")
+                               .append("`elevation` double NULL, `horiz_accuracy` double NULL, `vert_accuracy` double NULL);"));
+  if (create.lastError().isValid()) {
+    std::cerr << "Creating legacy table failed: " << create.lastError().text().toStdString() << std::endl;
+    return false;
+  }
+
+  db.transaction();
+  QSqlQuery sql(db);
+  sql.prepare(QString("INSERT INTO `track_point` (`segment_id`, `timestamp`, `latitude`, `longitude`, `elevation`, `horiz_accuracy`, `vert_accuracy`) ")
+                .append("VALUES (:segment_id, :timestamp, :latitude, :longitude, :elevation, :horiz_accuracy, :vert_accuracy);"));
+  qint64 segmentId = 0;
+  for (const auto &seg: gpxFile.tracks.front().segments) {
+    segmentId++;
+    for (const auto &p: seg.points) {
+      sql.bindValue(":segment_id", segmentId);
+      sql.bindValue(":timestamp", dateTimeToSQL(timestampToDateTime(p.timestamp)));
+      sql.bindValue(":latitude", p.coord.GetLat());
+      sql.bindValue(":longitude", p.coord.GetLon());
+      sql.bindValue(":elevation", p.elevation.has_value() ? QVariant(*p.elevation) : QVariant());
+      sql.bindValue(":horiz_accuracy", p.hdop.has_value() ? QVariant(*p.hdop) : QVariant());
+      sql.bindValue(":vert_accuracy", p.vdop.has_value() ? QVariant(*p.vdop) : QVariant());
+      sql.exec();
+      if (sql.lastError().isValid()) {
+        std::cerr << "Inserting legacy point failed: " << sql.lastError().text().toStdString() << std::endl;
+        db.rollback();
+        return false;
+      }
+    }
+  }
+  return db.commit();
+}
+
+size_t loadLegacy(QSqlDatabase &db, size_t segmentCount)
+{
+  size_t count = 0;
+  for (qint64 segmentId = 1; segmentId <= qint64(segmentCount); ++segmentId) {
+    gpx::TrackSegment segment;
+    QSqlQuery sql(db);
+    sql.prepare("SELECT CAST(STRFTIME('%s',`timestamp`, 'UTC') AS INTEGER) AS `timestamp`, `latitude`, `longitude`, `elevation`, `horiz_accuracy`, `vert_accuracy` FROM `track_point` WHERE segment_id = :segmentId;");
+    sql.bindValue(":segmentId", segmentId);
+    sql.exec();
+    int size = 0;
+    if (sql.last()) {
+      size = sql.at() + 1;
+    }
+    sql.seek(QSql::BeforeFirstRow);
+    segment.points.reserve(size);
+    while (sql.next()) {
+      gpx::TrackPoint &point = segment.points.emplace_back(GeoCoord(varToDouble(sql.value(1)), varToDouble(sql.value(2))));
+      point.timestamp = varLongToOptTimestamp(sql.value(0));
+      point.elevation = varToDoubleOpt(sql.value(3));
+      point.hdop = varToDoubleOpt(sql.value(4));
+      point.vdop = varToDoubleOpt(sql.value(5));
+    }
+    count += segment.points.size();
+  }
+  return count;
+}
+
+/**
+ * MaxSpeedBuffer before ring buffer rewrite, for comparison.
+ */
+class LegacyMaxSpeedBuffer
+{
+public:
+  void insert(const gpx::TrackPoint &p)
+  {
+    if (!p.timestamp){
+      return;
+    }
+    if (lastPoint){
+      Timestamp::duration timeDiff = *(p.timestamp) - *(lastPoint->timestamp);
+      if (timeDiff.count() < 0){
+        return;
+      }
+      Distance distanceDiff = GetEllipsoidalDistance(lastPoint->coord, p.coord);
+      distanceFifo.push_back(distanceDiff);
+      timeFifo.push_back(timeDiff);
+      bufferDistance += distanceDiff;
+      bufferTime += timeDiff;
+
+      while (bufferTime > std::chrono::seconds(5) && !distanceFifo.empty()){
+        double speed = bufferDistance.AsMeter() / std::chrono::duration<double>(bufferTime).count();
+        maxSpeed = std::max(maxSpeed, speed);
+        bufferDistance = bufferDistance - distanceFifo.front();
+        bufferTime -= timeFifo.front();
+        distanceFifo.pop_front();
+        timeFifo.pop_front();
+      }
+    }
+    lastPoint=std::make_shared<gpx::TrackPoint>(p);
+  }
+
+  double getMaxSpeed() const
+  {
+    return maxSpeed;
+  }
+
+private:
+  QList<Distance> distanceFifo;
+  QList<Timestamp::duration> timeFifo;
+  Distance bufferDistance;
+  Timestamp::duration bufferTime{0};
+  std::shared_ptr<gpx::TrackPoint> lastPoint;
+  double maxSpeed{0};
+};
+
+/**
+ * ElevationFilter before ring buffer rewrite, for comparison.
+ */
+class LegacyElevationFilter
+{
+public:
+  std::optional<Distance> update(const gpx::TrackPoint &p)
+  {
+    if (!p.elevation || (p.vdop && *(p.vdop) >= 50.0) || (p.hdop && *(p.hdop) >= 30.0)) {
+      return std::nullopt;
+    }
+    Distance currentEle = Meters(*p.elevation);
+    if (lastPoint) {
+      Distance distanceDiff = GetEllipsoidalDistance(lastPoint->coord, p.coord);
+      bool flushBuffer = false;
+      if (p.timestamp && lastPoint->timestamp) {
+        double timeDiff = std::chrono::duration<double>(*(p.timestamp) - *(lastPoint->timestamp)).count();
+        if (timeDiff > 0) {
+          double speed = std::abs(*(p.elevation) - *(lastPoint->elevation)) / timeDiff;
+          flushBuffer = speed > 50;
+        }
+      }
+      if (flushBuffer) {
+        flush();
+      } else {
+        distanceFifo.push_back(distanceDiff);
+        elevationFifo.push_back(currentEle);
+        bufferLength += distanceDiff;
+        bufferElevation += currentEle;
+      }
+    }
+    if (distanceFifo.empty()) {
+      distanceFifo.push_back(Meters(0));
+      elevationFifo.push_back(currentEle);
+      bufferLength = Meters(0);
+      bufferElevation = currentEle;
+    }
+    lastPoint = p;
+    if (bufferLength > Meters(250) || distanceFifo.size() > 60) {
+      Distance eleAvg = bufferElevation / distanceFifo.size();
+      bufferLength -= distanceFifo.front();
+      distanceFifo.pop_front();
+      bufferElevation -= elevationFifo.front();
+      elevationFifo.pop_front();
+
+      minElevation = minElevation ? std::min(eleAvg, *minElevation) : eleAvg;
+      maxElevation = maxElevation ? std::max(eleAvg, *maxElevation) : eleAvg;
+      if (lastEleStep) {
+        Distance step = eleAvg - *lastEleStep;
+        if (std::abs(step.AsMeter()) > 9.0) {
+          if (step > Meters(0)) {
+            ascent += step;
+          } else {
+            descent -= step;
+          }
+          lastEleStep = eleAvg;
+        }
+      } else {
+        lastEleStep = eleAvg;
+      }
+      return eleAvg;
+    }
+    return std::nullopt;
+  }
+
+private:
+  void flush()
+  {
+    distanceFifo.clear();
+    elevationFifo.clear();
+    bufferLength = Meters(0);
+    bufferElevation = Meters(0);
+    lastPoint = std::nullopt;
+    lastEleStep = std::nullopt;
+  }
+
+private:
+  std::optional<Distance> minElevation;
+  std::optional<Distance> maxElevation;
+  Distance ascent;
+  Distance descent;
+  std::optional<Distance> lastEleStep;
+
+  QList<Distance> distanceFifo;
+  QList<Distance> elevationFifo;
+  Distance bufferLength;
+  Distance bufferElevation;
+  std::optional<gpx::TrackPoint> lastPoint;
+};
+
+/**
+ * Process all points with given filter.
+ * @return result used by the benchmark, so the compiler cannot skip the work
+ */
+template<typename Filter, typename Update>
+double runFilter(const gpx::Track &track, Stats &stats, Update update)
+{
+  QElapsedTimer timer;
+  timer.start();
+  Filter filter;
+  double result = 0;
+  for (const auto &segment: track.segments) {
+    for (const auto &point: segment.points) {
+      result += update(filter, point);
+    }
+  }
+  stats.add(timer.nsecsElapsed() / 1e6);
+  return result;
+}
+
+void printPointCost(const std::string &name, const Stats &stats, size_t points)
+{
+  std::cout << std::left << std::setw(24) << name
+            << " avg: " << std::setw(8) << stats.avgTime() << " ms"
+            << " per point: " << std::setw(8) << (points == 0 ? 0 : stats.avgTime() * 1e6 / points) << " ns" << std::endl;
+}
+
+void printStats(const std::string &name, const Stats &stats, size_t count)
+{
+  std::cout << std::left << std::setw(24) << name
+            << " min: " << std::setw(8) << stats.minTime << " ms"
+            << " avg: " << std::setw(8) << stats.avgTime() << " ms"
+            << " max: " << std::setw(8) << stats.maxTime << " ms"
+            << " count: " << count << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  CmdLineParser argParser("StoragePerfTest", argc, argv);
+  Arguments args;
+
+  argParser.AddOption(CmdLineFlag([&args](const bool& value) {
+                        args.help=value;
+                      }),
+                      std::vector<std::string>{"h","help"},
+                      "Display help",
+                      true);
+  argParser.AddOption(CmdLineUIntOption([&args](const unsigned int& value) {
+                        args.points = value;
+                      }),
+                      "points",
+                      "Count of generated track points, default: " + std::to_string(args.points),
+                      false);
+  argParser.AddOption(CmdLineUIntOption([&args](const unsigned int& value) {
+                        args.segments = std::max(1u, value);
+                      }),
+                      "segments",
+                      "Count of generated track segments, default: " + std::to_string(args.segments),
+                      false);
+  argParser.AddOption(CmdLineUIntOption([&args](const unsigned int& value) {
+                        args.waypoints = value;
+                      }),
+                      "waypoints",
+                      "Count of generated waypoints, default: " + std::to_string(args.waypoints),
+                      false);
+  argParser.AddOption(CmdLineUIntOption([&args](const unsigned int& value) {
+                        args.repeat = std::max(1u, value);
+                      }),
+                      "repeat",
+                      "Repeat every load, default: " + std::to_string(args.repeat),
+                      false);
+
+  CmdLineParseResult argResult=argParser.Parse();
+  if (argResult.HasError()) {
+    std::cerr << "ERROR: " << argResult.GetErrorDescription() << std::endl;
+    std::cout << argParser.GetHelp() << std::endl;
+    return 1;
+  }
+  if (args.help) {
+    std::cout << argParser.GetHelp() << std::endl;
+    return 0;
+  }
+
+  QCoreApplication app(argc, argv);
+  qRegisterMetaType<std::optional<double>>("std::optional<double>");
+
+  QTemporaryDir tmpDir;
+  if (!tmpDir.isValid()) {
+    std::cerr << "Cannot create temporary directory" << std::endl;
+    return 1;
+  }
+
+  gpx::GpxFile gpxFile = generateGpx(args);
+  QString gpxPath = tmpDir.filePath("generated.gpx");
+  if (!gpx::ExportGpx(gpxFile, gpxPath.toStdString(), nullptr, nullptr)) {
+    std::cerr << "Cannot export generated track" << std::endl;
+    return 1;
+  }
+  size_t segmentCount = gpxFile.tracks.front().segments.size();
+
+  // Storage slots are invoked directly, from the thread where it "lives"
+  Storage storage(QThread::currentThread(), QDir(tmpDir.filePath("storage")));
+  QObject::connect(&storage, &Storage::error, [](QString message) {
+    std::cerr << "Storage error: " << message.toStdString() << std::endl;
+  });
+  storage.init();
+  if (!storage) {
+    std::cerr << "Storage initialisation failed" << std::endl;
+    return 1;
+  }
+
+  std::vector<Collection> collections;
+  QObject::connect(&storage, &Storage::collectionsLoaded, [&collections](std::vector<Collection> loaded, bool) {
+    collections = loaded;
+  });
+  QElapsedTimer timer;
+  timer.start();
+  storage.importCollection(gpxPath);
+  qint64 importTime = std::max(timer.elapsed(), qint64(1));
+  std::cout << "Imported " << args.points << " points and " << args.waypoints << " waypoints in " << importTime << " ms"
+            << " (" << (args.points * 1000 / importTime) << " points/s)" << std::endl;
+  if (collections.empty()) {
+    std::cerr << "Import failed" << std::endl;
+    return 1;
+  }
+
+  Collection collection;
+  QObject::connect(&storage, &Storage::collectionDetailsLoaded, [&collection](Collection loaded, bool) {
+    collection = loaded;
+  });
+  storage.loadCollectionDetails(collections.front());
+  if (!collection.tracks || collection.tracks->empty()) {
+    std::cerr << "Imported track not found" << std::endl;
+    return 1;
+  }
+
+  // track data are streamed in chunks, they are kept like a consumer would do
+  std::vector<std::shared_ptr<std::vector<gpx::TrackPoint>>> chunks;
+  QObject::connect(&storage, &Storage::trackDataChunkLoaded,
+                   [&chunks](Track, std::optional<double>, quint64, std::shared_ptr<std::vector<gpx::TrackPoint>> points, QObject*) {
+    chunks.push_back(points);
+  });
+
+  Stats storageStats;
+  size_t storagePoints = 0;
+  for (size_t i = 0; i < args.repeat; ++i) {
+    chunks.clear();
+    timer.restart();
+    storage.loadTrackData(collection.tracks->front(), std::nullopt, nullptr);
+    storageStats.add(timer.nsecsElapsed() / 1e6);
+    storagePoints = 0;
+    for (const auto &chunk: chunks) {
+      storagePoints += chunk->size();
+    }
+  }
+
+  // legacy storage
+  QSqlDatabase legacyDb = QSqlDatabase::addDatabase("QSQLITE", "legacy");
+  legacyDb.setDatabaseName(tmpDir.filePath("legacy.db"));
+  if (!legacyDb.open() || !createLegacyTable(legacyDb, gpxFile)) {
+    std::cerr << "Cannot create legacy database" << std::endl;
+    return 1;
+  }
+  Stats legacyStats;
+  size_t legacyPoints = 0;
+  for (size_t i = 0; i < args.repeat; ++i) {
+    timer.restart();
+    legacyPoints = loadLegacy(legacyDb, segmentCount);
+    legacyStats.add(timer.nsecsElapsed() / 1e6);
+  }
+
+  // spatial queries
+  GeoCoord center(50.0, 14.0);
+  size_t nearbyCount = 0;
+  QObject::connect(&storage, &Storage::nearbyWaypoints,
+                   [&nearbyCount](const GeoCoord &, const Distance &, const std::vector<Storage::WaypointNearby> &waypoints) {
+    nearbyCount = waypoints.size();
+  });
+
+  Stats nearbyStats;
+  for (size_t i = 0; i < args.repeat; ++i) {
+    timer.restart();
+    storage.loadNearbyWaypoints(center, Meters(1000));
+    nearbyStats.add(timer.nsecsElapsed() / 1e6);
+  }
+
+  // statistics filters, once per point in import, tracking and statistics computation
+  Stats maxSpeedStats;
+  Stats legacyMaxSpeedStats;
+  Stats elevationStats;
+  Stats legacyElevationStats;
+  double checksum = 0;
+  const gpx::Track &generatedTrack = gpxFile.tracks.front();
+  for (size_t i = 0; i < args.repeat; ++i) {
+    checksum += runFilter<MaxSpeedBuffer>(generatedTrack, maxSpeedStats, [](MaxSpeedBuffer &f, const gpx::TrackPoint &p) {
+      f.insert(p);
+      return f.getMaxSpeed();
+    });
+    checksum += runFilter<LegacyMaxSpeedBuffer>(generatedTrack, legacyMaxSpeedStats, [](LegacyMaxSpeedBuffer &f, const gpx::TrackPoint &p) {
+      f.insert(p);
+      return f.getMaxSpeed();
+    });
+    checksum += runFilter<ElevationFilter>(generatedTrack, elevationStats, [](ElevationFilter &f, const gpx::TrackPoint &p) {
+      return f.update(p).value_or(Meters(0)).AsMeter();
+    });
+    checksum += runFilter<LegacyElevationFilter>(generatedTrack, legacyElevationStats, [](LegacyElevationFilter &f, const gpx::TrackPoint &p) {
+      return f.update(p).value_or(Meters(0)).AsMeter();
+    });
+  }
+
+  printStats("Storage::loadTrackData", storageStats, storagePoints);
+  printStats("row-per-point QVariant", legacyStats, legacyPoints);
+  printStats("nearby waypoints (1 km)", nearbyStats, nearbyCount);
+  printPointCost("MaxSpeedBuffer", maxSpeedStats, args.points);
+  printPointCost("QList MaxSpeedBuffer", legacyMaxSpeedStats, args.points);
+  printPointCost("ElevationFilter", elevationStats, args.points);
+  printPointCost("QList ElevationFilter", legacyElevationStats, args.points);
+  std::cout << "filters checksum: " << checksum << std::endl;
+
+  storage.logStatementCacheStats();
+
+  return storagePoints == args.points && legacyPoints == args.points ? 0 : 1;
+}
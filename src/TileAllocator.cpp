@@ -0,0 +1,352 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2026 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "TileAllocator.h"
+
+#include "config.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#if defined(HAVE_LIB_GPERFTOOLS)
+#include <gperftools/tcmalloc.h>
+
+// glibc allocator is still accessible when malloc is replaced by tcmalloc
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void __libc_free(void *ptr);
+#endif
+
+namespace {
+
+enum class Source: uint32_t
+{
+  System,
+  TcMalloc,
+  Arena
+};
+
+struct Chunk
+{
+  std::atomic<size_t> references; // live allocations + 1 while the chunk is open
+  size_t used;
+};
+
+// header keeps default new alignment of returned pointer, on 32-bit targets as well
+constexpr size_t Alignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+struct alignas(Alignment) Header
+{
+  Chunk *chunk;
+  Source source;
+};
+static_assert(sizeof(Header) % Alignment == 0);
+
+constexpr size_t align(size_t size)
+{
+  return (size + Alignment - 1) & ~(Alignment - 1);
+}
+
+constexpr size_t ChunkHeaderSize = align(sizeof(Chunk));
+constexpr size_t MaxArenaAllocation = TileAllocator::ChunkSize / 8; // bigger allocations goes to system allocator
+
+std::atomic<TileAllocator::Type> currentType{TileAllocator::Type::System};
+std::atomic<bool> scopeActive{false};
+std::atomic<uint64_t> generation{0}; // incremented by every scope change, stale chunks are closed
+
+std::atomic<uint64_t> allocations{0};
+std::atomic<uint64_t> allocated{0};
+std::atomic<uint64_t> chunks{0};
+std::atomic<uint64_t> liveChunks{0};
+
+// trivial type, it is accessible during thread exit as well
+struct ThreadChunk
+{
+  Chunk *chunk;
+  uint64_t generation;
+  bool exiting; // arena is not used by exiting thread anymore
+};
+thread_local ThreadChunk threadChunk{nullptr, 0, false};
+
+void* systemAlloc(size_t size)
+{
+#if defined(HAVE_LIB_GPERFTOOLS)
+  return __libc_malloc(size);
+#else
+  return std::malloc(size);
+#endif
+}
+
+void systemFree(void *ptr)
+{
+#if defined(HAVE_LIB_GPERFTOOLS)
+  __libc_free(ptr);
+#else
+  std::free(ptr);
+#endif
+}
+
+void releaseChunk(Chunk *chunk)
+{
+  if (chunk->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    liveChunks.fetch_sub(1, std::memory_order_relaxed);
+    chunk->~Chunk();
+    systemFree(chunk);
+  }
+}
+
+void closeThreadChunk()
+{
+  if (threadChunk.chunk != nullptr) {
+    releaseChunk(threadChunk.chunk);
+    threadChunk.chunk = nullptr;
+  }
+}
+
+/**
+ * Open chunk is closed when thread exits, worker threads may be short living.
+ */
+struct ThreadGuard
+{
+  bool used{false};
+
+  ~ThreadGuard()
+  {
+    threadChunk.exiting = true;
+    closeThreadChunk();
+  }
+};
+thread_local ThreadGuard threadGuard;
+
+Header* arenaAlloc(size_t size, uint64_t currentGeneration)
+{
+  if (threadChunk.exiting) {
+    return nullptr;
+  }
+  size_t total = sizeof(Header) + align(size);
+  if (threadChunk.chunk != nullptr && threadChunk.chunk->used + total > TileAllocator::ChunkSize) {
+    closeThreadChunk();
+  }
+  if (threadChunk.chunk == nullptr) {
+    void *memory = systemAlloc(TileAllocator::ChunkSize);
+    if (memory == nullptr) {
+      return nullptr;
+    }
+    threadChunk.chunk = new (memory) Chunk{{1}, ChunkHeaderSize};
+    threadChunk.generation = currentGeneration;
+    threadGuard.used = true; // registers guard destructor
+    chunks.fetch_add(1, std::memory_order_relaxed);
+    liveChunks.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // just owner thread is bumping the chunk, it holds one reference, so it cannot be released meanwhile
+  Chunk *chunk = threadChunk.chunk;
+  auto *header = reinterpret_cast<Header*>(reinterpret_cast<char*>(chunk) + chunk->used);
+  chunk->used += total;
+  chunk->references.fetch_add(1, std::memory_order_relaxed);
+  header->chunk = chunk;
+  header->source = Source::Arena;
+  return header;
+}
+
+void* allocate(size_t size)
+{
+  uint64_t currentGeneration = generation.load(std::memory_order_acquire);
+  if (threadChunk.chunk != nullptr && threadChunk.generation != currentGeneration) {
+    closeThreadChunk();
+  }
+
+  TileAllocator::Type type = currentType.load(std::memory_order_relaxed);
+  Header *header = nullptr;
+  if (scopeActive.load(std::memory_order_relaxed)) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated.fetch_add(size, std::memory_order_relaxed);
+    if (type == TileAllocator::Type::Arena && size <= MaxArenaAllocation) {
+      header = arenaAlloc(size, currentGeneration);
+    }
+  }
+  if (header == nullptr) {
+#if defined(HAVE_LIB_GPERFTOOLS)
+    if (type == TileAllocator::Type::TcMalloc) {
+      header = static_cast<Header*>(tc_malloc(sizeof(Header) + size));
+      if (header != nullptr) {
+        header->source = Source::TcMalloc;
+      }
+    } else
+#endif
+    {
+      header = static_cast<Header*>(systemAlloc(sizeof(Header) + size));
+      if (header != nullptr) {
+        header->source = Source::System;
+      }
+    }
+    if (header == nullptr) {
+      return nullptr;
+    }
+    header->chunk = nullptr;
+  }
+  return header + 1;
+}
+
+void deallocate(void *ptr)
+{
+  if (ptr == nullptr) {
+    return;
+  }
+  Header *header = static_cast<Header*>(ptr) - 1;
+  switch (header->source) {
+    case Source::Arena:
+      releaseChunk(header->chunk);
+      break;
+    case Source::TcMalloc:
+#if defined(HAVE_LIB_GPERFTOOLS)
+      tc_free(header);
+#endif
+      break;
+    case Source::System:
+      systemFree(header);
+      break;
+  }
+}
+
+void* allocateOrThrow(size_t size)
+{
+  void *ptr = allocate(size);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+}
+
+bool TileAllocator::parseType(const std::string &name, Type &type)
+{
+  for (Type t: {Type::System, Type::TcMalloc, Type::Arena}) {
+    if (name == typeName(t)) {
+      type = t;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* TileAllocator::typeName(Type type)
+{
+  switch (type) {
+    case Type::System: return "system";
+    case Type::TcMalloc: return "tcmalloc";
+    case Type::Arena: return "arena";
+  }
+  return "unknown";
+}
+
+bool TileAllocator::isAvailable(Type type)
+{
+#if defined(HAVE_LIB_GPERFTOOLS)
+  return true;
+#else
+  return type != Type::TcMalloc;
+#endif
+}
+
+void TileAllocator::setType(Type type)
+{
+  currentType.store(type, std::memory_order_relaxed);
+}
+
+TileAllocator::Type TileAllocator::type()
+{
+  return currentType.load(std::memory_order_relaxed);
+}
+
+void TileAllocator::beginScope()
+{
+  allocations.store(0, std::memory_order_relaxed);
+  allocated.store(0, std::memory_order_relaxed);
+  chunks.store(0, std::memory_order_relaxed);
+  generation.fetch_add(1, std::memory_order_release);
+  scopeActive.store(true, std::memory_order_relaxed);
+}
+
+void TileAllocator::endScope()
+{
+  scopeActive.store(false, std::memory_order_relaxed);
+  generation.fetch_add(1, std::memory_order_release);
+  closeThreadChunk();
+}
+
+TileAllocator::Statistics TileAllocator::statistics()
+{
+  return Statistics{
+    allocations.load(std::memory_order_relaxed),
+    allocated.load(std::memory_order_relaxed),
+    chunks.load(std::memory_order_relaxed),
+    liveChunks.load(std::memory_order_relaxed)
+  };
+}
+
+void* operator new(size_t size)
+{
+  return allocateOrThrow(size);
+}
+
+void* operator new[](size_t size)
+{
+  return allocateOrThrow(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+  return allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+  return allocate(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+  deallocate(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+  deallocate(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+  deallocate(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+  deallocate(ptr);
+}
+
+void operator delete(void *ptr, const std::nothrow_t&) noexcept
+{
+  deallocate(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t&) noexcept
+{
+  deallocate(ptr);
+}
@@ -0,0 +1,101 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2026 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Allocator behind global operator new/delete of PerformanceTest binary.
+ * It makes possible to compare allocators for one tile load-and-draw cycle:
+ *
+ *  - system: malloc/free (glibc)
+ *  - tcmalloc: gperftools tc_malloc/tc_free, available when built with HAVE_LIB_GPERFTOOLS
+ *  - arena: allocations inside the scope (from all threads) are bumped from 1 MiB chunks,
+ *    delete just decrements chunk reference count and the whole chunk is released when
+ *    the last object allocated in it is deleted. Objects that outlive the scope
+ *    (tile cache, database caches) keep their chunks alive, they are reported as retained.
+ *
+ * Every allocation has small header with its source, so memory may be released
+ * after the allocator type is changed. Only C++ allocations are affected, Qt containers
+ * and C libraries are using malloc directly.
+ */
+class TileAllocator
+{
+public:
+  enum class Type
+  {
+    System,
+    TcMalloc,
+    Arena
+  };
+
+  struct Statistics
+  {
+    uint64_t allocations{0}; // operator new calls inside the scope
+    uint64_t allocated{0}; // bytes requested inside the scope
+    uint64_t chunks{0}; // arena chunks allocated inside the scope
+    uint64_t retainedChunks{0}; // arena chunks that are still alive (from all scopes)
+  };
+
+  TileAllocator() = delete;
+
+  static bool parseType(const std::string &name, Type &type);
+  static const char* typeName(Type type);
+  static bool isAvailable(Type type);
+
+  /**
+   * Type used for following allocations.
+   */
+  static void setType(Type type);
+  static Type type();
+
+  /**
+   * Start of tile load-and-draw cycle, it resets statistics.
+   */
+  static void beginScope();
+
+  /**
+   * End of the cycle. Arena chunks are closed, they are released with the last object.
+   * Chunk of other threads are closed on their next allocation.
+   */
+  static void endScope();
+
+  static Statistics statistics();
+
+  static constexpr size_t ChunkSize = 1 << 20;
+};
+
+class TileAllocatorScope
+{
+public:
+  TileAllocatorScope()
+  {
+    TileAllocator::beginScope();
+  }
+
+  ~TileAllocatorScope()
+  {
+    TileAllocator::endScope();
+  }
+
+  TileAllocatorScope(const TileAllocatorScope&) = delete;
+  TileAllocatorScope& operator=(const TileAllocatorScope&) = delete;
+};
@@ -19,8 +19,6 @@
 
 #include "TrackElevationChartWidget.h"
 
-#include <QElapsedTimer>
-
 TrackElevationChartWidget::TrackElevationChartWidget(QQuickItem* parent)
   :osmscout::ElevationChartWidget(parent)
 {
@@ -35,8 +33,12 @@ TrackElevationChartWidget::TrackElevationChartWidget(QQuickItem* parent)
           this, &TrackElevationChartWidget::storageInitialisationError,
           Qt::QueuedConnection);
 
-  connect(this, &TrackElevationChartWidget::trackDataRequest,
-          storage, &Storage::loadTrackData,
+  connect(this, &TrackElevationChartWidget::elevationProfileRequest,
+          storage, &Storage::loadElevationProfile,
+          Qt::QueuedConnection);
+
+  connect(storage, &Storage::elevationProfileLoaded,
+          this, &TrackElevationChartWidget::onElevationProfileLoaded,
           Qt::QueuedConnection);
 
   connect(storage, &Storage::trackDataLoaded,
@@ -45,13 +47,40 @@ TrackElevationChartWidget::TrackElevationChartWidget(QQuickItem* parent)
 
   connect(this, &TrackElevationChartWidget::loadingChanged,
           this, &TrackElevationChartWidget::loadingChanged2);
+
+  connect(this, &QQuickItem::widthChanged,
+          this, &TrackElevationChartWidget::onWidthChanged);
+
+  // profile in cache resolution is just needed when widget width is changed, it may be requested again
+  if (MemoryManager *memoryManager = MemoryManager::getInstance(); memoryManager != nullptr) {
+    memoryCacheId = memoryManager->registerCache("elevation profile", CacheTier::Offscreen,
+                                                 [this]() -> size_t {
+                                                   // decimated points are not released, but they are small
+                                                   return (profile ? profile->size() * sizeof(ElevationProfilePoint) : 0) +
+                                                          size_t(points.size()) * sizeof(decltype(points)::value_type);
+                                                 },
+                                                 [this](size_t) -> size_t {
+                                                   size_t released = profile ? profile->size() * sizeof(ElevationProfilePoint) : 0;
+                                                   profile.reset();
+                                                   return released;
+                                                 });
+  }
+}
+
+TrackElevationChartWidget::~TrackElevationChartWidget()
+{
+  if (MemoryManager *memoryManager = MemoryManager::getInstance(); memoryManager != nullptr && memoryCacheId >= 0) {
+    memoryManager->unregisterCache(memoryCacheId);
+  }
 }
 
 void TrackElevationChartWidget::storageInitialised()
 {
   if (track.id > 0) {
     loading = true;
-    emit trackDataRequest(track, accuracyFilter);
+    // profile is requested in cache resolution, it is decimated to widget width by updatePoints,
+    // so width change doesn't require new request
+    emit elevationProfileRequest(track, accuracyFilter, ElevationProfile::CacheResolution);
     emit loadingChanged();
   }
 }
@@ -61,43 +90,21 @@ void TrackElevationChartWidget::storageInitialisationError(QString)
   storageInitialised();
 }
 
-void TrackElevationChartWidget::onTrackDataLoaded(Track track, std::optional<double>, bool complete, bool /*ok*/)
+void TrackElevationChartWidget::onElevationProfileLoaded(Track track,
+                                                         std::optional<double> accuracyFilter,
+                                                         std::shared_ptr<std::vector<ElevationProfilePoint>> profile,
+                                                         bool ok)
 {
-  using namespace osmscout;
-  if (track.id != this->track.id || accuracyFilter != this->accuracyFilter){
+  if (track.id != this->track.id || accuracyFilter != this->accuracyFilter || !loading){
     return;
   }
   // TODO: error handling when !ok
-  loading = !complete;
-  if (complete) {
-    QElapsedTimer timer;
-    timer.start();
-    points.clear();
-    TrackStatisticsAccumulator trackStat;
-    ElevationFilter elevationFilter;
-    for (const auto &segment : track.data->segments) {
-      points.reserve(points.size()+segment.points.size());
-      for (const auto &point : segment.points) {
-        trackStat.update(point);
-        std::optional<osmscout::Distance> eleOpt = elevationFilter.update(point);
-        if (eleOpt.has_value()) {
-          ElevationPoint pt{trackStat.getLength(), *eleOpt, point.coord, nullptr};
-          // qDebug() << "On" << pt.distance.AsMeter() << "ele" << pt.elevation.AsMeter();
-          points.push_back(pt);
-          if (!lowest.has_value() || lowest->elevation > pt.elevation){
-            lowest=pt;
-          }
-          if (!highest.has_value() || highest->elevation < pt.elevation){
-            highest=pt;
-          }
-        }
-      }
-      trackStat.segmentEnd();
-      elevationFilter.flush();
-    }
-    // be careful with elapsed time, method is processed in UI thread
-    qDebug() << "Preparing elevation profile took" << timer.elapsed() << "ms";
-  }
+  loading = false;
+  lastModification = track.lastModification;
+
+  this->profile = ok ? profile : nullptr;
+  decimatedWidth = 0;
+  updatePoints();
   ascent=track.statistics.ascent;
   descent=track.statistics.descent;
   update();
@@ -105,6 +112,59 @@ void TrackElevationChartWidget::onTrackDataLoaded(Track track, std::optional<dou
   emit loadingChanged();
 }
 
+void TrackElevationChartWidget::onWidthChanged()
+{
+  if (loading || int(width()) == decimatedWidth) {
+    return;
+  }
+  if (!profile) {
+    // released on memory pressure, or loading failed
+    storageInitialised();
+    return;
+  }
+  updatePoints();
+  update();
+  emit pointsUpdated();
+}
+
+void TrackElevationChartWidget::updatePoints()
+{
+  using namespace osmscout;
+  points.clear();
+  lowest.reset();
+  highest.reset();
+  decimatedWidth = int(width());
+  if (!profile) {
+    return;
+  }
+  // chart cannot display more than lowest and highest point per pixel column,
+  // full cache resolution is used while widget is not laid out yet
+  std::vector<ElevationProfilePoint> decimated = ElevationProfile::decimate(
+    *profile, decimatedWidth > 0 ? size_t(decimatedWidth) : ElevationProfile::CacheResolution);
+  points.reserve(decimated.size());
+  for (const auto &p : decimated) {
+    ElevationPoint pt{p.distance, p.elevation, p.coord, nullptr};
+    points.push_back(pt);
+    if (!lowest.has_value() || lowest->elevation > pt.elevation){
+      lowest=pt;
+    }
+    if (!highest.has_value() || highest->elevation < pt.elevation){
+      highest=pt;
+    }
+  }
+}
+
+void TrackElevationChartWidget::onTrackDataLoaded(Track track, std::optional<double> /*accuracyFilter*/, bool complete, bool /*ok*/)
+{
+  if (track.id != this->track.id){
+    return;
+  }
+  // track was loaded by someone else (after modification for example), reload profile when it is changed
+  if (complete && !loading && lastModification.isValid() && lastModification != track.lastModification){
+    storageInitialised();
+  }
+}
+
 QString TrackElevationChartWidget::getTrackId() const
 {
   return QString::number(track.id);
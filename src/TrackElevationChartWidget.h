@@ -21,6 +21,7 @@
 #include <osmscoutclientqt/ElevationChartWidget.h>
 
 #include "Storage.h"
+#include "MemoryManager.h"
 
 class TrackElevationChartWidget : public osmscout::ElevationChartWidget
 {
@@ -28,22 +29,34 @@ class TrackElevationChartWidget : public osmscout::ElevationChartWidget
   Q_PROPERTY(QString trackId READ getTrackId WRITE setTrackId NOTIFY loadingChanged2)
 
 signals:
-  void trackDataRequest(Track track, std::optional<double>);
+  void elevationProfileRequest(Track track, std::optional<double> accuracyFilter, int buckets);
   void loadingChanged2();
 
 public slots:
   void storageInitialised();
   void storageInitialisationError(QString);
   void onTrackDataLoaded(Track track, std::optional<double>, bool complete, bool ok);
+  void onElevationProfileLoaded(Track track, std::optional<double> accuracyFilter,
+                                std::shared_ptr<std::vector<ElevationProfilePoint>> profile,
+                                bool ok);
+  void onWidthChanged();
 
 public:
   TrackElevationChartWidget(QQuickItem* parent = nullptr);
-  ~TrackElevationChartWidget() override = default;
+  ~TrackElevationChartWidget() override;
 
   QString getTrackId() const;
   void setTrackId(QString id);
 
+private:
+  void updatePoints();
+
 private:
   Track track;
   std::optional<double> accuracyFilter=100;
+  QDateTime lastModification; // of displayed track
+
+  std::shared_ptr<std::vector<ElevationProfilePoint>> profile; // in cache resolution
+  int decimatedWidth{0}; // width of the widget when points were decimated
+  int memoryCacheId{-1}; // profile registered in MemoryManager
 };
@@ -0,0 +1,271 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2026 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "TrackJournal.h"
+
+#include <QDebug>
+
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+using namespace osmscout;
+
+namespace {
+constexpr quint32 JournalMagic = 0x4a534f4f; // "OOSJ"
+constexpr quint32 JournalVersion = 1;
+constexpr quint64 InitialCapacity = 4096; // records
+
+constexpr quint32 FlagSegmentStart = 1;
+constexpr quint32 FlagTimestamp = 2;
+}
+
+struct TrackJournal::Header
+{
+  quint32 magic;
+  quint32 version;
+  quint32 generation; // incremented on rewind, records of older generation are not valid
+  quint32 reserved;
+  qint64 trackId;
+  quint64 committed; // count of committed records in current generation
+  char padding[32];
+};
+
+struct TrackJournal::Record
+{
+  quint32 generation;
+  quint32 index; // position in the journal
+  double lat;
+  double lon;
+  qint64 timestamp; // nanoseconds since epoch
+  double elevation; // NaN when not available
+  double hdop;
+  double vdop;
+  quint32 flags;
+  quint32 checksum; // of previous bytes, partially written record is not valid
+};
+
+namespace {
+quint32 recordChecksum(const void *record, size_t size)
+{
+  // FNV-1a
+  quint32 hash = 2166136261u;
+  const auto *bytes = static_cast<const unsigned char*>(record);
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+double optionalToDouble(const std::optional<double> &value)
+{
+  return value ? *value : std::nan("");
+}
+
+std::optional<double> doubleToOptional(double value)
+{
+  if (std::isnan(value)) {
+    return std::nullopt;
+  }
+  return value;
+}
+}
+
+TrackJournal::TrackJournal(const QString &path):
+  file(path)
+{
+}
+
+TrackJournal::~TrackJournal()
+{
+  close();
+}
+
+bool TrackJournal::map(quint64 newCapacity)
+{
+  static_assert(sizeof(Header) == 64, "Unexpected journal header size");
+  static_assert(sizeof(Record) == 64, "Unexpected journal record size");
+
+  if (header != nullptr) {
+    file.unmap(reinterpret_cast<uchar*>(header));
+    header = nullptr;
+    records = nullptr;
+  }
+  qint64 size = sizeof(Header) + newCapacity * sizeof(Record);
+  if (file.size() < size && !file.resize(size)) {
+    qWarning() << "Cannot resize journal" << file.fileName() << file.errorString();
+    return false;
+  }
+  uchar *data = file.map(0, size);
+  if (data == nullptr) {
+    qWarning() << "Cannot map journal" << file.fileName() << file.errorString();
+    return false;
+  }
+  header = reinterpret_cast<Header*>(data);
+  records = reinterpret_cast<Record*>(data + sizeof(Header));
+  capacity = newCapacity;
+  return true;
+}
+
+bool TrackJournal::open(qint64 trackId)
+{
+  close();
+  if (!file.open(QIODevice::ReadWrite)) {
+    qWarning() << "Cannot open journal" << file.fileName() << file.errorString();
+    return false;
+  }
+  if (!map(InitialCapacity)) {
+    file.close();
+    return false;
+  }
+  header->magic = JournalMagic;
+  header->version = JournalVersion;
+  header->trackId = trackId;
+  // sequence keeps growing, so late commit of the previous session is ignored
+  rewind();
+  return true;
+}
+
+void TrackJournal::close()
+{
+  if (header != nullptr) {
+    file.unmap(reinterpret_cast<uchar*>(header));
+    header = nullptr;
+    records = nullptr;
+  }
+  if (file.isOpen()) {
+    file.close();
+  }
+  capacity = 0;
+}
+
+qint64 TrackJournal::getTrackId() const
+{
+  return header == nullptr ? -1 : header->trackId;
+}
+
+void TrackJournal::rewind()
+{
+  assert(header);
+  baseSequence += written;
+  written = 0;
+  // generation is changed first, so old records are never replayed
+  header->generation++;
+  header->committed = 0;
+}
+
+bool TrackJournal::append(const gpx::TrackPoint &point, bool segmentStart)
+{
+  if (header == nullptr) {
+    return false;
+  }
+  if (written == capacity) {
+    // points are not persisted, storage is slow, enlarge the journal
+    if (!map(capacity * 2)) {
+      close();
+      return false;
+    }
+  }
+
+  Record record{};
+  record.generation = header->generation;
+  record.index = quint32(written);
+  record.lat = point.coord.GetLat();
+  record.lon = point.coord.GetLon();
+  if (point.timestamp) {
+    record.flags |= FlagTimestamp;
+    record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(point.timestamp->time_since_epoch()).count();
+  }
+  record.elevation = optionalToDouble(point.elevation);
+  record.hdop = optionalToDouble(point.hdop);
+  record.vdop = optionalToDouble(point.vdop);
+  if (segmentStart) {
+    record.flags |= FlagSegmentStart;
+  }
+  record.checksum = recordChecksum(&record, offsetof(Record, checksum));
+  std::memcpy(&records[written], &record, sizeof(Record));
+  written++;
+  return true;
+}
+
+void TrackJournal::commit(quint64 sequence)
+{
+  if (header == nullptr || sequence <= baseSequence) {
+    return;
+  }
+  if (sequence >= getWrittenSequence()) {
+    rewind();
+    return;
+  }
+  header->committed = sequence - baseSequence;
+}
+
+bool TrackJournal::read(const QString &path, qint64 &trackId, std::vector<Entry> &entries)
+{
+  QFile file(path);
+  if (!file.exists() || !file.open(QIODevice::ReadOnly)) {
+    return false;
+  }
+  if (file.size() < qint64(sizeof(Header))) {
+    qWarning() << "Journal" << path << "is too small";
+    return false;
+  }
+  uchar *data = file.map(0, file.size());
+  if (data == nullptr) {
+    qWarning() << "Cannot map journal" << path << file.errorString();
+    return false;
+  }
+  const Header *header = reinterpret_cast<const Header*>(data);
+  if (header->magic != JournalMagic || header->version != JournalVersion) {
+    qWarning() << "Journal" << path << "has unknown format";
+    file.unmap(data);
+    return false;
+  }
+  trackId = header->trackId;
+
+  const Record *records = reinterpret_cast<const Record*>(data + sizeof(Header));
+  quint64 count = (file.size() - sizeof(Header)) / sizeof(Record);
+  for (quint64 i = header->committed; i < count; i++) {
+    Record record;
+    std::memcpy(&record, &records[i], sizeof(Record));
+    if (record.generation != header->generation ||
+        record.index != i ||
+        record.checksum != recordChecksum(&record, offsetof(Record, checksum))) {
+      break; // end of written records
+    }
+    gpx::TrackPoint point(GeoCoord(record.lat, record.lon));
+    if (record.flags & FlagTimestamp) {
+      point.timestamp = Timestamp(std::chrono::duration_cast<Timestamp::duration>(std::chrono::nanoseconds(record.timestamp)));
+    }
+    point.elevation = doubleToOptional(record.elevation);
+    point.hdop = doubleToOptional(record.hdop);
+    point.vdop = doubleToOptional(record.vdop);
+    entries.push_back(Entry{point, (record.flags & FlagSegmentStart) != 0});
+  }
+  file.unmap(data);
+  return true;
+}
+
+bool TrackJournal::remove(const QString &path)
+{
+  return !QFile::exists(path) || QFile::remove(path);
+}
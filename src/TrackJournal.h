@@ -0,0 +1,110 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2026 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+
+#include <osmscoutgpx/TrackPoint.h>
+
+#include <QFile>
+#include <QString>
+
+#include <vector>
+
+/**
+ * Append-only journal of recorded track points that are not persisted in database yet.
+ *
+ * Journal is memory-mapped file with fixed size records, so appending point is
+ * just a copy to mapped memory. Written data survives when application
+ * is killed (by OOM killer for example). Storage replays not committed points
+ * on the next start, see Storage::loadRecentOpenTrack.
+ *
+ * Points are identified by sequence number, it is growing during the whole
+ * journal lifetime. When all written points are committed (persisted
+ * in database), journal is rewound to the beginning.
+ */
+class TrackJournal
+{
+public:
+  struct Entry
+  {
+    osmscout::gpx::TrackPoint point;
+    bool segmentStart; //!< point starts new track segment
+  };
+
+public:
+  explicit TrackJournal(const QString &path);
+  TrackJournal(const TrackJournal&) = delete;
+  TrackJournal& operator=(const TrackJournal&) = delete;
+  ~TrackJournal();
+
+  /**
+   * Start journal for the track, previous content is discarded.
+   */
+  bool open(qint64 trackId);
+
+  void close();
+
+  bool isOpen() const
+  {
+    return header != nullptr;
+  }
+
+  qint64 getTrackId() const;
+
+  /**
+   * Write point to the journal. Constant time, except the case when
+   * journal is full, then file is enlarged.
+   */
+  bool append(const osmscout::gpx::TrackPoint &point, bool segmentStart);
+
+  /**
+   * Sequence number after the last written point.
+   */
+  quint64 getWrittenSequence() const
+  {
+    return baseSequence + written;
+  }
+
+  /**
+   * Mark points before given sequence as persisted.
+   */
+  void commit(quint64 sequence);
+
+  /**
+   * Read points that was not committed.
+   * @return false when journal don't exists or it is not valid
+   */
+  static bool read(const QString &path, qint64 &trackId, std::vector<Entry> &entries);
+
+  static bool remove(const QString &path);
+
+private:
+  struct Header;
+  struct Record;
+
+  bool map(quint64 capacity);
+  void rewind();
+
+private:
+  QFile file;
+  Header *header{nullptr};
+  Record *records{nullptr};
+  quint64 capacity{0}; // record count
+  quint64 written{0}; // records written since rewind
+  quint64 baseSequence{0}; // sequence number of the first record
+};
@@ -0,0 +1,169 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2026 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "TrackLod.h"
+#include "TrackPointBlob.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+using namespace osmscout;
+
+namespace {
+constexpr double FirstLevelTolerance = 4; // meters
+constexpr double MetersPerDegree = 111319.49; // on equator
+
+struct ProjectedPoint
+{
+  double x;
+  double y;
+};
+
+/**
+ * Squared distance of point p from line segment a-b.
+ */
+double segmentDistanceSquared(const ProjectedPoint &p, const ProjectedPoint &a, const ProjectedPoint &b)
+{
+  double dx = b.x - a.x;
+  double dy = b.y - a.y;
+  double lengthSquared = dx * dx + dy * dy;
+  double t = 0;
+  if (lengthSquared > 0) {
+    t = std::clamp(((p.x - a.x) * dx + (p.y - a.y) * dy) / lengthSquared, 0.0, 1.0);
+  }
+  double ex = p.x - (a.x + t * dx);
+  double ey = p.y - (a.y + t * dy);
+  return ex * ex + ey * ey;
+}
+}
+
+double TrackLod::levelTolerance(int level)
+{
+  if (level <= 0) {
+    return 0;
+  }
+  return FirstLevelTolerance * std::pow(4.0, level - 1);
+}
+
+int TrackLod::levelForPixelSize(double pixelSize)
+{
+  int level = 0;
+  while (level + 1 < LevelCount && levelTolerance(level + 1) <= pixelSize) {
+    level++;
+  }
+  return level;
+}
+
+std::vector<GeoCoord> TrackLod::simplify(const std::vector<GeoCoord> &coords, double toleranceMeters)
+{
+  if (coords.size() <= 2 || toleranceMeters <= 0) {
+    return coords;
+  }
+
+  // local equirectangular projection is precise enough for simplification
+  double lonScale = MetersPerDegree * std::cos(coords.front().GetLat() * M_PI / 180.0);
+  std::vector<ProjectedPoint> projected;
+  projected.reserve(coords.size());
+  for (const auto &c: coords) {
+    projected.push_back(ProjectedPoint{c.GetLon() * lonScale, c.GetLat() * MetersPerDegree});
+  }
+
+  const double toleranceSquared = toleranceMeters * toleranceMeters;
+  std::vector<bool> keep(coords.size(), false);
+  keep.front() = true;
+  keep.back() = true;
+
+  // iterative variant, recursion depth may be linear with point count
+  std::vector<std::pair<size_t, size_t>> stack;
+  stack.emplace_back(0, coords.size() - 1);
+  while (!stack.empty()) {
+    auto [first, last] = stack.back();
+    stack.pop_back();
+
+    double maxDistance = 0;
+    size_t farthest = first;
+    for (size_t i = first + 1; i < last; i++) {
+      double distance = segmentDistanceSquared(projected[i], projected[first], projected[last]);
+      if (distance > maxDistance) {
+        maxDistance = distance;
+        farthest = i;
+      }
+    }
+    if (maxDistance > toleranceSquared) {
+      keep[farthest] = true;
+      if (farthest - first > 1) {
+        stack.emplace_back(first, farthest);
+      }
+      if (last - farthest > 1) {
+        stack.emplace_back(farthest, last);
+      }
+    }
+  }
+
+  std::vector<GeoCoord> result;
+  result.reserve(std::count(keep.begin(), keep.end(), true));
+  for (size_t i = 0; i < coords.size(); i++) {
+    if (keep[i]) {
+      result.push_back(coords[i]);
+    }
+  }
+  return result;
+}
+
+std::vector<std::vector<GeoCoord>> TrackLod::pyramid(const std::vector<gpx::TrackPoint> &points)
+{
+  std::vector<GeoCoord> coords;
+  coords.reserve(points.size());
+  for (const auto &p: points) {
+    coords.push_back(p.coord);
+  }
+
+  std::vector<std::vector<GeoCoord>> levels;
+  levels.reserve(LevelCount - 1);
+  // every level is simplified from the previous one, it is much cheaper than from all points
+  // and error is still bounded by sum of tolerances (< 4/3 of level tolerance)
+  for (int level = 1; level < LevelCount; level++) {
+    levels.push_back(simplify(level == 1 ? coords : levels.back(), levelTolerance(level)));
+  }
+  return levels;
+}
+
+QByteArray TrackLod::encode(const std::vector<GeoCoord> &coords)
+{
+  std::vector<gpx::TrackPoint> points;
+  points.reserve(coords.size());
+  for (const auto &c: coords) {
+    points.emplace_back(c);
+  }
+  return TrackPointBlob::encode(points);
+}
+
+bool TrackLod::decode(const char *data, size_t size, std::vector<GeoCoord> &coords)
+{
+  std::vector<gpx::TrackPoint> points;
+  if (!TrackPointBlob::decode(data, size, points)) {
+    return false;
+  }
+  coords.reserve(coords.size() + points.size());
+  for (const auto &p: points) {
+    coords.push_back(p.coord);
+  }
+  return true;
+}
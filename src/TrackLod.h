@@ -0,0 +1,73 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2026 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+
+#include <osmscoutgpx/TrackPoint.h>
+#include <osmscout/GeoCoord.h>
+
+#include <QByteArray>
+
+#include <vector>
+
+/**
+ * Level of detail pyramid of track segment, used for displaying tracks on the map.
+ *
+ * Level 0 contains all segment points, every following level is Douglas-Peucker
+ * simplification of the previous level with four times bigger tolerance.
+ * Levels 1..LevelCount-1 are stored in `track_segment_lod` table, map displays
+ * the coarsest level with tolerance smaller than one screen pixel.
+ */
+class TrackLod
+{
+public:
+  static constexpr int LevelCount = 6;
+
+  TrackLod() = delete;
+
+  /**
+   * Simplification tolerance of the level in meters, zero for level 0.
+   */
+  static double levelTolerance(int level);
+
+  /**
+   * The coarsest level that is not distinguishable from full data
+   * on the map with given pixel size (meters per pixel).
+   */
+  static int levelForPixelSize(double pixelSize);
+
+  /**
+   * Douglas-Peucker simplification, first and last points are kept always.
+   */
+  static std::vector<osmscout::GeoCoord> simplify(const std::vector<osmscout::GeoCoord> &coords,
+                                                  double toleranceMeters);
+
+  /**
+   * Compute levels 1..LevelCount-1 of segment.
+   *
+   * @return vector with LevelCount-1 entries, index 0 is level 1
+   */
+  static std::vector<std::vector<osmscout::GeoCoord>> pyramid(const std::vector<osmscout::gpx::TrackPoint> &points);
+
+  /**
+   * Level points are stored in TrackPointBlob format, without time and accuracy columns.
+   */
+  static QByteArray encode(const std::vector<osmscout::GeoCoord> &coords);
+
+  static bool decode(const char *data, size_t size, std::vector<osmscout::GeoCoord> &coords);
+};
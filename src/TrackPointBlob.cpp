@@ -0,0 +1,392 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2026 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "TrackPointBlob.h"
+
+#include <QDebug>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <optional>
+
+using namespace osmscout;
+
+namespace {
+  constexpr uint8_t FormatVersion = 1;
+
+  constexpr double CoordFactor = 1e7;
+  constexpr double CentimeterFactor = 100;
+
+  enum class Presence: uint8_t {
+    None = 0,
+    All = 1,
+    Some = 2
+  };
+
+  using Iterator = std::vector<gpx::TrackPoint>::const_iterator;
+
+  void writeVarint(QByteArray &out, uint64_t value)
+  {
+    while (value >= 0x80) {
+      out.append(char((value & 0x7F) | 0x80));
+      value >>= 7;
+    }
+    out.append(char(value));
+  }
+
+  void writeZigZag(QByteArray &out, int64_t value)
+  {
+    writeVarint(out, (uint64_t(value) << 1) ^ uint64_t(value >> 63));
+  }
+
+  class Reader
+  {
+  public:
+    Reader(const char *data, size_t size):
+      pos(reinterpret_cast<const uint8_t*>(data)),
+      end(reinterpret_cast<const uint8_t*>(data) + size)
+    {}
+
+    bool atEnd() const
+    {
+      return pos == end;
+    }
+
+    size_t remaining() const
+    {
+      return size_t(end - pos);
+    }
+
+    const char* current() const
+    {
+      return reinterpret_cast<const char*>(pos);
+    }
+
+    bool skip(size_t count)
+    {
+      if (count > remaining()) {
+        return false;
+      }
+      pos += count;
+      return true;
+    }
+
+    bool readByte(uint8_t &value)
+    {
+      if (pos == end) {
+        return false;
+      }
+      value = *(pos++);
+      return true;
+    }
+
+    bool readVarint(uint64_t &value)
+    {
+      value = 0;
+      for (int shift = 0; shift < 64; shift += 7) {
+        if (pos == end) {
+          return false;
+        }
+        uint8_t byte = *(pos++);
+        value |= uint64_t(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+          return true;
+        }
+      }
+      return false; // too long
+    }
+
+    bool readZigZag(int64_t &value)
+    {
+      uint64_t raw;
+      if (!readVarint(raw)) {
+        return false;
+      }
+      value = int64_t(raw >> 1) ^ -int64_t(raw & 1);
+      return true;
+    }
+
+  private:
+    const uint8_t *pos;
+    const uint8_t *end;
+  };
+
+  template<typename Getter>
+  void writeColumn(QByteArray &out, Iterator begin, Iterator end, Getter getter)
+  {
+    size_t count = size_t(end - begin);
+    size_t present = 0;
+    for (auto it = begin; it != end; ++it) {
+      if (getter(*it).has_value()) {
+        present++;
+      }
+    }
+
+    if (present == 0) {
+      out.append(char(Presence::None));
+      return;
+    }
+    if (present == count) {
+      out.append(char(Presence::All));
+    } else {
+      out.append(char(Presence::Some));
+      QByteArray bitmap((int(count) + 7) / 8, 0);
+      size_t i = 0;
+      for (auto it = begin; it != end; ++it, ++i) {
+        if (getter(*it).has_value()) {
+          bitmap[int(i / 8)] = char(bitmap[int(i / 8)] | (1 << (i % 8)));
+        }
+      }
+      out.append(bitmap);
+    }
+
+    int64_t previous = 0;
+    for (auto it = begin; it != end; ++it) {
+      std::optional<int64_t> value = getter(*it);
+      if (value.has_value()) {
+        writeZigZag(out, *value - previous);
+        previous = *value;
+      }
+    }
+  }
+
+  template<typename Setter>
+  bool readColumn(Reader &reader, std::vector<gpx::TrackPoint>::iterator begin, size_t count, Setter setter)
+  {
+    uint8_t presenceByte;
+    if (!reader.readByte(presenceByte)) {
+      return false;
+    }
+    Presence presence = Presence(presenceByte);
+    if (presence == Presence::None) {
+      return true;
+    }
+    if (presence != Presence::All && presence != Presence::Some) {
+      return false;
+    }
+
+    const uint8_t *bitmap = nullptr;
+    if (presence == Presence::Some) {
+      bitmap = reinterpret_cast<const uint8_t*>(reader.current());
+      if (!reader.skip((count + 7) / 8)) {
+        return false;
+      }
+    }
+
+    int64_t value = 0;
+    for (size_t i = 0; i < count; ++i) {
+      if (bitmap != nullptr && (bitmap[i / 8] & (1 << (i % 8))) == 0) {
+        continue;
+      }
+      int64_t delta;
+      if (!reader.readZigZag(delta)) {
+        return false;
+      }
+      value += delta;
+      setter(*(begin + i), value);
+    }
+    return true;
+  }
+
+  std::optional<int64_t> toFixed(const std::optional<double> &value, double factor)
+  {
+    if (!value.has_value()) {
+      return std::nullopt;
+    }
+    return std::llround(*value * factor);
+  }
+}
+
+QByteArray TrackPointBlob::encode(const std::vector<gpx::TrackPoint> &points)
+{
+  return encode(points.begin(), points.end());
+}
+
+QByteArray TrackPointBlob::encode(Iterator begin, Iterator end)
+{
+  if (begin == end) {
+    return QByteArray();
+  }
+
+  size_t count = size_t(end - begin);
+  QByteArray columns;
+  columns.reserve(int(count) * 12);
+
+  writeColumn(columns, begin, end, [](const gpx::TrackPoint &p) -> std::optional<int64_t> {
+    if (!p.timestamp.has_value()) {
+      return std::nullopt;
+    }
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(p.timestamp->time_since_epoch()).count();
+  });
+  writeColumn(columns, begin, end, [](const gpx::TrackPoint &p) -> std::optional<int64_t> {
+    return std::llround(p.coord.GetLat() * CoordFactor);
+  });
+  writeColumn(columns, begin, end, [](const gpx::TrackPoint &p) -> std::optional<int64_t> {
+    return std::llround(p.coord.GetLon() * CoordFactor);
+  });
+  writeColumn(columns, begin, end, [](const gpx::TrackPoint &p) {
+    return toFixed(p.elevation, CentimeterFactor);
+  });
+  // read TrackPoint notes, hdop and vdop contains accuracy in meters
+  writeColumn(columns, begin, end, [](const gpx::TrackPoint &p) {
+    return toFixed(p.hdop, CentimeterFactor);
+  });
+  writeColumn(columns, begin, end, [](const gpx::TrackPoint &p) {
+    return toFixed(p.vdop, CentimeterFactor);
+  });
+
+  QByteArray payload = qCompress(columns);
+
+  QByteArray chunk;
+  chunk.reserve(payload.size() + 12);
+  chunk.append(char(FormatVersion));
+  writeVarint(chunk, count);
+  writeVarint(chunk, uint64_t(payload.size()));
+  chunk.append(payload);
+  return chunk;
+}
+
+QByteArray TrackPointBlob::encode(const std::vector<gpx::TrackPoint> &points, size_t chunkSize)
+{
+  assert(chunkSize > 0);
+  QByteArray blob;
+  for (size_t from = 0; from < points.size(); from += chunkSize) {
+    blob.append(encode(points.begin() + from, points.begin() + std::min(from + chunkSize, points.size())));
+  }
+  return blob;
+}
+
+bool TrackPointBlob::pointCount(const char *data, size_t size, size_t &count)
+{
+  count = 0;
+  Reader reader(data, size);
+  while (!reader.atEnd()) {
+    uint8_t version;
+    uint64_t chunkCount;
+    uint64_t payloadSize;
+    if (!reader.readByte(version) || version != FormatVersion ||
+        !reader.readVarint(chunkCount) ||
+        !reader.readVarint(payloadSize) ||
+        !reader.skip(payloadSize) ||
+        chunkCount / 512 > payloadSize) { // every point takes two bytes at least, zlib ratio is limited to ~1000:1
+      return false;
+    }
+    count += chunkCount;
+  }
+  return true;
+}
+
+bool TrackPointBlob::decode(const char *data, size_t size, std::vector<gpx::TrackPoint> &points)
+{
+  size_t totalCount;
+  if (!pointCount(data, size, totalCount)) {
+    qWarning() << "Corrupted track point blob";
+    return false;
+  }
+  points.reserve(points.size() + totalCount);
+
+  Reader reader(data, size);
+  while (!reader.atEnd()) {
+    uint8_t version;
+    uint64_t count;
+    uint64_t payloadSize;
+    // header was validated already
+    reader.readByte(version);
+    reader.readVarint(count);
+    reader.readVarint(payloadSize);
+
+    const char *payload = reader.current();
+    reader.skip(payloadSize);
+    if (!decodeChunk(payload, size_t(payloadSize), size_t(count), points)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TrackPointBlob::decodeChunks(const char *data, size_t size,
+                                  const std::function<bool(std::vector<gpx::TrackPoint> &&)> &chunkDecoded)
+{
+  size_t totalCount;
+  if (!pointCount(data, size, totalCount)) {
+    qWarning() << "Corrupted track point blob";
+    return false;
+  }
+
+  Reader reader(data, size);
+  while (!reader.atEnd()) {
+    uint8_t version;
+    uint64_t count;
+    uint64_t payloadSize;
+    // header was validated already
+    reader.readByte(version);
+    reader.readVarint(count);
+    reader.readVarint(payloadSize);
+
+    const char *payload = reader.current();
+    reader.skip(payloadSize);
+    std::vector<gpx::TrackPoint> points;
+    if (!decodeChunk(payload, size_t(payloadSize), size_t(count), points) ||
+        !chunkDecoded(std::move(points))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TrackPointBlob::decodeChunk(const char *data, size_t size, size_t count, std::vector<gpx::TrackPoint> &points)
+{
+  QByteArray columns = qUncompress(reinterpret_cast<const uchar*>(data), int(size));
+  if (columns.isEmpty() || count * 2 > size_t(columns.size())) {
+    qWarning() << "Corrupted track point blob, cannot decompress chunk";
+    return false;
+  }
+
+  size_t offset = points.size();
+  points.resize(offset + count, gpx::TrackPoint(GeoCoord()));
+  auto begin = points.begin() + offset;
+
+  Reader columnReader(columns.constData(), size_t(columns.size()));
+  bool ok = readColumn(columnReader, begin, count, [](gpx::TrackPoint &p, int64_t value) {
+    p.timestamp = Timestamp(std::chrono::milliseconds(value));
+  });
+  ok = ok && readColumn(columnReader, begin, count, [](gpx::TrackPoint &p, int64_t value) {
+    p.coord.Set(double(value) / CoordFactor, p.coord.GetLon());
+  });
+  ok = ok && readColumn(columnReader, begin, count, [](gpx::TrackPoint &p, int64_t value) {
+    p.coord.Set(p.coord.GetLat(), double(value) / CoordFactor);
+  });
+  ok = ok && readColumn(columnReader, begin, count, [](gpx::TrackPoint &p, int64_t value) {
+    p.elevation = double(value) / CentimeterFactor;
+  });
+  ok = ok && readColumn(columnReader, begin, count, [](gpx::TrackPoint &p, int64_t value) {
+    p.hdop = double(value) / CentimeterFactor;
+  });
+  ok = ok && readColumn(columnReader, begin, count, [](gpx::TrackPoint &p, int64_t value) {
+    p.vdop = double(value) / CentimeterFactor;
+  });
+  if (!ok) {
+    qWarning() << "Corrupted track point blob, cannot decode columns";
+    points.erase(points.begin() + offset, points.end());
+    return false;
+  }
+  return true;
+}
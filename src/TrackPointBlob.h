@@ -0,0 +1,96 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2026 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+
+#include <osmscoutgpx/TrackPoint.h>
+
+#include <QByteArray>
+
+#include <functional>
+#include <vector>
+
+/**
+ * Compact storage format for track segment points, used by `track_segment.points`
+ * and `track_segment_chunk.points` columns.
+ *
+ * Blob is a sequence of self-contained chunks, so blobs may be concatenated
+ * without decoding them. Every chunk consists of header
+ * (format version, point count, payload size) and zlib compressed payload.
+ * Payload contains columns (timestamp, latitude, longitude, elevation,
+ * horizontal and vertical accuracy), every column is stored as zig-zag encoded
+ * varint deltas from previous value. Optional values are prefixed by presence flag
+ * (and bitmap when column contains just some values).
+ *
+ * Values are stored with fixed precision:
+ *  - timestamp in milliseconds
+ *  - coordinates in 1e-7 degree (~1 cm)
+ *  - elevation and accuracy in centimeters
+ */
+class TrackPointBlob
+{
+public:
+  TrackPointBlob() = delete;
+
+  /**
+   * Encode points to single chunk.
+   *
+   * @return chunk, it is empty when points are empty
+   */
+  static QByteArray encode(const std::vector<osmscout::gpx::TrackPoint> &points);
+
+  static QByteArray encode(std::vector<osmscout::gpx::TrackPoint>::const_iterator begin,
+                           std::vector<osmscout::gpx::TrackPoint>::const_iterator end);
+
+  /**
+   * Encode points to sequence of chunks with at most chunkSize points,
+   * so blob may be decoded incrementally by decodeChunks.
+   */
+  static QByteArray encode(const std::vector<osmscout::gpx::TrackPoint> &points, size_t chunkSize);
+
+  /**
+   * Decode all chunks from blob and append points to vector.
+   *
+   * @return false when blob is corrupted
+   */
+  static bool decode(const char *data, size_t size, std::vector<osmscout::gpx::TrackPoint> &points);
+
+  static bool decode(const QByteArray &blob, std::vector<osmscout::gpx::TrackPoint> &points)
+  {
+    return decode(blob.constData(), size_t(blob.size()), points);
+  }
+
+  /**
+   * Decode blob chunk by chunk, points of every chunk are passed to callback.
+   * Decoding is stopped when callback returns false.
+   *
+   * @return false when blob is corrupted or decoding was stopped
+   */
+  static bool decodeChunks(const char *data, size_t size,
+                           const std::function<bool(std::vector<osmscout::gpx::TrackPoint> &&)> &chunkDecoded);
+
+  /**
+   * Count points in blob just from chunk headers, without payload decompression.
+   *
+   * @return false when blob is corrupted
+   */
+  static bool pointCount(const char *data, size_t size, size_t &count);
+
+private:
+  static bool decodeChunk(const char *data, size_t size, size_t count, std::vector<osmscout::gpx::TrackPoint> &points);
+};
@@ -0,0 +1,103 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2026 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "TrackSimplifier.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+using namespace osmscout;
+
+namespace {
+constexpr double MetersPerDegree = 111319.49; // on equator
+}
+
+TrackSimplifier::TrackSimplifier(double toleranceMeters, size_t maxWindow):
+  tolerance(toleranceMeters), maxWindow(std::max(size_t(1), maxWindow))
+{
+  window.reserve(this->maxWindow);
+}
+
+void TrackSimplifier::setTolerance(double toleranceMeters)
+{
+  tolerance = toleranceMeters;
+}
+
+bool TrackSimplifier::isWithinTolerance(const gpx::TrackPoint &point) const
+{
+  assert(anchor);
+  // local equirectangular projection with origin in anchor, it is precise enough for few meters
+  double lonScale = MetersPerDegree * std::cos(anchor->coord.GetLat() * M_PI / 180.0);
+  double bx = (point.coord.GetLon() - anchor->coord.GetLon()) * lonScale;
+  double by = (point.coord.GetLat() - anchor->coord.GetLat()) * MetersPerDegree;
+  double lengthSquared = bx * bx + by * by;
+  double toleranceSquared = tolerance * tolerance;
+
+  for (const auto &p: window) {
+    double px = (p.coord.GetLon() - anchor->coord.GetLon()) * lonScale;
+    double py = (p.coord.GetLat() - anchor->coord.GetLat()) * MetersPerDegree;
+    double t = 0;
+    if (lengthSquared > 0) {
+      t = std::clamp((px * bx + py * by) / lengthSquared, 0.0, 1.0);
+    }
+    double ex = px - t * bx;
+    double ey = py - t * by;
+    if (ex * ex + ey * ey > toleranceSquared) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::optional<gpx::TrackPoint> TrackSimplifier::add(const gpx::TrackPoint &point)
+{
+  if (tolerance <= 0 || !anchor) {
+    anchor = point;
+    window.clear();
+    return point;
+  }
+
+  if (window.size() < maxWindow && isWithinTolerance(point)) {
+    window.push_back(point);
+    return std::nullopt;
+  }
+
+  // window is not empty, empty window is always within tolerance
+  anchor = window.back();
+  window.clear();
+  window.push_back(point);
+  return anchor;
+}
+
+std::optional<gpx::TrackPoint> TrackSimplifier::flush()
+{
+  if (window.empty()) {
+    return std::nullopt;
+  }
+  anchor = window.back();
+  window.clear();
+  return anchor;
+}
+
+void TrackSimplifier::reset()
+{
+  anchor.reset();
+  window.clear();
+}
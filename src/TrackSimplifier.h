@@ -0,0 +1,87 @@
+/*
+  OSMScout for SFOS
+  Copyright (C) 2026 Lukas Karas
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#pragma once
+
+#include <osmscoutgpx/TrackPoint.h>
+
+#include <optional>
+#include <vector>
+
+/**
+ * Online (streaming) track simplification used by Tracker.
+ *
+ * Points are received one by one. Point is dropped when all points since
+ * the last stored point (anchor) are closer than tolerance to the line
+ * from the anchor to the newest point. Otherwise the previous point
+ * is stored and it becomes new anchor. It drops stationary jitter
+ * and points on straight lines, while the stored track never deviates
+ * more than tolerance from received points.
+ *
+ * Window of not stored points is bounded, so one point is stored
+ * at least after maxWindow received points.
+ */
+class TrackSimplifier
+{
+public:
+  explicit TrackSimplifier(double toleranceMeters = 0, size_t maxWindow = 100);
+
+  /**
+   * Zero tolerance disables simplification, every point is stored.
+   */
+  void setTolerance(double toleranceMeters);
+
+  double getTolerance() const
+  {
+    return tolerance;
+  }
+
+  /**
+   * Add received point.
+   * @return point that should be stored, it is not necessarily the added one
+   */
+  std::optional<osmscout::gpx::TrackPoint> add(const osmscout::gpx::TrackPoint &point);
+
+  /**
+   * Store the last received point, when it is not stored yet.
+   * Simplification continues from this point.
+   */
+  std::optional<osmscout::gpx::TrackPoint> flush();
+
+  /**
+   * True when the last received point is not stored yet.
+   */
+  bool hasPending() const
+  {
+    return !window.empty();
+  }
+
+  /**
+   * Forget anchor and pending points (new segment is started).
+   */
+  void reset();
+
+private:
+  bool isWithinTolerance(const osmscout::gpx::TrackPoint &point) const;
+
+private:
+  double tolerance;
+  size_t maxWindow;
+  std::optional<osmscout::gpx::TrackPoint> anchor; // the last stored point
+  std::vector<osmscout::gpx::TrackPoint> window; // points received after anchor, not stored
+};
@@ -21,6 +21,7 @@
 #include "QVariantConverters.h"
 
 #include <QDebug>
+#include <QGuiApplication>
 #include <osmscout/util/Geometry.h>
 
 Tracker::Tracker() {
@@ -75,11 +76,23 @@ Tracker::Tracker() {
           storage, &Storage::editTrack,
           Qt::QueuedConnection);
 
+  connect(storage, &Storage::nodesAppended,
+          this, &Tracker::onNodesAppended,
+          Qt::QueuedConnection);
+
+  journal = std::make_unique<TrackJournal>(storage->trackJournalPath());
+
+  if (auto *app = qobject_cast<QGuiApplication*>(QCoreApplication::instance()); app != nullptr) {
+    connect(app, &QGuiApplication::applicationStateChanged,
+            this, &Tracker::onApplicationStateChanged);
+    background = app->applicationState() != Qt::ApplicationActive;
+  }
+
   init();
 }
 
 Tracker::~Tracker(){
-  if (isTracking() && !batch->empty()){
+  if (isTracking()){
     flushBatch(false);
   }
 }
@@ -98,12 +111,13 @@ void Tracker::onError(QString message){
   emit errorsChanged();
 }
 
-void Tracker::onOpenTrackLoaded(Track track, bool ok){
+void Tracker::onOpenTrackLoaded(Track track, QByteArray statisticsState, bool ok){
   if (!ok || track.id < 0){
     return;
   }
 
   recentOpenTrack = track;
+  recentOpenTrackState = statisticsState;
   emit openTrackLoaded(QString::number(track.id), track.name);
 }
 
@@ -129,8 +143,16 @@ void Tracker::resumeTrack(QString trackId){
   }
 
   track = recentOpenTrack;
-  // update accumulator by current track statistics
-  accumulator = TrackStatisticsAccumulator(track.statistics);
+  // restore accumulator state of open segment, when it is available,
+  // otherwise update accumulator by current track statistics
+  if (auto restored = TrackStatisticsAccumulator::deserialize(recentOpenTrackState); restored){
+    accumulator = *restored;
+    track.statistics = accumulator.accumulate();
+  } else {
+    accumulator = TrackStatisticsAccumulator(track.statistics);
+  }
+  resetQueue();
+  recentPoints.clear();
   lastError.clear();
   errors=0;
 
@@ -153,6 +175,7 @@ void Tracker::closeOpen(QString trackId){
   }
   emit closeTrackRequest(recentOpenTrack.collectionId, recentOpenTrack.id);
   recentOpenTrack=Track{};
+  recentOpenTrackState.clear();
   emit openTrackLoaded("-1", "");
 }
 
@@ -184,18 +207,132 @@ void Tracker::startTracking(QString collectionId, QString trackName, QString tra
   emit createTrackRequest(collId, trackName, trackDescription, true, type);
 }
 
+void Tracker::onApplicationStateChanged(Qt::ApplicationState state){
+  // screen is off or application is in background, write less often
+  background = state != Qt::ApplicationActive;
+}
+
+void Tracker::setSimplificationTolerance(double tolerance){
+  if (simplifier.getTolerance() == tolerance){
+    return;
+  }
+  // pending point would not be stored with zero tolerance
+  if (auto pending = simplifier.flush(); pending && isTracking()){
+    enqueue(*pending);
+  }
+  simplifier.setTolerance(tolerance);
+  emit configurationChanged();
+}
+
+void Tracker::setFlushInterval(int seconds){
+  if (flushInterval != seconds){
+    flushInterval = seconds;
+    emit configurationChanged();
+  }
+}
+
+void Tracker::setBackgroundFlushInterval(int seconds){
+  if (backgroundFlushInterval != seconds){
+    backgroundFlushInterval = seconds;
+    emit configurationChanged();
+  }
+}
+
+void Tracker::enqueue(const osmscout::gpx::TrackPoint &point){
+  if (!queue->push(point)){
+    qWarning() << "Track point queue is full, point is dropped";
+    lastError = tr("Storage is not responding, track point was dropped");
+    errors++;
+    emit error(lastError);
+    emit errorsChanged();
+    return;
+  }
+  batchSize++;
+  storedPoints++;
+
+  // statistics are computed from stored points, like statistics of closed segments
+  accumulator.update(point);
+
+  // point is persisted even when application is killed before the batch is flushed
+  if (journal->isOpen() && !journal->append(point, journalSegmentStart)){
+    qWarning() << "Writing to track journal failed";
+  }
+  journalSegmentStart = false;
+}
+
+void Tracker::onNodesAppended(qint64 trackId, quint64 journalSequence, bool ok){
+  if (trackId != journal->getTrackId()){
+    return;
+  }
+  // batches are persisted in order, journal is committed up to the first failed batch,
+  // so points of failed batch stays in the journal
+  if (!ok){
+    journalFailed = true;
+  } else if (!journalFailed){
+    journal->commit(journalSequence);
+  }
+  if (trackId != track.id && journalSequence >= journal->getWrittenSequence()){
+    // the last batch of stopped track
+    journal->close();
+  }
+}
+
 void Tracker::flushBatch(bool createNewSegment){
-  emit appendNodesRequest(track.id,
-                          batch,
-                          track.statistics,
-                          createNewSegment);
+  // the last received point is always stored with the batch
+  if (auto pending = simplifier.flush(); pending){
+    enqueue(*pending);
+  }
+  if (createNewSegment){
+    simplifier.reset();
+  }
+  batchStart.reset();
+
+  // state of the segment that will be open after this batch
+  QByteArray statisticsState;
+  if (createNewSegment){
+    TrackStatisticsAccumulator segmentStart(accumulator);
+    segmentStart.segmentEnd();
+    statisticsState = segmentStart.serialize();
+  } else {
+    statisticsState = accumulator.serialize();
+  }
 
-  batch = std::make_shared<std::vector<osmscout::gpx::TrackPoint>>();
+  quint64 journalSequence = journal->getWrittenSequence();
+  if (createNewSegment){
+    journalSegmentStart = true;
+  }
+
+  emit appendNodesRequest(track.id,
+                          queue,
+                          batchSize,
+                          accumulator.accumulate(),
+                          statisticsState,
+                          createNewSegment,
+                          journalSequence);
+
+  batchSize = 0;
+}
+
+void Tracker::resetQueue(){
+  // previous queue may be still referenced by pending append request
+  queue = std::make_shared<TrackPointQueue>(QueueCapacity);
+  batchSize = 0;
+  batchStart.reset();
+  lastPoint.reset();
+  simplifier.reset();
+  receivedPoints = 0;
+  storedPoints = 0;
+  journalSegmentStart = false;
+  journalFailed = false;
+  if (isTracking() && !journal->open(track.id)){
+    qWarning() << "Track journal cannot be opened, points may be lost when application is killed";
+  }
 }
 
 void Tracker::stopTrackingWithoutSync(){
-  batch = std::make_shared<std::vector<osmscout::gpx::TrackPoint>>();
   track.id = -1;
+  resetQueue();
+  journal->close();
   track.statistics = TrackStatistics{};
   accumulator = TrackStatisticsAccumulator{};
   emit trackingChanged();
@@ -208,6 +345,7 @@ void Tracker::stopTracking(){
     return;
   }
 
+  // journal is closed when the last batch is persisted, see onNodesAppended
   flushBatch(false);
   emit closeTrackRequest(track.collectionId, track.id);
 
@@ -242,15 +380,14 @@ void Tracker::locationChanged(const QDateTime &timestamp,
     point.vdop=verticalAccuracy;
   }
 
-  assert(batch);
   Timestamp::duration diffFromLast;
   Timestamp::duration diffFromFirst;
   Distance distanceFromLast;
-  if (!batch->empty()){
-    assert(batch->back().timestamp.has_value());
-    diffFromLast = *(point.timestamp) - *(batch->back().timestamp);
-    diffFromFirst = *(point.timestamp) - *(batch->front().timestamp);
-    distanceFromLast = GetEllipsoidalDistance(point.coord, batch->back().coord);
+  if (lastPoint){
+    assert(lastPoint->timestamp.has_value());
+    diffFromLast = *(point.timestamp) - *(lastPoint->timestamp);
+    diffFromFirst = batchStart ? *(point.timestamp) - *batchStart : Timestamp::duration::zero();
+    distanceFromLast = GetEllipsoidalDistance(point.coord, lastPoint->coord);
     if (diffFromLast < Timestamp::duration::zero()){
       qWarning() << "Clock move to the past by " <<
         std::chrono::duration_cast<std::chrono::seconds>(diffFromLast).count() <<
@@ -260,7 +397,12 @@ void Tracker::locationChanged(const QDateTime &timestamp,
     // track resumed
     if (accumulator.getTo()){
       diffFromLast = *(point.timestamp) - *(accumulator.getTo());
-      distanceFromLast = Kilometers(42); // always start with the new segment on track resume (and track is not "empty")
+      if (accumulator.getLastCoord()){
+        // accumulator state was restored, open segment may continue
+        distanceFromLast = GetEllipsoidalDistance(point.coord, *(accumulator.getLastCoord()));
+      } else {
+        distanceFromLast = Kilometers(42); // start with the new segment on track resume (and track is not "empty")
+      }
     }else {
       diffFromLast = Timestamp::duration::zero();
     }
@@ -272,21 +414,40 @@ void Tracker::locationChanged(const QDateTime &timestamp,
                    || diffFromLast < Timestamp::duration::zero() // time shift
                    || distanceFromLast > Kilometers(1); // big distance gap
 
-  if (closeSegment || batch->size() > 100 || diffFromFirst > std::chrono::minutes(1)) {
+  // batches are bigger when screen is off, it saves storage writes
+  quint64 maxBatchSize = background ? BackgroundBatchSize : BatchSize;
+  auto maxBatchDuration = std::chrono::seconds(background ? backgroundFlushInterval : flushInterval);
+  if (closeSegment || batchSize >= maxBatchSize || diffFromFirst > maxBatchDuration) {
     // append point batch to track (with flag for creating new segment)
     flushBatch(closeSegment);
   }
-
-  // update track statistics
   if (closeSegment){
     accumulator.segmentEnd();
   }
-  accumulator.update(point);
-  track.statistics = accumulator.accumulate();
+
+  // redundant points (stationary, straight line) are not stored
+  receivedPoints++;
+  if (auto stored = simplifier.add(point); stored){
+    enqueue(*stored);
+  }
+  if (!batchStart){
+    batchStart = *(point.timestamp);
+  }
+  lastPoint = point;
+
+  // update track statistics, displayed statistics contains the last received point even when it is not stored yet
+  if (simplifier.hasPending()){
+    TrackStatisticsAccumulator current(accumulator);
+    current.update(point);
+    track.statistics = current.accumulate();
+  } else {
+    track.statistics = accumulator.accumulate();
+  }
   emit statisticsUpdated();
 
-  assert(batch);
-  batch->push_back(point);
+  recentPoints.push_back(RecentPoint{point.coord, closeSegment});
+  recentPointsEnd++;
+  emit recentPointsAppended();
 }
 
 void Tracker::onTrackCreated(qint64 collectionId, qint64 trackId, QString name){
@@ -295,6 +456,8 @@ void Tracker::onTrackCreated(qint64 collectionId, qint64 trackId, QString name){
   }
   creationRequested = false;
   track.id = trackId;
+  resetQueue();
+  recentPoints.clear();
   lastError.clear();
   errors=0;
 
@@ -19,6 +19,11 @@
 #pragma once
 
 #include "Storage.h"
+#include "RingBuffer.h"
+#include "TrackSimplifier.h"
+#include "TrackJournal.h"
+
+#include <memory>
 
 class Tracker : public QObject {
   Q_OBJECT
@@ -58,6 +63,20 @@ class Tracker : public QObject {
   Q_PROPERTY(double minElevation READ getMinElevation() NOTIFY statisticsUpdated)
   Q_PROPERTY(double maxElevation READ getMaxElevation() NOTIFY statisticsUpdated)
 
+  // recorder configuration
+  //! points closer than tolerance (meters) to the simplified track are not stored, zero disables simplification
+  Q_PROPERTY(double simplificationTolerance READ getSimplificationTolerance WRITE setSimplificationTolerance NOTIFY configurationChanged)
+  //! maximum time (seconds) between writes to storage
+  Q_PROPERTY(int flushInterval READ getFlushInterval WRITE setFlushInterval NOTIFY configurationChanged)
+  //! maximum time (seconds) between writes to storage, when application is not active (screen is off)
+  Q_PROPERTY(int backgroundFlushInterval READ getBackgroundFlushInterval WRITE setBackgroundFlushInterval NOTIFY configurationChanged)
+
+  // recorder statistics of current tracking session
+  Q_PROPERTY(qint64 receivedPoints READ getReceivedPoints NOTIFY statisticsUpdated)
+  Q_PROPERTY(qint64 storedPoints READ getStoredPoints NOTIFY statisticsUpdated)
+  //! received / stored points
+  Q_PROPERTY(double compressionRatio READ getCompressionRatio NOTIFY statisticsUpdated)
+
 signals:
   // for UI
   void openTrackLoaded(QString trackId, QString name);
@@ -65,26 +84,36 @@ signals:
   void errorsChanged();
   void trackingChanged();
   void statisticsUpdated();
+  void configurationChanged();
+
+  // for map, recent points may be read directly, see getRecentPoint
+  void recentPointsAppended();
 
   // for storage
   void openTrackRequested();
   void createTrackRequest(qint64 collectionId, QString name, QString description, bool open, QString type);
   void closeTrackRequest(qint64 collectionId, qint64 trackId);
   void appendNodesRequest(qint64 trackId,
-                          std::shared_ptr<std::vector<osmscout::gpx::TrackPoint>> batch,
+                          std::shared_ptr<TrackPointQueue> queue,
+                          quint64 count,
                           TrackStatistics statistics,
-                          bool createNewSegment);
+                          QByteArray statisticsState,
+                          bool createNewSegment,
+                          quint64 journalSequence);
   void editTrackRequest(qint64 collectionId, qint64 id, QString name, QString description, QString type);
 
 public slots:
   // for Storage
   void init();
-  void onOpenTrackLoaded(Track track, bool ok);
+  void onOpenTrackLoaded(Track track, QByteArray statisticsState, bool ok);
   void onTrackCreated(qint64 collectionId, qint64 trackId, QString name);
   void onCollectionDetailsLoaded(Collection collection, bool ok);
   void onCollectionDeleted(qint64 collectionId);
   void onTrackDeleted(qint64 collectionId, qint64 trackId);
   void onError(QString message);
+  void onNodesAppended(qint64 trackId, quint64 journalSequence, bool ok);
+
+  void onApplicationStateChanged(Qt::ApplicationState state);
 
   // slot for UI
   void resumeTrack(QString trackId);
@@ -101,6 +130,35 @@ public slots:
 
   void editTrack(QString id, QString name, QString description, QString type);
 
+public:
+  /**
+   * Recently recorded point, displayed on the map before it is persisted.
+   */
+  struct RecentPoint
+  {
+    osmscout::GeoCoord coord;
+    bool segmentStart{false}; //!< point starts new track segment
+  };
+
+  /**
+   * Capacity of recent point ring. It is much bigger than point batch,
+   * so recent points always overlap with points already stored in database.
+   */
+  static constexpr size_t RecentPointsCapacity = 4096;
+
+  /**
+   * Capacity of queue between Tracker and Storage. Points are flushed
+   * by batches of ~100 points, so Storage may be blocked for dozens minutes
+   * before the queue is full.
+   */
+  static constexpr size_t QueueCapacity = 4096;
+
+  /**
+   * Maximum count of points in one batch, when application is active / inactive.
+   */
+  static constexpr quint64 BatchSize = 100;
+  static constexpr quint64 BackgroundBatchSize = 1000;
+
 public:
   Tracker();
   virtual ~Tracker();
@@ -155,9 +213,69 @@ public:
   double getMinElevation() const;
   double getMaxElevation() const;
 
+  double getSimplificationTolerance() const {
+    return simplifier.getTolerance();
+  }
+  void setSimplificationTolerance(double tolerance);
+
+  int getFlushInterval() const {
+    return flushInterval;
+  }
+  void setFlushInterval(int seconds);
+
+  int getBackgroundFlushInterval() const {
+    return backgroundFlushInterval;
+  }
+  void setBackgroundFlushInterval(int seconds);
+
+  qint64 getReceivedPoints() const {
+    return receivedPoints;
+  }
+
+  qint64 getStoredPoints() const {
+    return storedPoints;
+  }
+
+  double getCompressionRatio() const {
+    return storedPoints == 0 ? 1.0 : double(receivedPoints) / double(storedPoints);
+  }
+
+  /**
+   * Sequence number of the oldest recent point that is available.
+   * Recent points are cleared when tracking is started or resumed.
+   */
+  quint64 getRecentPointsBegin() const {
+    return recentPointsEnd - recentPoints.size();
+  }
+
+  /**
+   * Sequence number after the last recorded point.
+   */
+  quint64 getRecentPointsEnd() const {
+    return recentPointsEnd;
+  }
+
+  /**
+   * @param sequence from range [getRecentPointsBegin(), getRecentPointsEnd())
+   */
+  const RecentPoint& getRecentPoint(quint64 sequence) const {
+    assert(sequence >= getRecentPointsBegin() && sequence < recentPointsEnd);
+    return recentPoints[sequence - getRecentPointsBegin()];
+  }
+
 private:
   void flushBatch(bool createNewSegment);
 
+  /**
+   * Push point to the queue for storage and to the journal.
+   */
+  void enqueue(const osmscout::gpx::TrackPoint &point);
+
+  /**
+   * Start new tracking session, points of the previous one are discarded.
+   */
+  void resetQueue();
+
   /**
    * Stop tracking, but don't write changes to database
    */
@@ -167,8 +285,25 @@ private:
   bool creationRequested{false};
   Track track;
   Track recentOpenTrack;
-  std::shared_ptr<std::vector<osmscout::gpx::TrackPoint>> batch{std::make_shared<std::vector<osmscout::gpx::TrackPoint>>()};
+  QByteArray recentOpenTrackState; // serialized accumulator of recent open track
+  // queue is created for every tracking session, Storage consumes points of flushed batches
+  std::shared_ptr<TrackPointQueue> queue{std::make_shared<TrackPointQueue>(QueueCapacity)};
+  quint64 batchSize{0}; // points in the queue that was not flushed yet
+  std::optional<osmscout::Timestamp> batchStart; // timestamp of the first point received after flush
+  std::optional<osmscout::gpx::TrackPoint> lastPoint; // last received point in the session
+
+  TrackSimplifier simplifier;
+  int flushInterval{60};
+  int backgroundFlushInterval{600};
+  bool background{false};
+  std::unique_ptr<TrackJournal> journal;
+  bool journalSegmentStart{false}; // the next journal point starts new segment
+  bool journalFailed{false}; // some batch was not persisted, journal is not committed anymore
+  qint64 receivedPoints{0};
+  qint64 storedPoints{0};
   TrackStatisticsAccumulator accumulator;
+  RingBuffer<RecentPoint> recentPoints{RecentPointsCapacity};
+  quint64 recentPointsEnd{0};
   QString lastError;
   qint64 errors{0};
 };